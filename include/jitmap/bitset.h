@@ -14,12 +14,17 @@
 
 #pragma once
 
+#include <algorithm>
 #include <climits>
 #include <cstddef>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
 #include <stdexcept>
 #include <type_traits>
 
+#include <jitmap/pool.h>
 #include <jitmap/size.h>
 #include <jitmap/util/exception.h>
 
@@ -27,124 +32,232 @@ namespace jitmap {
 
 using BitsetWordType = uint64_t;
 
-// Bitset is a container similar to `std::bitset<N>` but wrapping a data pointer.
-// The ownership/lifetime of the data pointer is defined by `Ptr` type.
-template <size_t N = kBitsPerContainer, typename Ptr = const BitsetWordType*>
-class Bitset {
+// The extent of the bitsets whose size is known at runtime, see
+// `Bitset<kDynamicExtent, Ptr>`.
+constexpr size_t kDynamicExtent = std::numeric_limits<size_t>::max();
+
+// Reductions on `n` contiguous words, vectorized and dispatched on the host
+// CPU: the count uses `vpopcntq` with AVX-512 or a Harley-Seal carry-save
+// tree with AVX2, the predicates reduce blocks of a few vectors and exit on
+// the first block deciding the result.
+size_t CountWords(const BitsetWordType* words, size_t n) noexcept;
+bool AllWords(const BitsetWordType* words, size_t n) noexcept;
+bool AnyWords(const BitsetWordType* words, size_t n) noexcept;
+bool EqualWords(const BitsetWordType* lhs, const BitsetWordType* rhs, size_t n) noexcept;
+
+// BitsetExpr is the interface shared by the bitsets and the lazy expressions
+// combining them, e.g. `a & b | ~c`. An expression doesn't compute nor
+// allocate anything, it is evaluated word by word in a single pass when
+// assigned to a writable `Bitset` or when reduced, e.g. with `count`.
+//
+// An expression references its bitset operands and must not outlive them.
+//
+// The size of the expressions of extent `kDynamicExtent` is known at runtime
+// and is not necessarily a multiple of the word size, the bits of the last
+// word past the size are unspecified and ignored by the reductions.
+template <size_t N, typename Derived>
+class BitsetExpr {
  public:
   using word_type = BitsetWordType;
-  using storage_type = typename std::pointer_traits<Ptr>::element_type;
 
-  template <typename Type, typename Ret = void>
-  using enable_if_writable = std::enable_if_t<!std::is_const<Type>::value, Ret>;
-
-  // Indicate if the pointer is read-only.
-  static constexpr bool storage_is_const = std::is_const<storage_type>::value;
+  // Indicate if the expression is a lazy node, as opposed to a bitset.
+  static constexpr bool kIsLazy = false;
+  // Indicate if the expression owns its storage words.
+  static constexpr bool kIsOwning = false;
+  // Indicate if the size is known at runtime only.
+  static constexpr bool kIsDynamic = N == kDynamicExtent;
   static constexpr size_t kBitsPerWord = sizeof(word_type) * CHAR_BIT;
 
-  // Construct a bitset from a pointer.
-  Bitset(Ptr data) : data_(std::move(data)) { JITMAP_PRE_NE(data_, nullptr); }
+  const Derived& derived() const noexcept { return static_cast<const Derived&>(*this); }
 
   // Return the capacity (in bits) of the bitset.
-  constexpr size_t size() const noexcept { return N; }
-
-  template <typename OtherPtr>
-  bool operator==(const Bitset<N, OtherPtr>& rhs) const {
-    const auto& lhs_word = word();
-    const auto& rhs_word = rhs.word();
-
-    if (lhs_word == rhs_word) return true;
-
-    for (size_t i = 0; i < size_words(); i++) {
-      if (lhs_word[i] != rhs_word[i]) return false;
+  constexpr size_t size() const noexcept {
+    if constexpr (kIsDynamic) {
+      return derived().size();
+    } else {
+      return N;
     }
-
-    return true;
   }
 
-  template <typename OtherPtr>
-  bool operator!=(const Bitset<N, OtherPtr>& rhs) const {
-    return !(*this == rhs);
+  // Return the capacity (in words) of the bitset.
+  constexpr size_t size_words() const noexcept {
+    return (size() + kBitsPerWord - 1) / kBitsPerWord;
   }
 
-  // Accessors
-  bool test(size_t i) const {
-    if (i >= N) throw std::out_of_range("Can't access bit");
-    return operator[](i);
+  // Evaluate the i-th word.
+  word_type word_at(size_t i) const noexcept { return derived().word_at(i); }
+
+  template <typename Other>
+  bool operator==(const BitsetExpr<N, Other>& rhs) const {
+    if constexpr (kIsDynamic) {
+      if (size() != rhs.size()) return false;
+    } else if constexpr (!Derived::kIsLazy && !Other::kIsLazy) {
+      if (derived().word() == rhs.derived().word()) return true;
+      if constexpr (vectorized()) {
+        return EqualWords(derived().word(), rhs.derived().word(), size_words());
+      }
+    }
+
+    const size_t n = size_words();
+    for (size_t i = 0; i + 1 < n; i++) {
+      if (word_at(i) != rhs.word_at(i)) return false;
+    }
+
+    return n == 0 || ((word_at(n - 1) ^ rhs.word_at(n - 1)) & last_word_mask()) == 0;
   }
 
-  bool operator[](size_t i) const noexcept {
-    return word()[i / sizeof(word_type)] & (1U << (i % sizeof(word_type)));
+  template <typename Other>
+  bool operator!=(const BitsetExpr<N, Other>& rhs) const {
+    return !(derived() == rhs);
   }
 
   // Indicate if all bits are set.
   bool all() const noexcept {
-    for (size_t i = 0; i < size_words(); i++) {
-      if (word()[i] != std::numeric_limits<word_type>::max()) return false;
+    if constexpr (vectorized()) return AllWords(derived().word(), size_words());
+
+    const size_t n = size_words();
+    for (size_t i = 0; i + 1 < n; i++) {
+      if (word_at(i) != std::numeric_limits<word_type>::max()) return false;
     }
 
-    return true;
+    return n == 0 || (word_at(n - 1) | ~last_word_mask()) ==
+                         std::numeric_limits<word_type>::max();
   }
 
   // Indicate if at least one bit is set.
-  bool any() const noexcept {
-    for (size_t i = 0; i < size_words(); i++) {
-      if (word()[i] != 0) return true;
-    }
-
-    return false;
-  }
+  bool any() const noexcept { return !none(); }
 
   // Indicate if no bit is set.
   bool none() const noexcept {
-    for (size_t i = 0; i < size_words(); i++) {
-      if (word()[i] != 0) return false;
+    if constexpr (vectorized()) return !AnyWords(derived().word(), size_words());
+
+    const size_t n = size_words();
+    for (size_t i = 0; i + 1 < n; i++) {
+      if (word_at(i) != 0) return false;
     }
 
-    return true;
+    return n == 0 || (word_at(n - 1) & last_word_mask()) == 0;
   }
 
   // Count the number of set bits (ones).
   size_t count() const noexcept {
+    if constexpr (vectorized()) return CountWords(derived().word(), size_words());
+
     size_t sum = 0;
 
-    for (size_t i = 0; i < size_words(); i++) {
-      sum += __builtin_popcountll(word()[i]);
+    const size_t n = size_words();
+    for (size_t i = 0; i + 1 < n; i++) {
+      sum += __builtin_popcountll(word_at(i));
     }
+    if (n > 0) sum += __builtin_popcountll(word_at(n - 1) & last_word_mask());
 
     return sum;
   }
 
+ private:
+  // The bitsets of at least a cacheline use the vectorized reductions, the
+  // lazy expressions are reduced in a single fused loop.
+  static constexpr bool vectorized() {
+    return !kIsDynamic && !Derived::kIsLazy && N >= kBitsPerCacheLine;
+  }
+
+  // The bits of the last word within the size.
+  constexpr word_type last_word_mask() const noexcept {
+    const size_t remainder = size() % kBitsPerWord;
+    return remainder == 0 ? ~word_type{0} : (word_type{1} << remainder) - 1;
+  }
+};
+
+// Bitset is a container similar to `std::bitset<N>` but wrapping a data pointer.
+// The ownership/lifetime of the data pointer is defined by `Ptr` type. The
+// size of `Bitset<kDynamicExtent, Ptr>` is known at runtime, see below.
+template <size_t N = kBitsPerContainer, typename Ptr = const BitsetWordType*>
+class Bitset;
+
+template <typename Ptr>
+class Bitset<kDynamicExtent, Ptr>;
+
+// A range of bits sharing the storage of a bitset, see `Bitset::view`.
+using BitsetView = Bitset<kDynamicExtent, const BitsetWordType*>;
+using MutableBitsetView = Bitset<kDynamicExtent, BitsetWordType*>;
+
+template <size_t N, typename Ptr>
+class Bitset : public BitsetExpr<N, Bitset<N, Ptr>> {
+ public:
+  using word_type = BitsetWordType;
+  using storage_type = typename std::pointer_traits<Ptr>::element_type;
+
+  template <typename Type, typename Ret = void>
+  using enable_if_writable = std::enable_if_t<!std::is_const<Type>::value, Ret>;
+
+  // Indicate if the pointer is read-only.
+  static constexpr bool storage_is_const = std::is_const<storage_type>::value;
+  // Indicate if the bitset owns its words, as opposed to a view.
+  static constexpr bool kIsOwning = !std::is_pointer<Ptr>::value;
+  static constexpr size_t kBitsPerWord = sizeof(word_type) * CHAR_BIT;
+
+  using BitsetExpr<N, Bitset<N, Ptr>>::size;
+  using BitsetExpr<N, Bitset<N, Ptr>>::size_words;
+
+  // Construct a bitset from a pointer.
+  Bitset(Ptr data) : data_(std::move(data)) { JITMAP_PRE_NE(data_, nullptr); }
+
+  // Evaluate a lazy expression into the bitset in a single pass, without
+  // temporary. The expression may reference the bitset itself.
+  template <typename E, typename T1 = storage_type,
+            typename = std::enable_if_t<E::kIsLazy>>
+  enable_if_writable<T1, Bitset<N, Ptr>&> operator=(
+      const BitsetExpr<N, E>& expr) noexcept {
+    auto words = word();
+    for (size_t i = 0; i < size_words(); i++) {
+      words[i] = expr.word_at(i);
+    }
+    return *this;
+  }
+
+  // Accessors
+  bool test(size_t i) const {
+    if (i >= N) throw std::out_of_range("Can't access bit");
+    return operator[](i);
+  }
+
+  bool operator[](size_t i) const noexcept {
+    return word()[i / kBitsPerWord] & (word_type{1} << (i % kBitsPerWord));
+  }
+
+  word_type word_at(size_t i) const noexcept { return word()[i]; }
+
   // Modifiers
   //
   // The in-place modifiers are enabled only if the storage pointer is not const.
+  // The operand is either a bitset or a lazy expression, see `BitsetExpr`.
 
   // Perform binary AND
-  template <typename OtherPtr, typename T1 = storage_type>
+  template <typename E, typename T1 = storage_type>
   enable_if_writable<T1, Bitset<N, Ptr>&> operator&=(
-      const Bitset<N, OtherPtr>& other) noexcept {
+      const BitsetExpr<N, E>& other) noexcept {
     for (size_t i = 0; i < size_words(); i++) {
-      word()[i] &= other.word()[i];
+      word()[i] &= other.word_at(i);
     }
     return *this;
   }
 
   // Perform binary OR
-  template <typename OtherPtr, typename T1 = storage_type>
+  template <typename E, typename T1 = storage_type>
   enable_if_writable<T1, Bitset<N, Ptr>&> operator|=(
-      const Bitset<N, OtherPtr>& other) noexcept {
+      const BitsetExpr<N, E>& other) noexcept {
     for (size_t i = 0; i < size_words(); i++) {
-      word()[i] |= other.word()[i];
+      word()[i] |= other.word_at(i);
     }
     return *this;
   }
 
   // Perform binary XOR
-  template <typename OtherPtr, typename T1 = storage_type>
+  template <typename E, typename T1 = storage_type>
   enable_if_writable<T1, Bitset<N, Ptr>&> operator^=(
-      const Bitset<N, OtherPtr>& other) noexcept {
+      const BitsetExpr<N, E>& other) noexcept {
     for (size_t i = 0; i < size_words(); i++) {
-      word()[i] ^= other.word()[i];
+      word()[i] ^= other.word_at(i);
     }
     return *this;
   }
@@ -164,11 +277,14 @@ class Bitset {
     memset(word(), 0xFF, size() / CHAR_BIT);
   }
 
-  /* TODO
   // Set a single bit.
   template <typename T1 = storage_type>
-  enable_if_writable<T1> set(size_t i, bool value = true) {}
-  */
+  enable_if_writable<T1> set(size_t i, bool value = true) {
+    if (i >= N) throw std::out_of_range("Can't access bit");
+    auto mask = word_type{1} << (i % kBitsPerWord);
+    auto& w = word()[i / kBitsPerWord];
+    w = value ? (w | mask) : (w & ~mask);
+  }
 
   // Clear all bits.
   template <typename T1 = storage_type>
@@ -176,11 +292,11 @@ class Bitset {
     memset(word(), 0, size() / CHAR_BIT);
   }
 
-  /* TODO
   // Clear a single bit.
   template <typename T1 = storage_type>
-  enable_if_writable<T1> reset(size_t i) {}
-  */
+  enable_if_writable<T1> reset(size_t i) {
+    set(i, false);
+  }
 
   // Flip all bits (perform binary NOT).
   template <typename T1 = storage_type>
@@ -188,11 +304,31 @@ class Bitset {
     this->operator~();
   }
 
-  /* TODO
   // Flip a single bit.
   template <typename T1 = storage_type>
-  enable_if_writable<T1> flip(size_t i) {}
-  */
+  enable_if_writable<T1> flip(size_t i) {
+    if (i >= N) throw std::out_of_range("Can't access bit");
+    word()[i / kBitsPerWord] ^= word_type{1} << (i % kBitsPerWord);
+  }
+
+  // Views
+  //
+  // Return the bits in [begin, end) without copy, the view must not outlive
+  // the storage.
+
+  // The return types are deduced, the views are complete only after `Bitset`.
+
+  auto view(size_t begin, size_t end) const {
+    if (begin > end || end > N) throw std::out_of_range("Can't view bits");
+    return BitsetView{word() + begin / kBitsPerWord, end - begin, begin % kBitsPerWord};
+  }
+
+  template <typename T1 = storage_type, typename = enable_if_writable<T1>>
+  auto view(size_t begin, size_t end) {
+    if (begin > end || end > N) throw std::out_of_range("Can't view bits");
+    return MutableBitsetView{word() + begin / kBitsPerWord, end - begin,
+                             begin % kBitsPerWord};
+  }
 
   // Data pointers
   const char* data() const { return reinterpret_cast<const char*>(&data_[0]); }
@@ -202,11 +338,6 @@ class Bitset {
     return reinterpret_cast<char*>(&data_[0]);
   }
 
-  // Return the capacity (in words) of the bitset.
-  constexpr size_t size_words() const noexcept {
-    return N / (CHAR_BIT * sizeof(word_type));
-  }
-
   const word_type* word() const { return reinterpret_cast<const word_type*>(&data_[0]); }
 
   template <typename T1 = storage_type>
@@ -225,6 +356,337 @@ class Bitset {
   friend class Bitset;
 };
 
+// Bitset<kDynamicExtent, Ptr> is a bitset whose size is known at runtime and
+// which starts at any bit of its storage, e.g. a time window of a larger
+// bitset. The bits of the storage outside of the bitset are never modified.
+//
+// The words of the bitset (see `word_at`) are the storage words shifted by the
+// offset. The reductions and modifiers instead loop on the storage words: the
+// partial head and tail words are masked, and the full words in between go
+// through the vectorized reductions or a plain loop.
+template <typename Ptr>
+class Bitset<kDynamicExtent, Ptr>
+    : public BitsetExpr<kDynamicExtent, Bitset<kDynamicExtent, Ptr>> {
+  using Base = BitsetExpr<kDynamicExtent, Bitset<kDynamicExtent, Ptr>>;
+
+ public:
+  using word_type = BitsetWordType;
+  using storage_type = typename std::pointer_traits<Ptr>::element_type;
+
+  template <typename Type, typename Ret = void>
+  using enable_if_writable = std::enable_if_t<!std::is_const<Type>::value, Ret>;
+
+  // Indicate if the pointer is read-only.
+  static constexpr bool storage_is_const = std::is_const<storage_type>::value;
+  // Indicate if the bitset owns its words, as opposed to a view.
+  static constexpr bool kIsOwning = !std::is_pointer<Ptr>::value;
+  static constexpr size_t kBitsPerWord = sizeof(word_type) * CHAR_BIT;
+
+  using Base::size_words;
+
+  // Construct a bitset of `size` bits starting at the bit `offset` of a
+  // pointer.
+  Bitset(Ptr data, size_t size, size_t offset = 0)
+      : data_(std::move(data)), size_(size), offset_(offset) {
+    JITMAP_PRE_NE(data_, nullptr);
+  }
+
+  // Return the capacity (in bits) of the bitset.
+  size_t size() const noexcept { return size_; }
+
+  // Return the position of the first bit in the storage.
+  size_t offset() const noexcept { return offset_; }
+
+  // Evaluate a lazy expression into the bitset, see `assign`.
+  template <typename E, typename T1 = storage_type,
+            typename = std::enable_if_t<E::kIsLazy>>
+  enable_if_writable<T1, Bitset&> operator=(const BitsetExpr<kDynamicExtent, E>& expr) {
+    return assign(expr);
+  }
+
+  // Copy the bits of an expression or of another bitset in a single pass. The
+  // expression may reference the bitset itself, but not an overlapping range
+  // of the storage at another offset.
+  //
+  // \throws Exception if the sizes differ.
+  template <typename E, typename T1 = storage_type>
+  enable_if_writable<T1, Bitset&> assign(const BitsetExpr<kDynamicExtent, E>& expr) {
+    Apply([](word_type, word_type word) { return word; }, expr);
+    return *this;
+  }
+
+  // Accessors
+  bool test(size_t i) const {
+    if (i >= size_) throw std::out_of_range("Can't access bit");
+    return operator[](i);
+  }
+
+  bool operator[](size_t i) const noexcept {
+    i += offset_;
+    return word()[i / kBitsPerWord] & (word_type{1} << (i % kBitsPerWord));
+  }
+
+  word_type word_at(size_t i) const noexcept {
+    const auto* words = first_word();
+    if (shift() == 0) return words[i];
+
+    // The last word of the bitset may lie in a single storage word, the bits
+    // read from the clamped index are then past the size.
+    auto next = words[std::min(i + 1, n_storage_words() - 1)];
+    return (words[i] >> shift()) | (next << (kBitsPerWord - shift()));
+  }
+
+  // Reductions, see `BitsetExpr`.
+
+  template <typename E>
+  bool operator==(const BitsetExpr<kDynamicExtent, E>& rhs) const {
+    if constexpr (!E::kIsLazy) {
+      // The storage words of bitsets at the same shift are compared directly.
+      const auto& other = rhs.derived();
+      if (size_ == other.size() && shift() == other.shift()) {
+        const auto* lhs_words = first_word();
+        const auto* rhs_words = other.first_word();
+        auto equal = [&](size_t i, word_type mask) {
+          return ((lhs_words[i] ^ rhs_words[i]) & mask) == 0;
+        };
+
+        const size_t n = n_storage_words();
+        if (n <= 1) return n == 0 || equal(0, head_mask() & tail_mask());
+        return equal(0, head_mask()) && equal(n - 1, tail_mask()) &&
+               EqualWords(lhs_words + 1, rhs_words + 1, n - 2);
+      }
+    }
+
+    return Base::operator==(rhs);
+  }
+
+  bool all() const noexcept {
+    const auto* words = first_word();
+    auto full = [&](size_t i, word_type mask) { return (words[i] & mask) == mask; };
+
+    const size_t n = n_storage_words();
+    if (n <= 1) return n == 0 || full(0, head_mask() & tail_mask());
+    return full(0, head_mask()) && full(n - 1, tail_mask()) && AllWords(words + 1, n - 2);
+  }
+
+  bool any() const noexcept { return !none(); }
+
+  bool none() const noexcept {
+    const auto* words = first_word();
+    auto empty = [&](size_t i, word_type mask) { return (words[i] & mask) == 0; };
+
+    const size_t n = n_storage_words();
+    if (n <= 1) return n == 0 || empty(0, head_mask() & tail_mask());
+    return empty(0, head_mask()) && empty(n - 1, tail_mask()) &&
+           !AnyWords(words + 1, n - 2);
+  }
+
+  size_t count() const noexcept {
+    const auto* words = first_word();
+    auto popcount = [&](size_t i, word_type mask) {
+      return size_t(__builtin_popcountll(words[i] & mask));
+    };
+
+    const size_t n = n_storage_words();
+    if (n <= 1) return n == 0 ? 0 : popcount(0, head_mask() & tail_mask());
+    return popcount(0, head_mask()) + CountWords(words + 1, n - 2) +
+           popcount(n - 1, tail_mask());
+  }
+
+  // Modifiers
+  //
+  // The in-place modifiers are enabled only if the storage pointer is not const.
+  //
+  // \throws Exception if the sizes of the operands differ.
+
+  // Perform binary AND
+  template <typename E, typename T1 = storage_type>
+  enable_if_writable<T1, Bitset&> operator&=(const BitsetExpr<kDynamicExtent, E>& other) {
+    Apply(std::bit_and<word_type>{}, other);
+    return *this;
+  }
+
+  // Perform binary OR
+  template <typename E, typename T1 = storage_type>
+  enable_if_writable<T1, Bitset&> operator|=(const BitsetExpr<kDynamicExtent, E>& other) {
+    Apply(std::bit_or<word_type>{}, other);
+    return *this;
+  }
+
+  // Perform binary XOR
+  template <typename E, typename T1 = storage_type>
+  enable_if_writable<T1, Bitset&> operator^=(const BitsetExpr<kDynamicExtent, E>& other) {
+    Apply(std::bit_xor<word_type>{}, other);
+    return *this;
+  }
+
+  // Perform binary NOT
+  template <typename T1 = storage_type>
+  enable_if_writable<T1, Bitset&> operator~() noexcept {
+    Transform([](word_type word) { return ~word; });
+    return *this;
+  }
+
+  // Set all bits.
+  template <typename T1 = storage_type>
+  enable_if_writable<T1> set() noexcept {
+    Transform([](word_type) { return ~word_type{0}; });
+  }
+
+  // Set a single bit.
+  template <typename T1 = storage_type>
+  enable_if_writable<T1> set(size_t i, bool value = true) {
+    if (i >= size_) throw std::out_of_range("Can't access bit");
+    i += offset_;
+    auto mask = word_type{1} << (i % kBitsPerWord);
+    auto& w = word()[i / kBitsPerWord];
+    w = value ? (w | mask) : (w & ~mask);
+  }
+
+  // Clear all bits.
+  template <typename T1 = storage_type>
+  enable_if_writable<T1> reset() noexcept {
+    Transform([](word_type) { return word_type{0}; });
+  }
+
+  // Clear a single bit.
+  template <typename T1 = storage_type>
+  enable_if_writable<T1> reset(size_t i) {
+    set(i, false);
+  }
+
+  // Flip all bits (perform binary NOT).
+  template <typename T1 = storage_type>
+  enable_if_writable<T1> flip() noexcept {
+    this->operator~();
+  }
+
+  // Flip a single bit.
+  template <typename T1 = storage_type>
+  enable_if_writable<T1> flip(size_t i) {
+    if (i >= size_) throw std::out_of_range("Can't access bit");
+    i += offset_;
+    word()[i / kBitsPerWord] ^= word_type{1} << (i % kBitsPerWord);
+  }
+
+  // Views, see `Bitset::view`.
+
+  auto view(size_t begin, size_t end) const {
+    if (begin > end || end > size_) throw std::out_of_range("Can't view bits");
+    const size_t first = offset_ + begin;
+    return BitsetView{word() + first / kBitsPerWord, end - begin, first % kBitsPerWord};
+  }
+
+  template <typename T1 = storage_type, typename = enable_if_writable<T1>>
+  auto view(size_t begin, size_t end) {
+    if (begin > end || end > size_) throw std::out_of_range("Can't view bits");
+    const size_t first = offset_ + begin;
+    return MutableBitsetView{word() + first / kBitsPerWord, end - begin,
+                             first % kBitsPerWord};
+  }
+
+  // Data pointers, to the storage word holding the bit at `offset()`.
+  const char* data() const { return reinterpret_cast<const char*>(&data_[0]); }
+
+  template <typename T1 = storage_type>
+  enable_if_writable<T1, char*> data() {
+    return reinterpret_cast<char*>(&data_[0]);
+  }
+
+  const word_type* word() const { return reinterpret_cast<const word_type*>(&data_[0]); }
+
+  template <typename T1 = storage_type>
+  enable_if_writable<T1, word_type*> word() {
+    return reinterpret_cast<word_type*>(&data_[0]);
+  }
+
+ private:
+  size_t shift() const noexcept { return offset_ % kBitsPerWord; }
+
+  // The storage words spanned by the bitset.
+  size_t n_storage_words() const noexcept {
+    return (shift() + size_ + kBitsPerWord - 1) / kBitsPerWord;
+  }
+
+  const word_type* first_word() const noexcept { return word() + offset_ / kBitsPerWord; }
+
+  template <typename T1 = storage_type>
+  enable_if_writable<T1, word_type*> first_word() noexcept {
+    return word() + offset_ / kBitsPerWord;
+  }
+
+  // The bits of the first, respectively last, storage word within the bitset.
+  word_type head_mask() const noexcept { return ~word_type{0} << shift(); }
+  word_type tail_mask() const noexcept {
+    const size_t end = (shift() + size_) % kBitsPerWord;
+    return end == 0 ? ~word_type{0} : (word_type{1} << end) - 1;
+  }
+
+  // Replace the bits of `*word` selected by `mask` with the bits of `value`.
+  static void Store(word_type* word, word_type value, word_type mask) noexcept {
+    *word = (*word & ~mask) | (value & mask);
+  }
+
+  // Replace each storage word by `op(word)`.
+  template <typename Op>
+  void Transform(Op op) noexcept {
+    auto* words = first_word();
+    const size_t n = n_storage_words();
+    if (n <= 1) {
+      if (n == 1) Store(words, op(words[0]), head_mask() & tail_mask());
+      return;
+    }
+
+    Store(words, op(words[0]), head_mask());
+    for (size_t i = 1; i + 1 < n; i++) words[i] = op(words[i]);
+    Store(words + n - 1, op(words[n - 1]), tail_mask());
+  }
+
+  // Replace each storage word by `op(word, aligned)`, where `aligned` is the
+  // word of the expression shifted to the storage word.
+  template <typename Op, typename E>
+  void Apply(Op op, const BitsetExpr<kDynamicExtent, E>& expr) {
+    JITMAP_PRE_EQ(size_, expr.size());
+
+    auto* words = first_word();
+    const size_t n = n_storage_words();
+    const size_t n_words = size_words();
+    const size_t s = shift();
+
+    // Each word of the expression is evaluated once, before the storage words
+    // it depends on are modified. The storage spans at most one more word
+    // than the expression.
+    word_type previous = 0;
+    auto aligned = [&](size_t i) {
+      word_type word = i < n_words ? expr.word_at(i) : 0;
+      word_type shifted = s == 0 ? word : (word << s) | (previous >> (kBitsPerWord - s));
+      previous = word;
+      return shifted;
+    };
+
+    if (n <= 1) {
+      if (n == 1) Store(words, op(words[0], aligned(0)), head_mask() & tail_mask());
+      return;
+    }
+
+    Store(words, op(words[0], aligned(0)), head_mask());
+    if (s == 0) {
+      for (size_t i = 1; i + 1 < n; i++) words[i] = op(words[i], expr.word_at(i));
+    } else {
+      for (size_t i = 1; i + 1 < n; i++) words[i] = op(words[i], aligned(i));
+    }
+    Store(words + n - 1, op(words[n - 1], aligned(n - 1)), tail_mask());
+  }
+
+  Ptr data_;
+  size_t size_;
+  size_t offset_;
+
+  // Friend itself of other template parameters, used for accessing `data_`.
+  template <size_t M, typename OtherPtr>
+  friend class Bitset;
+};
+
 // Create a bitset from a memory address.
 template <size_t N, typename Ptr = const BitsetWordType*>
 Bitset<N, Ptr> make_bitset(Ptr ptr) {
@@ -233,7 +695,16 @@ Bitset<N, Ptr> make_bitset(Ptr ptr) {
 
 template <class T>
 struct DeleteAligned {
-  void operator()(T* data) const { free(data); }
+  // Set if the data was drawn from the `ContainerPool`.
+  bool pooled = false;
+
+  void operator()(T* data) const {
+    if (pooled) {
+      FreeContainer(data);
+    } else {
+      free(data);
+    }
+  }
 };
 
 template <class T>
@@ -247,74 +718,141 @@ using OwnedBitset = Bitset<N, std::unique_ptr<T[], DeleteAligned<T>>>;
 
 template <size_t N>
 OwnedBitset<N, BitsetWordType> make_owned_bitset() {
+  using Deleter = DeleteAligned<BitsetWordType>;
+
+  // Container sized bitsets are recycled by the pool.
+  if constexpr (N == kBitsPerContainer) {
+    auto data = static_cast<BitsetWordType*>(AllocateContainer());
+    std::unique_ptr<BitsetWordType[], Deleter> owned{data, Deleter{true}};
+    return make_bitset<N>(std::move(owned));
+  }
+
   constexpr size_t kNumberWords = N / (sizeof(BitsetWordType) * CHAR_BIT);
   return make_bitset<N>(allocate_aligned<BitsetWordType>(kCacheLineSize, kNumberWords));
 }
 
-template <size_t N, typename Ptr>
-OwnedBitset<N, BitsetWordType> operator~(const Bitset<N, Ptr>& bitset) {
-  auto owned = make_owned_bitset<N>();
+// Create a bitset of `size` bits known at runtime.
+inline OwnedBitset<kDynamicExtent, BitsetWordType> make_owned_bitset(size_t size) {
+  // Rounded to whole cachelines, aligned_alloc expects a multiple of the alignment.
+  constexpr size_t kWordsPerCacheLine = kCacheLineSize / sizeof(BitsetWordType);
+  const size_t n_lines =
+      std::max<size_t>(1, (size + kBitsPerCacheLine - 1) / kBitsPerCacheLine);
+  return {allocate_aligned<BitsetWordType>(kCacheLineSize, n_lines * kWordsPerCacheLine),
+          size};
+}
 
-  auto owned_word = owned.word();
-  auto bitset_word = bitset.word();
+// Evaluate a lazy expression into a new bitset.
+template <size_t N, typename E>
+OwnedBitset<N, BitsetWordType> make_owned_bitset(const BitsetExpr<N, E>& expr) {
+  if constexpr (N == kDynamicExtent) {
+    auto owned = make_owned_bitset(expr.size());
+    owned.assign(expr);
+    return owned;
+  } else {
+    auto owned = make_owned_bitset<N>();
+
+    auto owned_word = owned.word();
+    for (size_t i = 0; i < owned.size_words(); i++) {
+      owned_word[i] = expr.word_at(i);
+    }
 
-  size_t remaining = owned.size_words();
-  while (remaining-- != 0UL) {
-    *owned_word++ = ~(*bitset_word++);
+    return owned;
   }
-
-  return owned;
 }
 
-template <size_t N, typename LeftPtr, typename RightPtr>
-OwnedBitset<N, BitsetWordType> operator&(const Bitset<N, LeftPtr>& lhs,
-                                         const Bitset<N, RightPtr>& rhs) {
-  auto owned = make_owned_bitset<N>();
+// The owning bitset operands are referenced, the views and the lazy nodes are
+// copied.
+template <typename E>
+using BitsetExprOperand = std::conditional_t<E::kIsOwning, const E&, const E>;
 
-  auto owned_word = owned.word();
-  auto lhs_word = lhs.word();
-  auto rhs_word = rhs.word();
+template <size_t N, typename E>
+class BitsetNotExpr : public BitsetExpr<N, BitsetNotExpr<N, E>> {
+ public:
+  static constexpr bool kIsLazy = true;
 
-  size_t remaining = owned.size_words();
-  while (remaining-- != 0UL) {
-    *owned_word++ = *lhs_word++ & *rhs_word++;
-  }
+  explicit BitsetNotExpr(const E& operand) : operand_(operand) {}
 
-  return owned;
-}
+  size_t size() const noexcept { return operand_.size(); }
+
+  BitsetWordType word_at(size_t i) const noexcept { return ~operand_.word_at(i); }
+
+ private:
+  BitsetExprOperand<E> operand_;
+};
 
-template <size_t N, typename LeftPtr, typename RightPtr>
-OwnedBitset<N, BitsetWordType> operator|(const Bitset<N, LeftPtr>& lhs,
-                                         const Bitset<N, RightPtr>& rhs) {
-  auto owned = make_owned_bitset<N>();
+template <size_t N, typename Op, typename L, typename R>
+class BitsetBinaryExpr : public BitsetExpr<N, BitsetBinaryExpr<N, Op, L, R>> {
+ public:
+  static constexpr bool kIsLazy = true;
+
+  // \throws Exception if the sizes of the dynamic extent operands differ.
+  BitsetBinaryExpr(const L& lhs, const R& rhs) : lhs_(lhs), rhs_(rhs) {
+    if constexpr (N == kDynamicExtent) JITMAP_PRE_EQ(lhs_.size(), rhs_.size());
+  }
 
-  auto owned_word = owned.word();
-  auto lhs_word = lhs.word();
-  auto rhs_word = rhs.word();
+  size_t size() const noexcept { return lhs_.size(); }
 
-  size_t remaining = owned.size_words();
-  while (remaining-- != 0UL) {
-    *owned_word++ = *lhs_word++ | *rhs_word++;
+  BitsetWordType word_at(size_t i) const noexcept {
+    return Op{}(lhs_.word_at(i), rhs_.word_at(i));
   }
 
-  return owned;
-}
+ private:
+  BitsetExprOperand<L> lhs_;
+  BitsetExprOperand<R> rhs_;
+};
 
-template <size_t N, typename LeftPtr, typename RightPtr>
-OwnedBitset<N, BitsetWordType> operator^(const Bitset<N, LeftPtr>& lhs,
-                                         const Bitset<N, RightPtr>& rhs) {
-  auto owned = make_owned_bitset<N>();
+// The operators build lazy expressions, see `BitsetExpr`. Note that `~` on a
+// writable bitset resolves to the in-place `Bitset::operator~`.
+template <size_t N, typename E>
+BitsetNotExpr<N, E> operator~(const BitsetExpr<N, E>& operand) {
+  return BitsetNotExpr<N, E>{operand.derived()};
+}
 
-  auto owned_word = owned.word();
-  auto lhs_word = lhs.word();
-  auto rhs_word = rhs.word();
+template <size_t N, typename L, typename R>
+BitsetBinaryExpr<N, std::bit_and<BitsetWordType>, L, R> operator&(
+    const BitsetExpr<N, L>& lhs, const BitsetExpr<N, R>& rhs) {
+  return {lhs.derived(), rhs.derived()};
+}
 
-  size_t remaining = owned.size_words();
-  while (remaining-- != 0UL) {
-    *owned_word++ = *lhs_word++ ^ *rhs_word++;
-  }
+template <size_t N, typename L, typename R>
+BitsetBinaryExpr<N, std::bit_or<BitsetWordType>, L, R> operator|(
+    const BitsetExpr<N, L>& lhs, const BitsetExpr<N, R>& rhs) {
+  return {lhs.derived(), rhs.derived()};
+}
 
-  return owned;
+template <size_t N, typename L, typename R>
+BitsetBinaryExpr<N, std::bit_xor<BitsetWordType>, L, R> operator^(
+    const BitsetExpr<N, L>& lhs, const BitsetExpr<N, R>& rhs) {
+  return {lhs.derived(), rhs.derived()};
 }
 
+// Indicate if `T` binds a temporary owning bitset, which an expression would
+// reference past its lifetime, see `BitsetExprOperand`.
+template <typename T, typename = void>
+struct is_temporary_bitset : std::false_type {};
+
+template <typename T>
+struct is_temporary_bitset<
+    T, std::enable_if_t<!std::is_lvalue_reference_v<T> && std::decay_t<T>::kIsOwning>>
+    : std::true_type {};
+
+template <typename... T>
+using enable_if_temporary_bitset =
+    std::enable_if_t<(is_temporary_bitset<T>::value || ...)>;
+
+// The expressions of temporary owning bitsets don't compile, e.g.
+// `auto e = a & make_owned_bitset<N>();` would dangle. Evaluate the
+// expression with `make_owned_bitset` or name the temporary.
+template <typename E, typename = enable_if_temporary_bitset<E>>
+void operator~(E&& operand) = delete;
+
+template <typename L, typename R, typename = enable_if_temporary_bitset<L, R>>
+void operator&(L&& lhs, R&& rhs) = delete;
+
+template <typename L, typename R, typename = enable_if_temporary_bitset<L, R>>
+void operator|(L&& lhs, R&& rhs) = delete;
+
+template <typename L, typename R, typename = enable_if_temporary_bitset<L, R>>
+void operator^(L&& lhs, R&& rhs) = delete;
+
 }  // namespace jitmap
@@ -0,0 +1,55 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <jitmap/container/container.h>
+#include <jitmap/jitmap.h>
+
+namespace jitmap {
+
+// Build a bitmap from sorted row ids, duplicates are ignored.
+//
+// The ids are split by their upper bits (see `Bitmap::key`) and each
+// container is built in the representation with the smallest serialized
+// size, see `SmallestContainerType`.
+//
+// \param[in] ids, the sorted row ids.
+// \param[in] n, the number of row ids.
+// \return a bitmap with the row ids set.
+//
+// \throws Exception if the ids are not sorted or if an id doesn't fit in 48
+// bits.
+Bitmap BuildBitmap(const uint32_t* ids, size_t n);
+Bitmap BuildBitmap(const uint64_t* ids, size_t n);
+
+// Build a bitmap from unsorted row ids. The ids are sorted in place with a
+// radix sort first, see `BuildBitmap`.
+Bitmap BuildBitmapUnsorted(uint32_t* ids, size_t n);
+Bitmap BuildBitmapUnsorted(uint64_t* ids, size_t n);
+
+// Build a container from sorted indices, duplicates are ignored.
+//
+// The cardinality and the number of runs are counted first, then only the
+// smallest representation is materialized.
+//
+// \throws Exception if the indices are not sorted.
+std::unique_ptr<Container> BuildContainer(const Container::index_type* indices,
+                                          size_t n);
+
+}  // namespace jitmap
@@ -0,0 +1,137 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <jitmap/bitset.h>
+#include <jitmap/container/container.h>
+
+namespace jitmap {
+
+// ArrayContainer stores the set bits of a sparse container as a sorted array
+// of unique 16-bit indices. Past `kMaxCardinality` elements, the dense
+// representation is smaller and the container must be converted.
+class ArrayContainer final : public BaseContainer<ArrayContainer, ARRAY> {
+ public:
+  // The maximum number of elements, at which point both representations
+  // occupy `kBytesPerContainer`.
+  static constexpr size_t kMaxCardinality =
+      kBytesPerContainer / sizeof(Container::index_type);
+
+  // Construct an empty container.
+  ArrayContainer() = default;
+
+  // Construct a container from sorted unique indices.
+  //
+  // \throws Exception if the values are not strictly increasing or if there
+  // are more than `kMaxCardinality` values.
+  explicit ArrayContainer(std::vector<index_type> values);
+
+  bool operator[](index_type index) const noexcept final;
+
+  // Insert an index.
+  //
+  // \return false if the index is not present and the container is full, the
+  //         caller must then convert to a `DenseContainer`.
+  bool add(index_type index);
+
+  size_t cardinality() const noexcept { return values_.size(); }
+
+  // Return the number of set bits before `index`.
+  size_t rank(index_type index) const noexcept;
+
+  // Return the index of the `k`-th set bit (0-based).
+  //
+  // \throws Exception if `k` is not less than the cardinality.
+  size_t select(size_t k) const {
+    JITMAP_PRE(k < values_.size());
+    return values_[k];
+  }
+
+  const std::vector<index_type>& values() const noexcept { return values_; }
+  const index_type* data() const noexcept { return values_.data(); }
+
+  // Convert to the dense representation.
+  DenseContainer ToDense() const;
+
+  // Convert from the dense representation.
+  //
+  // \throws Exception if the cardinality exceeds `kMaxCardinality`.
+  static ArrayContainer FromDense(const DenseContainer& dense);
+
+ private:
+  // Construct from values known to be sorted and unique, skipping validation.
+  struct Trusted {};
+  ArrayContainer(std::vector<index_type> values, Trusted) : values_(std::move(values)) {}
+
+  Statistics ComputeStatistics() const noexcept final;
+
+  std::vector<index_type> values_;
+
+  friend ArrayContainer Intersect(const ArrayContainer&, const ArrayContainer&);
+  friend ArrayContainer Intersect(const ArrayContainer&, const DenseContainer&);
+  friend std::unique_ptr<Container> Union(const ArrayContainer&, const ArrayContainer&);
+};
+
+// Kernels on sorted arrays of unique indices. The output buffers must not
+// alias the inputs.
+
+// The extra room required by the output of `IntersectArrays`.
+constexpr size_t kIntersectPadding = 8;
+
+// Intersect two arrays.
+//
+// Uses a vectorized merge when the sizes are comparable, and galloping
+// (exponential search of the smaller array's elements in the larger array)
+// when they are skewed.
+//
+// \param[out] out, must have room for `std::min(n_a, n_b) + kIntersectPadding`
+//                  elements, the vectorized merge writes past the result.
+// \return the number of elements written to `out`.
+size_t IntersectArrays(const uint16_t* a, size_t n_a, const uint16_t* b, size_t n_b,
+                       uint16_t* out);
+
+// Intersect an array with a dense bitmap of `kBitsPerContainer` by probing
+// the bit of each element.
+//
+// \param[out] out, must have room for `n_a` elements.
+// \return the number of elements written to `out`.
+size_t IntersectArrayDense(const uint16_t* a, size_t n_a, const BitsetWordType* dense,
+                           uint16_t* out);
+
+// Union of two arrays.
+//
+// \param[out] out, must have room for `n_a + n_b` elements.
+// \return the number of elements written to `out`.
+size_t UnionArrays(const uint16_t* a, size_t n_a, const uint16_t* b, size_t n_b,
+                   uint16_t* out);
+
+// Container level operations.
+
+ArrayContainer Intersect(const ArrayContainer& lhs, const ArrayContainer& rhs);
+ArrayContainer Intersect(const ArrayContainer& lhs, const DenseContainer& rhs);
+inline ArrayContainer Intersect(const DenseContainer& lhs, const ArrayContainer& rhs) {
+  return Intersect(rhs, lhs);
+}
+
+// Union of two arrays. The result is an `ArrayContainer` if its cardinality
+// is at most `ArrayContainer::kMaxCardinality`, a `DenseContainer` otherwise.
+std::unique_ptr<Container> Union(const ArrayContainer& lhs, const ArrayContainer& rhs);
+
+}  // namespace jitmap
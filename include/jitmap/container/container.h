@@ -17,8 +17,12 @@
 #include <bitset>
 #include <cstddef>
 #include <cstdint>
-#include <optional>
+#include <atomic>
+#include <memory>
 
+#include <jitmap/bitset.h>
+#include <jitmap/dirty.h>
+#include <jitmap/rank.h>
 #include <jitmap/size.h>
 
 namespace jitmap {
@@ -31,7 +35,20 @@ enum ContainerType : uint8_t {
   FULL = 4,
 };
 
+// Serialized sizes in bytes of a container per representation, following the
+// Roaring format. Used to select the most compact representation.
+constexpr size_t SerializedSizeAsArray(size_t cardinality) {
+  return cardinality * sizeof(uint16_t);
+}
+constexpr size_t SerializedSizeAsRun(size_t n_runs) {
+  return sizeof(uint16_t) + n_runs * 2 * sizeof(uint16_t);
+}
+constexpr size_t SerializedSizeAsDense() { return kBytesPerContainer; }
+
+// The proxy summarizes a container with one bit per block of
+// `kBitsPerProxyBit` bits, the bit is set if any bit of the block is set.
 constexpr size_t kBitsInProxy = 64U;
+constexpr size_t kBitsPerProxyBit = kBitsPerContainer / kBitsInProxy;
 using ProxyBitmap = std::bitset<kBitsInProxy>;
 
 class Statistics {
@@ -40,10 +57,13 @@ class Statistics {
   Statistics(ProxyBitmap proxy, int32_t count)
       : proxy_(std::move(proxy)), count_(count) {}
 
-  static Statistics Empty() {
+  static Statistics Empty() { return Statistics(); }
+  static Statistics Full() {
     return Statistics(0xFFFFFFFFFFFFFFFFULL, kBitsPerContainer);
   }
-  static Statistics Full() { return Statistics(); };
+
+  const ProxyBitmap& proxy() const noexcept { return proxy_; }
+  int32_t count() const noexcept { return count_; }
 
   bool all() const noexcept { return count_ == kBitsPerContainer; }
   bool full() const noexcept { return all(); }
@@ -58,14 +78,37 @@ class Statistics {
   int32_t count_ = 0UL;
 };
 
+// A non-owning view on the payload of a container, e.g. a container mapped
+// from a file, see `MappedBitmap`. The payload is interpreted following the
+// type: `kBitsPerContainer` bits for BITMAP, `size` sorted uint16_t values
+// for ARRAY and `size` runs of (start, length) uint16_t pairs for RUN_LENGTH.
+// Dense payloads must be aligned to `kCacheLineSize`.
+struct ContainerView {
+  ContainerType type = BITMAP;
+  uint32_t size = 0;
+  const void* data = nullptr;
+  Statistics statistics;
+};
+
 class Container {
  public:
   using index_type = uint16_t;
 
-  Container() : statistics_(std::nullopt) {}
-  Container(Statistics statistics) : statistics_(std::move(statistics)) {}
+  Container() = default;
+  Container(Statistics statistics)
+      : statistics_(std::move(statistics)), state_(kComputedStatistics) {}
+  Container(const Container& other) { *this = other; }
+  Container& operator=(const Container& other) noexcept {
+    if (other.has_statistics()) {
+      CopyStatistics(other.statistics_);
+    } else {
+      InvalidateStatistics();
+    }
+    return *this;
+  }
+  virtual ~Container() = default;
 
-  size_t count() const noexcept { return statistics().all(); }
+  size_t count() const noexcept { return statistics().count(); }
 
   bool all() const noexcept { return count() == kBitsPerContainer; }
   bool full() const noexcept { return all(); }
@@ -75,24 +118,55 @@ class Container {
   bool none() const noexcept { return statistics().none(); }
   bool empty() const noexcept { return none(); }
 
-  bool has_statistics() const noexcept { return statistics_.has_value(); }
+  bool has_statistics() const noexcept {
+    return state_.load(std::memory_order_acquire) == kComputedStatistics;
+  }
+  // The statistics are computed on the first access. Concurrent readers of a
+  // container may race to compute them, a single one publishes them.
   const Statistics& statistics() const noexcept {
-    if (!has_statistics()) statistics_ = ComputeStatistics();
-    return statistics_.value();
+    if (!has_statistics()) CacheStatistics(ComputeStatistics());
+    return statistics_;
   };
 
   virtual bool operator[](index_type index) const noexcept = 0;
 
+  // The representation of the container, used to dispatch without RTTI.
+  virtual ContainerType container_type() const noexcept = 0;
+
+ protected:
+  // Must be called by mutators such that statistics are recomputed. The
+  // mutators require exclusive access to the container.
+  void InvalidateStatistics() noexcept {
+    state_.store(kUnknownStatistics, std::memory_order_relaxed);
+  }
+  // Store statistics computed as a by-product of another pass, unless they
+  // are already known.
+  void CacheStatistics(Statistics statistics) const noexcept;
+
  private:
+  enum : uint8_t { kUnknownStatistics, kComputingStatistics, kComputedStatistics };
+
+  void CopyStatistics(const Statistics& statistics) noexcept {
+    statistics_ = statistics;
+    state_.store(kComputedStatistics, std::memory_order_relaxed);
+  }
+
   virtual Statistics ComputeStatistics() const noexcept = 0;
 
-  // Field is mutable because it is lazily computed.
-  mutable std::optional<Statistics> statistics_;
+  // Fields are mutable because the statistics are lazily computed. The state
+  // guards the statistics, they are only read once computed.
+  mutable Statistics statistics_;
+  mutable std::atomic<uint8_t> state_{kUnknownStatistics};
 };
 
 class EmptyContainer final : public Container {
  public:
   bool operator[](index_type index) const noexcept final { return false; }
+  ContainerType container_type() const noexcept final { return EMPTY; }
+
+  size_t rank(index_type index) const noexcept { return 0; }
+  // \throws Exception, there is no set bit to select.
+  size_t select(size_t k) const { throw Exception("Can't select in empty container"); }
 
  private:
   Statistics ComputeStatistics() const noexcept final { return Statistics::Empty(); }
@@ -101,6 +175,14 @@ class EmptyContainer final : public Container {
 class FullContainer final : public Container {
  public:
   bool operator[](index_type index) const noexcept final { return true; }
+  ContainerType container_type() const noexcept final { return FULL; }
+
+  size_t rank(index_type index) const noexcept { return index; }
+  // \throws Exception if `k` is not less than `kBitsPerContainer`.
+  size_t select(size_t k) const {
+    JITMAP_PRE(k < kBitsPerContainer);
+    return k;
+  }
 
  private:
   Statistics ComputeStatistics() const noexcept final { return Statistics::Full(); }
@@ -112,20 +194,87 @@ class BaseContainer : public Container {
   using SelfType = EffectiveType;
   static constexpr ContainerType type = Type;
 
-  constexpr ContainerType container_type() const { return type; }
+  ContainerType container_type() const noexcept final { return type; }
 };
 
-using DenseBitset = std::bitset<kBitsPerContainer>;
+using DenseBitset = OwnedBitset<kBitsPerContainer, BitsetWordType>;
+
+// Compute the cardinality and the proxy of a dense bitmap of
+// `kBitsPerContainer` bits in a single pass. Vectorized with AVX2 when the
+// host supports it.
+//
+// \param[out] ranks, if not null, filled with the rank directory of the
+//                    bitmap, see `RankDirectory<kBitsPerContainer>`.
+Statistics ComputeDenseStatistics(const BitsetWordType* words,
+                                  uint32_t* ranks = nullptr) noexcept;
 
 class DenseContainer final : public BaseContainer<DenseContainer, BITMAP> {
-  bool operator[](index_type index) const noexcept { return bitmap_[index]; }
+ public:
+  // Construct an empty container.
+  DenseContainer() : bitmap_(make_owned_bitset<kBitsPerContainer>()) { bitmap_.reset(); }
+  DenseContainer(DenseContainer&& other) noexcept
+      : BaseContainer(other),
+        bitmap_(std::move(other.bitmap_)),
+        dirty_(other.dirty_),
+        ranks_(other.ranks_.exchange(nullptr, std::memory_order_relaxed)) {}
+  ~DenseContainer() override { delete ranks_.load(std::memory_order_relaxed); }
+
+  bool operator[](index_type index) const noexcept final { return bitmap_[index]; }
+
+  // Set a single bit.
+  void set(index_type index) {
+    if (bitmap_[index]) return;
+    bitmap_.set(index);
+    dirty_.MarkBit(index);
+    Invalidate();
+  }
+
+  size_t cardinality() const noexcept { return count(); }
+
+  // Return the number of set bits before `index`.
+  //
+  // The first rank or select query builds a rank directory, along the
+  // statistics, which is dropped when the container is modified.
+  size_t rank(index_type index) const;
+
+  // Return the index of the `k`-th set bit (0-based).
+  //
+  // \throws Exception if `k` is not less than the cardinality.
+  size_t select(size_t k) const;
+
+  const DenseBitset& bitmap() const noexcept { return bitmap_; }
+  // Mutable access to the underlying bitmap, invalidates the statistics and
+  // marks all the cachelines dirty.
+  DenseBitset& bitmap() noexcept {
+    Invalidate();
+    dirty_.MarkAll();
+    return bitmap_;
+  }
+
+  const BitsetWordType* data() const noexcept { return bitmap_.word(); }
+
+  // The modified cachelines since the last call to `ClearDirty`, see
+  // `Query::EvalIncremental`.
+  const DirtyLines& dirty() const noexcept { return dirty_; }
+  void ClearDirty() noexcept { dirty_.clear(); }
 
  private:
   Statistics ComputeStatistics() const noexcept final {
-    return {0, static_cast<uint16_t>(bitmap_.count())};
+    return ComputeDenseStatistics(bitmap_.word());
   }
 
+  void Invalidate() noexcept {
+    InvalidateStatistics();
+    delete ranks_.exchange(nullptr, std::memory_order_relaxed);
+  }
+
+  const uint32_t* rank_directory() const;
+
   DenseBitset bitmap_;
+  DirtyLines dirty_;
+  // Lazily built, see `rank`. Concurrent readers may race to build it, the
+  // first one to install it wins.
+  mutable std::atomic<RankDirectory<kBitsPerContainer>*> ranks_{nullptr};
 };
 
 };  // namespace jitmap
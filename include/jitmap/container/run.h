@@ -0,0 +1,149 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <jitmap/bitset.h>
+#include <jitmap/container/array.h>
+#include <jitmap/container/container.h>
+
+namespace jitmap {
+
+// A run of `length + 1` consecutive indices starting at `start`. Following
+// Roaring's convention, the length is offset by one such that a full
+// container is represented by a single run.
+struct Run {
+  uint16_t start;
+  uint16_t length;
+
+  // The last index of the run, inclusive.
+  uint32_t end() const noexcept { return uint32_t{start} + length; }
+
+  bool operator==(const Run& rhs) const {
+    return start == rhs.start && length == rhs.length;
+  }
+};
+
+// The generated kernels read runs as pairs of uint16_t.
+static_assert(sizeof(Run) == 2 * sizeof(uint16_t), "Run must be packed");
+
+// RunContainer stores the set bits as sorted, disjoint and non-adjacent runs.
+class RunContainer final : public BaseContainer<RunContainer, RUN_LENGTH> {
+ public:
+  // Construct an empty container.
+  RunContainer() = default;
+
+  // Construct a container from runs.
+  //
+  // \throws Exception if the runs are not sorted or if two runs overlap or
+  // are adjacent, i.e. should be merged.
+  explicit RunContainer(std::vector<Run> runs);
+
+  bool operator[](index_type index) const noexcept final;
+
+  size_t n_runs() const noexcept { return runs_.size(); }
+  size_t cardinality() const noexcept;
+
+  // Return the number of set bits before `index`, linear in the number of
+  // runs.
+  size_t rank(index_type index) const noexcept;
+
+  // Return the index of the `k`-th set bit (0-based), linear in the number
+  // of runs.
+  //
+  // \throws Exception if `k` is not less than the cardinality.
+  size_t select(size_t k) const;
+  const std::vector<Run>& runs() const noexcept { return runs_; }
+  const Run* data() const noexcept { return runs_.data(); }
+
+  // Conversions
+  DenseContainer ToDense() const;
+  // \throws Exception if the cardinality exceeds `ArrayContainer::kMaxCardinality`.
+  ArrayContainer ToArray() const;
+  static RunContainer FromDense(const DenseContainer& dense);
+  static RunContainer FromArray(const ArrayContainer& array);
+
+ private:
+  struct Trusted {};
+  RunContainer(std::vector<Run> runs, Trusted) : runs_(std::move(runs)) {}
+
+  Statistics ComputeStatistics() const noexcept final;
+
+  std::vector<Run> runs_;
+
+  friend RunContainer Intersect(const RunContainer&, const RunContainer&);
+  friend RunContainer Union(const RunContainer&, const RunContainer&);
+};
+
+// Kernels operating directly on runs. The output buffers must not alias the
+// inputs.
+
+// Intersect two sequences of runs.
+//
+// \param[out] out, must have room for `n_a + n_b` runs.
+// \return the number of runs written to `out`.
+size_t IntersectRuns(const Run* a, size_t n_a, const Run* b, size_t n_b, Run* out);
+
+// Union of two sequences of runs, merging overlapping and adjacent runs.
+//
+// \param[out] out, must have room for `n_a + n_b` runs.
+// \return the number of runs written to `out`.
+size_t UnionRuns(const Run* a, size_t n_a, const Run* b, size_t n_b, Run* out);
+
+// Intersect runs with a dense bitmap of `kBitsPerContainer`, copying the
+// masked words covered by each run.
+//
+// \param[out] out, a dense bitmap of `kBitsPerContainer`, overwritten.
+void IntersectRunDense(const Run* runs, size_t n_runs, const BitsetWordType* dense,
+                       BitsetWordType* out);
+
+// Set the bits covered by the runs in a dense bitmap.
+void SetRuns(const Run* runs, size_t n_runs, BitsetWordType* out);
+
+// Count the number of runs of a dense bitmap of `kBitsPerContainer`.
+size_t CountRuns(const BitsetWordType* dense);
+
+// Count the number of runs of a dense bitmap of `kBitsPerContainer` starting
+// in the words [begin, end). The word preceding `begin` is read, if any.
+size_t CountRuns(const BitsetWordType* dense, size_t begin, size_t end);
+
+// Container level operations.
+
+RunContainer Intersect(const RunContainer& lhs, const RunContainer& rhs);
+DenseContainer Intersect(const RunContainer& lhs, const DenseContainer& rhs);
+inline DenseContainer Intersect(const DenseContainer& lhs, const RunContainer& rhs) {
+  return Intersect(rhs, lhs);
+}
+ArrayContainer Intersect(const RunContainer& lhs, const ArrayContainer& rhs);
+inline ArrayContainer Intersect(const ArrayContainer& lhs, const RunContainer& rhs) {
+  return Intersect(rhs, lhs);
+}
+RunContainer Union(const RunContainer& lhs, const RunContainer& rhs);
+
+// Return the representation with the smallest serialized size for a
+// container with the given cardinality and number of runs. Ties favor dense,
+// then array.
+ContainerType SmallestContainerType(size_t cardinality, size_t n_runs);
+
+// Convert to the representation with the smallest serialized size.
+std::unique_ptr<Container> Compact(const DenseContainer& dense);
+std::unique_ptr<Container> Compact(const ArrayContainer& array);
+std::unique_ptr<Container> Compact(const RunContainer& runs);
+
+}  // namespace jitmap
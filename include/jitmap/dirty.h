@@ -0,0 +1,132 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+
+#include <jitmap/bitset.h>
+#include <jitmap/size.h>
+
+namespace jitmap {
+
+// DirtyLines summarizes the modified cachelines of a dense container, one bit
+// per cacheline. It is the input of `Query::EvalIncremental`.
+class DirtyLines {
+ public:
+  using word_type = uint64_t;
+
+  static constexpr size_t kBitsPerWord = sizeof(word_type) * CHAR_BIT;
+  static constexpr size_t kNumberWords = kCacheLinesPerContainer / kBitsPerWord;
+
+  // Mark the cacheline holding the bit at `index` of the container.
+  void MarkBit(size_t index) noexcept { MarkLine(index / kBitsPerCacheLine); }
+  // Mark the cacheline at `line`.
+  void MarkLine(size_t line) noexcept {
+    words_[line / kBitsPerWord] |= word_type{1} << (line % kBitsPerWord);
+  }
+  // Mark all cachelines, e.g. when the container was overwritten.
+  void MarkAll() noexcept { words_.fill(~word_type{0}); }
+
+  // Indicate if the cacheline at `line` is marked.
+  bool test(size_t line) const noexcept {
+    return words_[line / kBitsPerWord] & (word_type{1} << (line % kBitsPerWord));
+  }
+
+  // Count the number of dirty cachelines.
+  size_t count() const noexcept {
+    size_t sum = 0;
+    for (auto w : words_) sum += __builtin_popcountll(w);
+    return sum;
+  }
+
+  bool any() const noexcept { return count() != 0; }
+  bool none() const noexcept { return !any(); }
+
+  void clear() noexcept { words_.fill(0); }
+
+  // Union of dirty lines, e.g. to combine the summaries of all the inputs of
+  // a query.
+  DirtyLines& operator|=(const DirtyLines& other) noexcept {
+    for (size_t i = 0; i < kNumberWords; i++) words_[i] |= other.words_[i];
+    return *this;
+  }
+
+  bool operator==(const DirtyLines& other) const { return words_ == other.words_; }
+  bool operator!=(const DirtyLines& other) const { return !(*this == other); }
+
+  const word_type* data() const { return words_.data(); }
+
+ private:
+  std::array<word_type, kNumberWords> words_{};
+
+  static_assert(kCacheLinesPerContainer % kBitsPerWord == 0,
+                "Cachelines per container must be a multiple of word_type");
+};
+
+// TrackedBitset wraps a writable container sized bitset and records which
+// cachelines were modified since the last call to `ClearDirty`. Only the
+// modifications that actually change a bit are recorded.
+template <typename Ptr = BitsetWordType*>
+class TrackedBitset {
+ public:
+  using bitset_type = Bitset<kBitsPerContainer, Ptr>;
+  using word_type = typename bitset_type::word_type;
+
+  explicit TrackedBitset(Ptr data) : bitset_(std::move(data)) {}
+
+  bool operator[](size_t i) const noexcept { return bitset_[i]; }
+  bool test(size_t i) const { return bitset_.test(i); }
+
+  // Set a single bit.
+  void set(size_t i, bool value = true) {
+    if (bitset_.test(i) == value) return;
+    bitset_.set(i, value);
+    dirty_.MarkBit(i);
+  }
+
+  // Clear a single bit.
+  void reset(size_t i) { set(i, false); }
+
+  // Flip a single bit.
+  void flip(size_t i) {
+    bitset_.flip(i);
+    dirty_.MarkBit(i);
+  }
+
+  // Overwrite the word at index `i`.
+  void set_word(size_t i, word_type value) {
+    JITMAP_PRE(i < bitset_.size_words());
+    auto& w = bitset_.word()[i];
+    if (w == value) return;
+    w = value;
+    dirty_.MarkBit(i * bitset_type::kBitsPerWord);
+  }
+
+  const bitset_type& bitset() const { return bitset_; }
+  const char* data() const { return bitset_.data(); }
+
+  // The modified cachelines since the last call to `ClearDirty`.
+  const DirtyLines& dirty() const { return dirty_; }
+  void ClearDirty() { dirty_.clear(); }
+
+ private:
+  bitset_type bitset_;
+  DirtyLines dirty_;
+};
+
+}  // namespace jitmap
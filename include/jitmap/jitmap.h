@@ -14,143 +14,209 @@
 
 #pragma once
 
-#include <algorithm>
-#include <bitset>
-#include <climits>
 #include <cstdint>
 #include <memory>
-#include <optional>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <jitmap/container/array.h>
+#include <jitmap/container/container.h>
+#include <jitmap/container/run.h>
 #include <jitmap/size.h>
+#include <jitmap/util/exception.h>
 
 namespace jitmap {
 
-enum ContainerType : uint8_t {
-  BITMAP = 0,
-  ARRAY = 1,
-  RUN_LENGTH = 2,
-  STATIC = 3,
-};
-
-constexpr size_t kBitsInProxy = 64U;
-using ProxyBitmap = std::bitset<kBitsInProxy>;
-
-class Statistics {
- public:
-  Statistics() : Statistics(0UL, 0L) {}
-  Statistics(ProxyBitmap proxy, int32_t count)
-      : proxy_(std::move(proxy)), count_(count) {}
-
-  static Statistics Empty() {
-    return Statistics(0xFFFFFFFFFFFFFFFFULL, kBitsPerContainer);
+// Invoke `f` with `container` downcasted to its effective type, e.g.
+// `const ArrayContainer*`. The call is resolved statically, the accessors
+// of the concrete containers are final and thus devirtualized.
+template <typename F>
+decltype(auto) VisitContainer(ContainerType type, const Container* container, F&& f) {
+  switch (type) {
+    case BITMAP:
+      return f(static_cast<const DenseContainer*>(container));
+    case ARRAY:
+      return f(static_cast<const ArrayContainer*>(container));
+    case RUN_LENGTH:
+      return f(static_cast<const RunContainer*>(container));
+    case EMPTY:
+      return f(static_cast<const EmptyContainer*>(container));
+    case FULL:
+      return f(static_cast<const FullContainer*>(container));
   }
-  static Statistics Full() { return Statistics(); };
-
-  bool all() const noexcept { return count_ == kBitsPerContainer; }
-  bool full() const noexcept { return all(); }
-
-  bool any() const noexcept { return proxy_.any(); }
-
-  bool none() const noexcept { return proxy_.none(); }
-  bool empty() const noexcept { return none(); }
-
- private:
-  ProxyBitmap proxy_;
-  int32_t count_ = 0UL;
-};
-
-class Container {
- public:
-  using index_type = uint16_t;
-
-  Container() : statistics_(std::nullopt) {}
-  Container(Statistics statistics) : statistics_(std::move(statistics)) {}
-
-  size_t count() const noexcept { return statistics().all(); }
-
-  bool all() const noexcept { return count() == kBitsPerContainer; }
-  bool full() const noexcept { return all(); }
-
-  bool any() const noexcept { return statistics().any(); }
-
-  bool none() const noexcept { return statistics().none(); }
-  bool empty() const noexcept { return none(); }
-
-  bool has_statistics() const noexcept { return statistics_.has_value(); }
-  const Statistics& statistics() const noexcept {
-    if (!has_statistics()) statistics_ = ComputeStatistics();
-    return statistics_.value();
-  };
-
-  virtual bool operator[](index_type index) const noexcept = 0;
-
- private:
-  virtual Statistics ComputeStatistics() const noexcept = 0;
-
-  // Field is mutable because it is lazily computed.
-  mutable std::optional<Statistics> statistics_;
-};
-
-class FullContainer final : public Container {
- public:
-  bool operator[](index_type index) const noexcept final { return true; }
 
- private:
-  Statistics ComputeStatistics() const noexcept final { return Statistics::Full(); }
-};
+  throw Exception("Unknown container type ", static_cast<int>(type));
+}
 
-class EmptyContainer final : public Container {
+// A reference counted handle on a container, tagged with the container type
+// and its cardinality such that the common accesses don't need to dereference
+// the container nor go through a virtual call.
+//
+// The container is immutable once shared: copying a handle shares the
+// container, see `Bitmap::Modify` for copy-on-write updates.
+class ContainerHandle {
  public:
-  bool operator[](index_type index) const noexcept final { return false; }
+  // \throws Exception if the container is null.
+  explicit ContainerHandle(std::shared_ptr<const Container> container);
 
- private:
-  Statistics ComputeStatistics() const noexcept final { return Statistics::Empty(); }
-};
+  ContainerType type() const noexcept { return type_; }
+  uint32_t cardinality() const noexcept { return cardinality_; }
+  const Container* get() const noexcept { return container_.get(); }
+  const std::shared_ptr<const Container>& shared() const noexcept { return container_; }
 
-template <typename EffectiveType, ContainerType Type>
-class BaseContainer : public Container {
- public:
-  using SelfType = EffectiveType;
-  static constexpr ContainerType type = Type;
+  // Indicates if no other handle references the container.
+  bool unique() const noexcept { return container_.use_count() == 1; }
 
-  constexpr ContainerType container_type() const { return type; }
-};
-
-using DenseBitset = std::bitset<kBitsPerContainer>;
+  bool operator[](Container::index_type index) const {
+    return VisitContainer(type_, get(), [index](auto c) { return (*c)[index]; });
+  }
 
-class DenseContainer final : public BaseContainer<DenseContainer, BITMAP> {
-  bool operator[](index_type index) const noexcept { return bitmap_[index]; }
+  // Return the number of set bits before `index`.
+  uint32_t rank(Container::index_type index) const {
+    return VisitContainer(type_, get(), [index](auto c) { return c->rank(index); });
+  }
 
- private:
-  Statistics ComputeStatistics() const noexcept final {
-    return {0, static_cast<uint16_t>(bitmap_.count())};
+  // Return the index of the `k`-th set bit (0-based).
+  //
+  // \throws Exception if `k` is not less than the cardinality.
+  Container::index_type select(uint32_t k) const {
+    return VisitContainer(type_, get(), [k](auto c) { return c->select(k); });
   }
 
-  DenseBitset bitmap_;
+ private:
+  ContainerType type_;
+  uint32_t cardinality_;
+  std::shared_ptr<const Container> container_;
 };
 
+// Bitmap is a sparse bitmap of 2^48 bits partitioned in containers of
+// `kBitsPerContainer` bits. The containers are indexed by the upper bits of
+// the index (the key), the lower bits index within the container.
+//
+// The keys and the container handles are stored in parallel arrays sorted by
+// key. Lookups are a (vectorized) search in a contiguous array of keys
+// instead of a hash table probe, and iteration follows the key order, see
+// `MergeJoin`.
+//
+// Copies share the containers, a copy costs a pointer per container. The
+// shared containers are copied on the first modification, see `Modify`.
 class Bitmap {
  public:
   using index_type = uint64_t;
   using key_index_type = uint32_t;
 
-  std::pair<key_index_type, Container::index_type> key(index_type index) const {
-    return {index >> kLogBitsPerContainer, index & 0xFF};
+  Bitmap() = default;
+  // The copies share the containers and the cumulative cardinalities.
+  Bitmap(const Bitmap& other);
+  Bitmap& operator=(const Bitmap& other);
+  Bitmap(Bitmap&& other) noexcept = default;
+  Bitmap& operator=(Bitmap&& other) noexcept = default;
+
+  static std::pair<key_index_type, Container::index_type> key(index_type index) {
+    return {static_cast<key_index_type>(index >> kLogBitsPerContainer),
+            static_cast<Container::index_type>(index & (kBitsPerContainer - 1))};
   }
 
   bool operator[](index_type index) const {
     auto [k, offset] = key(index);
+    auto handle = Find(k);
+    return handle != nullptr && (*handle)[offset];
+  }
 
-    if (auto result = containers_.find(k); result != containers_.end())
-      return result->second->operator[](offset);
-
-    return false;
+  // Return the number of set bits.
+  uint64_t cardinality() const noexcept;
+
+  // Return the number of set bits before `index`.
+  uint64_t rank(index_type index) const;
+
+  // Return the index of the `k`-th set bit (0-based).
+  //
+  // \throws Exception if `k` is not less than the cardinality.
+  index_type select(uint64_t k) const;
+
+  // Return the number of containers.
+  size_t n_containers() const noexcept { return keys_.size(); }
+
+  // Return the handle of the container at key or nullptr if there is none.
+  const ContainerHandle* Find(key_index_type key) const;
+
+  // Insert a container at key, replacing the existing container if any. The
+  // container may be shared with other bitmaps.
+  //
+  // \throws Exception if the container is null.
+  void Insert(key_index_type key, std::shared_ptr<const Container> container);
+
+  // Modify the container at key in place by invoking `f(Container*)`. If the
+  // container is shared with another bitmap, it is copied first such that
+  // the other bitmaps are not affected.
+  //
+  // \throws Exception if there is no container at key.
+  template <typename F>
+  void Modify(key_index_type key, F&& f) {
+    auto& handle = MutableHandle(key);
+    f(const_cast<Container*>(handle.get()));
+    // Refresh the cardinality.
+    handle = ContainerHandle{handle.shared()};
   }
 
+  // Remove the container at key.
+  //
+  // \return true if a container was removed.
+  bool Erase(key_index_type key);
+
+  // The sorted keys and their container handles, in the same order.
+  const std::vector<key_index_type>& keys() const noexcept { return keys_; }
+  const std::vector<ContainerHandle>& containers() const noexcept { return containers_; }
+
  private:
-  std::unordered_map<key_index_type, std::unique_ptr<Container>> containers_;
+  // Builds the lazy caches before publishing a version.
+  friend class SharedBitmap;
+
+  // Return the handle at key, owning its container exclusively.
+  ContainerHandle& MutableHandle(key_index_type key);
+
+  // Return the number of set bits before each container and the total, built
+  // on the first rank or select query and dropped by the mutators.
+  const std::vector<uint64_t>& cumulative_cardinalities() const;
+
+  std::vector<key_index_type> keys_;
+  std::vector<ContainerHandle> containers_;
+  // Accessed with the atomic operations of shared_ptr. Concurrent readers may
+  // race to build it, the first one to install it wins.
+  mutable std::shared_ptr<const std::vector<uint64_t>> cumulative_;
 };
 
-};  // namespace jitmap
+// Return the position of the first key not less than `key` in the sorted
+// array `keys`, i.e. `std::lower_bound`. The search is branchless until the
+// range is small enough to be scanned with vector comparisons.
+size_t LowerBound(const Bitmap::key_index_type* keys, size_t n,
+                  Bitmap::key_index_type key);
+
+// Walk the containers of two bitmaps in key order, invoking
+// `f(key, lhs_handle, rhs_handle)` for every key present in either bitmap. The
+// handle of the bitmap missing the key is nullptr. Intersections can skip
+// the calls with a nullptr handle, unions and differences can't.
+template <typename F>
+void MergeJoin(const Bitmap& lhs, const Bitmap& rhs, F&& f) {
+  const auto& lhs_keys = lhs.keys();
+  const auto& rhs_keys = rhs.keys();
+  const auto* lhs_containers = lhs.containers().data();
+  const auto* rhs_containers = rhs.containers().data();
+
+  size_t i = 0, j = 0;
+  while (i < lhs_keys.size() && j < rhs_keys.size()) {
+    auto lhs_key = lhs_keys[i];
+    auto rhs_key = rhs_keys[j];
+    if (lhs_key < rhs_key) {
+      f(lhs_key, &lhs_containers[i++], nullptr);
+    } else if (rhs_key < lhs_key) {
+      f(rhs_key, nullptr, &rhs_containers[j++]);
+    } else {
+      f(lhs_key, &lhs_containers[i++], &rhs_containers[j++]);
+    }
+  }
+  for (; i < lhs_keys.size(); i++) f(lhs_keys[i], &lhs_containers[i], nullptr);
+  for (; j < rhs_keys.size(); j++) f(rhs_keys[j], nullptr, &rhs_containers[j]);
+}
+
+}  // namespace jitmap
@@ -0,0 +1,131 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <jitmap/size.h>
+
+namespace jitmap {
+
+class ThreadCache;
+
+// ContainerPool allocates blocks of `kBytesPerContainer` bytes aligned on a
+// cacheline, i.e. the storage of dense containers and evaluation outputs.
+//
+// Blocks are carved from slabs of `kSlabSize` bytes which are never returned
+// to the system. Each thread keeps a small cache of free blocks and exchanges
+// them in batches with a shared free list, thus the common case of allocating
+// and freeing temporaries doesn't take a lock.
+//
+// The pool is process wide, see `ContainerPool::Instance`.
+class ContainerPool {
+ public:
+  // The size of a slab, a (huge) page of 2MiB.
+  static constexpr size_t kSlabSize = 2ULL << 20;
+  static constexpr size_t kBlocksPerSlab = kSlabSize / kBytesPerContainer;
+  static constexpr size_t kDefaultThreadCacheSize = 64;
+
+  struct Options {
+    // Back the slabs with huge pages. Explicit huge pages (MAP_HUGETLB) are
+    // tried first, then transparent huge pages.
+    bool huge_pages = false;
+    // The maximum number of free blocks held by a thread, half of it is
+    // exchanged with the shared free list when the cache is empty or full.
+    size_t thread_cache_size = kDefaultThreadCacheSize;
+  };
+
+  struct Stats {
+    // Monotonic counters, sample them periodically to derive rates.
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+
+    // Number of slabs reserved from the system.
+    size_t slabs = 0;
+    // Number of slabs backed by huge pages.
+    size_t huge_slabs = 0;
+
+    size_t blocks_reserved() const { return slabs * kBlocksPerSlab; }
+    size_t blocks_in_use() const { return allocations - deallocations; }
+    // The fraction of the reserved memory that is free, either in the shared
+    // free list or in the thread caches.
+    double fragmentation() const {
+      if (blocks_reserved() == 0) return 0.0;
+      return 1.0 - static_cast<double>(blocks_in_use()) / blocks_reserved();
+    }
+  };
+
+  // Return the process wide pool.
+  static ContainerPool& Instance();
+
+  // Change the options of the pool.
+  //
+  // \throws Exception if the pool already reserved memory.
+  void Configure(Options options);
+
+  // Allocate a block of `kBytesPerContainer` bytes.
+  //
+  // \throws std::bad_alloc if the system is out of memory.
+  void* Allocate();
+
+  // Release a block obtained by `Allocate`.
+  void Free(void* block) noexcept;
+
+  Stats stats() const;
+
+ private:
+  ContainerPool() = default;
+
+  // Move up to `n` blocks from the shared free list to `out`, reserving a new
+  // slab if the list is empty.
+  void Refill(std::vector<void*>& out, size_t n);
+  // Move the last `n` blocks of `blocks` to the shared free list. The list
+  // has room for every block, see `ReserveSlab`.
+  void Drain(std::vector<void*>& blocks, size_t n) noexcept;
+  // Allocate and free a block without a thread cache, once the cache of the
+  // thread is destroyed.
+  void* AllocateShared();
+  void FreeShared(void* block) noexcept;
+  void ReserveSlab();
+
+  void Register(ThreadCache* cache);
+  void Unregister(ThreadCache* cache);
+
+  mutable std::mutex mutex_;
+  Options options_;
+  // Read without the lock by `Allocate` and `Free`.
+  std::atomic<size_t> thread_cache_size_{kDefaultThreadCacheSize};
+  std::vector<void*> free_;
+  size_t slabs_ = 0;
+  size_t huge_slabs_ = 0;
+
+  // The counters of the live thread caches, and of the exited threads and the
+  // blocks which bypassed the thread caches.
+  std::vector<ThreadCache*> caches_;
+  uint64_t retired_allocations_ = 0;
+  uint64_t retired_deallocations_ = 0;
+
+  friend class ThreadCache;
+};
+
+// Allocate a block from the process wide pool, see `ContainerPool`.
+inline void* AllocateContainer() { return ContainerPool::Instance().Allocate(); }
+inline void FreeContainer(void* block) noexcept { ContainerPool::Instance().Free(block); }
+
+}  // namespace jitmap
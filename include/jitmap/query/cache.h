@@ -0,0 +1,125 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <jitmap/size.h>
+
+namespace jitmap {
+namespace query {
+
+class Expr;
+
+// Return a canonical string representation of an expression.
+//
+// The representation is similar to `Expr::ToString` except that the operands
+// of commutative operators are sorted. Thus `(a & b)` and `(b & a)` share the
+// same canonical form. Two expressions with the same canonical form always
+// evaluate to the same bitmap given the same inputs.
+std::string CanonicalForm(const Expr& expr);
+
+// Identifies a cached result, i.e. the canonical form of an expression and
+// the versions of the bitmaps referenced by the expression, in the order of
+// their sorted names.
+struct ResultCacheKey {
+  std::string expr;
+  std::vector<uint64_t> versions;
+
+  bool operator==(const ResultCacheKey& rhs) const {
+    return expr == rhs.expr && versions == rhs.versions;
+  }
+};
+
+struct ResultCacheKeyHash {
+  size_t operator()(const ResultCacheKey& key) const noexcept;
+};
+
+// A materialized result of size `kBytesPerContainer`. The buffer is shared
+// such that an entry evicted while being read by an evaluation stays alive
+// until the evaluation finishes.
+using CachedBuffer = std::shared_ptr<const char>;
+
+class BufferPool;
+
+// ResultCache memoizes the results of (sub-)expressions evaluation.
+//
+// Entries are evicted in least-recently-used order once the memory budget is
+// exceeded. Evicted buffers are recycled in an internal pool to avoid
+// hammering the allocator. All methods are thread-safe.
+class ResultCache {
+ public:
+  // The number of evicted buffers kept for recycling, outside of the budget.
+  static constexpr size_t kMaxRecycledBuffers = 8;
+
+  // Create a cache that holds at most `memory_budget` bytes of results. The
+  // pool holds up to `kMaxRecycledBuffers` more buffers.
+  explicit ResultCache(size_t memory_budget);
+  ~ResultCache();
+
+  // Lookup a result and mark it as most recently used.
+  //
+  // \return the cached buffer or nullptr if not found.
+  CachedBuffer Lookup(const ResultCacheKey& key);
+
+  // Allocate a writable buffer of `kBytesPerContainer` from the pool. The
+  // buffer must be filled before being published with `Insert`.
+  std::shared_ptr<char> Allocate();
+
+  // Publish a result, possibly evicting older entries. If an entry already
+  // exists with the same key (e.g. two threads raced on a miss), the existing
+  // entry is kept.
+  void Insert(ResultCacheKey key, CachedBuffer buffer);
+
+  // Remove all entries.
+  void Clear();
+
+  size_t memory_budget() const { return memory_budget_; }
+  size_t memory_usage() const;
+  size_t size() const;
+
+  // Counters
+  uint64_t hits() const;
+  uint64_t misses() const;
+  uint64_t evictions() const;
+
+ private:
+  using Entry = std::pair<ResultCacheKey, CachedBuffer>;
+  using LruList = std::list<Entry>;
+
+  void EvictUnlocked();
+
+  const size_t memory_budget_;
+  std::shared_ptr<BufferPool> pool_;
+
+  mutable std::mutex mutex_;
+  // Most recently used at the front.
+  LruList lru_;
+  std::unordered_map<ResultCacheKey, LruList::iterator, ResultCacheKeyHash> index_;
+  size_t memory_usage_ = 0;
+
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+};
+
+}  // namespace query
+}  // namespace jitmap
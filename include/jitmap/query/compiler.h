@@ -17,7 +17,9 @@
 #include <memory>
 #include <string>
 #include <tuple>
+#include <vector>
 
+#include <jitmap/container/container.h>
 #include <jitmap/size.h>
 #include <jitmap/util/exception.h>
 #include <jitmap/util/pimpl.h>
@@ -35,9 +37,42 @@ class CompilerException : public Exception {
   using Exception::Exception;
 };
 
+class Expr;
+
+// Return the number of inputs of the dense kernels of an expression, one per
+// variable. With a shift operator (see `Expr::HasShift`), the bits close to
+// the container boundaries depend on the adjacent containers: the inputs are
+// followed by the inputs of the preceding container and then by the inputs of
+// the following container, i.e. three per variable.
+size_t DenseInputsCount(const Expr& expression);
+
 // Signature of generated functions
 typedef void (*DenseEvalFn)(const char**, char*);
 typedef int32_t (*DenseEvalPopCountFn)(const char**, char*);
+// Recompute only the cachelines flagged in the mask (see `DirtyLines`) and
+// return the popcount delta of the output.
+typedef int32_t (*DenseEvalIncrementalFn)(const char**, char*, const uint64_t*);
+// Evaluate the expression and count the runs of the output in the same pass,
+// the number of runs is written to the last argument. Returns the popcount of
+// the output.
+typedef int32_t (*DenseEvalRunsFn)(const char**, char*, int32_t*);
+// Evaluate `n` containers in a single call. The inputs of the containers are
+// laid out contiguously. If not null, popcounts receives the popcount of each
+// output.
+typedef void (*DenseEvalBatchFn)(const char** inputs, char** outputs, int32_t* popcounts,
+                                 uint64_t n);
+// Evaluate a single container whose inputs are in mixed representations, see
+// `JitEngine::CompileSpecialized`. A dense input points to the bitmap words,
+// an array input to its sorted uint16_t values and a run input to its
+// (start, length) uint16_t pairs. `sizes[i]` is the cardinality of an array
+// input or the number of runs of a run input, it is ignored for dense inputs.
+// Returns the popcount of the output.
+typedef int32_t (*SpecializedEvalFn)(const char** inputs, const uint32_t* sizes,
+                                     char* output);
+// Evaluate bitmaps of a small universe, see `JitEngine::CompileTiny`. The
+// inputs are laid out contiguously, `n_bits / 64` words per input. Returns
+// the popcount of the output.
+typedef int32_t (*TinyEvalFn)(const uint64_t* inputs, uint64_t* output);
 
 struct CompilerOptions {
   // Controls LLVM optimization level (-O0, -O1, -O2, -O3). Anything above 3
@@ -55,8 +90,6 @@ struct CompilerOptions {
   std::string cpu = "";
 };
 
-class Expr;
-
 class JitEngineImpl;
 // The JitEngine class transforms IR queries into executable functions.
 class JitEngine : util::Pimpl<JitEngineImpl> {
@@ -96,9 +129,70 @@ class JitEngine : util::Pimpl<JitEngineImpl> {
   // \throws CompilerException if any errors is encountered.
   std::string CompileIR(const std::string& name, const Expr& expression);
 
+  // Compile a variant of a query expression specialized for the container
+  // type of each input.
+  //
+  // Array and run inputs are decoded one cacheline at a time in registers and
+  // combined with the dense inputs, there is no conversion to a dense bitmap.
+  //
+  // \param[in] name, the query name, see `Compile`.
+  // \param[in] expr, the query expression.
+  // \param[in] types, the container type of each variable, in the order of
+  //                   `Expr::Variables`. Only BITMAP, ARRAY and RUN_LENGTH
+  //                   are supported.
+  //
+  // \throws CompilerException if any errors is encountered.
+  void CompileSpecialized(const std::string& name, const Expr& expression,
+                          const std::vector<ContainerType>& types);
+
+  // Compile a variant of a query expression for bitmaps of a small universe.
+  //
+  // The bitmaps are loaded in a single (vector) register each, the function
+  // is a single block without loop.
+  //
+  // \param[in] name, the query name, see `Compile`.
+  // \param[in] expr, the query expression.
+  // \param[in] n_bits, the size of the bitmaps, see `IsTinySize`.
+  //
+  // \throws CompilerException if the size is not supported or any errors is
+  // encountered.
+  void CompileTiny(const std::string& name, const Expr& expression, size_t n_bits);
+
+  // Compile the incremental variant of a query expression, see
+  // `DenseEvalIncrementalFn`.
+  //
+  // \param[in] name, the query name, see `Compile`.
+  // \param[in] expr, the query expression.
+  //
+  // \throws CompilerException if any errors is encountered.
+  void CompileIncremental(const std::string& name, const Expr& expression);
+
+  // Compile the variant of a query expression counting the runs of the output,
+  // see `DenseEvalRunsFn`.
+  //
+  // \param[in] name, the query name, see `Compile`.
+  // \param[in] expr, the query expression.
+  //
+  // \throws CompilerException if any errors is encountered.
+  void CompileRuns(const std::string& name, const Expr& expression);
+
+  // Compile the batch variant of a query expression, see `DenseEvalBatchFn`.
+  //
+  // \param[in] name, the query name, see `Compile`.
+  // \param[in] expr, the query expression.
+  //
+  // \throws CompilerException if any errors is encountered.
+  void CompileBatch(const std::string& name, const Expr& expression);
+
   // Lookup a query
   DenseEvalFn LookupUserQuery(const std::string& query_name);
   DenseEvalPopCountFn LookupUserPopCountQuery(const std::string& query_name);
+  DenseEvalIncrementalFn LookupUserIncrementalQuery(const std::string& query_name);
+  DenseEvalBatchFn LookupUserBatchQuery(const std::string& query_name);
+  DenseEvalRunsFn LookupUserRunsQuery(const std::string& query_name);
+  SpecializedEvalFn LookupUserSpecializedQuery(const std::string& query_name,
+                                               const std::vector<ContainerType>& types);
+  TinyEvalFn LookupUserTinyQuery(const std::string& query_name, size_t n_bits);
 
   // Return the LLVM name for the host CPU.
   //
@@ -14,8 +14,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -39,6 +41,8 @@ class Expr {
     AND_OPERATOR,
     OR_OPERATOR,
     XOR_OPERATOR,
+    SHIFT_LEFT_OPERATOR,
+    SHIFT_RIGHT_OPERATOR,
   };
 
   Type type() const { return type_; }
@@ -48,6 +52,11 @@ class Expr {
   bool IsOperator() const;
   bool IsUnaryOperator() const;
   bool IsBinaryOperator() const;
+  bool IsShiftOperator() const;
+
+  // Return true if a shift operator appears in the expression, a bit of the
+  // result then depends on the inputs at other positions, see `ShiftOpExpr`.
+  bool HasShift() const;
 
   template <typename Visitor>
   auto Visit(Visitor&& v) const;
@@ -63,7 +72,9 @@ class Expr {
   // Return all Reference expressions.
   std::vector<std::string> Variables() const;
 
-  // Copy the expression
+  // Copy the expression. The copy shares the nodes which are shared in the
+  // expression, copying into the builder which owns the expression returns
+  // the expression itself.
   Expr* Copy(ExprBuilder* builder) const;
 
   virtual ~Expr() {}
@@ -93,21 +104,32 @@ class UnaryOpExpr : public OpExpr {
   explicit UnaryOpExpr(Expr* expr) : operand_(expr) {}
 
   Expr* operand() const { return operand_; }
-  void set_operand(Expr* expr) { operand_ = expr; }
 
  private:
   Expr* operand_;
 };
 
+// Moves the bits of the operand by `amount` positions, the positions are
+// numbered across the containers of a bitmap. The positions outside of the
+// evaluated inputs are unset, e.g. `a << 1` shifts in an unset bit at the first
+// position of a bitmap with a single container and drops the last bit. The
+// literals span all positions, `$1 << k` is `$1`.
+class ShiftOpExpr : public UnaryOpExpr {
+ public:
+  ShiftOpExpr(Expr* expr, uint32_t amount) : UnaryOpExpr(expr), amount_(amount) {}
+
+  uint32_t amount() const { return amount_; }
+
+ private:
+  uint32_t amount_;
+};
+
 class BinaryOpExpr : public OpExpr {
  public:
   BinaryOpExpr(Expr* lhs, Expr* rhs) : left_operand_(lhs), right_operand_(rhs) {}
 
   Expr* left_operand() const { return left_operand_; }
-  void set_left_operand(Expr* left) { left_operand_ = left; }
-
   Expr* right_operand() const { return right_operand_; }
-  void set_right_operand(Expr* right) { right_operand_ = right; }
 
  private:
   Expr* left_operand_;
@@ -140,6 +162,20 @@ class NotOpExpr final : public BaseExpr<Expr::NOT_OPERATOR>, public UnaryOpExpr
   using UnaryOpExpr::UnaryOpExpr;
 };
 
+// Moves the bit at position `i` to `i + amount`.
+class ShiftLeftOpExpr final : public BaseExpr<Expr::SHIFT_LEFT_OPERATOR>,
+                              public ShiftOpExpr {
+ public:
+  using ShiftOpExpr::ShiftOpExpr;
+};
+
+// Moves the bit at position `i` to `i - amount`.
+class ShiftRightOpExpr final : public BaseExpr<Expr::SHIFT_RIGHT_OPERATOR>,
+                               public ShiftOpExpr {
+ public:
+  using ShiftOpExpr::ShiftOpExpr;
+};
+
 class AndOpExpr final : public BaseExpr<Expr::AND_OPERATOR>, public BinaryOpExpr {
  public:
   using BinaryOpExpr::BinaryOpExpr;
@@ -155,6 +191,13 @@ class XorOpExpr final : public BaseExpr<Expr::XOR_OPERATOR>, public BinaryOpExpr
   using BinaryOpExpr::BinaryOpExpr;
 };
 
+// ExprBuilder owns the expressions and hash-conses them: building a node
+// which is structurally equal to a node already built returns the latter, such
+// that the common subexpressions are a single node and an expression is a DAG.
+// The nodes are immutable, a rewrite builds new nodes.
+//
+// The structural equality is checked on the operands' addresses, it holds for
+// the operands built by the same builder.
 class ExprBuilder {
  public:
   Expr* EmptyBitmap() {
@@ -172,20 +215,58 @@ class ExprBuilder {
 
   Expr* Not(Expr* expr) { return Build<NotOpExpr>(expr); }
 
+  Expr* ShiftLeft(Expr* expr, uint32_t amount) {
+    return Build<ShiftLeftOpExpr>(expr, amount);
+  }
+
+  Expr* ShiftRight(Expr* expr, uint32_t amount) {
+    return Build<ShiftRightOpExpr>(expr, amount);
+  }
+
   Expr* And(Expr* lhs, Expr* rhs) { return Build<AndOpExpr>(lhs, rhs); }
 
   Expr* Or(Expr* lhs, Expr* rhs) { return Build<OrOpExpr>(lhs, rhs); }
 
   Expr* Xor(Expr* lhs, Expr* rhs) { return Build<XorOpExpr>(lhs, rhs); }
 
+  // Build an operator of the type, and shift amount, of `op` with other
+  // operands, `rhs` is ignored for the unary operators.
+  Expr* Rebuild(const Expr& op, Expr* lhs, Expr* rhs = nullptr);
+
+  // Return the number of distinct nodes built.
+  size_t size() const { return expressions_.size(); }
+
  private:
+  // The structure of a node, the operands are compared by address.
+  struct Key {
+    Expr::Type type;
+    const Expr* lhs = nullptr;
+    const Expr* rhs = nullptr;
+    uint32_t amount = 0;
+    std::string name;
+
+    bool operator==(const Key& o) const {
+      return type == o.type && lhs == o.lhs && rhs == o.rhs && amount == o.amount &&
+             name == o.name;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const;
+  };
+
   template <typename Type, typename... Args>
   Expr* Build(Args&&... args) {
-    return expressions_.emplace_back(std::make_unique<Type>(std::forward<Args>(args)...))
-        .get();
+    auto node = std::make_unique<Type>(std::forward<Args>(args)...);
+    auto [it, inserted] = interned_.try_emplace(KeyOf(*node), node.get());
+    if (inserted) expressions_.push_back(std::move(node));
+    return it->second;
   }
 
+  static Key KeyOf(const Expr& e);
+
   std::vector<std::unique_ptr<Expr>> expressions_;
+  std::unordered_map<Key, Expr*, KeyHash> interned_;
 };
 
 // TODO: Refactor to support various input types (instead of `const Expr&`).
@@ -206,6 +287,10 @@ auto Expr::Visit(Visitor&& v) const {
       return v(dynamic_cast<const OrOpExpr*>(this));
     case XOR_OPERATOR:
       return v(dynamic_cast<const XorOpExpr*>(this));
+    case SHIFT_LEFT_OPERATOR:
+      return v(dynamic_cast<const ShiftLeftOpExpr*>(this));
+    case SHIFT_RIGHT_OPERATOR:
+      return v(dynamic_cast<const ShiftRightOpExpr*>(this));
   }
 
   throw Exception("Unknown type: ", type());
@@ -228,6 +313,10 @@ auto Expr::Visit(Visitor&& v) {
       return v(dynamic_cast<OrOpExpr*>(this));
     case XOR_OPERATOR:
       return v(dynamic_cast<XorOpExpr*>(this));
+    case SHIFT_LEFT_OPERATOR:
+      return v(dynamic_cast<ShiftLeftOpExpr*>(this));
+    case SHIFT_RIGHT_OPERATOR:
+      return v(dynamic_cast<ShiftRightOpExpr*>(this));
   }
 
   throw Exception("Unknown type: ", type());
@@ -51,7 +51,7 @@ class TypeMatcher final : public Matcher {
   bool Match(const Expr& expr) const override;
 
  private:
-  std::bitset<8> mask_;
+  std::bitset<16> mask_;
 };
 
 // OperandMatcher applies a matcher to an operator's operand(s).
@@ -14,7 +14,10 @@
 
 #pragma once
 
+#include <cstddef>
 #include <optional>
+#include <unordered_map>
+#include <utility>
 
 #include <jitmap/query/matcher.h>
 
@@ -97,11 +100,93 @@ class NotChainFolding final : public OptimizationPass {
   Expr* Rewrite(const Expr& expr) override;
 };
 
+// And(e, Not(e)) -> 0
+// Or(e, Not(e))  -> 1
+// Xor(e, Not(e)) -> 1
+class ComplementFolding final : public OptimizationPass {
+ public:
+  explicit ComplementFolding(ExprBuilder* builder);
+
+  Expr* Rewrite(const Expr& expr) override;
+};
+
+// And(a, Or(a, b)) -> a
+// Or(a, And(a, b)) -> a
+//
+// The operands of both operators may be in any order.
+class AbsorptionFolding final : public OptimizationPass {
+ public:
+  explicit AbsorptionFolding(ExprBuilder* builder);
+
+  Expr* Rewrite(const Expr& expr) override;
+};
+
+// Or(And(a, b), And(a, c))  -> And(a, Or(b, c))
+// And(Or(a, b), Or(a, c))   -> Or(a, And(b, c))
+// Xor(And(a, b), And(a, c)) -> And(a, Xor(b, c))
+//
+// The common operand may be on either side of the inner operators, it keeps
+// the side it has in the left one.
+class Factoring final : public OptimizationPass {
+ public:
+  explicit Factoring(ExprBuilder* builder);
+
+  Expr* Rewrite(const Expr& expr) override;
+};
+
+// Not(And(Not(a), b)) -> Or(a, Not(b))
+// Not(Or(Not(a), b))  -> And(a, Not(b))
+// Not(Xor(Not(a), b)) -> Xor(a, b)
+// Xor(Not(a), Not(b)) -> Xor(a, b)
+// Not(Shift(Not(a), k)) -> Shift(a, k)
+//
+// The negations are pushed toward the variables when they cancel a negated
+// operand, i.e. when it doesn't add operations. A negation of an operator
+// without negated operands is kept, pushing it would add one.
+class DeMorganFolding final : public OptimizationPass {
+ public:
+  explicit DeMorganFolding(ExprBuilder* builder);
+
+  Expr* Rewrite(const Expr& expr) override;
+};
+
+// And(And(And(a, b), c), d) -> And(And(a, b), And(c, d))
+//
+// The chains of an associative operator are flattened and rebuilt into trees
+// of minimal height, i.e. the shortest dependency chain once lowered. Wide
+// conjunctions then expose instruction-level parallelism instead of a serial
+// chain of operations per word.
+//
+// The operands keep their order, only associativity is used, such that the
+// variables are referenced in the same order, see `Expr::Variables`. The
+// whole expression is rewritten in a single traversal, the pass is applied
+// once to the root.
+class TreeHeightReduction final : public OptimizationPass {
+ public:
+  explicit TreeHeightReduction(ExprBuilder* builder);
+
+  Expr* Rewrite(const Expr& expr) override;
+
+ private:
+  // Return the reduced expression, or `kNoOptimizationPerformed` if it is
+  // unchanged, and its height.
+  std::pair<Expr*, size_t> Reduce(const Expr& expr);
+
+  // The reductions of the visited nodes, such that a shared node is reduced
+  // once.
+  std::unordered_map<const Expr*, std::pair<Expr*, size_t>> reduced_;
+};
+
 struct OptimizerOptions {
   enum EnabledOptimizations : uint64_t {
     CONSTANT_FOLDING = 1U << 1,
     SAME_OPERAND_FOLDING = 1U << 2,
     NOT_CHAIN_FOLDING = 1U << 3,
+    TREE_HEIGHT_REDUCTION = 1U << 4,
+    COMPLEMENT_FOLDING = 1U << 5,
+    ABSORPTION_FOLDING = 1U << 6,
+    FACTORING = 1U << 7,
+    DE_MORGAN_FOLDING = 1U << 8,
   };
 
   bool HasOptimization(enum EnabledOptimizations optimization) {
@@ -109,7 +194,8 @@ struct OptimizerOptions {
   }
 
   static constexpr uint64_t kDefaultOptimizations =
-      CONSTANT_FOLDING | SAME_OPERAND_FOLDING | NOT_CHAIN_FOLDING;
+      CONSTANT_FOLDING | SAME_OPERAND_FOLDING | NOT_CHAIN_FOLDING | COMPLEMENT_FOLDING |
+      ABSORPTION_FOLDING | FACTORING | DE_MORGAN_FOLDING | TREE_HEIGHT_REDUCTION;
 
   uint64_t enabled_optimizations = kDefaultOptimizations;
 };
@@ -120,8 +206,17 @@ class Optimizer {
 
   const OptimizerOptions& options() const { return options_; }
 
+  // Apply the folding passes bottom-up until the expression is a fixpoint, or
+  // a round doesn't lower the count of operations, see `OperationCount`. The
+  // passes expose each other, e.g. a factoring yields a complement. The tree
+  // height reduction then reshapes the result.
   Expr* Optimize(const Expr& input);
 
+  // Return the number of operators of the expression, a shared node is
+  // counted once. This is the number of vector operations per word of the
+  // kernels before instruction selection.
+  static size_t OperationCount(const Expr& expr);
+
  private:
   ExprBuilder* builder_;
   OptimizerOptions options_;
@@ -129,6 +224,11 @@ class Optimizer {
   std::optional<ConstantFolding> constant_folding_;
   std::optional<SameOperandFolding> same_operand_folding_;
   std::optional<NotChainFolding> not_chain_folding_;
+  std::optional<ComplementFolding> complement_folding_;
+  std::optional<AbsorptionFolding> absorption_folding_;
+  std::optional<Factoring> factoring_;
+  std::optional<DeMorganFolding> de_morgan_folding_;
+  std::optional<TreeHeightReduction> tree_height_reduction_;
 };
 
 }  // namespace query
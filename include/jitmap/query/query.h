@@ -14,6 +14,9 @@
 
 #pragma once
 
+#include <exception>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -21,11 +24,18 @@
 #include <jitmap/util/pimpl.h>
 
 namespace jitmap {
+
+class Container;
+class ContainerHandle;
+struct ContainerView;
+class DirtyLines;
+
 namespace query {
 
 class Expr;
 class ExecutionContext;
 class EvaluationContext;
+class ResultCache;
 
 class QueryImpl;
 
@@ -80,12 +90,198 @@ class Query : util::Pimpl<QueryImpl> {
   // auto ordered_bitmaps = ReorderInputs({"a": a, "b": b, "c": c}, order);
   // query->Eval(ordered_bitmaps, output);
   // ```
+  //
+  // The shift operators, e.g. `a << 1`, move bits across the container
+  // boundaries. A single container is evaluated as if the adjacent containers
+  // were empty, see `Query::EvalViews` and `Query::EvalShared` to supply them.
   int32_t Eval(const EvaluationContext& ctx, std::vector<const char*> ins, char* out);
   int32_t Eval(std::vector<const char*> ins, char* out);
 
   int32_t EvalUnsafe(const EvaluationContext& ctx, std::vector<const char*>& ins,
                      char* out);
 
+  // Evaluate the expression on a batch of dense bitmaps with a single call.
+  //
+  // \param[in] ctx, evaluation context, see `EvaluationContext`.
+  // \param[in] ins, pointers to input bitmaps, `variables().size()` pointers
+  //                 per output, laid out contiguously in the order of `outs`.
+  // \param[out] outs, pointers where the resulting bitmaps will be written to.
+  // \return the popcount of each output, or kUnknownPopCount if popcount is
+  //         not computed.
+  //
+  // \throws Exception if the number of inputs doesn't match the number of
+  // outputs or if any of the outputs pointers is nullptr.
+  std::vector<int32_t> EvalBatch(const EvaluationContext& ctx,
+                                 std::vector<const char*> ins,
+                                 const std::vector<char*>& outs);
+
+  // Callback invoked with the result of `Query::Eval`, or with
+  // kUnknownPopCount and the exception if the evaluation failed.
+  using EvalCallback = std::function<void(int32_t, std::exception_ptr)>;
+
+  // Asynchronously evaluate the expression on dense bitmaps.
+  //
+  // The parameters and return value follow `Query::Eval`. The inputs are
+  // validated in the calling thread, the evaluation is then enqueued in a
+  // lock-free queue owned by the query. A worker thread (started on first
+  // use) drains the queue in batches and evaluates them via the batch kernel,
+  // see `Query::EvalBatch`. Under load, many requests are evaluated per kernel
+  // call, amortizing the per-call overhead.
+  //
+  // The input and output bitmaps must stay valid until the evaluation
+  // completes. Callbacks are invoked from the worker thread and must not
+  // block. Pending evaluations are completed before the query is destroyed.
+  //
+  // A failed evaluation is reported to the callback, or set on the returned
+  // future. The exceptions thrown by a callback have no caller to reach, they
+  // are caught and dropped by the worker; callbacks must handle their errors.
+  std::future<int32_t> EvalAsync(const EvaluationContext& ctx,
+                                 std::vector<const char*> ins, char* out);
+  void EvalAsync(const EvaluationContext& ctx, std::vector<const char*> ins, char* out,
+                 EvalCallback callback);
+
+  // Evaluate the expression on containers of any representation.
+  //
+  // \param[in] ctx, evaluation context, see `EvaluationContext`.
+  // \param[in] ins, pointers to input containers, see `Query::Eval` on
+  //                 ordering. Empty and full containers are supported.
+  // \param[out] out, pointer where the resulting dense bitmap will be written.
+  // \return see `Query::Eval`.
+  //
+  // Array and run inputs are not converted to dense bitmaps, they are decoded
+  // one cacheline at a time by a kernel specialized for the container type of
+  // each input. A kernel is compiled the first time a combination of types is
+  // seen and re-used afterwards.
+  //
+  // The statistics of the containers (see `Container::statistics`) are
+  // propagated through the expression first. If they prove the result empty
+  // or full, no kernel is invoked. If they prove most blocks of the result
+  // empty, only the remaining blocks are evaluated.
+  int32_t EvalContainers(const EvaluationContext& ctx,
+                         const std::vector<const Container*>& ins, char* out);
+
+  // Evaluate the expression on views of container payloads.
+  //
+  // \param[in] ctx, evaluation context, see `EvaluationContext`.
+  // \param[in] ins, views on the input containers, see `Query::Eval` on
+  //                 ordering. A view with a null data pointer is missing.
+  // \param[out] out, pointer where the resulting dense bitmap will be written.
+  // \return see `Query::Eval`.
+  //
+  // Behaves as `Query::EvalContainers`, the payloads are handed to the
+  // kernels as is, e.g. pointers in a file mapped by `MappedBitmap`.
+  //
+  // If the expression shifts, `ins` may also hold the views of the preceding
+  // containers followed by the views of the following containers, i.e.
+  // `3 * variables().size()` views, from which the bits are shifted in. A
+  // missing adjacent container is empty. The sparse inputs of such a query are
+  // decoded to dense bitmaps.
+  int32_t EvalViews(const EvaluationContext& ctx, const std::vector<ContainerView>& ins,
+                    char* out);
+
+  // Evaluate the expression into a new container.
+  //
+  // \param[in] ctx, evaluation context, see `EvaluationContext`.
+  // \param[in] ins, the inputs, see respectively `Query::Eval`,
+  //                 `Query::EvalContainers` and `Query::EvalViews`.
+  // \return the resulting container, whose representation follows
+  //         `EvaluationContext::OutputPolicy`.
+  //
+  // With the COMPACT policy, the dense kernel counts the runs of the result in
+  // the same pass as the popcount, the re-encoding doesn't need to scan the
+  // result beforehand.
+  std::unique_ptr<Container> Eval(const EvaluationContext& ctx,
+                                  std::vector<const char*> ins);
+  std::unique_ptr<Container> EvalContainers(const EvaluationContext& ctx,
+                                            const std::vector<const Container*>& ins);
+  std::unique_ptr<Container> EvalViews(const EvaluationContext& ctx,
+                                       const std::vector<ContainerView>& ins);
+
+  // Evaluate the expression on shared containers, forwarding an input as the
+  // result when the expression reduces to it.
+  //
+  // \param[in] ctx, evaluation context, see `EvaluationContext`.
+  // \param[in] ins, handles on the input containers, see `Query::Eval` on
+  //                 ordering. A null handle is missing.
+  // \return the resulting container, see `Query::EvalContainers`.
+  //
+  // The missing, empty and full inputs are substituted by constants and the
+  // expression is folded. If it reduces to an input, e.g. `a & !b` where `b`
+  // is missing, the container of the input is shared as is: no kernel is
+  // invoked, no memory is allocated and the output policy doesn't apply.
+  //
+  // \param[in] previous, next, handles on the preceding, respectively the
+  //                           following, containers of the inputs, read by the
+  //                           shift operators. Either empty or of the size of
+  //                           `ins`, a null handle is empty.
+  std::shared_ptr<const Container> EvalShared(
+      const EvaluationContext& ctx, const std::vector<const ContainerHandle*>& ins);
+  std::shared_ptr<const Container> EvalShared(
+      const EvaluationContext& ctx, const std::vector<const ContainerHandle*>& ins,
+      const std::vector<const ContainerHandle*>& previous,
+      const std::vector<const ContainerHandle*>& next);
+
+  // Evaluate the expression on bitmaps of a small universe, e.g. a few
+  // hundred entities, instead of a full container.
+  //
+  // \param[in] n_bits, the size of the bitmaps, 64, 128, 256 or 512.
+  // \param[in] ins, the words of the inputs, `n_bits / 64` words per input
+  //                 laid out contiguously in the order of `Query::variables`.
+  // \param[out] out, the `n_bits / 64` words of the result.
+  // \return the popcount of the result.
+  //
+  // \throws Exception if the size is not supported or a pointer is null.
+  //
+  // A kernel is compiled for each size on first use. It holds each input in
+  // a single register and has no loop, see `JitEngine::CompileTiny`. The
+  // missing policy doesn't apply, every input must be given.
+  int32_t EvalTiny(size_t n_bits, const uint64_t* ins, uint64_t* out);
+
+  // Evaluate the expression on dense bitmaps, re-using sub-expression results
+  // from the `ResultCache` of the `ExecutionContext`.
+  //
+  // \param[in] ctx, evaluation context, see `EvaluationContext`.
+  // \param[in] ins, pointers to input bitmaps, see `Query::Eval`.
+  // \param[in] versions, the version of each input bitmap, in the same order.
+  // \param[out] out, pointer where the resulting bitmap will be written to.
+  // \return see `Query::Eval`.
+  //
+  // Every binary operator below the root of the expression is a cached
+  // sub-expression, e.g. both `a & !b` and `(a & !b) & c` in `((a & !b) & c) | d`.
+  // Cached results are keyed by the canonical form of the sub-expression, the
+  // variable names and the versions of the referenced inputs. A version must
+  // uniquely identify the content of a variable's bitmap; the caller must bump
+  // it whenever the content changes. When evaluating multiple containers of
+  // the same bitmap, the container key must be part of the version.
+  //
+  // If the query was created in a context without cache, or if the expression
+  // shifts, this is equivalent to `Query::Eval` and versions are ignored.
+  int32_t Eval(const EvaluationContext& ctx, std::vector<const char*> ins,
+               const std::vector<uint64_t>& versions, char* out);
+
+  // Incrementally re-evaluate the expression after some of the inputs changed.
+  //
+  // \param[in] ctx, evaluation context, see `EvaluationContext`.
+  // \param[in] ins, pointers to input bitmaps, see `Query::Eval`.
+  // \param[in] dirty, the union of the cachelines modified in any of the inputs
+  //                   since `out` was computed, see `DenseContainer::dirty`
+  //                   and `TrackedBitset::dirty`.
+  // \param[in,out] out, the result of a previous evaluation of this query. Only
+  //                     the dirty cachelines are recomputed and written.
+  // \param[in] popcount, the popcount of `out` before the call, or
+  //                      kUnknownPopCount.
+  // \return kUnknownPopCount if popcount is not computed or the previous
+  //         popcount is unknown, else the popcount of the updated bitmap.
+  //
+  // Since the operators are applied vertically, a cacheline of the output only
+  // depends on the same cacheline of the inputs. The cost is thus proportional
+  // to the number of dirty cachelines instead of the container size. The shift
+  // operators break this property, the result of such an expression is fully
+  // recomputed if any cacheline is dirty.
+  int32_t EvalIncremental(const EvaluationContext& ctx, std::vector<const char*> ins,
+                          const DirtyLines& dirty, char* out,
+                          int32_t popcount = kUnknownPopCount);
+
   // Return the referenced variables and the expected order.o
   //
   // The ordering is fix once a Query object is constructed, i.e. the ordering
@@ -99,21 +295,41 @@ class Query : util::Pimpl<QueryImpl> {
   // Return the expression of the query.
   const Expr& expr() const;
 
+  // Return the expression compiled in the kernels, the optimized expression
+  // if it keeps the variables and the shifts of `expr`.
+  const Expr& compiled_expr() const;
+
  private:
   // Private constructor, see Query::Make.
   Query(std::string name, std::string query, ExecutionContext* context);
+
+  // See `Query::EvalViews`. If not null, `n_runs` receives the number of runs
+  // of the result when it is known without scanning it, else kUnknownPopCount.
+  // The runs are counted by the dense kernels, while computing the blocks
+  // which may be non-empty, but not by the kernels specialized on sparse
+  // inputs, whose results are scanned by the compact evaluations.
+  int32_t EvalViewsAndRuns(const EvaluationContext& ctx,
+                           const std::vector<ContainerView>& ins, char* out,
+                           int32_t* n_runs);
 };
 
 class JitEngine;
 
 class ExecutionContext {
  public:
-  explicit ExecutionContext(std::shared_ptr<JitEngine> jit) : jit_(std::move(jit)) {}
+  explicit ExecutionContext(std::shared_ptr<JitEngine> jit,
+                            std::shared_ptr<ResultCache> cache = nullptr)
+      : jit_(std::move(jit)), cache_(std::move(cache)) {}
 
   JitEngine* jit() { return jit_.get(); }
 
+  // The cache shared by all queries created with this context, may be null.
+  // See `Query::Eval` with versions.
+  const std::shared_ptr<ResultCache>& cache() const { return cache_; }
+
  private:
   std::shared_ptr<JitEngine> jit_;
+  std::shared_ptr<ResultCache> cache_;
 };
 
 class EvaluationContext {
@@ -133,14 +349,33 @@ class EvaluationContext {
     REPLACE_WITH_FULL,
   };
 
+  // The OutputPolicy indicates the representation of the containers returned
+  // by the `Eval` methods which allocate their result.
+  enum OutputPolicy {
+    // Always return a dense container.
+    DENSE = 0,
+    // Return an empty or a full container if the result is empty or full,
+    // else re-encode it in the representation with the smallest serialized
+    // size, see `SmallestContainerType`. The cardinality of the result is
+    // needed, thus this policy only applies when popcount is enabled.
+    COMPACT,
+  };
+
   MissingPolicy missing_policy() const { return missing_policy_; }
   void set_missing_policy(MissingPolicy policy) { missing_policy_ = policy; }
 
+  OutputPolicy output_policy() const { return output_policy_; }
+  void set_output_policy(OutputPolicy policy) { output_policy_ = policy; }
+
   bool popcount() const { return popcount_; }
   void set_popcount(bool popcount) { popcount_ = popcount; }
 
+  // Indicates if the result of an evaluation must be re-encoded.
+  bool compact() const { return popcount_ && output_policy_ == COMPACT; }
+
  private:
   MissingPolicy missing_policy_ = ERROR;
+  OutputPolicy output_policy_ = DENSE;
   bool popcount_ = false;
 };
 
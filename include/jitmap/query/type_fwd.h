@@ -30,6 +30,9 @@ class OpExpr;
 
 class UnaryOpExpr;
 class NotOpExpr;
+class ShiftOpExpr;
+class ShiftLeftOpExpr;
+class ShiftRightOpExpr;
 
 class BinaryOpExpr;
 class AndOpExpr;
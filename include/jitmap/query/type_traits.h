@@ -51,6 +51,24 @@ using is_not_op = std::is_same<NotOpExpr, E>;
 template <typename E, typename R = void>
 using enable_if_not_op = std::enable_if_t<is_not_op<E>::value, R>;
 
+template <typename E>
+using is_shift_op = std::is_base_of<ShiftOpExpr, E>;
+
+template <typename E, typename R = void>
+using enable_if_shift_op = std::enable_if_t<is_shift_op<E>::value, R>;
+
+template <typename E>
+using is_shift_left_op = std::is_same<ShiftLeftOpExpr, E>;
+
+template <typename E, typename R = void>
+using enable_if_shift_left_op = std::enable_if_t<is_shift_left_op<E>::value, R>;
+
+template <typename E>
+using is_shift_right_op = std::is_same<ShiftRightOpExpr, E>;
+
+template <typename E, typename R = void>
+using enable_if_shift_right_op = std::enable_if_t<is_shift_right_op<E>::value, R>;
+
 template <typename E>
 using is_binary_op = std::is_base_of<BinaryOpExpr, E>;
 
@@ -0,0 +1,113 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include <jitmap/bitset.h>
+#include <jitmap/size.h>
+#include <jitmap/util/exception.h>
+
+namespace jitmap {
+
+// The rank directory stores one cumulative count per cacheline of bits, such
+// that a rank query popcounts at most one cacheline.
+constexpr size_t kBitsPerRankBlock = kBitsPerCacheLine;
+constexpr size_t kWordsPerRankBlock = kCacheLineSize / sizeof(BitsetWordType);
+
+// The number of entries of the rank directory of `n_words` words, one per
+// (possibly partial) block followed by the total count.
+constexpr size_t RankDirectorySize(size_t n_words) {
+  return (n_words + kWordsPerRankBlock - 1) / kWordsPerRankBlock + 1;
+}
+
+// Kernels on raw words and their rank directory, `ranks[b]` is the number of
+// set bits before block `b` and the last entry is the total count.
+
+// Fill the rank directory of `n_words` words.
+//
+// \param[out] ranks, must have room for `RankDirectorySize(n_words)` entries.
+// \return the number of set bits.
+size_t BuildRankDirectory(const BitsetWordType* words, size_t n_words, uint32_t* ranks);
+
+// Return the number of set bits before bit `i`, `i` may be one past the end.
+size_t RankWords(const BitsetWordType* words, const uint32_t* ranks, size_t i);
+
+// Return the position of the set bit of rank `k` (0-based), found with a
+// binary search of the directory followed by a scan of a single block.
+//
+// `k` must be less than the total count.
+size_t SelectWords(const BitsetWordType* words, size_t n_words, const uint32_t* ranks,
+                   size_t k);
+
+// Return the position of the set bit of rank `k` within a word, with
+// PDEP/TZCNT when the host supports BMI2.
+//
+// `k` must be less than the number of set bits of `word`.
+size_t SelectInWord(BitsetWordType word, size_t k);
+
+// RankDirectory indexes a `Bitset<N>` for constant time rank and select
+// queries. The directory is a snapshot, it must be rebuilt after the bitset
+// is modified.
+template <size_t N>
+class RankDirectory {
+ public:
+  static constexpr size_t kWords = N / (sizeof(BitsetWordType) * CHAR_BIT);
+
+  // Construct an empty directory, i.e. of a bitset without set bits.
+  RankDirectory() : ranks_() {}
+
+  template <typename Ptr>
+  explicit RankDirectory(const Bitset<N, Ptr>& bitset) {
+    Build(bitset.word());
+  }
+
+  // Rebuild the directory from the words of a bitset.
+  void Build(const BitsetWordType* words) {
+    BuildRankDirectory(words, kWords, ranks_.data());
+  }
+
+  // Return the number of set bits of the indexed bitset.
+  size_t count() const noexcept { return ranks_.back(); }
+
+  // Return the number of set bits before bit `i`.
+  //
+  // \throws std::out_of_range if `i` is greater than N.
+  template <typename Ptr>
+  size_t rank(const Bitset<N, Ptr>& bitset, size_t i) const {
+    if (i > N) throw std::out_of_range("Can't rank bit");
+    return RankWords(bitset.word(), ranks_.data(), i);
+  }
+
+  // Return the position of the `k`-th set bit (0-based).
+  //
+  // \throws Exception if `k` is not less than the number of set bits.
+  template <typename Ptr>
+  size_t select(const Bitset<N, Ptr>& bitset, size_t k) const {
+    JITMAP_PRE(k < count());
+    return SelectWords(bitset.word(), kWords, ranks_.data(), k);
+  }
+
+  uint32_t* data() noexcept { return ranks_.data(); }
+  const uint32_t* data() const noexcept { return ranks_.data(); }
+
+ private:
+  std::array<uint32_t, RankDirectorySize(kWords)> ranks_;
+};
+
+}  // namespace jitmap
@@ -0,0 +1,85 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <jitmap/container/container.h>
+#include <jitmap/jitmap.h>
+
+namespace jitmap {
+
+// Interoperability with the Roaring portable serialization format, see
+// https://github.com/RoaringBitmap/RoaringFormatSpec. The Roaring containers
+// map one to one to jitmap's containers: both use 16-bit keys of 65536 bits,
+// the same sorted uint16_t arrays, the same (start, length - 1) runs and the
+// same little-endian dense words.
+//
+// The 32-bit format holds the containers of keys below 2^16. The 64-bit
+// format is a sequence of 32-bit bitmaps prefixed by the upper 32 bits of
+// their ids.
+
+// Deserialize a bitmap in the 32-bit (resp. 64-bit) portable format.
+//
+// \throws Exception if the buffer is truncated or malformed.
+Bitmap ReadRoaring(const char* data, size_t size);
+Bitmap ReadRoaring64(const char* data, size_t size);
+
+// Serialize a bitmap in the 32-bit (resp. 64-bit) portable format. Empty
+// containers are omitted and full containers are written as a single run.
+//
+// \throws Exception if a key doesn't fit the 32-bit format.
+std::string WriteRoaring(const Bitmap& bitmap);
+std::string WriteRoaring64(const Bitmap& bitmap);
+
+// FrozenRoaring is a read-only view on a bitmap serialized in the 32-bit
+// portable format, whose containers are evaluated in place, see
+// `Query::EvalViews`.
+//
+// A payload is referenced in the buffer when its alignment permits it, i.e.
+// arrays and runs at an even address and dense bitmaps on a cacheline, it is
+// copied otherwise. The format doesn't store the proxies of the containers,
+// the views carry a conservative proxy (all blocks may be non-empty) and the
+// serialized cardinality. The payloads referenced in place are not validated,
+// the buffer must come from a trusted source and outlive the view.
+class FrozenRoaring {
+ public:
+  using key_index_type = Bitmap::key_index_type;
+
+  // \throws Exception if the buffer is truncated or malformed.
+  FrozenRoaring(const char* data, size_t size);
+
+  size_t n_containers() const noexcept { return keys_.size(); }
+  const std::vector<key_index_type>& keys() const noexcept { return keys_; }
+  const ContainerView& view(size_t i) const noexcept { return views_[i]; }
+
+  // Return the view on the container at key, or a view with a null data
+  // pointer if there is none, i.e. a missing input for `Query::EvalViews`.
+  ContainerView Find(key_index_type key) const;
+
+  // Return the number of payloads which had to be copied.
+  size_t n_copies() const noexcept { return copies_.size(); }
+
+ private:
+  std::vector<key_index_type> keys_;
+  std::vector<ContainerView> views_;
+  std::vector<std::unique_ptr<Container>> copies_;
+};
+
+}  // namespace jitmap
@@ -28,5 +28,9 @@ constexpr size_t kLogBitsPerContainer = 16ULL;
 constexpr size_t kBitsPerContainer = 1ULL << kLogBitsPerContainer;
 // The number of bytes per container.
 constexpr size_t kBytesPerContainer = kBitsPerContainer / CHAR_BIT;
+// The number of bits per cacheline.
+constexpr size_t kBitsPerCacheLine = kCacheLineSize * CHAR_BIT;
+// The number of cachelines per container.
+constexpr size_t kCacheLinesPerContainer = kBytesPerContainer / kCacheLineSize;
 
 }  // namespace jitmap
@@ -0,0 +1,129 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <jitmap/jitmap.h>
+#include <jitmap/size.h>
+
+namespace jitmap {
+
+// SharedBitmap publishes the versions of a bitmap to concurrent readers with
+// read-copy-update. The readers evaluate a consistent snapshot without locks
+// while a writer ingests bits.
+//
+// A writer copies the current version, which shares the containers (see
+// `Bitmap`), modifies the copy and publishes it with an atomic swap. The
+// modified containers are copied on write, the containers of the pinned
+// versions are never modified.
+//
+// A reader pins the current epoch in a slot before loading the current
+// version. A replaced version is retired with the epoch of its replacement
+// and freed once no slot pins an older epoch, i.e. after a grace period
+// during which every reader which could have loaded it released it.
+class SharedBitmap {
+ public:
+  // The number of snapshots which can be held concurrently. A reader waits
+  // for a free slot when they are all taken.
+  static constexpr size_t kMaxReaders = 64;
+
+  // A pinned version of the bitmap, valid until the snapshot is destroyed.
+  class Snapshot {
+   public:
+    Snapshot(Snapshot&& other) noexcept
+        : slot_(std::exchange(other.slot_, nullptr)), bitmap_(other.bitmap_) {}
+    Snapshot& operator=(Snapshot&&) = delete;
+    ~Snapshot() {
+      if (slot_ != nullptr) slot_->store(0, std::memory_order_release);
+    }
+
+    const Bitmap& operator*() const noexcept { return *bitmap_; }
+    const Bitmap* operator->() const noexcept { return bitmap_; }
+
+   private:
+    friend class SharedBitmap;
+    Snapshot(std::atomic<uint64_t>* slot, const Bitmap* bitmap)
+        : slot_(slot), bitmap_(bitmap) {}
+
+    std::atomic<uint64_t>* slot_;
+    const Bitmap* bitmap_;
+  };
+
+  SharedBitmap() : SharedBitmap(Bitmap{}) {}
+  explicit SharedBitmap(Bitmap bitmap);
+
+  SharedBitmap(const SharedBitmap&) = delete;
+  SharedBitmap& operator=(const SharedBitmap&) = delete;
+
+  // No snapshot may outlive the shared bitmap.
+  ~SharedBitmap();
+
+  // Pin the current version. Lock-free unless all the slots are taken.
+  Snapshot snapshot() const;
+
+  // Publish a new version, `f(Bitmap*)` modifies a copy of the current
+  // version. The writers are serialized.
+  //
+  // The copy shares the containers of the current version, the containers
+  // must be modified with `Bitmap::Modify` or replaced with `Bitmap::Insert`,
+  // never through a const_cast of `ContainerHandle::get`.
+  template <typename F>
+  void Update(F&& f) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto next = std::make_unique<Bitmap>(*current_.load(std::memory_order_relaxed));
+      f(next.get());
+      Publish(std::move(next));
+    }
+    Reclaim();
+  }
+
+  // Free the retired versions whose grace period elapsed, invoked by
+  // `Update`.
+  //
+  // \return the number of retired versions which may still be pinned.
+  size_t Reclaim();
+
+  // Return the current epoch, incremented by each publication.
+  uint64_t epoch() const noexcept { return epoch_.load(); }
+
+ private:
+  // Must be called with the mutex held.
+  void Publish(std::unique_ptr<Bitmap> next);
+
+  // The epoch pinned by a reader, or 0 if the slot is free. Padded such that
+  // the readers don't share cachelines.
+  struct alignas(kCacheLineSize) Slot {
+    std::atomic<uint64_t> epoch{0};
+  };
+
+  mutable std::array<Slot, kMaxReaders> slots_;
+  std::atomic<uint64_t> epoch_{1};
+  std::atomic<const Bitmap*> current_{nullptr};
+
+  std::mutex mutex_;
+  // The replaced versions and the epoch at which they were replaced.
+  std::vector<std::pair<uint64_t, std::unique_ptr<const Bitmap>>> retired_;
+};
+
+}  // namespace jitmap
@@ -0,0 +1,135 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <jitmap/container/container.h>
+#include <jitmap/jitmap.h>
+#include <jitmap/size.h>
+
+namespace jitmap {
+
+// On-disk format of a `Bitmap`, designed to be memory mapped and evaluated
+// in place. All sections and payloads are aligned to `kCacheLineSize` and
+// integers are stored in the host (little-endian) byte order.
+//
+// ```
+// StorageHeader
+// uint32_t keys[n_containers]                  // sorted
+// StorageEntry entries[n_containers]           // in the order of keys
+// payloads                                     // each aligned
+// ```
+//
+// A payload follows `ContainerView`: a dense bitmap of `kBytesPerContainer`,
+// `size` uint16_t values or `size` runs. Empty containers are not stored and
+// full containers are stored as a single run.
+constexpr char kStorageMagic[8] = {'J', 'I', 'T', 'M', 'A', 'P', '\0', '\1'};
+constexpr uint32_t kStorageVersion = 1;
+
+struct StorageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_containers;
+  uint64_t keys_offset;
+  uint64_t entries_offset;
+  uint64_t file_size;
+  uint8_t padding[24];
+};
+
+struct StorageEntry {
+  // The number of values or runs, unused for dense payloads.
+  uint32_t size;
+  uint32_t cardinality;
+  uint64_t proxy;
+  uint64_t offset;
+  ContainerType type;
+  uint8_t padding[7];
+};
+
+static_assert(sizeof(StorageHeader) == kCacheLineSize, "StorageHeader must be padded");
+static_assert(sizeof(StorageEntry) == 32, "StorageEntry must be packed");
+
+// Write a bitmap to a file in the storage format, replacing the file.
+//
+// \throws Exception if the file can't be written.
+void WriteBitmap(const Bitmap& bitmap, const std::string& path);
+
+// MappedBitmap is a read-only bitmap backed by a file memory mapped in the
+// storage format, see `WriteBitmap`.
+//
+// Opening only maps the file and validates its header, the pages are loaded
+// on demand by the kernel and shared between the processes mapping the same
+// file. The containers are exposed as views on the mapped payloads which are
+// evaluated in place, see `Query::EvalViews`.
+class MappedBitmap {
+ public:
+  using key_index_type = Bitmap::key_index_type;
+
+  // Map a file written by `WriteBitmap`.
+  //
+  // \throws Exception if the file can't be mapped or has an invalid header.
+  static std::unique_ptr<MappedBitmap> Open(const std::string& path);
+
+  ~MappedBitmap();
+
+  MappedBitmap(const MappedBitmap&) = delete;
+  MappedBitmap& operator=(const MappedBitmap&) = delete;
+
+  // Return the number of stored containers.
+  size_t n_containers() const noexcept { return header().n_containers; }
+
+  // Return the sorted keys of the stored containers.
+  const key_index_type* keys() const noexcept;
+
+  // Return the view on the `i`-th stored container, in key order.
+  //
+  // \throws Exception if the entry points outside of the file.
+  ContainerView view(size_t i) const;
+
+  // Return the view on the container at key, or a view with a null data
+  // pointer if there is none, i.e. a missing input for `Query::EvalViews`.
+  ContainerView Find(key_index_type key) const;
+
+  // Return the number of set bits.
+  uint64_t cardinality() const noexcept;
+
+  // Advise the kernel that the containers at `keys` will be accessed in
+  // that order, such that their pages are read ahead (`MADV_WILLNEED`).
+  // Contiguous payloads are coalesced in a single advice.
+  //
+  // \throws Exception if an entry points outside of the file.
+  void WillNeed(const std::vector<key_index_type>& keys) const;
+
+ private:
+  MappedBitmap(const char* data, size_t size) : data_(data), size_(size) {}
+
+  const StorageHeader& header() const noexcept {
+    return *reinterpret_cast<const StorageHeader*>(data_);
+  }
+  const StorageEntry* entries() const noexcept;
+  // Return the size of the payload of the `i`-th entry after checking that it
+  // is within the file.
+  size_t PayloadSizeOf(size_t i) const;
+
+  const char* data_;
+  size_t size_;
+};
+
+}  // namespace jitmap
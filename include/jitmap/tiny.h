@@ -15,6 +15,7 @@
 #pragma once
 
 #include <bitset>
+#include <cstddef>
 #include <cstdint>
 
 namespace jitmap {
@@ -22,4 +23,13 @@ namespace jitmap {
 constexpr size_t kBitsInTiny = 64U;
 using TinyBitmap = std::bitset<kBitsInTiny>;
 
+// The bitmaps of a small universe, up to `kMaxBitsInTiny` bits, are evaluated
+// in registers, see `Query::EvalTiny`. Such a bitmap of `n` bits is stored as
+// `n / kBitsInTiny` 64-bit words.
+constexpr size_t kMaxBitsInTiny = 512U;
+
+constexpr bool IsTinySize(size_t n_bits) {
+  return n_bits == 64 || n_bits == 128 || n_bits == 256 || n_bits == 512;
+}
+
 }  // namespace jitmap
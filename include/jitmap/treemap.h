@@ -0,0 +1,162 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <jitmap/container/container.h>
+#include <jitmap/jitmap.h>
+#include <jitmap/size.h>
+
+namespace jitmap {
+
+namespace query {
+class EvaluationContext;
+class Query;
+}  // namespace query
+
+// Treemap is a sparse bitmap of 2^64 bits. The upper 32 bits of an index (the
+// high part) select a bucket, a `Bitmap` of the lower 32 bits, i.e. of at
+// most 2^16 containers.
+//
+// A container is addressed by a 48-bit key, the upper bits of the index
+// above `kLogBitsPerContainer`. The high parts and their buckets are stored
+// in parallel arrays sorted by high part, such that visiting the buckets in
+// order, then the containers of each bucket, follows the key order.
+class Treemap {
+ public:
+  using index_type = uint64_t;
+  using key_type = uint64_t;
+  using high_type = uint32_t;
+
+  static constexpr size_t kLogContainersPerBucket = 32 - kLogBitsPerContainer;
+  // One past the largest container key.
+  static constexpr key_type kEndKey = key_type{1} << (64 - kLogBitsPerContainer);
+
+  static std::pair<key_type, Container::index_type> key(index_type index) {
+    return {index >> kLogBitsPerContainer,
+            static_cast<Container::index_type>(index & (kBitsPerContainer - 1))};
+  }
+
+  // Split a container key in the high part of its bucket and its key in the
+  // bucket.
+  static std::pair<high_type, Bitmap::key_index_type> split(key_type key) {
+    constexpr key_type kMask = (key_type{1} << kLogContainersPerBucket) - 1;
+    return {static_cast<high_type>(key >> kLogContainersPerBucket),
+            static_cast<Bitmap::key_index_type>(key & kMask)};
+  }
+
+  bool operator[](index_type index) const {
+    auto [k, offset] = key(index);
+    auto handle = Find(k);
+    return handle != nullptr && (*handle)[offset];
+  }
+
+  // Return the number of set bits.
+  uint64_t cardinality() const noexcept;
+
+  // Return the number of containers, respectively of buckets.
+  size_t n_containers() const noexcept;
+  size_t n_buckets() const noexcept { return highs_.size(); }
+
+  // Return the handle of the container at key or nullptr if there is none.
+  const ContainerHandle* Find(key_type key) const;
+
+  // Return the bucket of the high part or nullptr if there is none.
+  const Bitmap* FindBucket(high_type high) const;
+
+  // Insert a container at key, replacing the existing container if any. The
+  // container may be shared with other treemaps.
+  //
+  // \throws Exception if the container is null or the key is not less than
+  // `kEndKey`.
+  void Insert(key_type key, std::shared_ptr<const Container> container);
+
+  // Remove the container at key, and its bucket if it becomes empty.
+  //
+  // \return true if a container was removed.
+  bool Erase(key_type key);
+
+  // The sorted high parts and their buckets, in the same order.
+  const std::vector<high_type>& highs() const noexcept { return highs_; }
+  const std::vector<Bitmap>& buckets() const noexcept { return buckets_; }
+
+  // Invoke `f(key, handle)` for every container whose key is in [begin, end),
+  // in key order. The buckets and containers before `begin` are skipped with
+  // a search, not visited.
+  template <typename F>
+  void ForEach(key_type begin, key_type end, F&& f) const {
+    if (begin >= end) return;
+
+    const auto [first_high, first_key] = split(begin);
+    for (auto b = LowerBound(highs_.data(), highs_.size(), first_high);
+         b < highs_.size(); b++) {
+      const key_type base = key_type{highs_[b]} << kLogContainersPerBucket;
+      if (base >= end) return;
+
+      const auto& keys = buckets_[b].keys();
+      const auto* containers = buckets_[b].containers().data();
+      size_t i = highs_[b] == first_high ? LowerBound(keys.data(), keys.size(), first_key)
+                                         : 0;
+      for (; i < keys.size(); i++) {
+        const key_type k = base | keys[i];
+        if (k >= end) return;
+        f(k, containers[i]);
+      }
+    }
+  }
+
+  template <typename F>
+  void ForEach(F&& f) const {
+    ForEach(0, kEndKey, std::forward<F>(f));
+  }
+
+ private:
+  std::vector<high_type> highs_;
+  std::vector<Bitmap> buckets_;
+};
+
+// Evaluate a query on treemaps, one container key at a time in key order.
+//
+// \param[in] query, the query, see `Query::EvalShared`.
+// \param[in] ctx, evaluation context, its missing policy applies to the
+//                 inputs without a container at the evaluated key and its
+//                 output policy to the containers of the result.
+// \param[in] ins, the input treemaps, in the order of `Query::variables`.
+// \param[in] begin, end, restrict the evaluation to the container keys in
+//                        [begin, end).
+// \return the non-empty containers of the result.
+//
+// \throws Exception if an input is null or the number of inputs doesn't match
+// the number of variables.
+//
+// Only the keys of the containers of the inputs are evaluated, the result of
+// a query such as `!a` is thus restricted to the keys of `a`. The result shares
+// the containers of the inputs where the query reduces to an input, e.g. the
+// containers of `a` without a counterpart in `b` for `a & !b`.
+//
+// A query with shift operators, e.g. `a & (b << 1)`, moves bits across the
+// container boundaries. The keys adjacent to the keys of the inputs are then
+// evaluated as well, each with the adjacent containers of the inputs.
+Treemap EvalTreemaps(query::Query* query, const query::EvaluationContext& ctx,
+                     const std::vector<const Treemap*>& ins,
+                     Treemap::key_type begin = 0,
+                     Treemap::key_type end = Treemap::kEndKey);
+
+}  // namespace jitmap
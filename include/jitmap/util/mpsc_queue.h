@@ -0,0 +1,87 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+#include <jitmap/size.h>
+
+namespace jitmap {
+namespace util {
+
+// Unbounded lock-free multiple-producers single-consumer queue.
+//
+// This is Dmitry Vyukov's intrusive MPSC node-based queue. Producers only
+// perform a single atomic exchange. The consumer may transiently observe an
+// empty queue while a producer is in the middle of a `Push`, callers must
+// account for this, e.g. by tracking the number of pending elements.
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  ~MpscQueue() {
+    while (Pop()) {
+    }
+    if (tail_ != &stub_) delete tail_;
+  }
+
+  // Enqueue an element, safe to call from any thread.
+  void Push(T value) {
+    auto node = new Node(std::move(value));
+    auto prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Dequeue an element, must only be called by the consumer thread.
+  //
+  // \return the element or std::nullopt if the queue is (transiently) empty.
+  std::optional<T> Pop() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) return std::nullopt;
+
+    // The dequeued node becomes the new stub.
+    tail_ = next;
+    std::optional<T> value = std::move(next->value);
+    next->value.reset();
+
+    if (tail != &stub_) delete tail;
+    return value;
+  }
+
+  // Disable copy & assign
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+ private:
+  struct Node {
+    Node() = default;
+    explicit Node(T v) : value(std::move(v)) {}
+
+    std::atomic<Node*> next{nullptr};
+    std::optional<T> value;
+  };
+
+  // Producers and consumer touch different ends, avoid false sharing.
+  alignas(kCacheLineSize) std::atomic<Node*> head_;
+  alignas(kCacheLineSize) Node* tail_;
+  Node stub_;
+};
+
+}  // namespace util
+}  // namespace jitmap
@@ -0,0 +1,247 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/bitset.h"
+
+#include <iterator>
+#include <numeric>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace jitmap {
+
+static size_t CountWordsScalar(const BitsetWordType* words, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) count += __builtin_popcountll(words[i]);
+  return count;
+}
+
+static bool AllWordsScalar(const BitsetWordType* words, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (words[i] != std::numeric_limits<BitsetWordType>::max()) return false;
+  }
+  return true;
+}
+
+static bool AnyWordsScalar(const BitsetWordType* words, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (words[i] != 0) return true;
+  }
+  return false;
+}
+
+static bool EqualWordsScalar(const BitsetWordType* lhs, const BitsetWordType* rhs,
+                             size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (lhs[i] != rhs[i]) return false;
+  }
+  return true;
+}
+
+#if defined(__x86_64__)
+
+constexpr size_t kWordsPerAvx2 = sizeof(__m256i) / sizeof(BitsetWordType);
+constexpr size_t kWordsPerAvx512 = sizeof(__m512i) / sizeof(BitsetWordType);
+// The predicates check a block of 4 vectors per iteration, i.e. a few
+// independent loads between two early-exit branches.
+constexpr size_t kWordsPerBlock = 4 * kWordsPerAvx2;
+
+__attribute__((target("avx512f,avx512vpopcntdq"))) static size_t CountWordsAvx512(
+    const BitsetWordType* words, size_t n) {
+  auto total = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + kWordsPerAvx512 <= n; i += kWordsPerAvx512) {
+    total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+  }
+  if (i < n) {
+    auto tail = _mm512_maskz_loadu_epi64((__mmask8{1} << (n - i)) - 1, words + i);
+    total = _mm512_add_epi64(total, _mm512_popcnt_epi64(tail));
+  }
+  alignas(sizeof(__m512i)) uint64_t lanes[kWordsPerAvx512];
+  _mm512_store_si512(lanes, total);
+  return std::accumulate(std::begin(lanes), std::end(lanes), size_t{0});
+}
+
+// Load the `i`-th vector of `words`.
+__attribute__((target("avx2"))) static inline __m256i LoadAvx2(
+    const BitsetWordType* words, size_t i) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words) + i);
+}
+
+// Population count of each 64-bit lane with a nibble lookup table, see
+// `ComputeDenseStatisticsAvx2`.
+__attribute__((target("avx2"))) static inline __m256i PopCountAvx2(__m256i v) {
+  const auto lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0,
+                                       1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const auto low_nibbles = _mm256_set1_epi8(0x0F);
+  auto lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_nibbles));
+  auto hi = _mm256_shuffle_epi8(
+      lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+// Carry-save adder, `high` receives the carries of `a + b + c` and `low` the
+// sums, bitwise.
+__attribute__((target("avx2"))) static inline void CarrySaveAdd(__m256i* high,
+                                                                __m256i* low, __m256i a,
+                                                                __m256i b, __m256i c) {
+  auto u = _mm256_xor_si256(a, b);
+  *high = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+  *low = _mm256_xor_si256(u, c);
+}
+
+// Harley-Seal population count, see Muła, Kurz & Lemire "Faster Population
+// Counts Using AVX2 Instructions". A tree of carry-save adders reduces 16
+// vectors to a single vector of weight 16 per iteration, only the latter is
+// counted with the lookup table.
+__attribute__((target("avx2"))) static size_t CountWordsAvx2(const BitsetWordType* words,
+                                                               size_t n) {
+  const size_t n_vectors = n / kWordsPerAvx2;
+
+  auto total = _mm256_setzero_si256();
+  auto ones = _mm256_setzero_si256();
+  auto twos = _mm256_setzero_si256();
+  auto fours = _mm256_setzero_si256();
+  auto eights = _mm256_setzero_si256();
+  __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+  size_t i = 0;
+  for (; i + 16 <= n_vectors; i += 16) {
+    CarrySaveAdd(&twos_a, &ones, ones, LoadAvx2(words, i), LoadAvx2(words, i + 1));
+    CarrySaveAdd(&twos_b, &ones, ones, LoadAvx2(words, i + 2), LoadAvx2(words, i + 3));
+    CarrySaveAdd(&fours_a, &twos, twos, twos_a, twos_b);
+    CarrySaveAdd(&twos_a, &ones, ones, LoadAvx2(words, i + 4), LoadAvx2(words, i + 5));
+    CarrySaveAdd(&twos_b, &ones, ones, LoadAvx2(words, i + 6), LoadAvx2(words, i + 7));
+    CarrySaveAdd(&fours_b, &twos, twos, twos_a, twos_b);
+    CarrySaveAdd(&eights_a, &fours, fours, fours_a, fours_b);
+    CarrySaveAdd(&twos_a, &ones, ones, LoadAvx2(words, i + 8), LoadAvx2(words, i + 9));
+    CarrySaveAdd(&twos_b, &ones, ones, LoadAvx2(words, i + 10), LoadAvx2(words, i + 11));
+    CarrySaveAdd(&fours_a, &twos, twos, twos_a, twos_b);
+    CarrySaveAdd(&twos_a, &ones, ones, LoadAvx2(words, i + 12), LoadAvx2(words, i + 13));
+    CarrySaveAdd(&twos_b, &ones, ones, LoadAvx2(words, i + 14), LoadAvx2(words, i + 15));
+    CarrySaveAdd(&fours_b, &twos, twos, twos_a, twos_b);
+    CarrySaveAdd(&eights_b, &fours, fours, fours_a, fours_b);
+    CarrySaveAdd(&sixteens, &eights, eights, eights_a, eights_b);
+    total = _mm256_add_epi64(total, PopCountAvx2(sixteens));
+  }
+
+  total = _mm256_slli_epi64(total, 4);
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(PopCountAvx2(eights), 3));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(PopCountAvx2(fours), 2));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(PopCountAvx2(twos), 1));
+  total = _mm256_add_epi64(total, PopCountAvx2(ones));
+  for (; i < n_vectors; i++) {
+    total = _mm256_add_epi64(total, PopCountAvx2(LoadAvx2(words, i)));
+  }
+
+  size_t count = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                 _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+  const size_t tail = n_vectors * kWordsPerAvx2;
+  return count + CountWordsScalar(words + tail, n - tail);
+}
+
+// The bitwise and, respectively or, of a block of 4 vectors.
+__attribute__((target("avx2"))) static inline __m256i AndBlockAvx2(
+    const BitsetWordType* words) {
+  return _mm256_and_si256(_mm256_and_si256(LoadAvx2(words, 0), LoadAvx2(words, 1)),
+                          _mm256_and_si256(LoadAvx2(words, 2), LoadAvx2(words, 3)));
+}
+
+__attribute__((target("avx2"))) static inline __m256i OrBlockAvx2(
+    const BitsetWordType* words) {
+  return _mm256_or_si256(_mm256_or_si256(LoadAvx2(words, 0), LoadAvx2(words, 1)),
+                         _mm256_or_si256(LoadAvx2(words, 2), LoadAvx2(words, 3)));
+}
+
+__attribute__((target("avx2"))) static inline __m256i XorAvx2(const BitsetWordType* lhs,
+                                                             const BitsetWordType* rhs,
+                                                             size_t i) {
+  return _mm256_xor_si256(LoadAvx2(lhs, i), LoadAvx2(rhs, i));
+}
+
+__attribute__((target("avx2"))) static bool AllWordsAvx2(const BitsetWordType* words,
+                                                           size_t n) {
+  const auto ones = _mm256_set1_epi64x(-1);
+  size_t i = 0;
+  for (; i + kWordsPerBlock <= n; i += kWordsPerBlock) {
+    if (!_mm256_testc_si256(AndBlockAvx2(words + i), ones)) return false;
+  }
+  return AllWordsScalar(words + i, n - i);
+}
+
+__attribute__((target("avx2"))) static bool AnyWordsAvx2(const BitsetWordType* words,
+                                                           size_t n) {
+  size_t i = 0;
+  for (; i + kWordsPerBlock <= n; i += kWordsPerBlock) {
+    auto block = OrBlockAvx2(words + i);
+    if (!_mm256_testz_si256(block, block)) return true;
+  }
+  return AnyWordsScalar(words + i, n - i);
+}
+
+__attribute__((target("avx2"))) static bool EqualWordsAvx2(const BitsetWordType* lhs,
+                                                             const BitsetWordType* rhs,
+                                                             size_t n) {
+  size_t i = 0;
+  for (; i + kWordsPerBlock <= n; i += kWordsPerBlock) {
+    auto block = _mm256_or_si256(
+        _mm256_or_si256(XorAvx2(lhs + i, rhs + i, 0), XorAvx2(lhs + i, rhs + i, 1)),
+        _mm256_or_si256(XorAvx2(lhs + i, rhs + i, 2), XorAvx2(lhs + i, rhs + i, 3)));
+    if (!_mm256_testz_si256(block, block)) return false;
+  }
+  return EqualWordsScalar(lhs + i, rhs + i, n - i);
+}
+
+static const bool kHasAvx2 = __builtin_cpu_supports("avx2");
+static const bool kHasAvx512Popcnt =
+    __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+
+#endif
+
+size_t CountWords(const BitsetWordType* words, size_t n) noexcept {
+#if defined(__x86_64__)
+  if (kHasAvx512Popcnt) return CountWordsAvx512(words, n);
+  if (kHasAvx2) return CountWordsAvx2(words, n);
+#endif
+
+  return CountWordsScalar(words, n);
+}
+
+bool AllWords(const BitsetWordType* words, size_t n) noexcept {
+#if defined(__x86_64__)
+  if (kHasAvx2) return AllWordsAvx2(words, n);
+#endif
+
+  return AllWordsScalar(words, n);
+}
+
+bool AnyWords(const BitsetWordType* words, size_t n) noexcept {
+#if defined(__x86_64__)
+  if (kHasAvx2) return AnyWordsAvx2(words, n);
+#endif
+
+  return AnyWordsScalar(words, n);
+}
+
+bool EqualWords(const BitsetWordType* lhs, const BitsetWordType* rhs, size_t n) noexcept {
+#if defined(__x86_64__)
+  if (kHasAvx2) return EqualWordsAvx2(lhs, rhs, n);
+#endif
+
+  return EqualWordsScalar(lhs, rhs, n);
+}
+
+}  // namespace jitmap
@@ -0,0 +1,358 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/builder.h"
+
+#include <algorithm>
+#include <climits>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "jitmap/container/array.h"
+#include "jitmap/container/run.h"
+
+namespace jitmap {
+
+constexpr size_t kBitsPerWord = DenseBitset::kBitsPerWord;
+
+template <typename T>
+static inline Container::index_type LowBits(T id) {
+  return static_cast<Container::index_type>(id & (kBitsPerContainer - 1));
+}
+
+// The number of consecutive ids which are equal and adjacent, see
+// `CountUniqueAndRuns`.
+struct DeltaCounts {
+  size_t equal = 0;
+  size_t adjacent = 0;
+};
+
+// Count the deltas of the ids [begin, n), with their predecessors.
+template <typename T>
+static inline DeltaCounts CountDeltasScalar(const T* ids, size_t begin, size_t n) {
+  DeltaCounts counts;
+  for (size_t i = begin; i < n; i++) {
+    const T delta = ids[i] - ids[i - 1];
+    counts.equal += delta == 0;
+    counts.adjacent += delta == 1;
+  }
+  return counts;
+}
+
+// Or the bits of the sorted ids [begin, n) in the words of a dense bitmap.
+// Consecutive ids mostly fall in the same word, which is accumulated in a
+// register and stored once.
+template <typename T>
+static inline void ScatterSortedScalar(const T* ids, size_t begin, size_t n,
+                                       BitsetWordType* words) {
+  size_t i = begin;
+  while (i < n) {
+    const size_t w = LowBits(ids[i]) / kBitsPerWord;
+    BitsetWordType word = 0;
+    for (; i < n && LowBits(ids[i]) / kBitsPerWord == w; i++) {
+      word |= BitsetWordType{1} << (LowBits(ids[i]) % kBitsPerWord);
+    }
+    words[w] |= word;
+  }
+}
+
+#if defined(__x86_64__)
+
+template <typename T>
+__attribute__((target("avx2"))) static inline __m256i LoadIdsAvx2(const T* ids) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids));
+}
+
+template <typename T>
+__attribute__((target("avx2"))) static inline __m256i SubIdsAvx2(__m256i a, __m256i b) {
+  if constexpr (sizeof(T) == 2) {
+    return _mm256_sub_epi16(a, b);
+  } else if constexpr (sizeof(T) == 4) {
+    return _mm256_sub_epi32(a, b);
+  } else {
+    return _mm256_sub_epi64(a, b);
+  }
+}
+
+// The number of lanes of `a` and `b` which are equal.
+template <typename T>
+__attribute__((target("avx2,popcnt"))) static inline size_t CountEqualAvx2(__m256i a,
+                                                                          __m256i b) {
+  __m256i equal;
+  if constexpr (sizeof(T) == 2) {
+    equal = _mm256_cmpeq_epi16(a, b);
+  } else if constexpr (sizeof(T) == 4) {
+    equal = _mm256_cmpeq_epi32(a, b);
+  } else {
+    equal = _mm256_cmpeq_epi64(a, b);
+  }
+  // A bit per byte of the equal lanes.
+  return __builtin_popcount(static_cast<uint32_t>(_mm256_movemask_epi8(equal))) /
+         sizeof(T);
+}
+
+// Compare a vector of ids with the vector shifted by one id, i.e. the deltas
+// of 32 bytes of ids per iteration.
+template <typename T>
+__attribute__((target("avx2,popcnt"))) static DeltaCounts CountDeltasAvx2(const T* ids,
+                                                                         size_t n) {
+  constexpr size_t kIdsPerAvx2 = sizeof(__m256i) / sizeof(T);
+  const auto zeros = _mm256_setzero_si256();
+  const auto ones = SubIdsAvx2<T>(zeros, _mm256_cmpeq_epi8(zeros, zeros));
+
+  DeltaCounts counts;
+  size_t i = 1;
+  for (; i + kIdsPerAvx2 <= n; i += kIdsPerAvx2) {
+    auto delta = SubIdsAvx2<T>(LoadIdsAvx2(ids + i), LoadIdsAvx2(ids + i - 1));
+    counts.equal += CountEqualAvx2<T>(delta, zeros);
+    counts.adjacent += CountEqualAvx2<T>(delta, ones);
+  }
+
+  auto tail = CountDeltasScalar(ids, i, n);
+  return {counts.equal + tail.equal, counts.adjacent + tail.adjacent};
+}
+
+// Load 4 ids widened to 64-bit lanes.
+template <typename T>
+__attribute__((target("avx2"))) static inline __m256i LoadWidenedAvx2(const T* ids) {
+  if constexpr (sizeof(T) == 2) {
+    return _mm256_cvtepu16_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ids)));
+  } else if constexpr (sizeof(T) == 4) {
+    return _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ids)));
+  } else {
+    return LoadIdsAvx2(ids);
+  }
+}
+
+// Shift the bits of 4 ids per iteration in parallel. The ids are sorted,
+// the 4 bits fall in the same word when the first and the last do, and are
+// or-reduced in the accumulated word. Else they are scattered one by one.
+template <typename T>
+__attribute__((target("avx2"))) static void ScatterSortedAvx2(const T* ids, size_t n,
+                                                              BitsetWordType* words) {
+  constexpr size_t kIdsPerIteration = sizeof(__m256i) / sizeof(BitsetWordType);
+  const auto ones = _mm256_set1_epi64x(1);
+  const auto bit_mask = _mm256_set1_epi64x(kBitsPerWord - 1);
+
+  size_t i = 0;
+  size_t w = 0;
+  BitsetWordType word = 0;
+  for (; i + kIdsPerIteration <= n; i += kIdsPerIteration) {
+    const size_t first = LowBits(ids[i]) / kBitsPerWord;
+    if (LowBits(ids[i + kIdsPerIteration - 1]) / kBitsPerWord != first) {
+      words[w] |= word;
+      word = 0;
+      ScatterSortedScalar(ids, i, i + kIdsPerIteration, words);
+      continue;
+    }
+
+    auto shifts = _mm256_and_si256(LoadWidenedAvx2(ids + i), bit_mask);
+    auto bits = _mm256_sllv_epi64(ones, shifts);
+    auto half =
+        _mm_or_si128(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1));
+    if (first != w) {
+      words[w] |= word;
+      w = first;
+      word = 0;
+    }
+    word |= _mm_cvtsi128_si64(half) | _mm_extract_epi64(half, 1);
+  }
+  words[w] |= word;
+
+  ScatterSortedScalar(ids, i, n, words);
+}
+
+static const bool kHasAvx2 = __builtin_cpu_supports("avx2") &&
+                             __builtin_cpu_supports("popcnt");
+
+#endif
+
+// Count the unique ids and the runs of sorted ids sharing the same key. A run
+// starts at every id which is neither equal nor adjacent to its predecessor,
+// the representation is chosen before materializing any container.
+template <typename T>
+static std::pair<size_t, size_t> CountUniqueAndRuns(const T* ids, size_t n) {
+  if (n == 0) return {0, 0};
+
+#if defined(__x86_64__)
+  auto counts = kHasAvx2 ? CountDeltasAvx2(ids, n) : CountDeltasScalar(ids, 1, n);
+#else
+  auto counts = CountDeltasScalar(ids, 1, n);
+#endif
+  return {n - counts.equal, n - counts.equal - counts.adjacent};
+}
+
+// Or the sorted ids in the words of a dense bitmap.
+template <typename T>
+static void ScatterSorted(const T* ids, size_t n, BitsetWordType* words) {
+#if defined(__x86_64__)
+  if (kHasAvx2) return ScatterSortedAvx2(ids, n, words);
+#endif
+
+  ScatterSortedScalar(ids, 0, n, words);
+}
+
+template <typename T>
+static std::vector<Container::index_type> CollectUnique(const T* ids, size_t n,
+                                                        size_t cardinality) {
+  std::vector<Container::index_type> values(cardinality);
+  if (cardinality == n) {
+    std::transform(ids, ids + n, values.begin(), LowBits<T>);
+    return values;
+  }
+
+  size_t unique = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (i == 0 || ids[i] != ids[i - 1]) values[unique++] = LowBits(ids[i]);
+  }
+  return values;
+}
+
+template <typename T>
+static std::vector<Run> CollectRuns(const T* ids, size_t n, size_t n_runs) {
+  std::vector<Run> runs;
+  runs.reserve(n_runs);
+
+  uint32_t start = LowBits(ids[0]), end = start;
+  for (size_t i = 1; i < n; i++) {
+    const uint32_t index = LowBits(ids[i]);
+    if (index > end + 1) {
+      runs.push_back({static_cast<uint16_t>(start), static_cast<uint16_t>(end - start)});
+      start = index;
+    }
+    end = index;
+  }
+  runs.push_back({static_cast<uint16_t>(start), static_cast<uint16_t>(end - start)});
+
+  return runs;
+}
+
+// Build a container from sorted ids sharing the same key.
+template <typename T>
+static std::unique_ptr<Container> BuildContainerImpl(const T* ids, size_t n) {
+  if (n == 0) return std::make_unique<ArrayContainer>();
+
+  auto [cardinality, n_runs] = CountUniqueAndRuns(ids, n);
+  switch (SmallestContainerType(cardinality, n_runs)) {
+    case ARRAY:
+      return std::make_unique<ArrayContainer>(CollectUnique(ids, n, cardinality));
+    case RUN_LENGTH:
+      return std::make_unique<RunContainer>(CollectRuns(ids, n, n_runs));
+    default:
+      break;
+  }
+
+  auto dense = std::make_unique<DenseContainer>();
+  ScatterSorted(ids, n, dense->bitmap().word());
+  return dense;
+}
+
+std::unique_ptr<Container> BuildContainer(const Container::index_type* indices,
+                                          size_t n) {
+  JITMAP_PRE(std::is_sorted(indices, indices + n));
+  return BuildContainerImpl(indices, n);
+}
+
+template <typename T>
+static Bitmap BuildBitmapImpl(const T* ids, size_t n) {
+  constexpr uint64_t kMaxId = (uint64_t{1} << 48) - 1;
+  JITMAP_PRE(std::is_sorted(ids, ids + n));
+  JITMAP_PRE(n == 0 || ids[n - 1] <= kMaxId);
+
+  Bitmap bitmap;
+
+  const T* end = ids + n;
+  for (const T* it = ids; it != end;) {
+    const auto key = Bitmap::key(*it).first;
+    // The first id of the next container, saturating on the last key.
+    const uint64_t next = (uint64_t{key} + 1) << kLogBitsPerContainer;
+    const T* last = next > std::numeric_limits<T>::max()
+                        ? end
+                        : std::lower_bound(it, end, static_cast<T>(next));
+
+    bitmap.Insert(key, BuildContainerImpl(it, last - it));
+    it = last;
+  }
+
+  return bitmap;
+}
+
+Bitmap BuildBitmap(const uint32_t* ids, size_t n) { return BuildBitmapImpl(ids, n); }
+Bitmap BuildBitmap(const uint64_t* ids, size_t n) { return BuildBitmapImpl(ids, n); }
+
+// Least significant digit radix sort with 16-bit digits. The digits which are
+// equal for all values are skipped, e.g. the upper digits of small ids.
+template <typename T>
+static void RadixSort(T* values, size_t n) {
+  constexpr size_t kDigitBits = 16;
+  constexpr size_t kBuckets = size_t{1} << kDigitBits;
+  constexpr size_t kDigits = sizeof(T) * CHAR_BIT / kDigitBits;
+
+  // Not worth the histograms.
+  if (n < kBuckets) {
+    std::sort(values, values + n);
+    return;
+  }
+
+  T all_ones = std::numeric_limits<T>::max(), any_one = 0;
+  for (size_t i = 0; i < n; i++) {
+    all_ones &= values[i];
+    any_one |= values[i];
+  }
+  // The bits which differ between at least two values.
+  const T varying = all_ones ^ any_one;
+
+  std::vector<T> scratch(n);
+  std::vector<size_t> offsets(kBuckets);
+  T* src = values;
+  T* dst = scratch.data();
+  for (size_t d = 0; d < kDigits; d++) {
+    const size_t shift = d * kDigitBits;
+    if (((varying >> shift) & (kBuckets - 1)) == 0) continue;
+
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (size_t i = 0; i < n; i++) offsets[(src[i] >> shift) & (kBuckets - 1)]++;
+
+    size_t sum = 0;
+    for (auto& offset : offsets) {
+      auto count = offset;
+      offset = sum;
+      sum += count;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      dst[offsets[(src[i] >> shift) & (kBuckets - 1)]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+
+  if (src != values) std::copy(src, src + n, values);
+}
+
+Bitmap BuildBitmapUnsorted(uint32_t* ids, size_t n) {
+  RadixSort(ids, n);
+  return BuildBitmap(ids, n);
+}
+
+Bitmap BuildBitmapUnsorted(uint64_t* ids, size_t n) {
+  RadixSort(ids, n);
+  return BuildBitmap(ids, n);
+}
+
+}  // namespace jitmap
@@ -0,0 +1,289 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/container/array.h"
+
+#include <algorithm>
+#include <functional>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace jitmap {
+
+ArrayContainer::ArrayContainer(std::vector<index_type> values)
+    : values_(std::move(values)) {
+  JITMAP_PRE(values_.size() <= kMaxCardinality);
+  auto not_increasing = std::adjacent_find(values_.cbegin(), values_.cend(),
+                                           std::greater_equal<index_type>());
+  JITMAP_PRE(not_increasing == values_.cend());
+}
+
+bool ArrayContainer::operator[](index_type index) const noexcept {
+  return std::binary_search(values_.cbegin(), values_.cend(), index);
+}
+
+size_t ArrayContainer::rank(index_type index) const noexcept {
+  return std::lower_bound(values_.cbegin(), values_.cend(), index) - values_.cbegin();
+}
+
+bool ArrayContainer::add(index_type index) {
+  auto it = std::lower_bound(values_.begin(), values_.end(), index);
+  if (it != values_.end() && *it == index) return true;
+  if (values_.size() == kMaxCardinality) return false;
+
+  values_.insert(it, index);
+  InvalidateStatistics();
+  return true;
+}
+
+DenseContainer ArrayContainer::ToDense() const {
+  DenseContainer dense;
+  auto words = dense.bitmap().word();
+  for (auto index : values_) {
+    words[index / DenseBitset::kBitsPerWord] |= BitsetWordType{1}
+                                                << (index % DenseBitset::kBitsPerWord);
+  }
+  return dense;
+}
+
+ArrayContainer ArrayContainer::FromDense(const DenseContainer& dense) {
+  JITMAP_PRE(dense.cardinality() <= kMaxCardinality);
+
+  std::vector<index_type> values;
+  values.reserve(kMaxCardinality);
+
+  auto words = dense.data();
+  for (size_t i = 0; i < dense.bitmap().size_words(); i++) {
+    for (auto w = words[i]; w != 0; w &= w - 1) {
+      values.push_back(i * DenseBitset::kBitsPerWord + __builtin_ctzll(w));
+    }
+  }
+
+  return {std::move(values), Trusted{}};
+}
+
+Statistics ArrayContainer::ComputeStatistics() const noexcept {
+  ProxyBitmap proxy;
+  for (auto index : values_) proxy.set(index / kBitsPerProxyBit);
+  return {proxy, static_cast<int32_t>(values_.size())};
+}
+
+// Switch to galloping when an array is that many times larger than the other.
+constexpr size_t kGallopingRatio = 64;
+
+static size_t IntersectScalar(const uint16_t* a, size_t n_a, const uint16_t* b,
+                              size_t n_b, uint16_t* out) {
+  size_t i = 0, j = 0, count = 0;
+  while (i < n_a && j < n_b) {
+    if (a[i] < b[j]) {
+      i++;
+    } else if (b[j] < a[i]) {
+      j++;
+    } else {
+      out[count++] = a[i];
+      i++;
+      j++;
+    }
+  }
+  return count;
+}
+
+// Return the position of the first element not less than `target` in
+// `data[lo, n)`, probing positions at exponentially growing distances.
+static size_t Gallop(const uint16_t* data, size_t lo, size_t n, uint16_t target) {
+  size_t hi = lo;
+  for (size_t step = 1; hi < n && data[hi] < target; step <<= 1) {
+    lo = hi + 1;
+    hi += step;
+  }
+  return std::lower_bound(data + lo, data + std::min(hi, n), target) - data;
+}
+
+static size_t IntersectGalloping(const uint16_t* small, size_t n_small,
+                                 const uint16_t* large, size_t n_large, uint16_t* out) {
+  size_t j = 0, count = 0;
+  for (size_t i = 0; i < n_small; i++) {
+    j = Gallop(large, j, n_large, small[i]);
+    if (j == n_large) break;
+    if (large[j] == small[i]) out[count++] = small[i];
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+
+// For each 8-bit mask, the `pshufb` control moving the selected 16-bit lanes
+// to the front of the register.
+struct ShuffleTable {
+  constexpr ShuffleTable() : masks() {
+    for (size_t mask = 0; mask < 256; mask++) {
+      size_t k = 0;
+      for (uint8_t lane = 0; lane < 8; lane++) {
+        if (mask & (1U << lane)) {
+          masks[mask][k++] = 2 * lane;
+          masks[mask][k++] = 2 * lane + 1;
+        }
+      }
+      while (k < 16) masks[mask][k++] = 0xFF;
+    }
+  }
+
+  alignas(16) uint8_t masks[256][16];
+};
+
+static constexpr ShuffleTable kShuffleTable;
+
+// Block-wise merge, comparing 8 elements of `a` with 8 elements of `b` in a
+// single `pcmpestrm`, see "Faster Set Intersection with SIMD instructions by
+// Reducing Branch Mispredictions" (Inoue et al.) and Schlegel et al.
+__attribute__((target("sse4.2"))) static size_t IntersectVectorized(
+    const uint16_t* a, size_t n_a, const uint16_t* b, size_t n_b, uint16_t* out) {
+  constexpr int kMode = _SIDD_UWORD_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK;
+  constexpr size_t kLanes = 8;
+
+  const size_t last_a = n_a / kLanes * kLanes;
+  const size_t last_b = n_b / kLanes * kLanes;
+  size_t i = 0, j = 0, count = 0;
+
+  if (last_a != 0 && last_b != 0) {
+    auto v_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+    auto v_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+
+    while (true) {
+      // Bit k is set if a[i + k] equals any of b[j, j + 8).
+      auto matches = _mm_cmpestrm(v_b, kLanes, v_a, kLanes, kMode);
+      auto mask = _mm_extract_epi32(matches, 0);
+      auto shuffle =
+          _mm_load_si128(reinterpret_cast<const __m128i*>(kShuffleTable.masks[mask]));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + count),
+                       _mm_shuffle_epi8(v_a, shuffle));
+      count += __builtin_popcount(mask);
+
+      const uint16_t max_a = a[i + kLanes - 1];
+      const uint16_t max_b = b[j + kLanes - 1];
+      if (max_a <= max_b) {
+        i += kLanes;
+        if (i == last_a) break;
+        v_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+      }
+      if (max_b <= max_a) {
+        j += kLanes;
+        if (j == last_b) break;
+        v_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+      }
+    }
+  }
+
+  return count + IntersectScalar(a + i, n_a - i, b + j, n_b - j, out + count);
+}
+
+static const bool kHasSse42 = __builtin_cpu_supports("sse4.2");
+
+#endif
+
+size_t IntersectArrays(const uint16_t* a, size_t n_a, const uint16_t* b, size_t n_b,
+                       uint16_t* out) {
+  if (n_a == 0 || n_b == 0) return 0;
+
+  if (n_a * kGallopingRatio < n_b) return IntersectGalloping(a, n_a, b, n_b, out);
+  if (n_b * kGallopingRatio < n_a) return IntersectGalloping(b, n_b, a, n_a, out);
+
+#if defined(__x86_64__)
+  if (kHasSse42) return IntersectVectorized(a, n_a, b, n_b, out);
+#endif
+
+  return IntersectScalar(a, n_a, b, n_b, out);
+}
+
+size_t IntersectArrayDense(const uint16_t* a, size_t n_a, const BitsetWordType* dense,
+                           uint16_t* out) {
+  constexpr size_t kBitsPerWord = DenseBitset::kBitsPerWord;
+
+  // Branchless, the element is always written but only kept if its bit is set.
+  size_t count = 0;
+  for (size_t i = 0; i < n_a; i++) {
+    auto index = a[i];
+    out[count] = index;
+    count += (dense[index / kBitsPerWord] >> (index % kBitsPerWord)) & 1;
+  }
+  return count;
+}
+
+size_t UnionArrays(const uint16_t* a, size_t n_a, const uint16_t* b, size_t n_b,
+                   uint16_t* out) {
+  size_t i = 0, j = 0, count = 0;
+  while (i < n_a && j < n_b) {
+    auto value_a = a[i];
+    auto value_b = b[j];
+    out[count++] = std::min(value_a, value_b);
+    i += value_a <= value_b;
+    j += value_b <= value_a;
+  }
+
+  std::copy(a + i, a + n_a, out + count);
+  count += n_a - i;
+  std::copy(b + j, b + n_b, out + count);
+  count += n_b - j;
+
+  return count;
+}
+
+ArrayContainer Intersect(const ArrayContainer& lhs, const ArrayContainer& rhs) {
+  std::vector<Container::index_type> values(
+      std::min(lhs.cardinality(), rhs.cardinality()) + kIntersectPadding);
+  auto count = IntersectArrays(lhs.data(), lhs.cardinality(), rhs.data(),
+                               rhs.cardinality(), values.data());
+  values.resize(count);
+  return {std::move(values), ArrayContainer::Trusted{}};
+}
+
+ArrayContainer Intersect(const ArrayContainer& lhs, const DenseContainer& rhs) {
+  std::vector<Container::index_type> values(lhs.cardinality());
+  auto count =
+      IntersectArrayDense(lhs.data(), lhs.cardinality(), rhs.data(), values.data());
+  values.resize(count);
+  return {std::move(values), ArrayContainer::Trusted{}};
+}
+
+std::unique_ptr<Container> Union(const ArrayContainer& lhs, const ArrayContainer& rhs) {
+  const size_t upper_bound = lhs.cardinality() + rhs.cardinality();
+
+  if (upper_bound <= ArrayContainer::kMaxCardinality) {
+    std::vector<Container::index_type> values(upper_bound);
+    auto count = UnionArrays(lhs.data(), lhs.cardinality(), rhs.data(), rhs.cardinality(),
+                             values.data());
+    values.resize(count);
+    return std::unique_ptr<ArrayContainer>(
+        new ArrayContainer(std::move(values), ArrayContainer::Trusted{}));
+  }
+
+  // The result might not fit in an array, go through the dense representation
+  // and convert back if the overlap was large enough.
+  auto dense = std::make_unique<DenseContainer>(lhs.ToDense());
+  auto words = dense->bitmap().word();
+  for (auto index : rhs.values()) {
+    words[index / DenseBitset::kBitsPerWord] |= BitsetWordType{1}
+                                                << (index % DenseBitset::kBitsPerWord);
+  }
+
+  if (dense->cardinality() <= ArrayContainer::kMaxCardinality) {
+    return std::make_unique<ArrayContainer>(ArrayContainer::FromDense(*dense));
+  }
+
+  return dense;
+}
+
+}  // namespace jitmap
@@ -0,0 +1,153 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/container/container.h"
+
+#include <thread>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace jitmap {
+
+void Container::CacheStatistics(Statistics statistics) const noexcept {
+  uint8_t expected = kUnknownStatistics;
+  if (state_.compare_exchange_strong(expected, kComputingStatistics,
+                                     std::memory_order_acquire)) {
+    statistics_ = std::move(statistics);
+    state_.store(kComputedStatistics, std::memory_order_release);
+    return;
+  }
+
+  // Another reader publishes the same statistics.
+  while (!has_statistics()) std::this_thread::yield();
+}
+
+constexpr size_t kRankBlocksPerProxyBit = kBitsPerProxyBit / kBitsPerRankBlock;
+
+// The rank directory is filled along the count when `kRanks` is set, see
+// `DenseContainer::rank`.
+template <bool kRanks>
+static Statistics ComputeDenseStatisticsScalar(const BitsetWordType* words,
+                                               uint32_t* ranks) {
+  uint64_t proxy = 0;
+  int32_t count = 0;
+  for (size_t b = 0; b < kBitsInProxy; b++) {
+    BitsetWordType any = 0;
+    for (size_t r = 0; r < kRankBlocksPerProxyBit; r++) {
+      if constexpr (kRanks) *ranks++ = count;
+      for (size_t i = 0; i < kWordsPerRankBlock; i++) {
+        any |= words[i];
+        count += __builtin_popcountll(words[i]);
+      }
+      words += kWordsPerRankBlock;
+    }
+    proxy |= uint64_t{any != 0} << b;
+  }
+  if constexpr (kRanks) *ranks = count;
+  return {proxy, count};
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) static inline uint32_t HorizontalSum(__m256i v) {
+  return _mm256_extract_epi64(v, 0) + _mm256_extract_epi64(v, 1) +
+         _mm256_extract_epi64(v, 2) + _mm256_extract_epi64(v, 3);
+}
+
+// Population count with a nibble lookup table (`pshufb`) summed per 64-bit
+// lane with `psadbw`, see Mula et al. "Faster Population Counts Using AVX2
+// Instructions". The block's or-reduction gives its proxy bit.
+template <bool kRanks>
+__attribute__((target("avx2"))) static Statistics ComputeDenseStatisticsAvx2(
+    const BitsetWordType* words, uint32_t* ranks) {
+  constexpr size_t kVectorsPerRankBlock = kBitsPerRankBlock / 256;
+
+  const auto lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0,
+                                       1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const auto low_nibbles = _mm256_set1_epi8(0x0F);
+  const auto zero = _mm256_setzero_si256();
+
+  uint64_t proxy = 0;
+  uint32_t running = 0;
+  auto total = _mm256_setzero_si256();
+  const auto* vectors = reinterpret_cast<const __m256i*>(words);
+  for (size_t b = 0; b < kBitsInProxy; b++) {
+    auto any = _mm256_setzero_si256();
+    for (size_t r = 0; r < kRankBlocksPerProxyBit; r++) {
+      // At most 8 per byte per vector, thus a block can't overflow a byte.
+      auto counts = _mm256_setzero_si256();
+      for (size_t i = 0; i < kVectorsPerRankBlock; i++) {
+        auto v = _mm256_loadu_si256(vectors++);
+        any = _mm256_or_si256(any, v);
+        auto lo = _mm256_and_si256(v, low_nibbles);
+        auto hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles);
+        counts = _mm256_add_epi8(counts, _mm256_shuffle_epi8(lookup, lo));
+        counts = _mm256_add_epi8(counts, _mm256_shuffle_epi8(lookup, hi));
+      }
+      auto sums = _mm256_sad_epu8(counts, zero);
+      total = _mm256_add_epi64(total, sums);
+      if constexpr (kRanks) {
+        *ranks++ = running;
+        running += HorizontalSum(sums);
+      }
+    }
+    proxy |= uint64_t{!_mm256_testz_si256(any, any)} << b;
+  }
+
+  const auto count = HorizontalSum(total);
+  if constexpr (kRanks) *ranks = count;
+  return {proxy, static_cast<int32_t>(count)};
+}
+
+static const bool kHasAvx2 = __builtin_cpu_supports("avx2");
+
+#endif
+
+Statistics ComputeDenseStatistics(const BitsetWordType* words, uint32_t* ranks) noexcept {
+#if defined(__x86_64__)
+  if (kHasAvx2) {
+    return ranks == nullptr ? ComputeDenseStatisticsAvx2<false>(words, ranks)
+                            : ComputeDenseStatisticsAvx2<true>(words, ranks);
+  }
+#endif
+
+  return ranks == nullptr ? ComputeDenseStatisticsScalar<false>(words, ranks)
+                          : ComputeDenseStatisticsScalar<true>(words, ranks);
+}
+
+size_t DenseContainer::rank(index_type index) const {
+  return RankWords(data(), rank_directory(), index);
+}
+
+size_t DenseContainer::select(size_t k) const {
+  const auto* ranks = rank_directory();
+  JITMAP_PRE(k < count());
+  return SelectWords(data(), bitmap_.size_words(), ranks, k);
+}
+
+const uint32_t* DenseContainer::rank_directory() const {
+  auto ranks = ranks_.load(std::memory_order_acquire);
+  if (ranks != nullptr) return ranks->data();
+
+  auto built = std::make_unique<RankDirectory<kBitsPerContainer>>();
+  CacheStatistics(ComputeDenseStatistics(data(), built->data()));
+  if (ranks_.compare_exchange_strong(ranks, built.get(), std::memory_order_acq_rel)) {
+    ranks = built.release();
+  }
+  return ranks->data();
+}
+
+}  // namespace jitmap
@@ -0,0 +1,361 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/container/run.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace jitmap {
+
+constexpr size_t kBitsPerWord = DenseBitset::kBitsPerWord;
+constexpr size_t kWordsPerContainer = kBitsPerContainer / kBitsPerWord;
+constexpr BitsetWordType kAllOnes = std::numeric_limits<BitsetWordType>::max();
+
+RunContainer::RunContainer(std::vector<Run> runs) : runs_(std::move(runs)) {
+  for (size_t i = 1; i < runs_.size(); i++) {
+    // The next run must start after the end of the previous one, with a gap.
+    JITMAP_PRE(runs_[i].start > runs_[i - 1].end() + 1);
+  }
+  if (!runs_.empty()) JITMAP_PRE(runs_.back().end() < kBitsPerContainer);
+}
+
+bool RunContainer::operator[](index_type index) const noexcept {
+  // Find the last run starting at or before index.
+  auto it = std::upper_bound(runs_.cbegin(), runs_.cend(), index,
+                             [](index_type i, const Run& run) { return i < run.start; });
+  if (it == runs_.cbegin()) return false;
+  return index <= std::prev(it)->end();
+}
+
+size_t RunContainer::cardinality() const noexcept {
+  size_t sum = 0;
+  for (const auto& run : runs_) sum += run.length + 1;
+  return sum;
+}
+
+size_t RunContainer::rank(index_type index) const noexcept {
+  size_t rank = 0;
+  for (const auto& run : runs_) {
+    if (index <= run.start) break;
+    rank += std::min<uint32_t>(index, run.end() + 1) - run.start;
+  }
+  return rank;
+}
+
+size_t RunContainer::select(size_t k) const {
+  for (const auto& run : runs_) {
+    if (k <= run.length) return run.start + k;
+    k -= run.length + 1;
+  }
+  throw Exception("Can't select past the cardinality of the container");
+}
+
+DenseContainer RunContainer::ToDense() const {
+  DenseContainer dense;
+  SetRuns(runs_.data(), runs_.size(), dense.bitmap().word());
+  return dense;
+}
+
+ArrayContainer RunContainer::ToArray() const {
+  JITMAP_PRE(cardinality() <= ArrayContainer::kMaxCardinality);
+
+  std::vector<index_type> values;
+  values.reserve(cardinality());
+  for (const auto& run : runs_) {
+    for (uint32_t i = run.start; i <= run.end(); i++) values.push_back(i);
+  }
+
+  return ArrayContainer(std::move(values));
+}
+
+RunContainer RunContainer::FromDense(const DenseContainer& dense) {
+  std::vector<Run> runs;
+  runs.reserve(CountRuns(dense.data()));
+
+  // Process the runs with word-level bit tricks, see Lemire et al.
+  // "Consistently faster and smaller compressed bitmaps with Roaring".
+  auto words = dense.data();
+  size_t i = 0;
+  auto word = words[0];
+  while (true) {
+    while (word == 0 && i + 1 < kWordsPerContainer) word = words[++i];
+    if (word == 0) break;
+
+    const size_t start = i * kBitsPerWord + __builtin_ctzll(word);
+    // Fill the trailing zeros, then find the first zero.
+    auto ones = word | (word - 1);
+    while (ones == kAllOnes && i + 1 < kWordsPerContainer) ones = words[++i];
+    if (ones == kAllOnes) {
+      runs.push_back({static_cast<uint16_t>(start),
+                      static_cast<uint16_t>(kBitsPerContainer - 1 - start)});
+      break;
+    }
+
+    const size_t end = i * kBitsPerWord + __builtin_ctzll(~ones);
+    runs.push_back(
+        {static_cast<uint16_t>(start), static_cast<uint16_t>(end - 1 - start)});
+    // Clear the trailing ones, i.e. the run just emitted.
+    word = ones & (ones + 1);
+  }
+
+  return {std::move(runs), Trusted{}};
+}
+
+RunContainer RunContainer::FromArray(const ArrayContainer& array) {
+  std::vector<Run> runs;
+
+  const auto& values = array.values();
+  for (size_t i = 0; i < values.size();) {
+    size_t j = i + 1;
+    while (j < values.size() && values[j] == values[j - 1] + 1) j++;
+    runs.push_back({values[i], static_cast<uint16_t>(j - 1 - i)});
+    i = j;
+  }
+
+  return {std::move(runs), Trusted{}};
+}
+
+Statistics RunContainer::ComputeStatistics() const noexcept {
+  ProxyBitmap proxy;
+  for (const auto& run : runs_) {
+    const size_t last = run.end() / kBitsPerProxyBit;
+    for (size_t b = run.start / kBitsPerProxyBit; b <= last; b++) proxy.set(b);
+  }
+  return {proxy, static_cast<int32_t>(cardinality())};
+}
+
+size_t IntersectRuns(const Run* a, size_t n_a, const Run* b, size_t n_b, Run* out) {
+  size_t i = 0, j = 0, count = 0;
+  while (i < n_a && j < n_b) {
+    const uint32_t a_end = a[i].end();
+    const uint32_t b_end = b[j].end();
+    const uint32_t start = std::max(a[i].start, b[j].start);
+    const uint32_t end = std::min(a_end, b_end);
+    if (start <= end) {
+      out[count++] = {static_cast<uint16_t>(start), static_cast<uint16_t>(end - start)};
+    }
+
+    // Advance the run ending first, the other might overlap the next one.
+    if (a_end <= b_end) i++;
+    if (b_end <= a_end) j++;
+  }
+  return count;
+}
+
+size_t UnionRuns(const Run* a, size_t n_a, const Run* b, size_t n_b, Run* out) {
+  size_t count = 0;
+  auto append = [&](const Run& run) {
+    if (count != 0) {
+      auto& last = out[count - 1];
+      // Overlapping or adjacent, extend the last run.
+      if (run.start <= last.end() + 1) {
+        if (run.end() > last.end()) last.length = run.end() - last.start;
+        return;
+      }
+    }
+    out[count++] = run;
+  };
+
+  size_t i = 0, j = 0;
+  while (i < n_a && j < n_b) {
+    if (a[i].start <= b[j].start) {
+      append(a[i++]);
+    } else {
+      append(b[j++]);
+    }
+  }
+  while (i < n_a) append(a[i++]);
+  while (j < n_b) append(b[j++]);
+
+  return count;
+}
+
+// Masks of the bits of a word at or after `bit`, and at or before `bit`.
+static inline BitsetWordType MaskFrom(size_t bit) {
+  return kAllOnes << (bit % kBitsPerWord);
+}
+static inline BitsetWordType MaskUpTo(size_t bit) {
+  return kAllOnes >> (kBitsPerWord - 1 - bit % kBitsPerWord);
+}
+
+void SetRuns(const Run* runs, size_t n_runs, BitsetWordType* out) {
+  for (size_t r = 0; r < n_runs; r++) {
+    const size_t start = runs[r].start;
+    const size_t end = runs[r].end();
+    const size_t first = start / kBitsPerWord;
+    const size_t last = end / kBitsPerWord;
+
+    if (first == last) {
+      out[first] |= MaskFrom(start) & MaskUpTo(end);
+      continue;
+    }
+
+    out[first] |= MaskFrom(start);
+    std::memset(out + first + 1, 0xFF, (last - first - 1) * sizeof(BitsetWordType));
+    out[last] |= MaskUpTo(end);
+  }
+}
+
+void IntersectRunDense(const Run* runs, size_t n_runs, const BitsetWordType* dense,
+                       BitsetWordType* out) {
+  std::memset(out, 0, kBytesPerContainer);
+
+  for (size_t r = 0; r < n_runs; r++) {
+    const size_t start = runs[r].start;
+    const size_t end = runs[r].end();
+    const size_t first = start / kBitsPerWord;
+    const size_t last = end / kBitsPerWord;
+
+    // Consecutive runs may share their boundary words, thus the `|=`.
+    if (first == last) {
+      out[first] |= dense[first] & MaskFrom(start) & MaskUpTo(end);
+      continue;
+    }
+
+    out[first] |= dense[first] & MaskFrom(start);
+    std::memcpy(out + first + 1, dense + first + 1,
+                (last - first - 1) * sizeof(BitsetWordType));
+    out[last] |= dense[last] & MaskUpTo(end);
+  }
+}
+
+// A run starts at every set bit whose preceding bit is not set. The preceding
+// bit of a word's first bit is the previous word's last bit.
+template <typename Popcount>
+static inline size_t CountRunsImpl(const BitsetWordType* dense, size_t begin,
+                                   size_t end, Popcount popcount) {
+  size_t count = 0;
+  BitsetWordType carry = begin > 0 ? dense[begin - 1] >> (kBitsPerWord - 1) : 0;
+  for (size_t i = begin; i < end; i++) {
+    const auto word = dense[i];
+    count += popcount(word & ~((word << 1) | carry));
+    carry = word >> (kBitsPerWord - 1);
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+
+// Without `-mpopcnt`, `__builtin_popcountll` is a library call.
+__attribute__((target("popcnt"))) static size_t CountRunsPopcnt(
+    const BitsetWordType* dense, size_t begin, size_t end) {
+  return CountRunsImpl(dense, begin, end,
+                       [](BitsetWordType w) { return __builtin_popcountll(w); });
+}
+
+static const bool kHasPopcnt = __builtin_cpu_supports("popcnt");
+
+#endif
+
+size_t CountRuns(const BitsetWordType* dense) {
+  return CountRuns(dense, 0, kWordsPerContainer);
+}
+
+size_t CountRuns(const BitsetWordType* dense, size_t begin, size_t end) {
+  JITMAP_PRE(begin <= end && end <= kWordsPerContainer);
+#if defined(__x86_64__)
+  if (kHasPopcnt) return CountRunsPopcnt(dense, begin, end);
+#endif
+
+  return CountRunsImpl(dense, begin, end,
+                       [](BitsetWordType w) { return __builtin_popcountll(w); });
+}
+
+RunContainer Intersect(const RunContainer& lhs, const RunContainer& rhs) {
+  std::vector<Run> runs(lhs.n_runs() + rhs.n_runs());
+  auto count =
+      IntersectRuns(lhs.data(), lhs.n_runs(), rhs.data(), rhs.n_runs(), runs.data());
+  runs.resize(count);
+  return {std::move(runs), RunContainer::Trusted{}};
+}
+
+DenseContainer Intersect(const RunContainer& lhs, const DenseContainer& rhs) {
+  DenseContainer result;
+  IntersectRunDense(lhs.data(), lhs.n_runs(), rhs.data(), result.bitmap().word());
+  return result;
+}
+
+ArrayContainer Intersect(const RunContainer& lhs, const ArrayContainer& rhs) {
+  std::vector<Container::index_type> values;
+  values.reserve(rhs.cardinality());
+
+  // Both are sorted, walk the runs while scanning the array.
+  const auto* run = lhs.data();
+  const auto* runs_end = run + lhs.n_runs();
+  for (auto index : rhs.values()) {
+    while (run != runs_end && run->end() < index) run++;
+    if (run == runs_end) break;
+    if (index >= run->start) values.push_back(index);
+  }
+
+  return ArrayContainer(std::move(values));
+}
+
+RunContainer Union(const RunContainer& lhs, const RunContainer& rhs) {
+  std::vector<Run> runs(lhs.n_runs() + rhs.n_runs());
+  auto count = UnionRuns(lhs.data(), lhs.n_runs(), rhs.data(), rhs.n_runs(), runs.data());
+  runs.resize(count);
+  return {std::move(runs), RunContainer::Trusted{}};
+}
+
+ContainerType SmallestContainerType(size_t cardinality, size_t n_runs) {
+  const size_t dense_size = SerializedSizeAsDense();
+  const size_t array_size = cardinality <= ArrayContainer::kMaxCardinality
+                                ? SerializedSizeAsArray(cardinality)
+                                : std::numeric_limits<size_t>::max();
+  const size_t run_size = SerializedSizeAsRun(n_runs);
+
+  if (run_size < std::min(dense_size, array_size)) return RUN_LENGTH;
+  if (array_size < dense_size) return ARRAY;
+  return BITMAP;
+}
+
+std::unique_ptr<Container> Compact(const DenseContainer& dense) {
+  switch (SmallestContainerType(dense.cardinality(), CountRuns(dense.data()))) {
+    case RUN_LENGTH:
+      return std::make_unique<RunContainer>(RunContainer::FromDense(dense));
+    case ARRAY:
+      return std::make_unique<ArrayContainer>(ArrayContainer::FromDense(dense));
+    default:
+      break;
+  }
+
+  auto copy = std::make_unique<DenseContainer>();
+  std::memcpy(copy->bitmap().word(), dense.data(), kBytesPerContainer);
+  return copy;
+}
+
+std::unique_ptr<Container> Compact(const ArrayContainer& array) {
+  auto runs = RunContainer::FromArray(array);
+  if (SmallestContainerType(array.cardinality(), runs.n_runs()) == RUN_LENGTH) {
+    return std::make_unique<RunContainer>(std::move(runs));
+  }
+  return std::make_unique<ArrayContainer>(array);
+}
+
+std::unique_ptr<Container> Compact(const RunContainer& runs) {
+  switch (SmallestContainerType(runs.cardinality(), runs.n_runs())) {
+    case ARRAY:
+      return std::make_unique<ArrayContainer>(runs.ToArray());
+    case BITMAP:
+      return std::make_unique<DenseContainer>(runs.ToDense());
+    default:
+      break;
+  }
+  return std::make_unique<RunContainer>(runs);
+}
+
+}  // namespace jitmap
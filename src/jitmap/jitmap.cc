@@ -12,6 +12,194 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <jitmap/jitmap.h>
+#include "jitmap/jitmap.h"
 
-namespace jitmap {}
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <type_traits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace jitmap {
+
+static uint32_t CardinalityOf(ContainerType type, const Container* container) {
+  return VisitContainer(type, container, [](auto c) -> uint32_t {
+    using C = std::decay_t<std::remove_pointer_t<decltype(c)>>;
+    if constexpr (std::is_same_v<C, EmptyContainer>) {
+      return 0;
+    } else if constexpr (std::is_same_v<C, FullContainer>) {
+      return kBitsPerContainer;
+    } else {
+      return c->cardinality();
+    }
+  });
+}
+
+static std::shared_ptr<const Container> NotNull(
+    std::shared_ptr<const Container> container) {
+  JITMAP_PRE_NE(container, nullptr);
+  return container;
+}
+
+// Deep copy of a container.
+static std::shared_ptr<Container> Copy(ContainerType type, const Container* container) {
+  return VisitContainer(type, container, [](auto c) -> std::shared_ptr<Container> {
+    using C = std::decay_t<std::remove_pointer_t<decltype(c)>>;
+    if constexpr (std::is_same_v<C, DenseContainer>) {
+      // The dense bitset is move only.
+      auto copy = std::make_shared<DenseContainer>();
+      std::memcpy(copy->bitmap().word(), c->data(), kBytesPerContainer);
+      return copy;
+    } else {
+      return std::make_shared<C>(*c);
+    }
+  });
+}
+
+ContainerHandle::ContainerHandle(std::shared_ptr<const Container> container)
+    : container_(NotNull(std::move(container))) {
+  type_ = container_->container_type();
+  cardinality_ = CardinalityOf(type_, container_.get());
+}
+
+Bitmap::Bitmap(const Bitmap& other)
+    : keys_(other.keys_),
+      containers_(other.containers_),
+      cumulative_(std::atomic_load_explicit(&other.cumulative_,
+                                            std::memory_order_acquire)) {}
+
+Bitmap& Bitmap::operator=(const Bitmap& other) {
+  keys_ = other.keys_;
+  containers_ = other.containers_;
+  cumulative_ = std::atomic_load_explicit(&other.cumulative_, std::memory_order_acquire);
+  return *this;
+}
+
+uint64_t Bitmap::cardinality() const noexcept {
+  return std::accumulate(
+      containers_.cbegin(), containers_.cend(), uint64_t{0},
+      [](uint64_t sum, const ContainerHandle& c) { return sum + c.cardinality(); });
+}
+
+uint64_t Bitmap::rank(index_type index) const {
+  const auto& cumulative = cumulative_cardinalities();
+  auto [k, offset] = key(index);
+  auto i = LowerBound(keys_.data(), keys_.size(), k);
+  if (i == keys_.size() || keys_[i] != k) return cumulative[i];
+  return cumulative[i] + containers_[i].rank(offset);
+}
+
+Bitmap::index_type Bitmap::select(uint64_t k) const {
+  const auto& cumulative = cumulative_cardinalities();
+  JITMAP_PRE(k < cumulative.back());
+  // The last container with at most k set bits before it.
+  auto i = std::upper_bound(cumulative.cbegin(), cumulative.cend() - 1, k) -
+           cumulative.cbegin() - 1;
+  auto offset = containers_[i].select(static_cast<uint32_t>(k - cumulative[i]));
+  return (index_type{keys_[i]} << kLogBitsPerContainer) | offset;
+}
+
+const std::vector<uint64_t>& Bitmap::cumulative_cardinalities() const {
+  auto cumulative = std::atomic_load_explicit(&cumulative_, std::memory_order_acquire);
+  if (cumulative != nullptr) return *cumulative;
+
+  auto built = std::make_shared<std::vector<uint64_t>>(containers_.size() + 1);
+  uint64_t sum = 0;
+  for (size_t i = 0; i < containers_.size(); i++) {
+    (*built)[i] = sum;
+    sum += containers_[i].cardinality();
+  }
+  built->back() = sum;
+
+  std::shared_ptr<const std::vector<uint64_t>> desired = std::move(built);
+  if (std::atomic_compare_exchange_strong_explicit(&cumulative_, &cumulative, desired,
+                                                   std::memory_order_acq_rel,
+                                                   std::memory_order_acquire)) {
+    return *desired;
+  }
+  return *cumulative;
+}
+
+const ContainerHandle* Bitmap::Find(key_index_type key) const {
+  auto i = LowerBound(keys_.data(), keys_.size(), key);
+  if (i == keys_.size() || keys_[i] != key) return nullptr;
+  return &containers_[i];
+}
+
+void Bitmap::Insert(key_index_type key, std::shared_ptr<const Container> container) {
+  ContainerHandle handle{std::move(container)};
+  cumulative_.reset();
+
+  // Fast path for the bitmaps built in key order.
+  if (keys_.empty() || keys_.back() < key) {
+    keys_.push_back(key);
+    containers_.push_back(std::move(handle));
+    return;
+  }
+
+  auto i = LowerBound(keys_.data(), keys_.size(), key);
+  if (i < keys_.size() && keys_[i] == key) {
+    containers_[i] = std::move(handle);
+    return;
+  }
+
+  keys_.insert(keys_.begin() + i, key);
+  containers_.insert(containers_.begin() + i, std::move(handle));
+}
+
+ContainerHandle& Bitmap::MutableHandle(key_index_type key) {
+  auto i = LowerBound(keys_.data(), keys_.size(), key);
+  if (i == keys_.size() || keys_[i] != key) {
+    throw Exception("No container at key ", key);
+  }
+
+  cumulative_.reset();
+  auto& handle = containers_[i];
+  if (!handle.unique()) handle = ContainerHandle{Copy(handle.type(), handle.get())};
+  return handle;
+}
+
+bool Bitmap::Erase(key_index_type key) {
+  auto i = LowerBound(keys_.data(), keys_.size(), key);
+  if (i == keys_.size() || keys_[i] != key) return false;
+
+  cumulative_.reset();
+  keys_.erase(keys_.begin() + i);
+  containers_.erase(containers_.begin() + i);
+  return true;
+}
+
+size_t LowerBound(const Bitmap::key_index_type* keys, size_t n,
+                  Bitmap::key_index_type key) {
+  // Narrow down to a window scanned linearly. The invariant is that all keys
+  // before `base` are less than `key` and all keys from `base + n` are not.
+  constexpr size_t kWindow = 16;
+  const auto* base = keys;
+  while (n > kWindow) {
+    const size_t half = n / 2;
+    // Compiled to a conditional move.
+    base = base[half] < key ? base + half : base;
+    n -= half;
+  }
+
+  // Since the keys are sorted, the position is the number of smaller keys.
+  size_t i = 0, smaller = 0;
+#if defined(__x86_64__)
+  // SSE2 only has signed comparisons, flip the sign bit of both sides.
+  const auto bias = _mm_set1_epi32(INT32_MIN);
+  const auto needle = _mm_xor_si128(_mm_set1_epi32(key), bias);
+  for (; i + 4 <= n; i += 4) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + i));
+    auto lt = _mm_cmplt_epi32(_mm_xor_si128(v, bias), needle);
+    smaller += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+  }
+#endif
+  for (; i < n; i++) smaller += base[i] < key;
+
+  return (base - keys) + smaller;
+}
+
+}  // namespace jitmap
@@ -0,0 +1,225 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/pool.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include "jitmap/util/exception.h"
+
+namespace jitmap {
+
+// Set once the thread cache of the thread is destroyed. A block allocated or
+// freed afterwards, e.g. by the destructor of another thread local or of a
+// static, goes through the shared free list. Constant initialized and
+// trivially destructible, it can be read at any time.
+static thread_local bool tls_cache_destroyed = false;
+
+// ThreadCache holds the free blocks of a thread. The counters are only written
+// by the owning thread, they are atomic such that `ContainerPool::stats` can
+// read them concurrently.
+class ThreadCache {
+ public:
+  explicit ThreadCache(ContainerPool* pool) : pool_(pool) { pool_->Register(this); }
+
+  ~ThreadCache() {
+    tls_cache_destroyed = true;
+    pool_->Drain(blocks_, blocks_.size());
+    pool_->Unregister(this);
+  }
+
+  void* Allocate(size_t capacity) {
+    // Reserved up front, `Free` can't grow the list.
+    if (blocks_.capacity() < capacity) blocks_.reserve(capacity);
+    if (blocks_.empty()) pool_->Refill(blocks_, std::max<size_t>(capacity / 2, 1));
+    auto block = blocks_.back();
+    blocks_.pop_back();
+    Increment(allocations_);
+    return block;
+  }
+
+  void Free(void* block, size_t capacity) noexcept {
+    if (blocks_.size() >= capacity) pool_->Drain(blocks_, blocks_.size() - capacity / 2);
+    // A thread which didn't allocate yet has no room for the block.
+    if (blocks_.size() == blocks_.capacity()) return pool_->FreeShared(block);
+    blocks_.push_back(block);
+    Increment(deallocations_);
+  }
+
+  uint64_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+  uint64_t deallocations() const {
+    return deallocations_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Single writer, a plain load and store avoids the locked instruction of
+  // `fetch_add`.
+  static void Increment(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  ContainerPool* pool_;
+  std::vector<void*> blocks_;
+  std::atomic<uint64_t> allocations_{0};
+  std::atomic<uint64_t> deallocations_{0};
+};
+
+// Return the cache of the thread, or nullptr if it was destroyed.
+static ThreadCache* LocalCache() {
+  if (tls_cache_destroyed) return nullptr;
+  thread_local ThreadCache cache(&ContainerPool::Instance());
+  return &cache;
+}
+
+ContainerPool& ContainerPool::Instance() {
+  // Never destroyed, the thread caches drain into it when threads exit,
+  // including after the static destructors ran.
+  static auto pool = new ContainerPool();
+  return *pool;
+}
+
+void ContainerPool::Configure(Options options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  JITMAP_PRE_EQ(slabs_, 0);
+  options_ = options;
+  thread_cache_size_.store(options.thread_cache_size, std::memory_order_relaxed);
+}
+
+void* ContainerPool::Allocate() {
+  auto cache = LocalCache();
+  if (cache == nullptr) return AllocateShared();
+  return cache->Allocate(thread_cache_size_.load(std::memory_order_relaxed));
+}
+
+void ContainerPool::Free(void* block) noexcept {
+  if (block == nullptr) return;
+  auto cache = LocalCache();
+  if (cache == nullptr) return FreeShared(block);
+  cache->Free(block, thread_cache_size_.load(std::memory_order_relaxed));
+}
+
+ContainerPool::Stats ContainerPool::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  Stats stats;
+  stats.allocations = retired_allocations_;
+  stats.deallocations = retired_deallocations_;
+  for (auto cache : caches_) {
+    stats.allocations += cache->allocations();
+    stats.deallocations += cache->deallocations();
+  }
+  stats.slabs = slabs_;
+  stats.huge_slabs = huge_slabs_;
+  return stats;
+}
+
+void ContainerPool::Refill(std::vector<void*>& out, size_t n) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_.empty()) ReserveSlab();
+
+  n = std::min(n, free_.size());
+  out.insert(out.end(), free_.end() - n, free_.end());
+  free_.resize(free_.size() - n);
+}
+
+void ContainerPool::Drain(std::vector<void*>& blocks, size_t n) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.insert(free_.end(), blocks.end() - n, blocks.end());
+  blocks.resize(blocks.size() - n);
+}
+
+void* ContainerPool::AllocateShared() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_.empty()) ReserveSlab();
+
+  auto block = free_.back();
+  free_.pop_back();
+  retired_allocations_++;
+  return block;
+}
+
+void ContainerPool::FreeShared(void* block) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.push_back(block);
+  retired_deallocations_++;
+}
+
+// Map a slab backed by huge pages, or return nullptr.
+static void* MapHugeSlab() {
+#if defined(MAP_HUGETLB)
+  void* huge = mmap(nullptr, ContainerPool::kSlabSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (huge != MAP_FAILED) return huge;
+#endif
+
+#if defined(MADV_HUGEPAGE)
+  // Transparent huge pages require a slab aligned on the huge page size,
+  // over-allocate and trim the excess.
+  constexpr size_t kSize = ContainerPool::kSlabSize;
+  auto raw = mmap(nullptr, 2 * kSize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) return nullptr;
+
+  auto addr = reinterpret_cast<uintptr_t>(raw);
+  auto aligned = (addr + kSize - 1) & ~(kSize - 1);
+  if (aligned != addr) munmap(raw, aligned - addr);
+  munmap(reinterpret_cast<void*>(aligned + kSize), addr + kSize - aligned);
+
+  auto slab = reinterpret_cast<void*>(aligned);
+  if (madvise(slab, kSize, MADV_HUGEPAGE) == 0) return slab;
+  munmap(slab, kSize);
+#endif
+
+  return nullptr;
+}
+
+void ContainerPool::ReserveSlab() {
+  // Room for every block of the slabs, such that `Drain` and `FreeShared`
+  // never grow the list. It is empty here, nothing is copied.
+  free_.reserve((slabs_ + 1) * kBlocksPerSlab);
+
+  void* slab = options_.huge_pages ? MapHugeSlab() : nullptr;
+  if (slab != nullptr) {
+    huge_slabs_++;
+  } else {
+    slab = mmap(nullptr, kSlabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                -1, 0);
+    if (slab == MAP_FAILED) throw std::bad_alloc();
+  }
+  slabs_++;
+
+  // Pushed in reverse such that blocks are handed out in address order.
+  auto base = static_cast<char*>(slab);
+  for (size_t i = kBlocksPerSlab; i-- > 0;) {
+    free_.push_back(base + i * kBytesPerContainer);
+  }
+}
+
+void ContainerPool::Register(ThreadCache* cache) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  caches_.push_back(cache);
+}
+
+void ContainerPool::Unregister(ThreadCache* cache) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  retired_allocations_ += cache->allocations();
+  retired_deallocations_ += cache->deallocations();
+  caches_.erase(std::find(caches_.begin(), caches_.end(), cache));
+}
+
+}  // namespace jitmap
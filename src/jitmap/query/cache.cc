@@ -0,0 +1,200 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/query/cache.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "jitmap/pool.h"
+#include "jitmap/query/expr.h"
+#include "jitmap/query/type_traits.h"
+
+namespace jitmap {
+namespace query {
+
+std::string CanonicalForm(const Expr& expr) {
+  return expr.Visit([&](const auto* e) -> std::string {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+
+    if constexpr (is_variable<E>::value) {
+      return e->value();
+    } else if constexpr (is_literal<E>::value) {
+      return e->ToString();
+    } else if constexpr (is_shift_op<E>::value) {
+      auto symbol = (e->type() == Expr::SHIFT_LEFT_OPERATOR) ? " << " : " >> ";
+      return "(" + CanonicalForm(*e->operand()) + symbol + std::to_string(e->amount()) +
+             ")";
+    } else if constexpr (is_unary_op<E>::value) {
+      return "!" + CanonicalForm(*e->operand());
+    } else if constexpr (is_binary_op<E>::value) {
+      // All binary operators are commutative, order the operands such that
+      // `Or(a, b)` and `Or(b, a)` share the same form.
+      auto left = CanonicalForm(*e->left_operand());
+      auto right = CanonicalForm(*e->right_operand());
+      if (right < left) std::swap(left, right);
+
+      auto symbol = (e->type() == Expr::AND_OPERATOR)  ? " & "
+                    : (e->type() == Expr::OR_OPERATOR) ? " | "
+                                                       : " ^ ";
+      return "(" + left + symbol + right + ")";
+    }
+
+    throw Exception("Unknown expression type: ", e->type());
+  });
+}
+
+size_t ResultCacheKeyHash::operator()(const ResultCacheKey& key) const noexcept {
+  size_t seed = std::hash<std::string>{}(key.expr);
+  for (auto version : key.versions) {
+    // Borrowed from boost::hash_combine.
+    seed ^= std::hash<uint64_t>{}(version) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  }
+  return seed;
+}
+
+// BufferPool recycles cache-line aligned buffers of `kBytesPerContainer`,
+// drawn from the `ContainerPool`. The buffers handed out hold a weak reference
+// to the pool such that they can outlive it.
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+ public:
+  explicit BufferPool(size_t max_free_buffers) : max_free_buffers_(max_free_buffers) {}
+
+  ~BufferPool() {
+    for (auto buffer : free_) FreeContainer(buffer);
+  }
+
+  std::shared_ptr<char> Acquire() {
+    char* buffer = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        buffer = free_.back();
+        free_.pop_back();
+      }
+    }
+
+    if (buffer == nullptr) buffer = static_cast<char*>(AllocateContainer());
+
+    std::weak_ptr<BufferPool> weak_pool = shared_from_this();
+    return std::shared_ptr<char>(buffer, [weak_pool](char* b) {
+      if (auto pool = weak_pool.lock()) {
+        pool->Release(b);
+      } else {
+        FreeContainer(b);
+      }
+    });
+  }
+
+ private:
+  void Release(char* buffer) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_.size() < max_free_buffers_) {
+        free_.push_back(buffer);
+        return;
+      }
+    }
+
+    FreeContainer(buffer);
+  }
+
+  const size_t max_free_buffers_;
+  std::mutex mutex_;
+  std::vector<char*> free_;
+};
+
+ResultCache::ResultCache(size_t memory_budget)
+    : memory_budget_(memory_budget),
+      pool_(std::make_shared<BufferPool>(
+          std::min(memory_budget / kBytesPerContainer, kMaxRecycledBuffers))) {}
+
+ResultCache::~ResultCache() = default;
+
+CachedBuffer ResultCache::Lookup(const ResultCacheKey& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    misses_++;
+    return nullptr;
+  }
+
+  hits_++;
+  // Move to the front, i.e. mark as most recently used.
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+std::shared_ptr<char> ResultCache::Allocate() { return pool_->Acquire(); }
+
+void ResultCache::Insert(ResultCacheKey key, CachedBuffer buffer) {
+  JITMAP_PRE_NE(buffer, nullptr);
+
+  // A result larger than the budget can't be cached.
+  if (memory_budget_ < kBytesPerContainer) return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index_.find(key) != index_.end()) return;
+
+  lru_.emplace_front(std::move(key), std::move(buffer));
+  index_.emplace(lru_.front().first, lru_.begin());
+  memory_usage_ += kBytesPerContainer;
+
+  EvictUnlocked();
+}
+
+void ResultCache::EvictUnlocked() {
+  while (memory_usage_ > memory_budget_ && !lru_.empty()) {
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+    memory_usage_ -= kBytesPerContainer;
+    evictions_++;
+  }
+}
+
+void ResultCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  index_.clear();
+  lru_.clear();
+  memory_usage_ = 0;
+}
+
+size_t ResultCache::memory_usage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_usage_;
+}
+
+size_t ResultCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return lru_.size();
+}
+
+uint64_t ResultCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+uint64_t ResultCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+uint64_t ResultCache::evictions() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return evictions_;
+}
+
+}  // namespace query
+}  // namespace jitmap
@@ -14,9 +14,15 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <map>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
@@ -31,19 +37,44 @@
 #include "jitmap/query/expr.h"
 #include "jitmap/query/query.h"
 #include "jitmap/query/type_traits.h"
+#include "jitmap/tiny.h"
 
 namespace jitmap {
 namespace query {
 
 // Generate the hot section of the loop. Takes an expression and reduce it to a
 // single (scalar or vector) value.
+//
+// The bitwise operators commute with the shifts, a shift is pushed down to the
+// variables as a bit offset: the bit at position `p` of `e << k` is the bit at
+// position `p - k` of `e`. The variables under a shift are then read at their
+// offset by `shifted_bitmap`.
+//
+// The expression is a DAG, see `ExprBuilder`, the value of a node shared by
+// multiple operators is generated once per offset.
 struct ExprCodeGenVisitor {
  public:
   std::unordered_map<std::string, llvm::Value*>& bitmaps;
   llvm::IRBuilder<>& builder;
   llvm::Type* vector_type;
+  // Return the value of a variable whose bit at position `p` is the bit at
+  // position `p + offset` of the variable. Null if the kernel doesn't support
+  // the shift operators.
+  std::function<llvm::Value*(const std::string& name, int64_t offset)> shifted_bitmap =
+      nullptr;
+  // The offset of the visited sub-expression.
+  int64_t offset = 0;
+  // The values of the visited nodes, at their offset.
+  std::map<std::pair<const Expr*, int64_t>, llvm::Value*> values;
 
-  llvm::Value* operator()(const VariableExpr* e) { return FindBitmapByName(e->value()); }
+  llvm::Value* operator()(const VariableExpr* e) {
+    auto bitmap = FindBitmapByName(e->value());
+    if (offset == 0) return bitmap;
+    if (shifted_bitmap == nullptr) {
+      throw CompilerException("Shift operators are not supported by this kernel");
+    }
+    return shifted_bitmap(e->value(), offset);
+  }
 
   llvm::Value* operator()(const EmptyBitmapExpr*) {
     return llvm::ConstantInt::get(vector_type, 0UL);
@@ -54,8 +85,15 @@ struct ExprCodeGenVisitor {
   }
 
   llvm::Value* operator()(const NotOpExpr* e) {
-    auto operand = e->operand()->Visit(*this);
-    return builder.CreateNot(operand);
+    return builder.CreateNot(VisitOperand(e->operand()));
+  }
+
+  llvm::Value* operator()(const ShiftLeftOpExpr* e) {
+    return VisitAtOffset(e->operand(), -static_cast<int64_t>(e->amount()));
+  }
+
+  llvm::Value* operator()(const ShiftRightOpExpr* e) {
+    return VisitAtOffset(e->operand(), e->amount());
   }
 
   llvm::Value* operator()(const AndOpExpr* e) {
@@ -81,8 +119,24 @@ struct ExprCodeGenVisitor {
     return result->second;
   }
 
+  llvm::Value* VisitOperand(const Expr* e) {
+    auto key = std::make_pair(e, offset);
+    if (auto it = values.find(key); it != values.end()) return it->second;
+    auto value = e->Visit(*this);
+    values.emplace(key, value);
+    return value;
+  }
+
   std::pair<llvm::Value*, llvm::Value*> VisitBinary(const BinaryOpExpr* e) {
-    return {e->left_operand()->Visit(*this), e->right_operand()->Visit(*this)};
+    auto lhs = VisitOperand(e->left_operand());
+    return {lhs, VisitOperand(e->right_operand())};
+  }
+
+  llvm::Value* VisitAtOffset(const Expr* e, int64_t delta) {
+    offset += delta;
+    auto result = VisitOperand(e);
+    offset -= delta;
+    return result;
   }
 };
 
@@ -100,6 +154,70 @@ class ExpressionCodeGen {
     return *this;
   }
 
+  // Generate an incremental variant of the expression which only recomputes
+  // the cachelines flagged in a dirty mask and returns the popcount delta of
+  // the output, see `DenseEvalIncrementalFn`.
+  ExpressionCodeGen& CompileIncremental(const std::string& name, const Expr& expression) {
+    auto fn = FunctionDeclForIncrementalQuery(name, expression);
+    IncrementalFunctionCodeGen(expression, fn);
+    return *this;
+  }
+
+  // Generate a variant of the expression which also counts the runs of the
+  // output in the same pass, see `DenseEvalRunsFn`.
+  ExpressionCodeGen& CompileRuns(const std::string& name, const Expr& expression) {
+    auto fn = FunctionDeclForRunsQuery(name);
+    RunsFunctionCodeGen(expression, fn);
+    return *this;
+  }
+
+  // Generate a batch variant evaluating the expression on many containers in
+  // a single call, see `DenseEvalBatchFn`. The batch function calls private
+  // copies of the dense kernels which are expected to be inlined by the
+  // optimizer.
+  ExpressionCodeGen& CompileBatch(const std::string& name, const Expr& expression) {
+    auto fn = FunctionDeclForQuery(name + ".dense", expression, false);
+    fn->setLinkage(llvm::Function::InternalLinkage);
+    FunctionCodeGen(expression, false, fn);
+
+    auto popcount_fn = FunctionDeclForQuery(name + ".popcount", expression, true);
+    popcount_fn->setLinkage(llvm::Function::InternalLinkage);
+    FunctionCodeGen(expression, true, popcount_fn);
+
+    BatchFunctionCodeGen(expression, FunctionDeclForBatchQuery(name), fn, popcount_fn);
+    return *this;
+  }
+
+  // Generate a variant of the expression specialized for the representation
+  // of each input, see `SpecializedEvalFn`. Array and run inputs are decoded
+  // one cacheline at a time into a vector register which is then combined with
+  // the dense inputs, no intermediate dense buffer is materialized.
+  ExpressionCodeGen& CompileSpecialized(const std::string& name, const Expr& expression,
+                                        const std::vector<ContainerType>& types) {
+    auto variables = expression.Variables();
+    if (types.size() != variables.size()) {
+      throw CompilerException("Expected ", variables.size(), " container types but got ",
+                              types.size());
+    }
+
+    auto fn = FunctionDeclForSpecializedQuery(name);
+    SpecializedFunctionCodeGen(expression, types, fn);
+    return *this;
+  }
+
+  // Generate a variant of the expression for bitmaps of `n_bits` bits, see
+  // `TinyEvalFn`. Each input is held in a single register, there is no loop.
+  ExpressionCodeGen& CompileTiny(const std::string& name, const Expr& expression,
+                                 size_t n_bits) {
+    if (!IsTinySize(n_bits)) {
+      throw CompilerException("Unsupported tiny bitmap size ", n_bits);
+    }
+
+    auto fn = FunctionDeclForTinyQuery(name);
+    TinyFunctionCodeGen(expression, n_bits / kBitsInTiny, fn);
+    return *this;
+  }
+
   using ContextAndModule =
       std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>>;
 
@@ -112,7 +230,7 @@ class ExpressionCodeGen {
 
     auto variables = expression.Variables();
     // Load bitmaps addresses
-    auto [inputs, output] = UnrollInputsOutput(variables.size(), fn);
+    auto [inputs, output] = UnrollInputsOutput(DenseInputsCount(expression), fn);
 
     // Constants
     auto i64 = llvm::Type::getInt64Ty(*ctx_);
@@ -172,6 +290,707 @@ class ExpressionCodeGen {
     }
   }
 
+  void RunsFunctionCodeGen(const Expr& expression, llvm::Function* fn) {
+    auto entry_block = llvm::BasicBlock::Create(*ctx_, "entry", fn);
+    builder_.SetInsertPoint(entry_block);
+
+    auto variables = expression.Variables();
+    auto [inputs, output] = UnrollInputsOutput(DenseInputsCount(expression), fn);
+    auto n_runs_ptr = std::next(fn->args().begin(), 2);
+
+    // Constants
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    auto zero = llvm::ConstantInt::get(i64, 0);
+    auto step = llvm::ConstantInt::get(i64, 1);
+    auto n_words = llvm::ConstantInt::get(i64, words());
+    auto splat = [&](uint64_t v) {
+      return llvm::ConstantVector::getSplat(vector_width(),
+                                            llvm::ConstantInt::get(ElementType(), v));
+    };
+    auto zero_vec = splat(0);
+    auto one_vec = splat(1);
+    auto msb_vec = splat(scalar_width() - 1);
+
+    // Shuffle selecting the last lane of the previous vector followed by all
+    // but the last lane of the current vector.
+    std::vector<uint32_t> indices;
+    for (uint32_t lane = 0; lane < vector_width(); lane++) {
+      indices.push_back(vector_width() - 1 + lane);
+    }
+    auto preceding_lanes = llvm::ConstantDataVector::get(*ctx_, indices);
+
+    auto loop_block = llvm::BasicBlock::Create(*ctx_, "loop", fn);
+    auto after_block = llvm::BasicBlock::Create(*ctx_, "after_loop", fn);
+    builder_.CreateBr(loop_block);
+    builder_.SetInsertPoint(loop_block);
+
+    // The following block is equivalent to
+    // for (int i = 0; i < n_words ; i += step) {
+    //   result = LoopBodyCodeGen(fn, i)
+    //   acc += popcount(result)
+    //   runs_acc += popcount(result & ~((result << 1) | carry(previous, result)))
+    //   previous = result
+    // }
+    //
+    // A run starts at each set bit whose preceding bit is unset. The bit
+    // preceding the first bit of a lane is the last bit of the previous lane,
+    // which is carried across iterations for the first lane.
+    auto i = builder_.CreatePHI(i64, 2, "i");
+    i->addIncoming(zero, entry_block);
+    auto acc = builder_.CreatePHI(VectorType(), 2, "acc");
+    acc->addIncoming(zero_vec, entry_block);
+    auto runs_acc = builder_.CreatePHI(VectorType(), 2, "runs_acc");
+    runs_acc->addIncoming(zero_vec, entry_block);
+    auto previous = builder_.CreatePHI(VectorType(), 2, "previous");
+    previous->addIncoming(zero_vec, entry_block);
+
+    auto result = LoopBodyCodeGen(expression, variables, inputs, output, i);
+    auto next_acc = builder_.CreateAdd(acc, PopCount(result), "next_acc");
+
+    auto shuffled = builder_.CreateShuffleVector(previous, result, preceding_lanes);
+    auto carry = builder_.CreateLShr(shuffled, msb_vec, "carry");
+    auto preceding = builder_.CreateOr(builder_.CreateShl(result, one_vec), carry);
+    auto starts = builder_.CreateAnd(result, builder_.CreateNot(preceding), "starts");
+    auto next_runs_acc = builder_.CreateAdd(runs_acc, PopCount(starts), "next_runs_acc");
+
+    acc->addIncoming(next_acc, loop_block);
+    runs_acc->addIncoming(next_runs_acc, loop_block);
+    previous->addIncoming(result, loop_block);
+
+    auto next_i = builder_.CreateAdd(i, step, "next_i");
+    auto exit_cond = builder_.CreateICmpEQ(next_i, n_words, "exit_cond");
+    builder_.CreateCondBr(exit_cond, after_block, loop_block);
+    i->addIncoming(next_i, loop_block);
+
+    builder_.SetInsertPoint(after_block);
+    builder_.CreateStore(ReduceAdd(next_runs_acc), n_runs_ptr);
+    builder_.CreateRet(ReduceAdd(next_acc));
+  }
+
+  void IncrementalFunctionCodeGen(const Expr& expression, llvm::Function* fn) {
+    auto entry_block = llvm::BasicBlock::Create(*ctx_, "entry", fn);
+    builder_.SetInsertPoint(entry_block);
+
+    auto variables = expression.Variables();
+    auto [inputs, output] = UnrollInputsOutput(DenseInputsCount(expression), fn);
+    auto dirty_ptr = std::next(fn->args().begin(), 2);
+
+    // Constants
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    auto zero = llvm::ConstantInt::get(i64, 0);
+    auto one = llvm::ConstantInt::get(i64, 1);
+    auto bits_per_mask = llvm::ConstantInt::get(i64, 64);
+    auto n_masks = llvm::ConstantInt::get(i64, words() / 64);
+    auto zero_elem = llvm::ConstantInt::get(ElementType(), 0);
+    auto zero_vec = llvm::ConstantVector::getSplat(vector_width(), zero_elem);
+
+    auto outer_block = llvm::BasicBlock::Create(*ctx_, "outer", fn);
+    auto inner_block = llvm::BasicBlock::Create(*ctx_, "inner", fn);
+    auto latch_block = llvm::BasicBlock::Create(*ctx_, "latch", fn);
+    auto after_block = llvm::BasicBlock::Create(*ctx_, "after_loop", fn);
+
+    builder_.CreateBr(outer_block);
+
+    // The following blocks are equivalent to
+    // for (int w = 0; w < n_masks; w++) {
+    //   for (uint64_t m = dirty[w]; m != 0; m &= m - 1) {
+    //     LineCodeGen(w * 64 + cttz(m))
+    //   }
+    // }
+    //
+    // Each iteration of the inner loop processes a single cacheline, i.e. one
+    // vector of the output.
+    builder_.SetInsertPoint(outer_block);
+    auto w = builder_.CreatePHI(i64, 2, "w");
+    w->addIncoming(zero, entry_block);
+    auto outer_acc = builder_.CreatePHI(VectorType(), 2, "outer_acc");
+    outer_acc->addIncoming(zero_vec, entry_block);
+
+    auto mask_gep = builder_.CreateInBoundsGEP(dirty_ptr, w, "mask_gep");
+    auto mask = builder_.CreateLoad(mask_gep, "mask");
+    auto mask_is_empty = builder_.CreateICmpEQ(mask, zero, "mask_is_empty");
+    builder_.CreateCondBr(mask_is_empty, latch_block, inner_block);
+
+    builder_.SetInsertPoint(inner_block);
+    llvm::Value* next_acc = nullptr;
+    {
+      auto m = builder_.CreatePHI(i64, 2, "m");
+      m->addIncoming(mask, outer_block);
+      auto acc = builder_.CreatePHI(VectorType(), 2, "acc");
+      acc->addIncoming(outer_acc, outer_block);
+
+      auto bit = builder_.CreateBinaryIntrinsic(llvm::Intrinsic::cttz, m,
+                                                builder_.getTrue(), nullptr, "bit");
+      auto line = builder_.CreateAdd(builder_.CreateMul(w, bits_per_mask), bit, "line");
+
+      // The previous value of the output is needed to compute the delta.
+      auto out_gep = builder_.CreateInBoundsGEP(output, {line}, "gep_previous");
+      auto previous = builder_.CreateLoad(out_gep, "previous");
+      auto result = LoopBodyCodeGen(expression, variables, inputs, output, line);
+
+      auto delta = builder_.CreateSub(PopCount(result), PopCount(previous), "delta");
+      next_acc = builder_.CreateAdd(acc, delta, "next_acc");
+      acc->addIncoming(next_acc, inner_block);
+
+      // m &= m - 1, i.e. clear the lowest set bit.
+      auto next_m = builder_.CreateAnd(m, builder_.CreateSub(m, one), "next_m");
+      m->addIncoming(next_m, inner_block);
+      auto inner_done = builder_.CreateICmpEQ(next_m, zero, "inner_done");
+      builder_.CreateCondBr(inner_done, latch_block, inner_block);
+    }
+
+    builder_.SetInsertPoint(latch_block);
+    auto latch_acc = builder_.CreatePHI(VectorType(), 2, "latch_acc");
+    latch_acc->addIncoming(outer_acc, outer_block);
+    latch_acc->addIncoming(next_acc, inner_block);
+    outer_acc->addIncoming(latch_acc, latch_block);
+
+    auto next_w = builder_.CreateAdd(w, one, "next_w");
+    w->addIncoming(next_w, latch_block);
+    auto exit_cond = builder_.CreateICmpEQ(next_w, n_masks, "exit_cond");
+    builder_.CreateCondBr(exit_cond, after_block, outer_block);
+
+    builder_.SetInsertPoint(after_block);
+    builder_.CreateRet(ReduceAdd(latch_acc));
+  }
+
+  void TinyFunctionCodeGen(const Expr& expression, size_t n_words, llvm::Function* fn) {
+    auto entry_block = llvm::BasicBlock::Create(*ctx_, "entry", fn);
+    builder_.SetInsertPoint(entry_block);
+
+    auto args_it = fn->args().begin();
+    auto inputs_ptr = args_it++;
+    auto output_ptr = args_it++;
+
+    // A word, or a vector of words which fits a register with AVX-512. The
+    // words are only aligned on their size.
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    llvm::Type* type = i64;
+    if (n_words > 1) type = llvm::VectorType::get(i64, n_words);
+    auto ptr_type = type->getPointerTo();
+    constexpr unsigned kAlignment = sizeof(uint64_t);
+
+    auto variables = expression.Variables();
+    std::unordered_map<std::string, llvm::Value*> keyed_bitmaps;
+    for (size_t i = 0; i < variables.size(); i++) {
+      auto suffix = "_" + std::to_string(i);
+      auto offset = llvm::ConstantInt::get(i64, i * n_words);
+      auto gep = builder_.CreateInBoundsGEP(inputs_ptr, offset, "gep" + suffix);
+      auto addr = builder_.CreatePointerCast(gep, ptr_type, "bitmap" + suffix);
+      auto load = builder_.CreateAlignedLoad(addr, kAlignment, "load" + suffix);
+      keyed_bitmaps.emplace(variables[i], load);
+    }
+
+    ExprCodeGenVisitor visitor{keyed_bitmaps, builder_, type};
+    visitor.shifted_bitmap = [&](const std::string& name, int64_t offset) {
+      return TinyShiftCodeGen(keyed_bitmaps.at(name), n_words, offset);
+    };
+    auto result = expression.Visit(visitor);
+    auto output = builder_.CreatePointerCast(output_ptr, ptr_type, "output_vec");
+    builder_.CreateAlignedStore(result, output, kAlignment);
+
+    auto popcount = PopCount(result);
+    if (n_words > 1) popcount = ReduceAdd(popcount);
+    builder_.CreateRet(builder_.CreateTrunc(popcount, ElementType(), "popcount"));
+  }
+
+  void BatchFunctionCodeGen(const Expr& expression, llvm::Function* batch_fn,
+                            llvm::Function* fn, llvm::Function* popcount_fn) {
+    auto args_it = batch_fn->args().begin();
+    auto inputs_ptr = args_it++;
+    auto outputs_ptr = args_it++;
+    auto popcounts_ptr = args_it++;
+    auto n_containers = args_it++;
+
+    auto entry_block = llvm::BasicBlock::Create(*ctx_, "entry", batch_fn);
+    auto loop_block = llvm::BasicBlock::Create(*ctx_, "loop", batch_fn);
+    auto plain_block = llvm::BasicBlock::Create(*ctx_, "plain", batch_fn);
+    auto popcount_block = llvm::BasicBlock::Create(*ctx_, "popcount", batch_fn);
+    auto latch_block = llvm::BasicBlock::Create(*ctx_, "latch", batch_fn);
+    auto after_block = llvm::BasicBlock::Create(*ctx_, "after_loop", batch_fn);
+
+    // Constants
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    auto zero = llvm::ConstantInt::get(i64, 0);
+    auto step = llvm::ConstantInt::get(i64, 1);
+    auto n_inputs = llvm::ConstantInt::get(i64, DenseInputsCount(expression));
+
+    builder_.SetInsertPoint(entry_block);
+    auto with_popcount = builder_.CreateIsNotNull(popcounts_ptr, "with_popcount");
+    auto is_empty = builder_.CreateICmpEQ(n_containers, zero, "is_empty");
+    builder_.CreateCondBr(is_empty, after_block, loop_block);
+
+    // The following blocks are equivalent to
+    // for (int b = 0; b < n_containers; b++) {
+    //   const char** container_inputs = inputs + b * n_inputs;
+    //   if (popcounts)
+    //     popcounts[b] = popcount_fn(container_inputs, outputs[b]);
+    //   else
+    //     fn(container_inputs, outputs[b]);
+    // }
+    builder_.SetInsertPoint(loop_block);
+    auto b = builder_.CreatePHI(i64, 2, "b");
+    b->addIncoming(zero, entry_block);
+
+    auto offset = builder_.CreateMul(b, n_inputs, "offset");
+    auto inputs = builder_.CreateInBoundsGEP(inputs_ptr, offset, "container_inputs");
+    auto output_gep = builder_.CreateInBoundsGEP(outputs_ptr, b, "output_gep");
+    auto output = builder_.CreateLoad(output_gep, "container_output");
+    builder_.CreateCondBr(with_popcount, popcount_block, plain_block);
+
+    builder_.SetInsertPoint(plain_block);
+    builder_.CreateCall(fn, {inputs, output});
+    builder_.CreateBr(latch_block);
+
+    builder_.SetInsertPoint(popcount_block);
+    auto popcount =
+        builder_.CreateCall(popcount_fn, {inputs, output}, "container_popcnt");
+    auto popcount_gep = builder_.CreateInBoundsGEP(popcounts_ptr, b, "popcount_gep");
+    builder_.CreateStore(popcount, popcount_gep);
+    builder_.CreateBr(latch_block);
+
+    builder_.SetInsertPoint(latch_block);
+    auto next_b = builder_.CreateAdd(b, step, "next_b");
+    b->addIncoming(next_b, latch_block);
+    auto exit_cond = builder_.CreateICmpEQ(next_b, n_containers, "exit_cond");
+    builder_.CreateCondBr(exit_cond, after_block, loop_block);
+
+    builder_.SetInsertPoint(after_block);
+    builder_.CreateRetVoid();
+  }
+
+  // The state of a sparse (array or run) input of a specialized function.
+  struct SparseInput {
+    // Pointer to the uint16_t elements, two per run for run inputs.
+    llvm::Value* data;
+    // Number of elements (array) or runs (run).
+    llvm::Value* size;
+    // Index of the first element (or run) not yet consumed, carried across
+    // the cachelines of the loop.
+    llvm::PHINode* cursor;
+  };
+
+  void SpecializedFunctionCodeGen(const Expr& expression,
+                                  const std::vector<ContainerType>& types,
+                                  llvm::Function* fn) {
+    auto args_it = fn->args().begin();
+    auto inputs_ptr = args_it++;
+    auto sizes_ptr = args_it++;
+    auto output_ptr = args_it++;
+
+    auto entry_block = llvm::BasicBlock::Create(*ctx_, "entry", fn);
+    builder_.SetInsertPoint(entry_block);
+
+    auto variables = expression.Variables();
+
+    // Constants
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    auto i16_ptr = llvm::Type::getInt16Ty(*ctx_)->getPointerTo();
+    auto zero = llvm::ConstantInt::get(i64, 0);
+    auto one = llvm::ConstantInt::get(i64, 1);
+    auto n_words = llvm::ConstantInt::get(i64, words());
+    auto bits_per_line = llvm::ConstantInt::get(i64, scalar_width() * vector_width());
+    auto zero_elem = llvm::ConstantInt::get(ElementType(), 0);
+    auto zero_vec = llvm::ConstantVector::getSplat(vector_width(), zero_elem);
+
+    // Load the inputs addresses and the sizes of the sparse inputs.
+    std::vector<llvm::Value*> dense_inputs(types.size(), nullptr);
+    std::vector<SparseInput> sparse_inputs(types.size(), {nullptr, nullptr, nullptr});
+    for (size_t i = 0; i < types.size(); i++) {
+      auto namify = [&i](std::string key) { return key + "_" + std::to_string(i); };
+      auto index = llvm::ConstantInt::get(i64, i);
+      auto gep = builder_.CreateInBoundsGEP(inputs_ptr, index, namify("input_gep"));
+      auto addr = builder_.CreateLoad(gep, namify("input"));
+
+      switch (types[i]) {
+        case BITMAP:
+          dense_inputs[i] =
+              builder_.CreatePointerCast(addr, VectorPtrType(), namify("bitmap_vec"));
+          break;
+        case ARRAY:
+        case RUN_LENGTH: {
+          auto& sparse = sparse_inputs[i];
+          sparse.data = builder_.CreatePointerCast(addr, i16_ptr, namify("sparse"));
+          auto size_gep =
+              builder_.CreateInBoundsGEP(sizes_ptr, index, namify("size_gep"));
+          sparse.size = builder_.CreateZExt(builder_.CreateLoad(size_gep), i64,
+                                            namify("size"));
+          break;
+        }
+        default:
+          throw CompilerException("Container type ", static_cast<int>(types[i]),
+                                  " of variable '", variables[i], "' is not supported");
+      }
+    }
+
+    auto output = builder_.CreatePointerCast(output_ptr, VectorPtrType(), "output_vec");
+
+    auto loop_block = llvm::BasicBlock::Create(*ctx_, "loop", fn);
+    auto after_block = llvm::BasicBlock::Create(*ctx_, "after_loop", fn);
+    builder_.CreateBr(loop_block);
+    builder_.SetInsertPoint(loop_block);
+
+    // The following blocks are equivalent to
+    // for (int i = 0; i < n_words; i++) {
+    //   for each input:
+    //     dense: load the i-th vector
+    //     array: scatter the elements falling in the i-th cacheline
+    //     run: or the masks of the runs overlapping the i-th cacheline
+    //   LoopBodyCodeGen(fn, i)
+    // }
+    auto i = builder_.CreatePHI(i64, 2, "i");
+    i->addIncoming(zero, entry_block);
+    auto acc = builder_.CreatePHI(VectorType(), 2, "acc");
+    acc->addIncoming(zero_vec, entry_block);
+    for (size_t j = 0; j < types.size(); j++) {
+      if (dense_inputs[j] != nullptr) continue;
+      auto cursor = builder_.CreatePHI(i64, 2, "cursor_" + std::to_string(j));
+      cursor->addIncoming(zero, entry_block);
+      sparse_inputs[j].cursor = cursor;
+    }
+
+    auto line_start = builder_.CreateMul(i, bits_per_line, "line_start");
+    std::unordered_map<std::string, llvm::Value*> keyed_bitmaps;
+    std::vector<std::pair<llvm::PHINode*, llvm::Value*>> next_cursors;
+    for (size_t j = 0; j < types.size(); j++) {
+      llvm::Value* vec = nullptr;
+      llvm::Value* next_cursor = nullptr;
+      switch (types[j]) {
+        case BITMAP: {
+          auto gep = builder_.CreateInBoundsGEP(dense_inputs[j], {i});
+          vec = builder_.CreateLoad(gep, "load_" + std::to_string(j));
+          break;
+        }
+        case ARRAY:
+          std::tie(vec, next_cursor) = ArrayLineCodeGen(sparse_inputs[j], line_start, fn);
+          break;
+        default:
+          std::tie(vec, next_cursor) = RunLineCodeGen(sparse_inputs[j], line_start, fn);
+          break;
+      }
+
+      keyed_bitmaps.emplace(variables[j], vec);
+      if (next_cursor != nullptr) {
+        next_cursors.emplace_back(sparse_inputs[j].cursor, next_cursor);
+      }
+    }
+
+    ExprCodeGenVisitor visitor{keyed_bitmaps, builder_, VectorType()};
+    auto result = expression.Visit(visitor);
+    auto out_gep = builder_.CreateInBoundsGEP(output, {i}, "gep_output");
+    builder_.CreateStore(result, out_gep);
+
+    auto next_acc = builder_.CreateAdd(acc, PopCount(result), "next_acc");
+
+    // The decoding loops introduced new blocks, the back edge originates from
+    // the current block.
+    auto latch_block = builder_.GetInsertBlock();
+    acc->addIncoming(next_acc, latch_block);
+    for (auto [cursor, next_cursor] : next_cursors) {
+      cursor->addIncoming(next_cursor, latch_block);
+    }
+
+    auto next_i = builder_.CreateAdd(i, one, "next_i");
+    i->addIncoming(next_i, latch_block);
+    auto exit_cond = builder_.CreateICmpEQ(next_i, n_words, "exit_cond");
+    builder_.CreateCondBr(exit_cond, after_block, loop_block);
+
+    builder_.SetInsertPoint(after_block);
+    builder_.CreateRet(ReduceAdd(next_acc));
+  }
+
+  // Scatter the elements of a sorted array falling in the cacheline starting
+  // at bit `line_start` into a vector. Equivalent to
+  //
+  //   vec = 0;
+  //   for (; cursor < size && data[cursor] < line_start + 512; cursor++)
+  //     vec |= 1 << (data[cursor] - line_start);
+  //
+  // Return the vector and the updated cursor.
+  std::pair<llvm::Value*, llvm::Value*> ArrayLineCodeGen(const SparseInput& input,
+                                                         llvm::Value* line_start,
+                                                         llvm::Function* fn) {
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    auto i32 = llvm::Type::getInt32Ty(*ctx_);
+    auto bits_per_line = llvm::ConstantInt::get(i64, scalar_width() * vector_width());
+    auto line_end = builder_.CreateAdd(line_start, bits_per_line, "line_end");
+    auto zero_elem = llvm::ConstantInt::get(ElementType(), 0);
+    auto zero_vec = llvm::ConstantVector::getSplat(vector_width(), zero_elem);
+
+    auto pre_block = builder_.GetInsertBlock();
+    auto header_block = llvm::BasicBlock::Create(*ctx_, "array_header", fn);
+    auto check_block = llvm::BasicBlock::Create(*ctx_, "array_check", fn);
+    auto body_block = llvm::BasicBlock::Create(*ctx_, "array_body", fn);
+    auto exit_block = llvm::BasicBlock::Create(*ctx_, "array_exit", fn);
+    builder_.CreateBr(header_block);
+
+    builder_.SetInsertPoint(header_block);
+    auto cursor = builder_.CreatePHI(i64, 2, "array_cursor");
+    cursor->addIncoming(input.cursor, pre_block);
+    auto vec = builder_.CreatePHI(VectorType(), 2, "array_vec");
+    vec->addIncoming(zero_vec, pre_block);
+    auto has_more = builder_.CreateICmpULT(cursor, input.size, "has_more");
+    builder_.CreateCondBr(has_more, check_block, exit_block);
+
+    builder_.SetInsertPoint(check_block);
+    auto gep = builder_.CreateInBoundsGEP(input.data, cursor, "element_gep");
+    auto element = builder_.CreateZExt(builder_.CreateLoad(gep), i64, "element");
+    auto in_line = builder_.CreateICmpULT(element, line_end, "in_line");
+    builder_.CreateCondBr(in_line, body_block, exit_block);
+
+    builder_.SetInsertPoint(body_block);
+    auto offset =
+        builder_.CreateTrunc(builder_.CreateSub(element, line_start), i32, "offset");
+    auto lane = builder_.CreateUDiv(offset, builder_.getInt32(scalar_width()), "lane");
+    auto bit = builder_.CreateURem(offset, builder_.getInt32(scalar_width()), "bit");
+    auto lane_value = builder_.CreateExtractElement(vec, lane, "lane_value");
+    auto mask = builder_.CreateShl(llvm::ConstantInt::get(ElementType(), 1),
+                                   builder_.CreateZExtOrTrunc(bit, ElementType()));
+    auto updated = builder_.CreateInsertElement(vec, builder_.CreateOr(lane_value, mask),
+                                                lane, "updated_vec");
+    auto next_cursor = builder_.CreateAdd(cursor, llvm::ConstantInt::get(i64, 1));
+    cursor->addIncoming(next_cursor, body_block);
+    vec->addIncoming(updated, body_block);
+    builder_.CreateBr(header_block);
+
+    // The header dominates the exit block, its phis hold the results.
+    builder_.SetInsertPoint(exit_block);
+    return {vec, cursor};
+  }
+
+  // Or the masks of the runs overlapping the cacheline starting at bit
+  // `line_start` into a vector. Equivalent to
+  //
+  //   vec = 0;
+  //   for (; cursor < size && runs[cursor].start < line_start + 512; cursor++) {
+  //     vec |= RunMask(runs[cursor]);
+  //     // The run continues in the next cacheline, don't consume it.
+  //     if (runs[cursor].end() >= line_start + 512) break;
+  //   }
+  //
+  // Return the vector and the updated cursor.
+  std::pair<llvm::Value*, llvm::Value*> RunLineCodeGen(const SparseInput& input,
+                                                       llvm::Value* line_start,
+                                                       llvm::Function* fn) {
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    auto one = llvm::ConstantInt::get(i64, 1);
+    auto bits_per_line = llvm::ConstantInt::get(i64, scalar_width() * vector_width());
+    auto line_end = builder_.CreateAdd(line_start, bits_per_line, "line_end");
+    auto zero_elem = llvm::ConstantInt::get(ElementType(), 0);
+    auto zero_vec = llvm::ConstantVector::getSplat(vector_width(), zero_elem);
+
+    auto pre_block = builder_.GetInsertBlock();
+    auto header_block = llvm::BasicBlock::Create(*ctx_, "run_header", fn);
+    auto check_block = llvm::BasicBlock::Create(*ctx_, "run_check", fn);
+    auto body_block = llvm::BasicBlock::Create(*ctx_, "run_body", fn);
+    auto advance_block = llvm::BasicBlock::Create(*ctx_, "run_advance", fn);
+    auto exit_block = llvm::BasicBlock::Create(*ctx_, "run_exit", fn);
+    builder_.CreateBr(header_block);
+
+    builder_.SetInsertPoint(header_block);
+    auto cursor = builder_.CreatePHI(i64, 2, "run_cursor");
+    cursor->addIncoming(input.cursor, pre_block);
+    auto vec = builder_.CreatePHI(VectorType(), 2, "run_vec");
+    vec->addIncoming(zero_vec, pre_block);
+    auto has_more = builder_.CreateICmpULT(cursor, input.size, "has_more");
+    builder_.CreateCondBr(has_more, check_block, exit_block);
+
+    builder_.SetInsertPoint(check_block);
+    auto start_idx = builder_.CreateShl(cursor, 1, "start_idx");
+    auto start_gep = builder_.CreateInBoundsGEP(input.data, start_idx, "start_gep");
+    auto start = builder_.CreateZExt(builder_.CreateLoad(start_gep), i64, "start");
+    auto in_line = builder_.CreateICmpULT(start, line_end, "in_line");
+    builder_.CreateCondBr(in_line, body_block, exit_block);
+
+    builder_.SetInsertPoint(body_block);
+    auto length_idx = builder_.CreateAdd(start_idx, one, "length_idx");
+    auto length_gep = builder_.CreateInBoundsGEP(input.data, length_idx, "length_gep");
+    auto length = builder_.CreateZExt(builder_.CreateLoad(length_gep), i64, "length");
+    auto end = builder_.CreateAdd(start, length, "end");
+    auto or_vec = builder_.CreateOr(vec, RunMask(start, end, line_start), "or_vec");
+    auto ends_in_line = builder_.CreateICmpULT(end, line_end, "ends_in_line");
+    builder_.CreateCondBr(ends_in_line, advance_block, exit_block);
+
+    builder_.SetInsertPoint(advance_block);
+    auto next_cursor = builder_.CreateAdd(cursor, one);
+    cursor->addIncoming(next_cursor, advance_block);
+    vec->addIncoming(or_vec, advance_block);
+    builder_.CreateBr(header_block);
+
+    builder_.SetInsertPoint(exit_block);
+    auto result = builder_.CreatePHI(VectorType(), 3, "run_result");
+    result->addIncoming(vec, header_block);
+    result->addIncoming(vec, check_block);
+    result->addIncoming(or_vec, body_block);
+    return {result, cursor};
+  }
+
+  // Compute the mask of the bits in [start, end] (inclusive) of the cacheline
+  // starting at bit `line_start`, with vector operations. For the lane
+  // covering bits [lo, lo + 32), the mask is `LowMask(end + 1 - lo) &
+  // ~LowMask(start - lo)` where both arguments are clamped to [0, 32].
+  llvm::Value* RunMask(llvm::Value* start, llvm::Value* end, llvm::Value* line_start) {
+    auto width = scalar_width();
+    auto n = vector_width();
+
+    std::vector<uint32_t> offsets;
+    for (uint32_t lane = 0; lane < n; lane++) offsets.push_back(lane * width);
+    auto lane_start = builder_.CreateAdd(
+        builder_.CreateVectorSplat(n, builder_.CreateTrunc(line_start, ElementType())),
+        llvm::ConstantDataVector::get(*ctx_, offsets), "lane_start");
+
+    auto splat = [&](llvm::Value* v) {
+      return builder_.CreateVectorSplat(n, builder_.CreateTrunc(v, ElementType()));
+    };
+    auto splat_const = [&](uint64_t v) {
+      return llvm::ConstantVector::getSplat(n, llvm::ConstantInt::get(ElementType(), v));
+    };
+
+    auto zero = splat_const(0);
+    auto full_width = splat_const(width);
+    auto all_ones = splat_const(UINT64_MAX);
+    auto clamp = [&](llvm::Value* v) {
+      auto lower = builder_.CreateSelect(builder_.CreateICmpSLT(v, zero), zero, v);
+      return builder_.CreateSelect(builder_.CreateICmpSGT(lower, full_width), full_width,
+                                   lower);
+    };
+    // Mask of the `k` lowest bits, `k` in [0, 32].
+    auto low_mask = [&](llvm::Value* k) {
+      auto shift = builder_.CreateAnd(k, splat_const(width - 1));
+      auto mask =
+          builder_.CreateSub(builder_.CreateShl(splat_const(1), shift), splat_const(1));
+      return builder_.CreateSelect(builder_.CreateICmpEQ(k, full_width), all_ones, mask);
+    };
+
+    auto from = clamp(builder_.CreateSub(splat(start), lane_start, "from"));
+    auto to = clamp(builder_.CreateSub(
+        splat(builder_.CreateAdd(end, llvm::ConstantInt::get(end->getType(), 1))),
+        lane_start, "to"));
+    return builder_.CreateAnd(low_mask(to), builder_.CreateNot(low_mask(from)),
+                              "run_mask");
+  }
+
+  // Load the `i`-th vector of a dense input at a bit offset, i.e. the bits at
+  // positions [512 * i + offset, 512 * (i + 1) + offset). The positions out of
+  // the container are read in the inputs of the preceding and following
+  // containers, see `DenseInputsCount`.
+  //
+  // With `offset = 32 * q + r`, the lanes are the words starting at `16 * i + q`
+  // funnel shifted with their successor by `r` bits.
+  llvm::Value* ShiftedLoadCodeGen(const std::vector<llvm::Value*>& inputs, size_t input,
+                                  llvm::Value* i, int64_t offset) {
+    if (offset <= -static_cast<int64_t>(kBitsPerContainer) ||
+        offset >= static_cast<int64_t>(kBitsPerContainer)) {
+      throw CompilerException("Shifts by ", offset,
+                              " bits reach beyond the adjacent containers");
+    }
+
+    const int64_t width = scalar_width();
+    auto q = FloorDiv(offset, width);
+    auto r = offset - q * width;
+    auto lo = WordsLoadCodeGen(inputs, input, i, q);
+    if (r == 0) return lo;
+    auto hi = WordsLoadCodeGen(inputs, input, i, q + 1);
+    return FunnelShiftRight(hi, lo, r);
+  }
+
+  // Load the words [16 * i + q, 16 * i + q + 16) of a dense input, a word
+  // index is relative to the first word of the current container. Each of the
+  // preceding, current and following containers covering some of the words
+  // is read with a masked load, the masked lanes are not accessed.
+  llvm::Value* WordsLoadCodeGen(const std::vector<llvm::Value*>& inputs, size_t input,
+                                llvm::Value* i, int64_t q) {
+    auto i64 = llvm::Type::getInt64Ty(*ctx_);
+    const int64_t n_lanes = vector_width();
+    const int64_t n_words = words() * n_lanes;
+    const size_t n_variables = inputs.size() / 3;
+
+    auto first = builder_.CreateAdd(
+        builder_.CreateMul(i, llvm::ConstantInt::get(i64, n_lanes)),
+        llvm::ConstantInt::get(i64, q), "first_word");
+    std::vector<uint32_t> lanes;
+    for (uint32_t lane = 0; lane < n_lanes; lane++) lanes.push_back(lane);
+    auto indices = builder_.CreateAdd(
+        builder_.CreateVectorSplat(n_lanes, builder_.CreateTrunc(first, ElementType())),
+        llvm::ConstantDataVector::get(*ctx_, lanes), "word_indices");
+
+    llvm::Value* result = llvm::ConstantAggregateZero::get(VectorType());
+    // The first word of the current, preceding and following containers, in the
+    // order of the inputs.
+    const std::array<int64_t, 3> starts{0, -n_words, n_words};
+    for (size_t c = 0; c < starts.size(); c++) {
+      auto start = starts[c];
+      // The words of the container are not in the range of any iteration.
+      if (q > start + n_words - 1 || q + n_words - 1 < start) continue;
+
+      auto splat = [&](int64_t v) {
+        return llvm::ConstantVector::getSplat(n_lanes,
+                                              llvm::ConstantInt::get(ElementType(), v));
+      };
+      auto mask =
+          builder_.CreateAnd(builder_.CreateICmpSGE(indices, splat(start)),
+                             builder_.CreateICmpSLT(indices, splat(start + n_words)),
+                             "in_container");
+
+      auto words_ptr = builder_.CreatePointerCast(inputs[c * n_variables + input],
+                                                  ElementType()->getPointerTo());
+      // Not inbounds, the address of the masked lanes may be out of the container.
+      auto gep = builder_.CreateGEP(
+          words_ptr, builder_.CreateSub(first, llvm::ConstantInt::get(i64, start)));
+      auto addr = builder_.CreatePointerCast(gep, VectorPtrType());
+      result = builder_.CreateMaskedLoad(addr, sizeof(uint32_t), mask, result, "words");
+    }
+    return result;
+  }
+
+  // Shift a tiny bitmap held in a register, the bit at position `p` of the
+  // result is the bit at position `p + offset` of `value`, or unset if out of
+  // the bitmap.
+  llvm::Value* TinyShiftCodeGen(llvm::Value* value, size_t n_words, int64_t offset) {
+    const int64_t n_lanes = n_words;
+    const int64_t n_bits = n_lanes * kBitsInTiny;
+    if (offset <= -n_bits || offset >= n_bits) {
+      return llvm::Constant::getNullValue(value->getType());
+    }
+    if (n_words == 1) {
+      return offset > 0 ? builder_.CreateLShr(value, offset)
+                        : builder_.CreateShl(value, -offset);
+    }
+
+    // The words are shifted by whole lanes with a shuffle, the lanes shifted
+    // in are taken from a zero vector.
+    auto zero = llvm::ConstantAggregateZero::get(value->getType());
+    auto shift_lanes = [&](int64_t q) {
+      std::vector<uint32_t> indices;
+      for (int64_t lane = 0; lane < n_lanes; lane++) {
+        auto index = lane + q;
+        indices.push_back(index >= 0 && index < n_lanes ? index : n_lanes);
+      }
+      return builder_.CreateShuffleVector(value, zero,
+                                          llvm::ConstantDataVector::get(*ctx_, indices));
+    };
+
+    const int64_t width = kBitsInTiny;
+    auto q = FloorDiv(offset, width);
+    auto r = offset - q * width;
+    auto lo = shift_lanes(q);
+    if (r == 0) return lo;
+    return FunnelShiftRight(shift_lanes(q + 1), lo, r);
+  }
+
+  // The lanes of `lo` shifted right by `r` bits, the high bits are shifted in
+  // from the lanes of `hi`.
+  llvm::Value* FunnelShiftRight(llvm::Value* hi, llvm::Value* lo, int64_t r) {
+    auto type = lo->getType();
+    auto amount = llvm::ConstantInt::get(type, r);
+    return builder_.CreateIntrinsic(llvm::Intrinsic::fshr, {type}, {hi, lo, amount},
+                                    nullptr, "fshr");
+  }
+
+  static int64_t FloorDiv(int64_t a, int64_t b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+  }
+
   llvm::Value* PopCount(llvm::Value* val) {
     // See https://reviews.llvm.org/D10084
     constexpr auto ctpop = llvm::Intrinsic::ctpop;
@@ -224,12 +1043,16 @@ class ExpressionCodeGen {
     // Bind the variable bitmaps by name to inputs of the function
     const auto& parameters = variables;
     std::unordered_map<std::string, llvm::Value*> keyed_bitmaps;
-    for (size_t i = 0; i < inputs.size(); i++) {
+    for (size_t i = 0; i < parameters.size(); i++) {
       keyed_bitmaps.emplace(parameters[i], load_vector_inst(inputs[i], i));
     }
 
     // Execute the expression tree on the input
     ExprCodeGenVisitor visitor{keyed_bitmaps, builder_, VectorType()};
+    visitor.shifted_bitmap = [&](const std::string& name, int64_t offset) {
+      auto it = std::find(parameters.cbegin(), parameters.cend(), name);
+      return ShiftedLoadCodeGen(inputs, it - parameters.cbegin(), loop_idx, offset);
+    };
     auto result = expression.Visit(visitor);
 
     // Store the result in the output bitmap.
@@ -240,7 +1063,8 @@ class ExpressionCodeGen {
     return result;
   }
 
-  llvm::FunctionType* FunctionTypeForArguments(bool with_popcount) {
+  llvm::FunctionType* FunctionTypeForArguments(bool with_popcount,
+                                               bool with_dirty_mask = false) {
     // void
     auto return_type = with_popcount ? ElementType() : llvm::Type::getVoidTy(*ctx_);
     auto i8 = llvm::Type::getInt8Ty(*ctx_);
@@ -250,15 +1074,136 @@ class ExpressionCodeGen {
     auto inputs_type = i8_ptr->getPointerTo();
     // int8_t* output,
     auto output_type = i8_ptr;
+    std::vector<llvm::Type*> args{inputs_type, output_type};
+    if (with_dirty_mask) {
+      // const uint64_t* dirty,
+      args.push_back(llvm::Type::getInt64Ty(*ctx_)->getPointerTo());
+    }
     // )
 
     constexpr bool is_var_args = false;
-    return llvm::FunctionType::get(return_type, {inputs_type, output_type}, is_var_args);
+    return llvm::FunctionType::get(return_type, args, is_var_args);
+  }
+
+  llvm::Function* FunctionDeclForSpecializedQuery(const std::string& name) {
+    auto i8_ptr = llvm::Type::getInt8Ty(*ctx_)->getPointerTo();
+    // int32_t specialized_fn(
+    //   const int8_t** inputs,
+    //   const uint32_t* sizes,
+    //   int8_t* output
+    // )
+    auto fn_type = llvm::FunctionType::get(
+        ElementType(),
+        {i8_ptr->getPointerTo(), llvm::Type::getInt32Ty(*ctx_)->getPointerTo(), i8_ptr},
+        false);
+    auto fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, name,
+                                     *module_);
+    fn->setCallingConv(llvm::CallingConv::C);
+    fn->addFnAttr(llvm::Attribute::ArgMemOnly);
+
+    auto args_it = fn->args().begin();
+    for (auto arg_name : {"inputs", "sizes", "output"}) {
+      auto arg = args_it++;
+      arg->setName(arg_name);
+      arg->addAttr(llvm::Attribute::NoCapture);
+    }
+
+    return fn;
+  }
+
+  llvm::Function* FunctionDeclForTinyQuery(const std::string& name) {
+    auto i64_ptr = llvm::Type::getInt64Ty(*ctx_)->getPointerTo();
+    // int32_t tiny_fn(
+    //   const uint64_t* inputs,
+    //   uint64_t* output
+    // )
+    auto fn_type = llvm::FunctionType::get(ElementType(), {i64_ptr, i64_ptr}, false);
+    auto fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, name,
+                                     *module_);
+    fn->setCallingConv(llvm::CallingConv::C);
+    fn->addFnAttr(llvm::Attribute::ArgMemOnly);
+
+    auto args_it = fn->args().begin();
+    for (auto arg_name : {"inputs", "output"}) {
+      auto arg = args_it++;
+      arg->setName(arg_name);
+      arg->addAttr(llvm::Attribute::NoCapture);
+    }
+    fn->args().begin()->addAttr(llvm::Attribute::ReadOnly);
+
+    return fn;
+  }
+
+  llvm::Function* FunctionDeclForBatchQuery(const std::string& name) {
+    auto i8_ptr = llvm::Type::getInt8Ty(*ctx_)->getPointerTo();
+    // void batch_fn(
+    //   const int8_t** inputs,
+    //   int8_t** outputs,
+    //   int32_t* popcounts,
+    //   uint64_t n_containers
+    // )
+    auto fn_type = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(*ctx_),
+        {i8_ptr->getPointerTo(), i8_ptr->getPointerTo(), ElementType()->getPointerTo(),
+         llvm::Type::getInt64Ty(*ctx_)},
+        false);
+    auto fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, name,
+                                     *module_);
+    fn->setCallingConv(llvm::CallingConv::C);
+
+    auto args_it = fn->args().begin();
+    for (auto arg_name : {"inputs", "outputs", "popcounts"}) {
+      auto arg = args_it++;
+      arg->setName(arg_name);
+      arg->addAttr(llvm::Attribute::NoCapture);
+    }
+    args_it->setName("n_containers");
+
+    return fn;
+  }
+
+  llvm::Function* FunctionDeclForRunsQuery(const std::string& name) {
+    auto i8_ptr = llvm::Type::getInt8Ty(*ctx_)->getPointerTo();
+    // int32_t runs_fn(
+    //   const int8_t** inputs,
+    //   int8_t* output,
+    //   int32_t* n_runs
+    // )
+    auto fn_type = llvm::FunctionType::get(
+        ElementType(), {i8_ptr->getPointerTo(), i8_ptr, ElementType()->getPointerTo()},
+        false);
+    auto fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, name,
+                                     *module_);
+    fn->setCallingConv(llvm::CallingConv::C);
+    fn->addFnAttr(llvm::Attribute::ArgMemOnly);
+
+    auto args_it = fn->args().begin();
+    for (auto arg_name : {"inputs", "output", "n_runs"}) {
+      auto arg = args_it++;
+      arg->setName(arg_name);
+      arg->addAttr(llvm::Attribute::NoCapture);
+    }
+    fn->args().begin()->addAttr(llvm::Attribute::ReadOnly);
+
+    return fn;
+  }
+
+  llvm::Function* FunctionDeclForIncrementalQuery(const std::string& name,
+                                                  const Expr& expression) {
+    auto fn = FunctionDeclForQuery(name, expression, true /* with_popcount */,
+                                   true /* with_dirty_mask */);
+
+    auto dirty = std::next(fn->args().begin(), 2);
+    dirty->setName("dirty");
+    dirty->addAttr(llvm::Attribute::NoCapture);
+    dirty->addAttr(llvm::Attribute::ReadOnly);
+
+    return fn;
   }
 
   llvm::Function* FunctionDeclForQuery(const std::string& name, const Expr& expression,
-                                       bool with_popcount) {
-    auto fn_type = FunctionTypeForArguments(with_popcount);
+                                       bool with_popcount, bool with_dirty_mask = false) {
+    auto fn_type = FunctionTypeForArguments(with_popcount, with_dirty_mask);
     // The generated function will be exposed as an external symbol, i.e the
     // symbol will be globally visible. This would be equivalent to defining a
     // symbol with the `extern` storage classifier.
@@ -12,7 +12,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <functional>
 #include <memory>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <llvm/ADT/Triple.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
@@ -24,8 +30,11 @@
 #include <llvm/ExecutionEngine/Orc/LLJIT.h>
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/DataLayout.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/PassManager.h>
+#include <llvm/Pass.h>
 #include <llvm/Support/CodeGen.h>
 #include <llvm/Support/Error.h>
 #include <llvm/Support/TargetSelect.h>
@@ -147,6 +156,143 @@ auto AsThreadSafeModule(ExpressionCodeGen::ContextAndModule ctx_module) {
   return orc::ThreadSafeModule(std::move(module), std::move(context));
 }
 
+// Rebalance the chains of bitwise operators into trees of minimal height.
+//
+// The expressions are compiled from balanced trees, see `TreeHeightReduction`,
+// but LLVM's reassociation linearizes the chains of associative operators,
+// e.g. `((a & b) & c) & d`, a serial dependency per word. This pass runs last
+// and rebuilds each chain by combining the two operands of minimal height
+// first, i.e. Huffman's algorithm on the heights.
+class TreeHeightReductionPass : public llvm::FunctionPass {
+ public:
+  static char ID;
+
+  TreeHeightReductionPass() : llvm::FunctionPass(ID) {}
+
+  llvm::StringRef getPassName() const override { return "jitmap tree-height reduction"; }
+
+  void getAnalysisUsage(llvm::AnalysisUsage& usage) const override {
+    usage.setPreservesCFG();
+  }
+
+  bool runOnFunction(llvm::Function& fn) override {
+    bool changed = false;
+    for (auto& block : fn) {
+      std::vector<llvm::BinaryOperator*> roots;
+      for (auto& inst : block) {
+        auto op = llvm::dyn_cast<llvm::BinaryOperator>(&inst);
+        if (op != nullptr && IsBitwise(op) && !IsInnerNode(op)) roots.push_back(op);
+      }
+
+      heights_.clear();
+      for (auto root : roots) changed |= Rebalance(root);
+    }
+    return changed;
+  }
+
+ private:
+  static bool IsBitwise(const llvm::BinaryOperator* op) {
+    auto opcode = op->getOpcode();
+    return opcode == llvm::Instruction::And || opcode == llvm::Instruction::Or ||
+           opcode == llvm::Instruction::Xor;
+  }
+
+  // Indicate if `value` is an operator of the same kind as `root`, in the
+  // same block, whose only use is in the chain.
+  static bool IsChainNode(llvm::Value* value, const llvm::BinaryOperator* root) {
+    auto op = llvm::dyn_cast<llvm::BinaryOperator>(value);
+    return op != nullptr && op->getOpcode() == root->getOpcode() &&
+           op->getParent() == root->getParent() && op->hasOneUse();
+  }
+
+  // Indicate if `op` is a node of the chain of its only user.
+  static bool IsInnerNode(llvm::BinaryOperator* op) {
+    if (!op->hasOneUse()) return false;
+    auto user = llvm::dyn_cast<llvm::BinaryOperator>(op->user_back());
+    return user != nullptr && IsChainNode(op, user);
+  }
+
+  // The height of the bitwise operators computing `value` in the block.
+  size_t Height(llvm::Value* value, const llvm::BasicBlock* block) {
+    auto op = llvm::dyn_cast<llvm::BinaryOperator>(value);
+    if (op == nullptr || !IsBitwise(op) || op->getParent() != block) return 0;
+
+    auto it = heights_.find(op);
+    if (it != heights_.end()) return it->second;
+    auto height = std::max(Height(op->getOperand(0), block),
+                           Height(op->getOperand(1), block)) +
+                  1;
+    heights_.emplace(op, height);
+    return height;
+  }
+
+  // Collect the operands of the chain rooted at `value`, the nodes in
+  // pre-order, and return the height of the chain.
+  size_t Collect(llvm::Value* value, llvm::BinaryOperator* root,
+                 std::vector<llvm::Value*>* leaves,
+                 std::vector<llvm::BinaryOperator*>* nodes) {
+    if (value != root && !IsChainNode(value, root)) {
+      leaves->push_back(value);
+      return Height(value, root->getParent());
+    }
+
+    auto op = llvm::cast<llvm::BinaryOperator>(value);
+    nodes->push_back(op);
+    auto lhs = Collect(op->getOperand(0), root, leaves, nodes);
+    auto rhs = Collect(op->getOperand(1), root, leaves, nodes);
+    return std::max(lhs, rhs) + 1;
+  }
+
+  bool Rebalance(llvm::BinaryOperator* root) {
+    std::vector<llvm::Value*> leaves;
+    std::vector<llvm::BinaryOperator*> nodes;
+    auto height = Collect(root, root, &leaves, &nodes);
+    // A chain of 3 operands is balanced.
+    if (leaves.size() < 4) return false;
+
+    using Operand = std::pair<size_t, llvm::Value*>;
+    auto by_height = [](const Operand& lhs, const Operand& rhs) {
+      return lhs.first > rhs.first;
+    };
+    std::priority_queue<Operand, std::vector<Operand>, decltype(by_height)> queue{
+        by_height};
+    for (auto leaf : leaves) queue.emplace(Height(leaf, root->getParent()), leaf);
+
+    // The heights only, the chain is kept if it is not lowered.
+    auto heights = queue;
+    while (heights.size() > 1) {
+      auto lhs = heights.top().first;
+      heights.pop();
+      auto rhs = heights.top().first;
+      heights.pop();
+      heights.emplace(std::max(lhs, rhs) + 1, nullptr);
+    }
+    if (heights.top().first >= height) return false;
+
+    while (queue.size() > 1) {
+      auto [lhs_height, lhs] = queue.top();
+      queue.pop();
+      auto [rhs_height, rhs] = queue.top();
+      queue.pop();
+      auto op = llvm::BinaryOperator::Create(root->getOpcode(), lhs, rhs, "", root);
+      heights_[op] = std::max(lhs_height, rhs_height) + 1;
+      queue.emplace(heights_[op], op);
+    }
+
+    root->replaceAllUsesWith(queue.top().second);
+    // Each node is only used by its parent, erased before.
+    for (auto node : nodes) {
+      heights_.erase(node);
+      node->eraseFromParent();
+    }
+    return true;
+  }
+
+  std::unordered_map<const llvm::Value*, size_t> heights_;
+};
+
+char TreeHeightReductionPass::ID = 0;
+
 class JitEngineImpl {
  public:
   JitEngineImpl(orc::JITTargetMachineBuilder machine_builder, const CompilerOptions& opts)
@@ -161,8 +307,57 @@ class JitEngineImpl {
     RaiseOnFailure(jit_->addIRModule(user_queries_, std::move(thread_safe_module)));
   }
 
+  void CompileSpecialized(const std::string& name, const Expr& expr,
+                          const std::vector<ContainerType>& types) {
+    auto thread_safe_module =
+        AsThreadSafeModule(ExpressionCodeGen("module_s")
+                               .CompileSpecialized(query_specialized(name, types), expr,
+                                                   types)
+                               .Finish());
+    Optimize(thread_safe_module.getModule());
+    RaiseOnFailure(jit_->addIRModule(user_queries_, std::move(thread_safe_module)));
+  }
+
+  void CompileTiny(const std::string& name, const Expr& expr, size_t n_bits) {
+    auto thread_safe_module = AsThreadSafeModule(
+        ExpressionCodeGen("module_t").CompileTiny(query_tiny(name, n_bits), expr, n_bits)
+            .Finish());
+    Optimize(thread_safe_module.getModule());
+    RaiseOnFailure(jit_->addIRModule(user_queries_, std::move(thread_safe_module)));
+  }
+
+  void CompileIncremental(const std::string& name, const Expr& expr) {
+    auto thread_safe_module = AsThreadSafeModule(
+        ExpressionCodeGen("module_i")
+            .CompileIncremental(query_incremental(name), expr)
+            .Finish());
+    Optimize(thread_safe_module.getModule());
+    RaiseOnFailure(jit_->addIRModule(user_queries_, std::move(thread_safe_module)));
+  }
+
+  void CompileRuns(const std::string& name, const Expr& expr) {
+    auto thread_safe_module = AsThreadSafeModule(
+        ExpressionCodeGen("module_r").CompileRuns(query_runs(name), expr).Finish());
+    Optimize(thread_safe_module.getModule());
+    RaiseOnFailure(jit_->addIRModule(user_queries_, std::move(thread_safe_module)));
+  }
+
+  void CompileBatch(const std::string& name, const Expr& expr) {
+    auto thread_safe_module = AsThreadSafeModule(
+        ExpressionCodeGen("module_b").CompileBatch(query_batch(name), expr).Finish());
+    Optimize(thread_safe_module.getModule());
+    RaiseOnFailure(jit_->addIRModule(user_queries_, std::move(thread_safe_module)));
+  }
+
   std::string CompileIR(const std::string& n, const Expr& e) {
-    auto ctx_module = CompileInternal(n, e);
+    // The variants compiled on first use are part of the IR.
+    auto ctx_module = ExpressionCodeGen("module_a")
+                          .Compile(n, e, false /* with_popcount */)
+                          .Compile(query_popcount(n), e, true /* with_popcount */)
+                          .CompileIncremental(query_incremental(n), e)
+                          .CompileBatch(query_batch(n), e)
+                          .CompileRuns(query_runs(n), e)
+                          .Finish();
     auto module = ctx_module.second.get();
     // By default, the TargetTriple is not part of the module. This ensure that
     // callers of `jitmap-ir` don't need to explicit the tripple in the command
@@ -187,6 +382,33 @@ class JitEngineImpl {
     return llvm::jitTargetAddressToPointer<DenseEvalPopCountFn>(symbol.getAddress());
   }
 
+  DenseEvalIncrementalFn LookupUserIncrementalQuery(const std::string& name) {
+    auto symbol = ExpectOrRaise(jit_->lookup(user_queries_, query_incremental(name)));
+    return llvm::jitTargetAddressToPointer<DenseEvalIncrementalFn>(symbol.getAddress());
+  }
+
+  DenseEvalBatchFn LookupUserBatchQuery(const std::string& name) {
+    auto symbol = ExpectOrRaise(jit_->lookup(user_queries_, query_batch(name)));
+    return llvm::jitTargetAddressToPointer<DenseEvalBatchFn>(symbol.getAddress());
+  }
+
+  DenseEvalRunsFn LookupUserRunsQuery(const std::string& name) {
+    auto symbol = ExpectOrRaise(jit_->lookup(user_queries_, query_runs(name)));
+    return llvm::jitTargetAddressToPointer<DenseEvalRunsFn>(symbol.getAddress());
+  }
+
+  SpecializedEvalFn LookupUserSpecializedQuery(const std::string& name,
+                                               const std::vector<ContainerType>& types) {
+    auto symbol =
+        ExpectOrRaise(jit_->lookup(user_queries_, query_specialized(name, types)));
+    return llvm::jitTargetAddressToPointer<SpecializedEvalFn>(symbol.getAddress());
+  }
+
+  TinyEvalFn LookupUserTinyQuery(const std::string& name, size_t n_bits) {
+    auto symbol = ExpectOrRaise(jit_->lookup(user_queries_, query_tiny(name, n_bits)));
+    return llvm::jitTargetAddressToPointer<TinyEvalFn>(symbol.getAddress());
+  }
+
   // Introspection
   std::string GetTargetCPU() const { return host_->getTargetCPU(); }
   std::string GetTargetTriple() const { return host_->getTargetTriple().normalize(); }
@@ -197,10 +419,48 @@ class JitEngineImpl {
     return query_name + "_popcount";
   }
 
+  std::string query_incremental(const std::string query_name) {
+    return query_name + "_incremental";
+  }
+
+  std::string query_batch(const std::string query_name) { return query_name + "_batch"; }
+
+  std::string query_runs(const std::string query_name) { return query_name + "_runs"; }
+
+  std::string query_tiny(const std::string query_name, size_t n_bits) {
+    return query_name + "_tiny" + std::to_string(n_bits);
+  }
+
+  // The symbol is suffixed with one character per input, e.g. `q_dar` for a
+  // dense, an array and a run input.
+  std::string query_specialized(const std::string query_name,
+                                const std::vector<ContainerType>& types) {
+    std::string signature;
+    for (auto type : types) {
+      switch (type) {
+        case BITMAP:
+          signature += 'd';
+          break;
+        case ARRAY:
+          signature += 'a';
+          break;
+        case RUN_LENGTH:
+          signature += 'r';
+          break;
+        default:
+          throw CompilerException("Container type ", static_cast<int>(type),
+                                  " can't be specialized");
+      }
+    }
+    return query_name + "_" + signature;
+  }
+
   ExpressionCodeGen::ContextAndModule CompileInternal(const std::string& name,
                                                       const Expr& e) {
     // Generate 2 variants for the expression, one function that returns the
-    // popcount, and the other that doesn't tally the popcount and returns void.
+    // popcount and one that doesn't tally the popcount and returns void. The
+    // other variants are compiled on first use, see `CompileIncremental`,
+    // `CompileRuns` and `CompileBatch`.
     return ExpressionCodeGen("module_a")
         .Compile(name, e, false /* with_popcount */)
         .Compile(query_popcount(name), e, true /* with_popcount */)
@@ -221,6 +481,11 @@ class JitEngineImpl {
     builder.SLPVectorize = true;
     builder.DisableUnrollLoops = false;
     host_->adjustPassManager(builder);
+    builder.addExtension(llvm::PassManagerBuilder::EP_OptimizerLast,
+                         [](const llvm::PassManagerBuilder&,
+                            llvm::legacy::PassManagerBase& manager) {
+                           manager.add(new TreeHeightReductionPass());
+                         });
 
     auto cpu = host_->getTargetCPU();
     for (auto& function : *module) {
@@ -270,6 +535,11 @@ class JitEngineImpl {
   CompilerOptions options_;
 };
 
+size_t DenseInputsCount(const Expr& expression) {
+  auto n_variables = expression.Variables().size();
+  return expression.HasShift() ? 3 * n_variables : n_variables;
+}
+
 JitEngine::JitEngine(CompilerOptions opts)
     : Pimpl(std::make_unique<JitEngineImpl>(InitHostTargetMachineBuilder(opts), opts)) {}
 
@@ -295,5 +565,49 @@ DenseEvalPopCountFn JitEngine::LookupUserPopCountQuery(const std::string& query_
   return impl().LookupUserPopCountQuery(query_name);
 }
 
+DenseEvalIncrementalFn JitEngine::LookupUserIncrementalQuery(
+    const std::string& query_name) {
+  return impl().LookupUserIncrementalQuery(query_name);
+}
+
+DenseEvalBatchFn JitEngine::LookupUserBatchQuery(const std::string& query_name) {
+  return impl().LookupUserBatchQuery(query_name);
+}
+
+DenseEvalRunsFn JitEngine::LookupUserRunsQuery(const std::string& query_name) {
+  return impl().LookupUserRunsQuery(query_name);
+}
+
+void JitEngine::CompileSpecialized(const std::string& name, const Expr& expression,
+                                   const std::vector<ContainerType>& types) {
+  impl().CompileSpecialized(name, expression, types);
+}
+
+SpecializedEvalFn JitEngine::LookupUserSpecializedQuery(
+    const std::string& query_name, const std::vector<ContainerType>& types) {
+  return impl().LookupUserSpecializedQuery(query_name, types);
+}
+
+void JitEngine::CompileTiny(const std::string& name, const Expr& expression,
+                            size_t n_bits) {
+  impl().CompileTiny(name, expression, n_bits);
+}
+
+TinyEvalFn JitEngine::LookupUserTinyQuery(const std::string& query_name, size_t n_bits) {
+  return impl().LookupUserTinyQuery(query_name, n_bits);
+}
+
+void JitEngine::CompileIncremental(const std::string& name, const Expr& expression) {
+  impl().CompileIncremental(name, expression);
+}
+
+void JitEngine::CompileRuns(const std::string& name, const Expr& expression) {
+  impl().CompileRuns(name, expression);
+}
+
+void JitEngine::CompileBatch(const std::string& name, const Expr& expression) {
+  impl().CompileBatch(name, expression);
+}
+
 }  // namespace query
 }  // namespace jitmap
@@ -14,6 +14,7 @@
 
 #include <ostream>
 #include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -34,6 +35,8 @@ bool Expr::IsLiteral() const {
     case AND_OPERATOR:
     case OR_OPERATOR:
     case XOR_OPERATOR:
+    case SHIFT_LEFT_OPERATOR:
+    case SHIFT_RIGHT_OPERATOR:
       return false;
   }
 
@@ -52,18 +55,36 @@ bool Expr::IsOperator() const {
     case AND_OPERATOR:
     case OR_OPERATOR:
     case XOR_OPERATOR:
+    case SHIFT_LEFT_OPERATOR:
+    case SHIFT_RIGHT_OPERATOR:
       return true;
   }
 
   return false;
 }
 
-bool Expr::IsUnaryOperator() const { return type_ == NOT_OPERATOR; }
+bool Expr::IsUnaryOperator() const { return type_ == NOT_OPERATOR || IsShiftOperator(); }
 
 bool Expr::IsBinaryOperator() const {
   return type_ == AND_OPERATOR || type_ == OR_OPERATOR || type_ == XOR_OPERATOR;
 }
 
+bool Expr::IsShiftOperator() const {
+  return type_ == SHIFT_LEFT_OPERATOR || type_ == SHIFT_RIGHT_OPERATOR;
+}
+
+bool Expr::HasShift() const {
+  return Visit([](const auto* e) {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+    if constexpr (is_shift_op<E>::value) return true;
+    if constexpr (is_unary_op<E>::value) return e->operand()->HasShift();
+    if constexpr (is_binary_op<E>::value) {
+      return e->left_operand()->HasShift() || e->right_operand()->HasShift();
+    }
+    return false;
+  });
+}
+
 bool Expr::operator==(const Expr& rhs) const {
   // Pointer shorcut.
   if (this == &rhs) return true;
@@ -79,7 +100,9 @@ bool Expr::operator==(const Expr& rhs) const {
 
     if constexpr (is_literal<E>::value) return true;
     if constexpr (is_variable<E>::value) return left->value() == right->value();
-    if constexpr (is_unary_op<E>::value) return *left->operand() == *right->operand();
+    if constexpr (is_shift_op<E>::value) {
+      if (left->amount() != right->amount()) return false;
+    }
     if constexpr (is_unary_op<E>::value) return *left->operand() == *right->operand();
     if constexpr (is_binary_op<E>::value) {
       return (*left->left_operand() == *right->left_operand()) &&
@@ -106,6 +129,10 @@ static const char* OpToChar(Expr::Type op) {
       return "|";
     case Expr::XOR_OPERATOR:
       return "^";
+    case Expr::SHIFT_LEFT_OPERATOR:
+      return "<<";
+    case Expr::SHIFT_RIGHT_OPERATOR:
+      return ">>";
   }
 
   throw Exception("Unkonwn operator type: ", op);
@@ -127,7 +154,9 @@ std::string Expr::ToString() const {
       ss << symbol << e->value();
     }
 
-    if constexpr (is_unary_op<E>::value) {
+    if constexpr (is_shift_op<E>::value) {
+      ss << "(" << e->operand()->ToString() << " " << symbol << " " << e->amount() << ")";
+    } else if constexpr (is_unary_op<E>::value) {
       ss << symbol << e->operand()->ToString();
     }
 
@@ -166,27 +195,84 @@ std::vector<std::string> Expr::Variables() const {
   return variables;
 }
 
-Expr* Expr::Copy(ExprBuilder* b) const {
-  return Visit([b](const auto* e) -> Expr* {
+// Copy each node once, the copy of a DAG is a DAG.
+static Expr* CopyNode(const Expr& expr, ExprBuilder* b,
+                      std::unordered_map<const Expr*, Expr*>& copies) {
+  if (auto copy = copies.find(&expr); copy != copies.end()) return copy->second;
+
+  auto copy = expr.Visit([&](const auto* e) -> Expr* {
     using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
     if constexpr (is_variable<E>::value) {
       return b->Var(e->value());
     } else if constexpr (is_literal<E>::value) {
-      return (e->type() == FULL_LITERAL) ? b->FullBitmap() : b->EmptyBitmap();
-    } else if constexpr (is_not_op<E>::value) {
-      return b->Not(e->operand()->Copy(b));
+      return (e->type() == Expr::FULL_LITERAL) ? b->FullBitmap() : b->EmptyBitmap();
+    } else if constexpr (is_unary_op<E>::value) {
+      return b->Rebuild(*e, CopyNode(*e->operand(), b, copies));
+    } else if constexpr (is_binary_op<E>::value) {
+      return b->Rebuild(*e, CopyNode(*e->left_operand(), b, copies),
+                        CopyNode(*e->right_operand(), b, copies));
+    }
+
+    return nullptr;
+  });
+
+  return copies.emplace(&expr, copy).first->second;
+}
+
+Expr* Expr::Copy(ExprBuilder* b) const {
+  std::unordered_map<const Expr*, Expr*> copies;
+  return CopyNode(*this, b, copies);
+}
+
+Expr* ExprBuilder::Rebuild(const Expr& op, Expr* lhs, Expr* rhs) {
+  return op.Visit([&](const auto* e) -> Expr* {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+    if constexpr (is_not_op<E>::value) {
+      return Not(lhs);
+    } else if constexpr (is_shift_left_op<E>::value) {
+      return ShiftLeft(lhs, e->amount());
+    } else if constexpr (is_shift_right_op<E>::value) {
+      return ShiftRight(lhs, e->amount());
     } else if constexpr (is_and_op<E>::value) {
-      return b->And(e->left_operand()->Copy(b), e->right_operand()->Copy(b));
+      return And(lhs, rhs);
     } else if constexpr (is_or_op<E>::value) {
-      return b->Or(e->left_operand()->Copy(b), e->right_operand()->Copy(b));
+      return Or(lhs, rhs);
     } else if constexpr (is_xor_op<E>::value) {
-      return b->Xor(e->left_operand()->Copy(b), e->right_operand()->Copy(b));
+      return Xor(lhs, rhs);
     }
 
-    return nullptr;
+    throw Exception("Can't rebuild non-operator expression ", op);
   });
 }
 
+ExprBuilder::Key ExprBuilder::KeyOf(const Expr& expr) {
+  return expr.Visit([](const auto* e) {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+    Key key{e->type()};
+    if constexpr (is_variable<E>::value) key.name = e->value();
+    if constexpr (is_shift_op<E>::value) key.amount = e->amount();
+    if constexpr (is_unary_op<E>::value) key.lhs = e->operand();
+    if constexpr (is_binary_op<E>::value) {
+      key.lhs = e->left_operand();
+      key.rhs = e->right_operand();
+    }
+    return key;
+  });
+}
+
+size_t ExprBuilder::KeyHash::operator()(const Key& k) const {
+  // Combine as boost::hash_combine.
+  size_t seed = std::hash<int>{}(k.type);
+  auto combine = [&seed](size_t h) {
+    seed ^= h + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  };
+  combine(std::hash<const Expr*>{}(k.lhs));
+  combine(std::hash<const Expr*>{}(k.rhs));
+  combine(std::hash<uint32_t>{}(k.amount));
+  combine(std::hash<std::string>{}(k.name));
+  return seed;
+}
+
 std::ostream& operator<<(std::ostream& os, const Expr& e) { return os << e.ToString(); }
 std::ostream& operator<<(std::ostream& os, Expr* e) { return os << *e; }
 
@@ -42,7 +42,7 @@ bool OperandMatcher::Match(const Expr& expr) const {
     auto mode = this->mode_;
     auto& matcher = *this->matcher_;
 
-    if constexpr (is_not_op<E>::value) {
+    if constexpr (is_unary_op<E>::value) {
       return matcher(e->operand());
     }
 
@@ -14,6 +14,11 @@
 
 #include "jitmap/query/optimizer.h"
 
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #include "jitmap/query/expr.h"
 #include "jitmap/query/type_traits.h"
 
@@ -43,6 +48,12 @@ Expr* ConstantFolding::Rewrite(const Expr& expr) {
       if (type == Expr::FULL_LITERAL) return builder->EmptyBitmap();
     }
 
+    // Shift(0, k) -> 0
+    // Shift(1, k) -> 1
+    if constexpr (is_shift_op<E>::value) {
+      return e->operand();
+    }
+
     if constexpr (is_binary_op<E>::value) {
       // Returns a pair where the first element is the constant operand.
       auto unpack_const_expr = [](const BinaryOpExpr* expr) -> std::pair<Expr*, Expr*> {
@@ -147,6 +158,314 @@ Expr* NotChainFolding::Rewrite(const Expr& expr) {
   });
 }
 
+// Return the operands of a binary operator, or nulls.
+static std::pair<Expr*, Expr*> BinaryOperands(const Expr& expr) {
+  return expr.Visit([](const auto* e) -> std::pair<Expr*, Expr*> {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+    if constexpr (is_binary_op<E>::value) return {e->left_operand(), e->right_operand()};
+    return {nullptr, nullptr};
+  });
+}
+
+// Return the operand of a negation, or null.
+static Expr* NegatedOperand(const Expr* expr) {
+  if (expr->type() != Expr::NOT_OPERATOR) return nullptr;
+  return static_cast<const NotOpExpr*>(expr)->operand();
+}
+
+// Return true if `lhs` is the negation of `rhs`, or the converse.
+static bool IsComplement(const Expr* lhs, const Expr* rhs) {
+  auto not_lhs = NegatedOperand(lhs);
+  auto not_rhs = NegatedOperand(rhs);
+  return (not_lhs != nullptr && *not_lhs == *rhs) ||
+         (not_rhs != nullptr && *not_rhs == *lhs);
+}
+
+class ComplementOperandMatcher final : public Matcher {
+ public:
+  bool Match(const Expr& expr) const {
+    auto [lhs, rhs] = BinaryOperands(expr);
+    return lhs != nullptr && IsComplement(lhs, rhs);
+  }
+} kComplementOperandMatcher;
+
+ComplementFolding::ComplementFolding(ExprBuilder* builder)
+    : OptimizationPass(&kComplementOperandMatcher, builder) {}
+
+Expr* ComplementFolding::Rewrite(const Expr& expr) {
+  return expr.Visit([&](const auto* e) -> Expr* {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+
+    if constexpr (is_binary_op<E>::value) {
+      if (!IsComplement(e->left_operand(), e->right_operand())) {
+        return kNoOptimizationPerformed;
+      }
+
+      // And(e, Not(e)) -> 0
+      if constexpr (is_and_op<E>::value) return this->builder_->EmptyBitmap();
+      // Or(e, Not(e))  -> 1
+      // Xor(e, Not(e)) -> 1
+      return this->builder_->FullBitmap();
+    }
+
+    return kNoOptimizationPerformed;
+  });
+}
+
+TypeMatcher kAndOrMatcher{Expr::AND_OPERATOR, Expr::OR_OPERATOR};
+OperandMatcher kAndOrOperandMatcher{&kAndOrMatcher};
+ChainMatcher kAbsorptionMatcher{&kAndOrMatcher, &kAndOrOperandMatcher};
+
+AbsorptionFolding::AbsorptionFolding(ExprBuilder* builder)
+    : OptimizationPass(&kAbsorptionMatcher, builder) {}
+
+Expr* AbsorptionFolding::Rewrite(const Expr& expr) {
+  auto dual =
+      (expr.type() == Expr::AND_OPERATOR) ? Expr::OR_OPERATOR : Expr::AND_OPERATOR;
+  // Return true if `inner` is a `dual` operator of which `e` is an operand.
+  auto absorbs = [dual](const Expr* e, const Expr* inner) {
+    if (inner->type() != dual) return false;
+    auto [lhs, rhs] = BinaryOperands(*inner);
+    return *lhs == *e || *rhs == *e;
+  };
+
+  auto [lhs, rhs] = BinaryOperands(expr);
+  if (lhs == nullptr) return kNoOptimizationPerformed;
+
+  // And(a, Or(a, b)) -> a
+  // Or(a, And(a, b)) -> a
+  if (absorbs(lhs, rhs)) return lhs;
+  if (absorbs(rhs, lhs)) return rhs;
+
+  return kNoOptimizationPerformed;
+}
+
+TypeMatcher kFactorableMatcher{Expr::AND_OPERATOR, Expr::OR_OPERATOR,
+                               Expr::XOR_OPERATOR};
+OperandMatcher kAndOrOperandsMatcher{&kAndOrMatcher, OperandMatcher::ALL};
+ChainMatcher kFactoringMatcher{&kFactorableMatcher, &kAndOrOperandsMatcher};
+
+Factoring::Factoring(ExprBuilder* builder)
+    : OptimizationPass(&kFactoringMatcher, builder) {}
+
+Expr* Factoring::Rewrite(const Expr& expr) {
+  // And distributes over Or and Xor, Or distributes over And.
+  auto inner_type =
+      (expr.type() == Expr::AND_OPERATOR) ? Expr::OR_OPERATOR : Expr::AND_OPERATOR;
+
+  auto [left, right] = BinaryOperands(expr);
+  if (left == nullptr || left->type() != inner_type || right->type() != inner_type) {
+    return kNoOptimizationPerformed;
+  }
+
+  auto [a, b] = BinaryOperands(*left);
+  auto [c, d] = BinaryOperands(*right);
+  auto outer = [&](Expr* lhs, Expr* rhs) { return builder_->Rebuild(expr, lhs, rhs); };
+
+  // Or(And(a, b), And(a, c)) -> And(a, Or(b, c))
+  if (*a == *c) return builder_->Rebuild(*left, a, outer(b, d));
+  if (*a == *d) return builder_->Rebuild(*left, a, outer(b, c));
+  // Or(And(b, a), And(c, a)) -> And(Or(b, c), a)
+  if (*b == *c) return builder_->Rebuild(*left, outer(a, d), b);
+  if (*b == *d) return builder_->Rebuild(*left, outer(a, c), b);
+
+  return kNoOptimizationPerformed;
+}
+
+TypeMatcher kBinaryOpMatcher{Expr::AND_OPERATOR, Expr::OR_OPERATOR, Expr::XOR_OPERATOR};
+OperandMatcher kBinaryOpOperandMatcher{&kBinaryOpMatcher};
+ChainMatcher kNotOfBinaryOpMatcher{&kNotMatcher, &kBinaryOpOperandMatcher};
+TypeMatcher kXorMatcher{Expr::XOR_OPERATOR};
+OperandMatcher kNotOperandsMatcher{&kNotMatcher, OperandMatcher::ALL};
+ChainMatcher kXorOfNotsMatcher{&kXorMatcher, &kNotOperandsMatcher};
+TypeMatcher kShiftMatcher{Expr::SHIFT_LEFT_OPERATOR, Expr::SHIFT_RIGHT_OPERATOR};
+OperandMatcher kShiftOperandMatcher{&kShiftMatcher};
+ChainMatcher kNotOfShiftMatcher{&kNotMatcher, &kShiftOperandMatcher};
+ChainMatcher kDeMorganMatcher{
+    {&kNotOfBinaryOpMatcher, &kXorOfNotsMatcher, &kNotOfShiftMatcher}, ChainMatcher::ANY};
+
+DeMorganFolding::DeMorganFolding(ExprBuilder* builder)
+    : OptimizationPass(&kDeMorganMatcher, builder) {}
+
+Expr* DeMorganFolding::Rewrite(const Expr& expr) {
+  auto builder = builder_;
+  auto negate = [builder](Expr* e) {
+    auto operand = NegatedOperand(e);
+    return (operand != nullptr) ? operand : builder->Not(e);
+  };
+
+  return expr.Visit([&](const auto* e) -> Expr* {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+
+    // Xor(Not(a), Not(b)) -> Xor(a, b)
+    if constexpr (is_xor_op<E>::value) {
+      auto lhs = NegatedOperand(e->left_operand());
+      auto rhs = NegatedOperand(e->right_operand());
+      if (lhs != nullptr && rhs != nullptr) return builder->Xor(lhs, rhs);
+    }
+
+    if constexpr (is_not_op<E>::value) {
+      auto op = e->operand();
+
+      // Not(Shift(Not(a), k)) -> Shift(a, k), the shifts are pushed down to
+      // the variables thus commute with the negation, see `ShiftOpExpr`.
+      if (op->IsShiftOperator()) {
+        return op->Visit([&](const auto* shift) -> Expr* {
+          using S = std::decay_t<std::remove_pointer_t<decltype(shift)>>;
+          if constexpr (is_shift_op<S>::value) {
+            auto operand = NegatedOperand(shift->operand());
+            if (operand != nullptr) return builder->Rebuild(*shift, operand);
+          }
+          return kNoOptimizationPerformed;
+        });
+      }
+
+      auto [lhs, rhs] = BinaryOperands(*op);
+      if (lhs == nullptr) return kNoOptimizationPerformed;
+
+      auto not_lhs = NegatedOperand(lhs);
+      auto not_rhs = NegatedOperand(rhs);
+      if (not_lhs == nullptr && not_rhs == nullptr) return kNoOptimizationPerformed;
+
+      switch (op->type()) {
+        // Not(And(Not(a), b)) -> Or(a, Not(b))
+        case Expr::AND_OPERATOR:
+          return builder->Or(negate(lhs), negate(rhs));
+        // Not(Or(Not(a), b)) -> And(a, Not(b))
+        case Expr::OR_OPERATOR:
+          return builder->And(negate(lhs), negate(rhs));
+        // Not(Xor(Not(a), b)) -> Xor(a, b)
+        case Expr::XOR_OPERATOR:
+          return (not_lhs != nullptr) ? builder->Xor(not_lhs, rhs)
+                                      : builder->Xor(lhs, not_rhs);
+        default:
+          break;
+      }
+    }
+
+    return kNoOptimizationPerformed;
+  });
+}
+
+TypeMatcher kOperatorMatcher{Expr::NOT_OPERATOR,         Expr::AND_OPERATOR,
+                             Expr::OR_OPERATOR,          Expr::XOR_OPERATOR,
+                             Expr::SHIFT_LEFT_OPERATOR, Expr::SHIFT_RIGHT_OPERATOR};
+
+TreeHeightReduction::TreeHeightReduction(ExprBuilder* builder)
+    : OptimizationPass(&kOperatorMatcher, builder) {}
+
+Expr* TreeHeightReduction::Rewrite(const Expr& expr) {
+  reduced_.clear();
+  return Reduce(expr).first;
+}
+
+// Append the operands of the chain of `type` operators rooted at `expr`, in
+// order, and their depth in the chain.
+static void CollectChainOperands(Expr* expr, Expr::Type type, size_t depth,
+                                 std::vector<Expr*>* operands,
+                                 std::vector<size_t>* depths) {
+  if (expr->type() != type) {
+    operands->push_back(expr);
+    depths->push_back(depth);
+    return;
+  }
+
+  expr->Visit([&](const auto* op) {
+    using E = std::decay_t<std::remove_pointer_t<decltype(op)>>;
+    if constexpr (is_binary_op<E>::value) {
+      CollectChainOperands(op->left_operand(), type, depth + 1, operands, depths);
+      CollectChainOperands(op->right_operand(), type, depth + 1, operands, depths);
+    }
+  });
+}
+
+// Merge the adjacent pair of operands of minimal height, invoking `merge(i)`
+// on the pair at `i`, until a single tree remains. Return its height.
+//
+// This greedy order yields a tree of minimal height among the trees keeping
+// the order of the operands, see Golumbic "Combinatorial Merging" (1976).
+template <typename Merge>
+static size_t MergeAdjacentOperands(std::vector<size_t> heights, Merge&& merge) {
+  while (heights.size() > 1) {
+    size_t best = 0;
+    for (size_t i = 1; i + 1 < heights.size(); i++) {
+      if (std::max(heights[i], heights[i + 1]) <
+          std::max(heights[best], heights[best + 1])) {
+        best = i;
+      }
+    }
+    merge(best);
+    heights[best] = std::max(heights[best], heights[best + 1]) + 1;
+    heights.erase(heights.begin() + best + 1);
+  }
+  return heights.front();
+}
+
+static Expr* MakeBinaryOp(ExprBuilder* builder, Expr::Type type, Expr* lhs, Expr* rhs) {
+  switch (type) {
+    case Expr::AND_OPERATOR:
+      return builder->And(lhs, rhs);
+    case Expr::OR_OPERATOR:
+      return builder->Or(lhs, rhs);
+    case Expr::XOR_OPERATOR:
+      return builder->Xor(lhs, rhs);
+    default:
+      return nullptr;
+  }
+}
+
+std::pair<Expr*, size_t> TreeHeightReduction::Reduce(const Expr& expr) {
+  if (auto it = reduced_.find(&expr); it != reduced_.end()) return it->second;
+
+  auto reduced = expr.Visit([&](const auto* e) -> std::pair<Expr*, size_t> {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+    auto builder = this->builder_;
+
+    if constexpr (is_unary_op<E>::value) {
+      auto [operand, height] = Reduce(*e->operand());
+      if (operand == kNoOptimizationPerformed) return {operand, height + 1};
+      return {builder->Rebuild(*e, operand), height + 1};
+    }
+
+    if constexpr (is_binary_op<E>::value) {
+      auto type = e->type();
+      std::vector<Expr*> operands;
+      std::vector<size_t> depths;
+      CollectChainOperands(e->left_operand(), type, 1, &operands, &depths);
+      CollectChainOperands(e->right_operand(), type, 1, &operands, &depths);
+
+      // The operands are reduced first, their heights weigh on the shape of
+      // the chain.
+      bool changed = false;
+      size_t height = 0;
+      std::vector<size_t> heights;
+      for (size_t i = 0; i < operands.size(); i++) {
+        auto [reduced, operand_height] = Reduce(*operands[i]);
+        if (reduced != kNoOptimizationPerformed) {
+          operands[i] = reduced;
+          changed = true;
+        }
+        heights.push_back(operand_height);
+        height = std::max(height, depths[i] + operand_height);
+      }
+
+      // Keep the chain as is unless it is lowered.
+      auto minimal_height = MergeAdjacentOperands(heights, [](size_t) {});
+      if (!changed && minimal_height >= height) return {kNoOptimizationPerformed, height};
+
+      MergeAdjacentOperands(heights, [&](size_t i) {
+        operands[i] = MakeBinaryOp(builder, type, operands[i], operands[i + 1]);
+        operands.erase(operands.begin() + i + 1);
+      });
+      return {operands.front(), minimal_height};
+    }
+
+    return {kNoOptimizationPerformed, 0};
+  });
+
+  return reduced_.emplace(&expr, reduced).first->second;
+}
+
 Optimizer::Optimizer(ExprBuilder* builder, OptimizerOptions options)
     : builder_(builder), options_(options) {
   if (options.HasOptimization(OptimizerOptions::CONSTANT_FOLDING)) {
@@ -160,9 +479,50 @@ Optimizer::Optimizer(ExprBuilder* builder, OptimizerOptions options)
   if (options.HasOptimization(OptimizerOptions::NOT_CHAIN_FOLDING)) {
     not_chain_folding_ = NotChainFolding{builder_};
   }
+
+  if (options.HasOptimization(OptimizerOptions::COMPLEMENT_FOLDING)) {
+    complement_folding_ = ComplementFolding{builder_};
+  }
+
+  if (options.HasOptimization(OptimizerOptions::ABSORPTION_FOLDING)) {
+    absorption_folding_ = AbsorptionFolding{builder_};
+  }
+
+  if (options.HasOptimization(OptimizerOptions::FACTORING)) {
+    factoring_ = Factoring{builder_};
+  }
+
+  if (options.HasOptimization(OptimizerOptions::DE_MORGAN_FOLDING)) {
+    de_morgan_folding_ = DeMorganFolding{builder_};
+  }
+
+  if (options.HasOptimization(OptimizerOptions::TREE_HEIGHT_REDUCTION)) {
+    tree_height_reduction_ = TreeHeightReduction{builder_};
+  }
+}
+
+static void CountOperations(const Expr& expr, std::unordered_set<const Expr*>* visited) {
+  if (!expr.IsOperator() || !visited->insert(&expr).second) return;
+
+  expr.Visit([visited](const auto* e) {
+    using E = std::decay_t<std::remove_pointer_t<decltype(e)>>;
+    if constexpr (is_unary_op<E>::value) CountOperations(*e->operand(), visited);
+    if constexpr (is_binary_op<E>::value) {
+      CountOperations(*e->left_operand(), visited);
+      CountOperations(*e->right_operand(), visited);
+    }
+  });
+}
+
+size_t Optimizer::OperationCount(const Expr& expr) {
+  std::unordered_set<const Expr*> operators;
+  CountOperations(expr, &operators);
+  return operators.size();
 }
 
 // Apply optimizations in a bottom-up fashion, i.e. visit children before parents.
+// The nodes are immutable and may be shared, an operator whose operands were
+// rewritten is rebuilt and each node is visited once.
 template <typename Visitor>
 struct BottonUpVisitor {
   Expr* operator()(VariableExpr* e) { return visitor(e); }
@@ -174,18 +534,28 @@ struct BottonUpVisitor {
 
   template <typename E>
   enable_if_unary_op<E, Expr*> operator()(E* op) {
-    op->set_operand((op->operand()->Visit(*this)));
-    return visitor(op);
+    auto operand = Rewrite(op->operand());
+    if (operand == op->operand()) return visitor(op);
+    return visitor(builder->Rebuild(*op, operand));
   }
 
   template <typename E>
   enable_if_binary_op<E, Expr*> operator()(E* op) {
-    op->set_left_operand(op->left_operand()->Visit(*this));
-    op->set_right_operand(op->right_operand()->Visit(*this));
-    return visitor(op);
+    auto lhs = Rewrite(op->left_operand());
+    auto rhs = Rewrite(op->right_operand());
+    if (lhs == op->left_operand() && rhs == op->right_operand()) return visitor(op);
+    return visitor(builder->Rebuild(*op, lhs, rhs));
+  }
+
+  Expr* Rewrite(Expr* e) {
+    if (auto it = rewritten.find(e); it != rewritten.end()) return it->second;
+    auto rewrite = e->Visit(*this);
+    return rewritten.emplace(e, rewrite).first->second;
   }
 
   Visitor visitor;
+  ExprBuilder* builder;
+  std::unordered_map<const Expr*, Expr*> rewritten;
 };
 
 Expr* Optimizer::Optimize(const Expr& input) {
@@ -196,11 +566,30 @@ Expr* Optimizer::Optimize(const Expr& input) {
     if (this->constant_folding_) e = this->constant_folding_.value()(e);
     if (this->same_operand_folding_) e = this->same_operand_folding_.value()(e);
     if (this->not_chain_folding_) e = this->not_chain_folding_.value()(e);
+    if (this->complement_folding_) e = this->complement_folding_.value()(e);
+    if (this->absorption_folding_) e = this->absorption_folding_.value()(e);
+    if (this->factoring_) e = this->factoring_.value()(e);
+    if (this->de_morgan_folding_) e = this->de_morgan_folding_.value()(e);
     return e;
   };
-  BottonUpVisitor<decltype(folder)> folders{std::move(folder)};
 
-  return expr->Visit(folders);
+  // Each rewrite shrinks the tree, the rounds terminate. A rewrite of a
+  // shared node may add operations to the DAG, a round which does so is
+  // discarded.
+  auto cost = OperationCount(*expr);
+  while (true) {
+    BottonUpVisitor<decltype(folder)> folders{folder, builder_, {}};
+    auto folded = folders.Rewrite(expr);
+    auto folded_cost = OperationCount(*folded);
+    if (folded == expr || folded_cost > cost) break;
+    expr = folded;
+    cost = folded_cost;
+  }
+
+  // Rewrites the whole expression, see `TreeHeightReduction`.
+  if (tree_height_reduction_) expr = tree_height_reduction_.value()(expr);
+
+  return expr;
 }
 
 }  // namespace query
@@ -13,6 +13,9 @@
 // limitations under the License.
 
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <string>
 
 #include "jitmap/query/parser.h"
@@ -43,6 +46,10 @@ const char* TokenTypeToString(Token::Type type) {
       return "OrOp";
     case Token::Type::XOR_OPERATOR:
       return "XorOp";
+    case Token::Type::SHIFT_LEFT_OPERATOR:
+      return "ShiftLeftOp";
+    case Token::Type::SHIFT_RIGHT_OPERATOR:
+      return "ShiftRightOp";
     case Token::Type::END_OF_STREAM:
       return "EOS";
   }
@@ -63,6 +70,12 @@ Token Token::NotOp(std::string_view t) { return Token(Token::NOT_OPERATOR, t); }
 Token Token::AndOp(std::string_view t) { return Token(Token::AND_OPERATOR, t); }
 Token Token::OrOp(std::string_view t) { return Token(Token::OR_OPERATOR, t); }
 Token Token::XorOp(std::string_view t) { return Token(Token::XOR_OPERATOR, t); }
+Token Token::ShiftLeftOp(std::string_view t) {
+  return Token(Token::SHIFT_LEFT_OPERATOR, t);
+}
+Token Token::ShiftRightOp(std::string_view t) {
+  return Token(Token::SHIFT_RIGHT_OPERATOR, t);
+}
 Token Token::EoS(std::string_view t) { return Token(Token::END_OF_STREAM, t); }
 
 constexpr char kEoFCharacter = '\0';
@@ -82,6 +95,8 @@ static bool IsOperator(char c) {
     case '&':
     case '|':
     case '^':
+    case '<':
+    case '>':
       return true;
     default:
       return false;
@@ -154,6 +169,14 @@ Token Lexer::ConsumeOperator() {
       return Token::OrOp();
     case '^':
       return Token::XorOp();
+    // The shift operators are made of two characters, e.g. `<<`.
+    case '<':
+    case '>':
+      if (Peek() != c) {
+        throw ParserException("Unexpected character '", Peek(), "' after '", c, "'.");
+      }
+      Consume();
+      return c == '<' ? Token::ShiftLeftOp() : Token::ShiftRightOp();
     default:
       throw ParserException("Unexpected character '", c, "' while consuming operator.");
   }
@@ -180,6 +203,9 @@ Token Lexer::Next() {
 int OperatorPrecedence(Token::Type type) {
   switch (type) {
     case Token::NOT_OPERATOR:
+      return 5;
+    case Token::SHIFT_LEFT_OPERATOR:
+    case Token::SHIFT_RIGHT_OPERATOR:
       return 4;
     case Token::AND_OPERATOR:
       return 3;
@@ -265,11 +291,35 @@ class Parser {
         return builder_->Or(left, Parse(OperatorPrecedence(Token::OR_OPERATOR)));
       case Token::XOR_OPERATOR:
         return builder_->Xor(left, Parse(OperatorPrecedence(Token::XOR_OPERATOR)));
+      case Token::SHIFT_LEFT_OPERATOR:
+        return builder_->ShiftLeft(left, ConsumeShiftAmount());
+      case Token::SHIFT_RIGHT_OPERATOR:
+        return builder_->ShiftRight(left, ConsumeShiftAmount());
       default:
         throw ParserException("Unexpected token '", token, "'");
     }
   }
 
+  // The amount of a shift is a decimal number, it is lexed as a variable.
+  uint32_t ConsumeShiftAmount() {
+    Token token = Consume();
+    auto digits = token.string();
+    auto is_digit = [](char c) { return std::isdigit(c); };
+    if (token.type() != Token::VARIABLE ||
+        !std::all_of(digits.cbegin(), digits.cend(), is_digit)) {
+      throw ParserException("Expected a shift amount but got '", token, "'");
+    }
+
+    uint64_t amount = 0;
+    for (char c : digits) {
+      amount = amount * 10 + (c - '0');
+      if (amount > std::numeric_limits<uint32_t>::max()) {
+        throw ParserException("Shift amount '", digits, "' is too large");
+      }
+    }
+    return static_cast<uint32_t>(amount);
+  }
+
  private:
   Lexer lexer_;
   ExprBuilder* builder_;
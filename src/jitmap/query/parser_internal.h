@@ -35,6 +35,8 @@ class Token {
     AND_OPERATOR,
     OR_OPERATOR,
     XOR_OPERATOR,
+    SHIFT_LEFT_OPERATOR,
+    SHIFT_RIGHT_OPERATOR,
     END_OF_STREAM,
     LAST_TOKEN = END_OF_STREAM,
   };
@@ -63,6 +65,8 @@ class Token {
   static Token AndOp(std::string_view = "");
   static Token OrOp(std::string_view = "");
   static Token XorOp(std::string_view = "");
+  static Token ShiftLeftOp(std::string_view = "");
+  static Token ShiftRightOp(std::string_view = "");
   static Token EoS(std::string_view = "");
 
  private:
@@ -15,18 +15,192 @@
 #include "jitmap/query/query.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "jitmap/dirty.h"
 #include "jitmap/jitmap.h"
+#include "jitmap/query/cache.h"
 #include "jitmap/query/compiler.h"
 #include "jitmap/query/optimizer.h"
 #include "jitmap/query/parser.h"
+#include "jitmap/query/type_traits.h"
+#include "jitmap/tiny.h"
+#include "jitmap/util/mpsc_queue.h"
 
 namespace jitmap {
 namespace query {
 
+// A sub-expression whose result is memoized in the ResultCache.
+struct CachedSubExpr {
+  // Canonical form of the sub-expression, see `CanonicalForm`.
+  std::string canonical;
+  // Inputs of the kernel, following the encoding of `CachePlan::residual_inputs`.
+  // The nested sub-expressions are inputs of the enclosing one.
+  std::vector<size_t> inputs;
+  // Indices of the versions of the cache key in the query variables, by
+  // sorted variable name. The canonical form sorts the operands, equal forms
+  // may list their variables in another order, e.g. `a & !b` and `!b & a`.
+  std::vector<size_t> versions;
+  DenseEvalFn eval_fn = nullptr;
+};
+
+// The plan used when evaluating with a cache. Every binary operator below the
+// root roots a sub-expression which is evaluated (or fetched from the cache)
+// into a buffer, the buffers are bound as inputs to the kernels of the
+// enclosing sub-expressions and eventually to a residual kernel.
+//
+// For example, the query `((a & !b) & c) | d` is split in sub-expressions
+// `cached_0 = (a & !b)` and `cached_1 = cached_0 & c`, and a residual
+// expression `cached_1 | d`. Another query sharing `(a & !b)` reuses its
+// buffer, a hit on `cached_1` doesn't evaluate `cached_0`.
+struct CachePlan {
+  // Ordered such that the nested sub-expressions come first.
+  std::vector<CachedSubExpr> subexprs;
+  // For each input of the residual kernel, the index in the query inputs, or
+  // if greater or equal to the number of query variables, the index of the
+  // sub-expression buffer offset by the number of query variables.
+  std::vector<size_t> residual_inputs;
+  DenseEvalFn eval_fn = nullptr;
+  DenseEvalPopCountFn eval_popct_fn = nullptr;
+};
+
+struct AsyncRequest {
+  std::vector<const char*> inputs;
+  char* output;
+  bool popcount;
+  Query::EvalCallback callback;
+};
+
+// AsyncEvaluator owns the queue and the worker thread backing
+// `Query::EvalAsync`. The worker sleeps while the queue is empty, producers
+// only take the lock to wake it up.
+class AsyncEvaluator {
+ public:
+  // Upper bound on the number of requests evaluated by a single kernel call.
+  static constexpr size_t kMaxBatchSize = 64;
+
+  explicit AsyncEvaluator(DenseEvalBatchFn eval_fn)
+      : eval_fn_(eval_fn), worker_([this] { Run(); }) {}
+
+  ~AsyncEvaluator() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+  }
+
+  void Submit(AsyncRequest request) {
+    queue_.Push(std::move(request));
+    if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+      // The worker might be sleeping.
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv_.notify_one();
+    }
+  }
+
+ private:
+  void Run() {
+    std::vector<AsyncRequest> batch;
+    batch.reserve(kMaxBatchSize);
+
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return pending_.load() > 0 || stop_; });
+        if (pending_.load() == 0) return;
+      }
+
+      batch.clear();
+      while (batch.size() < kMaxBatchSize) {
+        auto request = queue_.Pop();
+        if (request) {
+          batch.push_back(std::move(*request));
+        } else if (batch.empty()) {
+          // A producer is in the middle of a push.
+          std::this_thread::yield();
+        } else {
+          break;
+        }
+      }
+
+      pending_.fetch_sub(batch.size(), std::memory_order_acq_rel);
+      Execute(batch);
+    }
+  }
+
+  void Execute(std::vector<AsyncRequest>& batch) {
+    // The batch is reported as failed if its scratch buffers can't grow.
+    std::exception_ptr error;
+    try {
+      inputs_.clear();
+      outputs_.clear();
+      bool with_popcount = false;
+      for (const auto& request : batch) {
+        inputs_.insert(inputs_.end(), request.inputs.cbegin(), request.inputs.cend());
+        outputs_.push_back(request.output);
+        with_popcount |= request.popcount;
+      }
+
+      popcounts_.assign(batch.size(), kUnknownPopCount);
+      eval_fn_(inputs_.data(), outputs_.data(),
+               with_popcount ? popcounts_.data() : nullptr, batch.size());
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+      auto& request = batch[i];
+      auto popcount = !error && request.popcount ? popcounts_[i] : kUnknownPopCount;
+      // A throwing callback must not terminate the worker nor skip the
+      // callbacks of the other requests, see `Query::EvalAsync`.
+      try {
+        request.callback(popcount, error);
+      } catch (...) {
+      }
+    }
+  }
+
+  DenseEvalBatchFn eval_fn_;
+
+  util::MpscQueue<AsyncRequest> queue_;
+  std::atomic<size_t> pending_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+
+  // Scratch buffers re-used across batches, only touched by the worker.
+  std::vector<const char*> inputs_;
+  std::vector<char*> outputs_;
+  std::vector<int32_t> popcounts_;
+
+  // Must be last, the thread starts in the constructor.
+  std::thread worker_;
+};
+
+static Expr* CompiledExpr(const Expr& expr, Expr* optimized, ExprBuilder* builder) {
+  // The inputs layout also depends on the shifts, see `DenseInputsCount`.
+  if (optimized->Variables() == expr.Variables() &&
+      optimized->HasShift() == expr.HasShift()) {
+    return optimized;
+  }
+  return Optimizer(builder, {OptimizerOptions::TREE_HEIGHT_REDUCTION}).Optimize(expr);
+}
+
 class QueryImpl {
  public:
   QueryImpl(std::string name, std::string query)
@@ -34,30 +208,128 @@ class QueryImpl {
         query_(std::move(query)),
         expr_(Parse(query_, &builder_)),
         optimized_expr_(Optimizer(&builder_).Optimize(*expr_)),
-        variables_(expr_->Variables()) {}
+        compiled_expr_(CompiledExpr(*expr_, optimized_expr_, &builder_)),
+        variables_(expr_->Variables()),
+        has_shift_(expr_->HasShift()) {}
 
   // Accessors
   const std::string& name() const { return name_; }
   const std::string& query() const { return query_; }
   const Expr& expr() const { return *expr_; }
   const Expr& optimized_expr() const { return *optimized_expr_; }
+  // The expression handed to the kernels. The folding passes may drop
+  // variables or shifts, which the inputs layout of the kernels doesn't allow.
+  // The optimized expression is compiled if it keeps the variables, their
+  // order and the shifts, otherwise only the passes keeping them apply.
+  const Expr& compiled_expr() const { return *compiled_expr_; }
   const std::vector<std::string>& variables() const { return variables_; }
+  bool has_shift() const { return has_shift_; }
 
   DenseEvalFn dense_eval_fn() const { return dense_eval_fn_; }
   DenseEvalPopCountFn dense_eval_popct_fn() const { return dense_eval_popct_fn_; }
+  // Return the incremental kernel, compiling it on first use.
+  DenseEvalIncrementalFn dense_eval_incremental_fn() {
+    return LazyEvalFn(&dense_eval_incremental_fn_, [this] {
+      jit_->CompileIncremental(name_, *compiled_expr_);
+      return jit_->LookupUserIncrementalQuery(name_);
+    });
+  }
+  // Return the batch kernel, compiling it on first use.
+  DenseEvalBatchFn dense_eval_batch_fn() {
+    return LazyEvalFn(&dense_eval_batch_fn_, [this] {
+      jit_->CompileBatch(name_, *compiled_expr_);
+      return jit_->LookupUserBatchQuery(name_);
+    });
+  }
+  // Return the kernel counting the runs, compiling it on first use. Only the
+  // COMPACT outputs use it.
+  DenseEvalRunsFn dense_eval_runs_fn() {
+    return LazyEvalFn(&dense_eval_runs_fn_, [this] {
+      jit_->CompileRuns(name_, *compiled_expr_);
+      return jit_->LookupUserRunsQuery(name_);
+    });
+  }
+
+  AsyncEvaluator& async_evaluator() {
+    std::call_once(async_once_, [this] {
+      async_ = std::make_unique<AsyncEvaluator>(dense_eval_batch_fn());
+    });
+    return *async_;
+  }
+
+  // Return the kernel specialized for the given input types, compiling it on
+  // first use.
+  SpecializedEvalFn specialized_eval_fn(const std::vector<ContainerType>& types) {
+    std::string key(types.cbegin(), types.cend());
+
+    std::lock_guard<std::mutex> lock(specialized_mutex_);
+    auto it = specialized_fns_.find(key);
+    if (it != specialized_fns_.end()) return it->second;
+
+    jit_->CompileSpecialized(name_, *compiled_expr_, types);
+    auto fn = jit_->LookupUserSpecializedQuery(name_, types);
+    specialized_fns_.emplace(std::move(key), fn);
+    return fn;
+  }
+
+  // Return the tiny kernel for bitmaps of `n_bits` bits, compiling it on
+  // first use.
+  TinyEvalFn tiny_eval_fn(size_t n_bits) {
+    return LazyEvalFn(&tiny_fns_[__builtin_ctzll(n_bits / kBitsInTiny)], [&] {
+      jit_->CompileTiny(name_, *compiled_expr_, n_bits);
+      return jit_->LookupUserTinyQuery(name_, n_bits);
+    });
+  }
+
+  ResultCache* cache() const { return cache_.get(); }
+  const std::optional<CachePlan>& cache_plan() const { return cache_plan_; }
 
  private:
+  // Load the kernel in `slot`, compiling it with `compile` on first use. The
+  // compiled kernels are read without locking.
+  template <typename Fn, typename Compile>
+  Fn LazyEvalFn(std::atomic<Fn>* slot, Compile&& compile) {
+    auto fn = slot->load(std::memory_order_acquire);
+    if (fn != nullptr) return fn;
+
+    std::lock_guard<std::mutex> lock(specialized_mutex_);
+    fn = slot->load(std::memory_order_relaxed);
+    if (fn == nullptr) {
+      fn = compile();
+      slot->store(fn, std::memory_order_release);
+    }
+    return fn;
+  }
+
   std::string name_;
   std::string query_;
   ExprBuilder builder_;
   Expr* expr_;
   Expr* optimized_expr_;
+  Expr* compiled_expr_;
 
   friend class Query;
 
   std::vector<std::string> variables_;
+  bool has_shift_;
   DenseEvalFn dense_eval_fn_ = nullptr;
   DenseEvalPopCountFn dense_eval_popct_fn_ = nullptr;
+  std::atomic<DenseEvalIncrementalFn> dense_eval_incremental_fn_{nullptr};
+  std::atomic<DenseEvalBatchFn> dense_eval_batch_fn_{nullptr};
+  std::atomic<DenseEvalRunsFn> dense_eval_runs_fn_{nullptr};
+
+  // Keyed by the input container types, one byte per input.
+  JitEngine* jit_ = nullptr;
+  std::mutex specialized_mutex_;
+  std::unordered_map<std::string, SpecializedEvalFn> specialized_fns_;
+  // Indexed by log2(n_bits / kBitsInTiny).
+  std::array<std::atomic<TinyEvalFn>, 4> tiny_fns_{};
+
+  std::shared_ptr<ResultCache> cache_;
+  std::optional<CachePlan> cache_plan_;
+
+  std::once_flag async_once_;
+  std::unique_ptr<AsyncEvaluator> async_;
 };
 
 static inline void ValidateQueryName(const std::string& name) {
@@ -84,6 +356,100 @@ static inline void ValidateQueryName(const std::string& name) {
 Query::Query(std::string name, std::string query, ExecutionContext* context)
     : Pimpl(std::make_unique<QueryImpl>(std::move(name), std::move(query))) {}
 
+// Split the expression in cacheable sub-expressions and a residual
+// expression, see `CachePlan`. Returns std::nullopt if there is nothing to
+// cache, i.e. no binary operator below the root.
+//
+// The kernels of the sub-expressions are suffixed with a `.` which the query
+// names don't allow, such that they don't collide with the user queries.
+static std::optional<CachePlan> MakeCachePlan(const std::string& name, const Expr& expr,
+                                              const std::vector<std::string>& variables,
+                                              ExprBuilder* builder, JitEngine* jit) {
+  // The kernels of the sub-expressions would read the adjacent containers, see
+  // `DenseInputsCount`, the cache is keyed by the evaluated container only.
+  if (expr.HasShift()) return std::nullopt;
+
+  // Pick a prefix for the placeholder variables that doesn't clash with the
+  // query variables.
+  std::string prefix = "cached_";
+  auto clashes = [&](const std::string& p) {
+    return std::any_of(variables.cbegin(), variables.cend(),
+                       [&](const auto& v) { return v.rfind(p, 0) == 0; });
+  };
+  while (clashes(prefix)) prefix = "_" + prefix;
+
+  auto index_of = [&](const std::string& variable) -> size_t {
+    return std::find(variables.cbegin(), variables.cend(), variable) - variables.cbegin();
+  };
+
+  CachePlan plan;
+  std::unordered_map<std::string, size_t> placeholders;
+  auto inputs_of = [&](const Expr& e) {
+    std::vector<size_t> inputs;
+    for (const auto& variable : e.Variables()) {
+      auto placeholder = placeholders.find(variable);
+      inputs.push_back(placeholder != placeholders.end() ? placeholder->second
+                                                         : index_of(variable));
+    }
+    return inputs;
+  };
+
+  // The shared sub-expressions of the DAG are cached once.
+  std::unordered_map<const Expr*, Expr*> cached;
+  auto cache = [&](const Expr& original, Expr* rewritten) {
+    auto id = plan.subexprs.size();
+    auto sub_name = name + ".cached" + std::to_string(id);
+    jit->Compile(sub_name, *rewritten);
+
+    CachedSubExpr sub;
+    sub.canonical = CanonicalForm(original);
+    sub.inputs = inputs_of(*rewritten);
+    auto sub_variables = original.Variables();
+    std::sort(sub_variables.begin(), sub_variables.end());
+    for (const auto& variable : sub_variables) {
+      sub.versions.push_back(index_of(variable));
+    }
+    sub.eval_fn = jit->LookupUserQuery(sub_name);
+    plan.subexprs.push_back(std::move(sub));
+
+    auto placeholder = prefix + std::to_string(id);
+    placeholders.emplace(placeholder, variables.size() + id);
+    return builder->Var(placeholder);
+  };
+
+  // Return `e` with the binary operators below the root replaced by the
+  // placeholders of their sub-expressions, nested ones first.
+  std::function<Expr*(const Expr&, bool)> rewrite = [&](const Expr& e,
+                                                        bool is_root) -> Expr* {
+    if (auto it = cached.find(&e); it != cached.end()) return it->second;
+
+    return e.Visit([&](const auto* op) -> Expr* {
+      using E = std::decay_t<std::remove_pointer_t<decltype(op)>>;
+      if constexpr (is_unary_op<E>::value) {
+        return builder->Rebuild(*op, rewrite(*op->operand(), false));
+      } else if constexpr (is_binary_op<E>::value) {
+        auto rewritten = builder->Rebuild(*op, rewrite(*op->left_operand(), false),
+                                          rewrite(*op->right_operand(), false));
+        if (is_root) return rewritten;
+        return cached[&e] = cache(e, rewritten);
+      } else {
+        return const_cast<E*>(op);
+      }
+    });
+  };
+
+  auto residual = rewrite(expr, true);
+  if (plan.subexprs.empty()) return std::nullopt;
+
+  plan.residual_inputs = inputs_of(*residual);
+  auto residual_name = name + ".residual";
+  jit->Compile(residual_name, *residual);
+  plan.eval_fn = jit->LookupUserQuery(residual_name);
+  plan.eval_popct_fn = jit->LookupUserPopCountQuery(residual_name);
+
+  return plan;
+}
+
 std::shared_ptr<Query> Query::Make(const std::string& name, const std::string& expr,
                                    ExecutionContext* context) {
   JITMAP_PRE_NE(context, nullptr);
@@ -92,21 +458,31 @@ std::shared_ptr<Query> Query::Make(const std::string& name, const std::string& e
   ValidateQueryName(name);
 
   auto query = std::shared_ptr<Query>(new Query(name, expr, context));
-  context->jit()->Compile(query->name(), query->expr());
+  context->jit()->Compile(query->name(), query->impl().compiled_expr());
 
   // Cache functions
   query->impl().dense_eval_fn_ = context->jit()->LookupUserQuery(name);
   query->impl().dense_eval_popct_fn_ = context->jit()->LookupUserPopCountQuery(name);
+  query->impl().jit_ = context->jit();
+
+  if (auto cache = context->cache()) {
+    auto& impl = query->impl();
+    impl.cache_ = cache;
+    impl.cache_plan_ = MakeCachePlan(name, impl.expr(), impl.variables(), &impl.builder_,
+                                     context->jit());
+  }
 
   return query;
 }
 
 const std::string& Query::name() const { return impl().name(); }
 const Expr& Query::expr() const { return impl().expr(); }
+const Expr& Query::compiled_expr() const { return impl().compiled_expr(); }
 const std::vector<std::string>& Query::variables() const { return impl().variables(); }
 
+// Aligned like the bitmaps handed to the kernels, which use aligned loads.
 template <char FillByte>
-class StaticArray : public std::array<char, kBytesPerContainer> {
+class alignas(kCacheLineSize) StaticArray : public std::array<char, kBytesPerContainer> {
  public:
   StaticArray() noexcept : array() { fill(FillByte); }
 };
@@ -136,10 +512,18 @@ static inline const char* CoalesceInputPointer(const char* input,
   throw Exception("Unreachable in ", __FUNCTION__);
 }
 
-int32_t Query::Eval(const EvaluationContext& eval_ctx, std::vector<const char*> inputs,
-                    char* output) {
-  auto vars = variables();
+// The dense kernels of an expression with a shift operator also read the inputs
+// of the adjacent containers, see `DenseInputsCount`. They are empty when a
+// single container is evaluated.
+static inline void AppendAdjacentInputs(const QueryImpl& impl,
+                                        std::vector<const char*>& inputs) {
+  if (impl.has_shift()) inputs.resize(3 * impl.variables().size(), kEmptyBitmap.data());
+}
 
+static inline void ValidateAndCoalesceInputs(const EvaluationContext& eval_ctx,
+                                             const std::vector<std::string>& vars,
+                                             std::vector<const char*>& inputs,
+                                             char* output) {
   JITMAP_PRE_EQ(vars.size(), inputs.size());
   JITMAP_PRE_NE(output, nullptr);
 
@@ -149,6 +533,12 @@ int32_t Query::Eval(const EvaluationContext& eval_ctx, std::vector<const char*>
       inputs[i] = CoalesceInputPointer(inputs[i], vars[i], policy);
     }
   }
+}
+
+int32_t Query::Eval(const EvaluationContext& eval_ctx, std::vector<const char*> inputs,
+                    char* output) {
+  ValidateAndCoalesceInputs(eval_ctx, variables(), inputs, output);
+  AppendAdjacentInputs(impl(), inputs);
 
   if (eval_ctx.popcount()) {
     auto eval_fn = impl().dense_eval_popct_fn();
@@ -165,6 +555,567 @@ int32_t Query::Eval(std::vector<const char*> inputs, char* output) {
   return Eval(ctx, std::move(inputs), output);
 }
 
+int32_t Query::Eval(const EvaluationContext& eval_ctx, std::vector<const char*> inputs,
+                    const std::vector<uint64_t>& versions, char* output) {
+  const auto& vars = variables();
+  ValidateAndCoalesceInputs(eval_ctx, vars, inputs, output);
+  JITMAP_PRE_EQ(vars.size(), versions.size());
+  AppendAdjacentInputs(impl(), inputs);
+
+  const auto& plan = impl().cache_plan();
+  if (!plan) return EvalUnsafe(eval_ctx, inputs, output);
+
+  auto cache = impl().cache();
+  // Holds a reference on the buffers for the duration of the evaluation.
+  std::vector<CachedBuffer> buffers(plan->subexprs.size());
+  auto input_of = [&](size_t i) {
+    return i < vars.size() ? inputs[i] : buffers[i - vars.size()].get();
+  };
+
+  // The sub-expressions are looked up from the residual down, the nested ones
+  // are only evaluated on a miss of the enclosing one.
+  std::function<void(size_t)> resolve = [&](size_t id) {
+    const auto& sub = plan->subexprs[id];
+    ResultCacheKey key{sub.canonical, {}};
+    for (auto i : sub.versions) key.versions.push_back(versions[i]);
+
+    auto buffer = cache->Lookup(key);
+    if (buffer == nullptr) {
+      std::vector<const char*> sub_inputs;
+      for (auto i : sub.inputs) {
+        if (i >= vars.size() && buffers[i - vars.size()] == nullptr) {
+          resolve(i - vars.size());
+        }
+        sub_inputs.push_back(input_of(i));
+      }
+
+      auto writable = cache->Allocate();
+      sub.eval_fn(sub_inputs.data(), writable.get());
+      cache->Insert(std::move(key), writable);
+      buffer = std::move(writable);
+    }
+
+    buffers[id] = std::move(buffer);
+  };
+
+  std::vector<const char*> residual_inputs;
+  residual_inputs.reserve(plan->residual_inputs.size());
+  for (auto i : plan->residual_inputs) {
+    if (i >= vars.size() && buffers[i - vars.size()] == nullptr) resolve(i - vars.size());
+    residual_inputs.push_back(input_of(i));
+  }
+
+  if (eval_ctx.popcount()) {
+    return plan->eval_popct_fn(residual_inputs.data(), output);
+  }
+
+  plan->eval_fn(residual_inputs.data(), output);
+  return kUnknownPopCount;
+}
+
+std::vector<int32_t> Query::EvalBatch(const EvaluationContext& eval_ctx,
+                                      std::vector<const char*> inputs,
+                                      const std::vector<char*>& outputs) {
+  const auto& vars = variables();
+  JITMAP_PRE_EQ(vars.size() * outputs.size(), inputs.size());
+
+  auto policy = eval_ctx.missing_policy();
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (inputs[i] == nullptr) {
+      inputs[i] = CoalesceInputPointer(inputs[i], vars[i % vars.size()], policy);
+    }
+  }
+
+  for (auto output : outputs) JITMAP_PRE_NE(output, nullptr);
+
+  if (impl().has_shift()) {
+    // See `AppendAdjacentInputs`, the inputs of each output are padded.
+    std::vector<const char*> padded;
+    padded.reserve(3 * inputs.size());
+    for (auto it = inputs.cbegin(); it != inputs.cend(); it += vars.size()) {
+      padded.insert(padded.end(), it, it + vars.size());
+      padded.insert(padded.end(), 2 * vars.size(), kEmptyBitmap.data());
+    }
+    inputs = std::move(padded);
+  }
+
+  std::vector<int32_t> popcounts(outputs.size(), kUnknownPopCount);
+  auto eval_fn = impl().dense_eval_batch_fn();
+  eval_fn(inputs.data(), const_cast<char**>(outputs.data()),
+          eval_ctx.popcount() ? popcounts.data() : nullptr, outputs.size());
+  return popcounts;
+}
+
+void Query::EvalAsync(const EvaluationContext& eval_ctx, std::vector<const char*> inputs,
+                      char* output, EvalCallback callback) {
+  JITMAP_PRE(callback != nullptr);
+  ValidateAndCoalesceInputs(eval_ctx, variables(), inputs, output);
+  AppendAdjacentInputs(impl(), inputs);
+
+  impl().async_evaluator().Submit(
+      {std::move(inputs), output, eval_ctx.popcount(), std::move(callback)});
+}
+
+std::future<int32_t> Query::EvalAsync(const EvaluationContext& eval_ctx,
+                                      std::vector<const char*> inputs, char* output) {
+  // std::function must be copyable, thus the promise is shared.
+  auto promise = std::make_shared<std::promise<int32_t>>();
+  auto future = promise->get_future();
+  EvalAsync(eval_ctx, std::move(inputs), output,
+            [promise](int32_t popcount, std::exception_ptr error) {
+              if (error) {
+                promise->set_exception(error);
+              } else {
+                promise->set_value(popcount);
+              }
+            });
+  return future;
+}
+
+// A conservative summary of a bitmap derived from the container statistics.
+// `any` has a bit set for every block which may have a set bit, `full`
+// indicates that the bitmap is known to be full.
+struct ResultBounds {
+  ProxyBitmap any;
+  bool full;
+
+  bool empty() const { return any.none(); }
+};
+
+// Propagate the bounds of the inputs through the expression.
+struct ResultBoundsVisitor {
+  const std::unordered_map<std::string, ResultBounds>& inputs;
+
+  ResultBounds operator()(const VariableExpr* e) { return inputs.at(e->value()); }
+  ResultBounds operator()(const EmptyBitmapExpr*) { return {0, false}; }
+  ResultBounds operator()(const FullBitmapExpr*) { return {ProxyBitmap().set(), true}; }
+
+  ResultBounds operator()(const NotOpExpr* e) {
+    auto operand = e->operand()->Visit(*this);
+    if (operand.full) return {0, false};
+    return {ProxyBitmap().set(), operand.empty()};
+  }
+
+  // The bits move across the blocks and in from the adjacent containers.
+  ResultBounds operator()(const ShiftOpExpr*) { return {ProxyBitmap().set(), false}; }
+
+  ResultBounds operator()(const AndOpExpr* e) {
+    auto [lhs, rhs] = VisitBinary(e);
+    return {lhs.any & rhs.any, lhs.full && rhs.full};
+  }
+
+  ResultBounds operator()(const OrOpExpr* e) {
+    auto [lhs, rhs] = VisitBinary(e);
+    return {lhs.any | rhs.any, lhs.full || rhs.full};
+  }
+
+  ResultBounds operator()(const XorOpExpr* e) {
+    auto [lhs, rhs] = VisitBinary(e);
+    if (lhs.full && rhs.full) return {0, false};
+    return {lhs.any | rhs.any, (lhs.full && rhs.empty()) || (rhs.full && lhs.empty())};
+  }
+
+ private:
+  std::pair<ResultBounds, ResultBounds> VisitBinary(const BinaryOpExpr* e) {
+    return {e->left_operand()->Visit(*this), e->right_operand()->Visit(*this)};
+  }
+};
+
+// The value of an expression once the constant inputs are substituted, see
+// `Query::EvalShared`.
+struct FoldedValue {
+  enum Kind { EMPTY, FULL, INPUT, UNKNOWN };
+
+  Kind kind;
+  // The index of the input if kind is INPUT.
+  size_t input = 0;
+
+  bool operator==(const FoldedValue& rhs) const {
+    return kind == rhs.kind && (kind != INPUT || input == rhs.input);
+  }
+};
+
+// Fold the expression with the constant inputs, the rules of `ConstantFolding`
+// and `SameOperandFolding`.
+struct FoldingVisitor {
+  const std::unordered_map<std::string, FoldedValue>& inputs;
+
+  FoldedValue operator()(const VariableExpr* e) { return inputs.at(e->value()); }
+  FoldedValue operator()(const EmptyBitmapExpr*) { return {FoldedValue::EMPTY}; }
+  FoldedValue operator()(const FullBitmapExpr*) { return {FoldedValue::FULL}; }
+
+  FoldedValue operator()(const NotOpExpr* e) {
+    auto operand = e->operand()->Visit(*this);
+    if (operand.kind == FoldedValue::EMPTY) return {FoldedValue::FULL};
+    if (operand.kind == FoldedValue::FULL) return {FoldedValue::EMPTY};
+    return {FoldedValue::UNKNOWN};
+  }
+
+  // The inputs are only known at the evaluated container, the shifted bits
+  // come in from the adjacent containers.
+  FoldedValue operator()(const ShiftOpExpr*) { return {FoldedValue::UNKNOWN}; }
+
+  FoldedValue operator()(const AndOpExpr* e) {
+    auto [lhs, rhs] = VisitBinary(e);
+    if (lhs.kind == FoldedValue::EMPTY || rhs.kind == FoldedValue::FULL) return lhs;
+    if (rhs.kind == FoldedValue::EMPTY || lhs.kind == FoldedValue::FULL) return rhs;
+    return lhs == rhs ? lhs : FoldedValue{FoldedValue::UNKNOWN};
+  }
+
+  FoldedValue operator()(const OrOpExpr* e) {
+    auto [lhs, rhs] = VisitBinary(e);
+    if (lhs.kind == FoldedValue::FULL || rhs.kind == FoldedValue::EMPTY) return lhs;
+    if (rhs.kind == FoldedValue::FULL || lhs.kind == FoldedValue::EMPTY) return rhs;
+    return lhs == rhs ? lhs : FoldedValue{FoldedValue::UNKNOWN};
+  }
+
+  FoldedValue operator()(const XorOpExpr* e) {
+    auto [lhs, rhs] = VisitBinary(e);
+    if (rhs.kind == FoldedValue::EMPTY) return lhs;
+    if (lhs.kind == FoldedValue::EMPTY) return rhs;
+    if (lhs.kind == FoldedValue::FULL && rhs.kind == FoldedValue::FULL) {
+      return {FoldedValue::EMPTY};
+    }
+    if (lhs.kind == FoldedValue::INPUT && lhs == rhs) return {FoldedValue::EMPTY};
+    return {FoldedValue::UNKNOWN};
+  }
+
+ private:
+  std::pair<FoldedValue, FoldedValue> VisitBinary(const BinaryOpExpr* e) {
+    return {e->left_operand()->Visit(*this), e->right_operand()->Visit(*this)};
+  }
+};
+
+// Evaluate only the blocks which may be non-empty when at most this many
+// blocks remain, otherwise the full kernel is cheaper.
+constexpr size_t kMaxPrunedBlocks = kBitsInProxy / 2;
+
+// Views on the payloads of in-memory containers. Empty and full containers
+// are viewed as the static dense bitmaps, keeping their statistics.
+static ContainerView ViewOf(const Container* container) {
+  if (container == nullptr) return {};
+
+  ContainerView view;
+  view.statistics = container->statistics();
+  switch (container->container_type()) {
+    case BITMAP:
+      view.data = static_cast<const DenseContainer*>(container)->data();
+      break;
+    case ARRAY: {
+      auto array = static_cast<const ArrayContainer*>(container);
+      view = {ARRAY, static_cast<uint32_t>(array->cardinality()), array->data(),
+              view.statistics};
+      break;
+    }
+    case RUN_LENGTH: {
+      auto runs = static_cast<const RunContainer*>(container);
+      view = {RUN_LENGTH, static_cast<uint32_t>(runs->n_runs()), runs->data(),
+              view.statistics};
+      break;
+    }
+    case EMPTY:
+      view.data = kEmptyBitmap.data();
+      break;
+    case FULL:
+      view.data = kFullBitmap.data();
+      break;
+  }
+  return view;
+}
+
+// Return the dense bitmap of a view, a sparse view is decoded in a container
+// appended to `decoded`.
+static const char* DenseInputOf(const ContainerView& view,
+                                std::vector<std::unique_ptr<DenseContainer>>* decoded) {
+  switch (view.type) {
+    case BITMAP:
+      return static_cast<const char*>(view.data);
+    case ARRAY: {
+      auto dense = std::make_unique<DenseContainer>();
+      auto values = static_cast<const Container::index_type*>(view.data);
+      for (uint32_t i = 0; i < view.size; i++) dense->set(values[i]);
+      decoded->push_back(std::move(dense));
+      break;
+    }
+    case RUN_LENGTH: {
+      auto dense = std::make_unique<DenseContainer>();
+      SetRuns(static_cast<const Run*>(view.data), view.size, dense->bitmap().word());
+      decoded->push_back(std::move(dense));
+      break;
+    }
+    default:
+      throw Exception("Unsupported container view type ", static_cast<int>(view.type));
+  }
+  return reinterpret_cast<const char*>(decoded->back()->data());
+}
+
+int32_t Query::EvalContainers(const EvaluationContext& eval_ctx,
+                              const std::vector<const Container*>& containers,
+                              char* output) {
+  std::vector<ContainerView> views(containers.size());
+  std::transform(containers.cbegin(), containers.cend(), views.begin(), ViewOf);
+  return EvalViews(eval_ctx, views, output);
+}
+
+int32_t Query::EvalViews(const EvaluationContext& eval_ctx,
+                         const std::vector<ContainerView>& views, char* output) {
+  return EvalViewsAndRuns(eval_ctx, views, output, nullptr);
+}
+
+int32_t Query::EvalViewsAndRuns(const EvaluationContext& eval_ctx,
+                                const std::vector<ContainerView>& views, char* output,
+                                int32_t* n_runs) {
+  if (n_runs != nullptr) *n_runs = kUnknownPopCount;
+
+  const auto& vars = variables();
+  const bool has_shift = impl().has_shift();
+  if (!has_shift || views.size() != 3 * vars.size()) {
+    JITMAP_PRE_EQ(vars.size(), views.size());
+  }
+  JITMAP_PRE_NE(output, nullptr);
+
+  std::vector<const char*> inputs(views.size());
+  std::vector<uint32_t> sizes(vars.size(), 0);
+  std::vector<ContainerType> types(vars.size(), BITMAP);
+  std::unordered_map<std::string, ResultBounds> bounds;
+  bool all_dense = true;
+  // The sparse inputs decoded for the dense kernels.
+  std::vector<std::unique_ptr<DenseContainer>> decoded;
+
+  auto policy = eval_ctx.missing_policy();
+  for (size_t i = 0; i < views.size(); i++) {
+    const auto& view = views[i];
+    // The views of the adjacent containers, see `DenseInputsCount`, are only
+    // read by the kernels.
+    if (i >= vars.size()) {
+      inputs[i] = kEmptyBitmap.data();
+      if (view.data != nullptr) inputs[i] = DenseInputOf(view, &decoded);
+      continue;
+    }
+
+    if (view.data == nullptr) {
+      inputs[i] = CoalesceInputPointer(nullptr, vars[i], policy);
+      bool full = policy == MissingPolicy::REPLACE_WITH_FULL;
+      auto any = full ? ProxyBitmap().set() : ProxyBitmap();
+      bounds.emplace(vars[i], ResultBounds{any, full});
+      continue;
+    }
+
+    const auto& statistics = view.statistics;
+    bounds.emplace(vars[i], ResultBounds{statistics.proxy(), statistics.full()});
+
+    inputs[i] = static_cast<const char*>(view.data);
+    switch (view.type) {
+      case BITMAP:
+        break;
+      case ARRAY:
+      case RUN_LENGTH:
+        // The specialized kernels don't read the adjacent containers.
+        if (has_shift) {
+          inputs[i] = DenseInputOf(view, &decoded);
+          break;
+        }
+        sizes[i] = view.size;
+        types[i] = view.type;
+        all_dense = false;
+        break;
+      default:
+        throw Exception("Unsupported container view type ", static_cast<int>(view.type));
+    }
+  }
+  AppendAdjacentInputs(impl(), inputs);
+
+  // Skip the kernel if the statistics prove the result empty or full.
+  auto result = impl().expr().Visit(ResultBoundsVisitor{bounds});
+  if (result.empty() || result.full) {
+    std::memset(output, result.full ? 0xFF : 0x00, kBytesPerContainer);
+    if (n_runs != nullptr) *n_runs = result.full ? 1 : 0;
+    if (!eval_ctx.popcount()) return kUnknownPopCount;
+    return result.full ? static_cast<int32_t>(kBitsPerContainer) : 0;
+  }
+
+  if (all_dense) {
+    if (result.any.count() > kMaxPrunedBlocks) {
+      if (n_runs != nullptr && eval_ctx.popcount()) {
+        return impl().dense_eval_runs_fn()(inputs.data(), output, n_runs);
+      }
+      return EvalUnsafe(eval_ctx, inputs, output);
+    }
+
+    // Only compute the cachelines of the blocks which may be non-empty, the
+    // output is zeroed beforehand such that the delta is the popcount.
+    constexpr size_t kLinesPerBlock = kBitsPerProxyBit / kBitsPerCacheLine;
+    DirtyLines lines;
+    for (size_t b = 0; b < kBitsInProxy; b++) {
+      if (!result.any[b]) continue;
+      for (size_t l = 0; l < kLinesPerBlock; l++) lines.MarkLine(b * kLinesPerBlock + l);
+    }
+
+    std::memset(output, 0, kBytesPerContainer);
+    auto eval_fn = impl().dense_eval_incremental_fn();
+    auto popcount = eval_fn(inputs.data(), output, lines.data());
+
+    // The runs can only start in the computed blocks, the others are zeroed.
+    if (n_runs != nullptr) {
+      constexpr size_t kWordsPerBlock = kBitsPerProxyBit / DenseBitset::kBitsPerWord;
+      auto words = reinterpret_cast<const BitsetWordType*>(output);
+      size_t count = 0;
+      for (size_t b = 0; b < kBitsInProxy; b++) {
+        if (!result.any[b]) continue;
+        count += CountRuns(words, b * kWordsPerBlock, (b + 1) * kWordsPerBlock);
+      }
+      *n_runs = static_cast<int32_t>(count);
+    }
+    return eval_ctx.popcount() ? popcount : kUnknownPopCount;
+  }
+
+  // The specialized kernels don't count the runs, see `EvalViewsAndRuns`.
+  auto eval_fn = impl().specialized_eval_fn(types);
+  auto popcount = eval_fn(inputs.data(), sizes.data(), output);
+  return eval_ctx.popcount() ? popcount : kUnknownPopCount;
+}
+
+// Allocate the result of an evaluation, see `Query::Eval`.
+static std::unique_ptr<DenseContainer> MakeResult(char** output) {
+  auto result = std::make_unique<DenseContainer>();
+  *output = reinterpret_cast<char*>(result->bitmap().word());
+  return result;
+}
+
+// Re-encode a dense result following the output policy, see
+// `EvaluationContext::OutputPolicy`. The runs are counted if `n_runs` is
+// unknown and the cardinality doesn't settle the representation.
+static std::unique_ptr<Container> EncodeResult(const EvaluationContext& eval_ctx,
+                                               std::unique_ptr<DenseContainer> result,
+                                               int32_t popcount, int32_t n_runs) {
+  if (!eval_ctx.compact()) return result;
+  if (popcount == 0) return std::make_unique<EmptyContainer>();
+  if (popcount == static_cast<int32_t>(kBitsPerContainer)) {
+    return std::make_unique<FullContainer>();
+  }
+
+  if (n_runs == kUnknownPopCount) n_runs = CountRuns(result->data());
+  switch (SmallestContainerType(popcount, n_runs)) {
+    case ARRAY:
+      return std::make_unique<ArrayContainer>(ArrayContainer::FromDense(*result));
+    case RUN_LENGTH:
+      return std::make_unique<RunContainer>(RunContainer::FromDense(*result));
+    default:
+      break;
+  }
+  return result;
+}
+
+std::unique_ptr<Container> Query::Eval(const EvaluationContext& eval_ctx,
+                                       std::vector<const char*> inputs) {
+  char* output = nullptr;
+  auto result = MakeResult(&output);
+  ValidateAndCoalesceInputs(eval_ctx, variables(), inputs, output);
+  AppendAdjacentInputs(impl(), inputs);
+
+  if (!eval_ctx.compact()) {
+    EvalUnsafe(eval_ctx, inputs, output);
+    return result;
+  }
+
+  int32_t n_runs = 0;
+  auto popcount = impl().dense_eval_runs_fn()(inputs.data(), output, &n_runs);
+  return EncodeResult(eval_ctx, std::move(result), popcount, n_runs);
+}
+
+std::unique_ptr<Container> Query::EvalContainers(
+    const EvaluationContext& eval_ctx, const std::vector<const Container*>& containers) {
+  std::vector<ContainerView> views(containers.size());
+  std::transform(containers.cbegin(), containers.cend(), views.begin(), ViewOf);
+  return EvalViews(eval_ctx, views);
+}
+
+std::unique_ptr<Container> Query::EvalViews(const EvaluationContext& eval_ctx,
+                                            const std::vector<ContainerView>& views) {
+  char* output = nullptr;
+  auto result = MakeResult(&output);
+
+  int32_t n_runs = kUnknownPopCount;
+  auto popcount = EvalViewsAndRuns(eval_ctx, views, output, &n_runs);
+  return EncodeResult(eval_ctx, std::move(result), popcount, n_runs);
+}
+
+std::shared_ptr<const Container> Query::EvalShared(
+    const EvaluationContext& eval_ctx, const std::vector<const ContainerHandle*>& ins) {
+  return EvalShared(eval_ctx, ins, {}, {});
+}
+
+std::shared_ptr<const Container> Query::EvalShared(
+    const EvaluationContext& eval_ctx, const std::vector<const ContainerHandle*>& ins,
+    const std::vector<const ContainerHandle*>& previous,
+    const std::vector<const ContainerHandle*>& next) {
+  const auto& vars = variables();
+  JITMAP_PRE_EQ(vars.size(), ins.size());
+  if (!previous.empty()) JITMAP_PRE_EQ(vars.size(), previous.size());
+  if (!next.empty()) JITMAP_PRE_EQ(vars.size(), next.size());
+
+  std::vector<const Container*> containers(ins.size(), nullptr);
+  std::unordered_map<std::string, FoldedValue> values;
+  auto policy = eval_ctx.missing_policy();
+  for (size_t i = 0; i < ins.size(); i++) {
+    FoldedValue value{FoldedValue::INPUT, i};
+    if (ins[i] == nullptr) {
+      // Throws with the ERROR policy, before folding may drop the input.
+      CoalesceInputPointer(nullptr, vars[i], policy);
+      if (policy == MissingPolicy::REPLACE_WITH_EMPTY) value = {FoldedValue::EMPTY};
+      if (policy == MissingPolicy::REPLACE_WITH_FULL) value = {FoldedValue::FULL};
+    } else {
+      containers[i] = ins[i]->get();
+      if (ins[i]->type() == EMPTY) value = {FoldedValue::EMPTY};
+      if (ins[i]->type() == FULL) value = {FoldedValue::FULL};
+    }
+    values.emplace(vars[i], value);
+  }
+
+  // The constant results are left to `EvalContainers` which honors the
+  // output policy without invoking a kernel.
+  auto folded = impl().expr().Visit(FoldingVisitor{values});
+  if (folded.kind == FoldedValue::INPUT) return ins[folded.input]->shared();
+  if (!impl().has_shift()) return EvalContainers(eval_ctx, containers);
+
+  // The inputs followed by the adjacent containers, see `DenseInputsCount`.
+  std::vector<ContainerView> views(3 * vars.size());
+  std::transform(containers.cbegin(), containers.cend(), views.begin(), ViewOf);
+  auto view_adjacent = [&](const std::vector<const ContainerHandle*>& handles,
+                           size_t offset) {
+    for (size_t i = 0; i < handles.size(); i++) {
+      if (handles[i] != nullptr) views[offset + i] = ViewOf(handles[i]->get());
+    }
+  };
+  view_adjacent(previous, vars.size());
+  view_adjacent(next, 2 * vars.size());
+
+  return EvalViews(eval_ctx, views);
+}
+
+int32_t Query::EvalTiny(size_t n_bits, const uint64_t* inputs, uint64_t* output) {
+  if (!IsTinySize(n_bits)) throw Exception("Unsupported tiny bitmap size ", n_bits);
+  JITMAP_PRE_NE(inputs, nullptr);
+  JITMAP_PRE_NE(output, nullptr);
+  return impl().tiny_eval_fn(n_bits)(inputs, output);
+}
+
+int32_t Query::EvalIncremental(const EvaluationContext& eval_ctx,
+                               std::vector<const char*> inputs, const DirtyLines& dirty,
+                               char* output, int32_t popcount) {
+  ValidateAndCoalesceInputs(eval_ctx, variables(), inputs, output);
+  AppendAdjacentInputs(impl(), inputs);
+
+  // A shifted bit crosses the cachelines, the result is recomputed.
+  if (impl().has_shift() && !dirty.none()) return EvalUnsafe(eval_ctx, inputs, output);
+
+  auto eval_fn = impl().dense_eval_incremental_fn();
+  auto delta = dirty.none() ? 0 : eval_fn(inputs.data(), output, dirty.data());
+
+  if (!eval_ctx.popcount() || popcount == kUnknownPopCount) return kUnknownPopCount;
+  return popcount + delta;
+}
+
 int32_t Query::EvalUnsafe(const EvaluationContext& eval_ctx,
                           std::vector<const char*>& inputs, char* output) {
   if (eval_ctx.popcount()) {
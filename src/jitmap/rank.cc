@@ -0,0 +1,141 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/rank.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace jitmap {
+
+constexpr size_t kBitsPerWord = sizeof(BitsetWordType) * CHAR_BIT;
+
+// The kernels are instantiated once for the default target and once for
+// popcnt/bmi2, `__builtin_popcountll` is otherwise a library call.
+
+static inline size_t BuildRankDirectoryImpl(const BitsetWordType* words, size_t n_words,
+                                            uint32_t* ranks) {
+  uint32_t sum = 0;
+  size_t b = 0;
+  for (size_t i = 0; i < n_words; i += kWordsPerRankBlock, b++) {
+    ranks[b] = sum;
+    const size_t last = std::min(i + kWordsPerRankBlock, n_words);
+    for (size_t w = i; w < last; w++) sum += __builtin_popcountll(words[w]);
+  }
+  ranks[b] = sum;
+  return sum;
+}
+
+static inline size_t RankWordsImpl(const BitsetWordType* words, const uint32_t* ranks,
+                                   size_t i) {
+  const size_t word = i / kBitsPerWord;
+  size_t rank = ranks[i / kBitsPerRankBlock];
+  for (size_t w = word / kWordsPerRankBlock * kWordsPerRankBlock; w < word; w++) {
+    rank += __builtin_popcountll(words[w]);
+  }
+  // Don't touch the word past the end when `i` is the size of the bitset.
+  if (i % kBitsPerWord != 0) {
+    const auto mask = ~BitsetWordType{0} >> (kBitsPerWord - i % kBitsPerWord);
+    rank += __builtin_popcountll(words[word] & mask);
+  }
+  return rank;
+}
+
+static inline size_t SelectInWordScalar(BitsetWordType word, size_t k) {
+  for (; k != 0; k--) word &= word - 1;
+  return __builtin_ctzll(word);
+}
+
+template <typename SelectInWordFn>
+static inline size_t SelectWordsImpl(const BitsetWordType* words, size_t n_words,
+                                     const uint32_t* ranks, size_t k,
+                                     SelectInWordFn select_in_word) {
+  // The last block whose cumulative count is at most k.
+  const size_t n_blocks = RankDirectorySize(n_words) - 1;
+  const size_t b = std::upper_bound(ranks, ranks + n_blocks, k) - ranks - 1;
+
+  k -= ranks[b];
+  for (size_t w = b * kWordsPerRankBlock;; w++) {
+    const size_t count = __builtin_popcountll(words[w]);
+    if (k < count) return w * kBitsPerWord + select_in_word(words[w], k);
+    k -= count;
+  }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("popcnt"))) static size_t BuildRankDirectoryPopcnt(
+    const BitsetWordType* words, size_t n_words, uint32_t* ranks) {
+  return BuildRankDirectoryImpl(words, n_words, ranks);
+}
+
+__attribute__((target("popcnt"))) static size_t RankWordsPopcnt(
+    const BitsetWordType* words, const uint32_t* ranks, size_t i) {
+  return RankWordsImpl(words, ranks, i);
+}
+
+// Deposit the k-th lowest bit of the mask at the position of the k-th set bit
+// of the word, see Pandey et al. "A Fast x86 Implementation of Select".
+__attribute__((target("bmi,bmi2"))) static size_t SelectInWordBmi2(BitsetWordType word,
+                                                                   size_t k) {
+  return _tzcnt_u64(_pdep_u64(BitsetWordType{1} << k, word));
+}
+
+__attribute__((target("popcnt,bmi,bmi2"))) static size_t SelectWordsBmi2(
+    const BitsetWordType* words, size_t n_words, const uint32_t* ranks, size_t k) {
+  return SelectWordsImpl(words, n_words, ranks, k, SelectInWordBmi2);
+}
+
+static const bool kHasPopcnt = __builtin_cpu_supports("popcnt");
+static const bool kHasBmi2 = kHasPopcnt && __builtin_cpu_supports("bmi2");
+
+#endif
+
+size_t BuildRankDirectory(const BitsetWordType* words, size_t n_words, uint32_t* ranks) {
+#if defined(__x86_64__)
+  if (kHasPopcnt) return BuildRankDirectoryPopcnt(words, n_words, ranks);
+#endif
+
+  return BuildRankDirectoryImpl(words, n_words, ranks);
+}
+
+size_t RankWords(const BitsetWordType* words, const uint32_t* ranks, size_t i) {
+#if defined(__x86_64__)
+  if (kHasPopcnt) return RankWordsPopcnt(words, ranks, i);
+#endif
+
+  return RankWordsImpl(words, ranks, i);
+}
+
+size_t SelectWords(const BitsetWordType* words, size_t n_words, const uint32_t* ranks,
+                   size_t k) {
+#if defined(__x86_64__)
+  if (kHasBmi2) return SelectWordsBmi2(words, n_words, ranks, k);
+#endif
+
+  return SelectWordsImpl(words, n_words, ranks, k, SelectInWordScalar);
+}
+
+size_t SelectInWord(BitsetWordType word, size_t k) {
+#if defined(__x86_64__)
+  if (kHasBmi2) return SelectInWordBmi2(word, k);
+#endif
+
+  return SelectInWordScalar(word, k);
+}
+
+}  // namespace jitmap
@@ -0,0 +1,361 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/roaring.h"
+
+#include <cstring>
+
+#include "jitmap/util/exception.h"
+
+namespace jitmap {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "The Roaring format is little-endian");
+
+constexpr uint32_t kCookieNoRuns = 12346;
+constexpr uint32_t kCookie = 12347;
+// With runs, the offsets are only written past this many containers.
+constexpr size_t kNoOffsetThreshold = 4;
+// A container of more elements is serialized as a dense bitmap.
+constexpr size_t kMaxArrayCardinality = 4096;
+constexpr size_t kKeysPerBucket = size_t{1} << 16;
+
+// A container as laid out in the buffer.
+struct SerializedContainer {
+  uint16_t key;
+  ContainerType type;
+  uint32_t cardinality;
+  // The number of values or runs.
+  uint32_t size;
+  const char* payload;
+};
+
+// Bounds-checked little-endian reads.
+class BufferReader {
+ public:
+  BufferReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  T Read() {
+    T value;
+    std::memcpy(&value, Skip(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  const char* Skip(size_t n) {
+    if (size_ - position_ < n) throw Exception("Truncated Roaring bitmap");
+    auto data = data_ + position_;
+    position_ += n;
+    return data;
+  }
+
+  bool done() const noexcept { return position_ == size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t position_ = 0;
+};
+
+static uint16_t Load16(const char* data) {
+  uint16_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Parse a 32-bit bitmap, the reader is left past its last container.
+static std::vector<SerializedContainer> Parse(BufferReader* reader) {
+  const auto cookie = reader->Read<uint32_t>();
+
+  size_t n = 0;
+  const char* run_flags = nullptr;
+  if ((cookie & 0xFFFF) == kCookie) {
+    n = (cookie >> 16) + 1;
+    run_flags = reader->Skip((n + 7) / 8);
+  } else if (cookie == kCookieNoRuns) {
+    n = reader->Read<uint32_t>();
+    if (n > kKeysPerBucket) throw Exception("Invalid Roaring container count ", n);
+  } else {
+    throw Exception("Invalid Roaring cookie ", cookie);
+  }
+
+  const char* header = reader->Skip(n * 2 * sizeof(uint16_t));
+  // The containers are contiguous, the offsets are not needed.
+  if (run_flags == nullptr || n >= kNoOffsetThreshold) {
+    reader->Skip(n * sizeof(uint32_t));
+  }
+
+  std::vector<SerializedContainer> containers(n);
+  for (size_t i = 0; i < n; i++) {
+    auto& container = containers[i];
+    container.key = Load16(header + 4 * i);
+    container.cardinality = uint32_t{Load16(header + 4 * i + 2)} + 1;
+    if (i > 0 && container.key <= containers[i - 1].key) {
+      throw Exception("Roaring container keys are not increasing");
+    }
+
+    if (run_flags != nullptr && (run_flags[i / 8] >> (i % 8)) & 1) {
+      container.type = RUN_LENGTH;
+      container.size = reader->Read<uint16_t>();
+      container.payload = reader->Skip(container.size * sizeof(Run));
+    } else if (container.cardinality <= kMaxArrayCardinality) {
+      container.type = ARRAY;
+      container.size = container.cardinality;
+      container.payload = reader->Skip(container.size * sizeof(uint16_t));
+    } else {
+      container.type = BITMAP;
+      container.payload = reader->Skip(kBytesPerContainer);
+    }
+  }
+
+  return containers;
+}
+
+// Copy a serialized container, validating its content.
+static std::unique_ptr<Container> Materialize(const SerializedContainer& serialized) {
+  switch (serialized.type) {
+    case ARRAY: {
+      std::vector<Container::index_type> values(serialized.size);
+      std::memcpy(values.data(), serialized.payload, values.size() * sizeof(uint16_t));
+      return std::make_unique<ArrayContainer>(std::move(values));
+    }
+    case RUN_LENGTH: {
+      std::vector<Run> runs(serialized.size);
+      std::memcpy(runs.data(), serialized.payload, runs.size() * sizeof(Run));
+      return std::make_unique<RunContainer>(std::move(runs));
+    }
+    default: {
+      auto dense = std::make_unique<DenseContainer>();
+      std::memcpy(dense->bitmap().data(), serialized.payload, kBytesPerContainer);
+      return dense;
+    }
+  }
+}
+
+static void ReadInto(BufferReader* reader, uint32_t high, Bitmap* bitmap) {
+  for (const auto& serialized : Parse(reader)) {
+    bitmap->Insert(high << 16 | serialized.key, Materialize(serialized));
+  }
+}
+
+Bitmap ReadRoaring(const char* data, size_t size) {
+  BufferReader reader{data, size};
+  Bitmap bitmap;
+  ReadInto(&reader, 0, &bitmap);
+  return bitmap;
+}
+
+Bitmap ReadRoaring64(const char* data, size_t size) {
+  BufferReader reader{data, size};
+  Bitmap bitmap;
+
+  const auto n_buckets = reader.Read<uint64_t>();
+  int64_t previous = -1;
+  for (uint64_t b = 0; b < n_buckets; b++) {
+    const auto high = reader.Read<uint32_t>();
+    // The keys of a Bitmap are 32-bit, i.e. 48-bit ids.
+    if (high >= kKeysPerBucket) throw Exception("Roaring id exceeds 2^48");
+    if (int64_t{high} <= previous) throw Exception("Roaring buckets are not increasing");
+    previous = high;
+    ReadInto(&reader, high, &bitmap);
+  }
+
+  return bitmap;
+}
+
+// Append the containers of the keys in [begin, end) as a 32-bit bitmap.
+static void WriteBucket(const Bitmap& bitmap, size_t begin, size_t end,
+                        std::string* out) {
+  struct Entry {
+    uint16_t key;
+    uint32_t cardinality;
+    ContainerType type;
+    uint32_t size;
+    const void* payload;
+  };
+
+  static const Run kFullRun{0, kBitsPerContainer - 1};
+
+  std::vector<Entry> entries;
+  // The dense containers small enough to be read back as arrays.
+  std::vector<ArrayContainer> converted;
+  converted.reserve(end - begin);
+  bool has_runs = false;
+  for (size_t i = begin; i < end; i++) {
+    const auto& handle = bitmap.containers()[i];
+    if (handle.cardinality() == 0) continue;
+
+    Entry entry{static_cast<uint16_t>(bitmap.keys()[i]), handle.cardinality(), BITMAP, 0,
+                nullptr};
+    switch (handle.type()) {
+      case BITMAP: {
+        auto dense = static_cast<const DenseContainer*>(handle.get());
+        if (entry.cardinality > kMaxArrayCardinality) {
+          entry.payload = dense->data();
+          break;
+        }
+        converted.push_back(ArrayContainer::FromDense(*dense));
+        entry = {entry.key, entry.cardinality, ARRAY, entry.cardinality,
+                 converted.back().data()};
+        break;
+      }
+      case ARRAY: {
+        auto array = static_cast<const ArrayContainer*>(handle.get());
+        entry = {entry.key, entry.cardinality, ARRAY, entry.cardinality, array->data()};
+        break;
+      }
+      case RUN_LENGTH: {
+        auto runs = static_cast<const RunContainer*>(handle.get());
+        entry = {entry.key, entry.cardinality, RUN_LENGTH,
+                 static_cast<uint32_t>(runs->n_runs()), runs->data()};
+        break;
+      }
+      default:
+        entry = {entry.key, entry.cardinality, RUN_LENGTH, 1, &kFullRun};
+        break;
+    }
+
+    has_runs |= entry.type == RUN_LENGTH;
+    entries.push_back(entry);
+  }
+
+  auto append = [out](const void* data, size_t size) {
+    out->append(static_cast<const char*>(data), size);
+  };
+  auto append16 = [&append](uint16_t value) { append(&value, sizeof(value)); };
+  auto append32 = [&append](uint32_t value) { append(&value, sizeof(value)); };
+
+  // Offsets are relative to the beginning of this bitmap.
+  const size_t start = out->size();
+  const size_t n = entries.size();
+  if (has_runs) {
+    // An empty bitmap can't be represented with runs, `n` is at least 1.
+    append32(kCookie | static_cast<uint32_t>(n - 1) << 16);
+    std::string run_flags((n + 7) / 8, '\0');
+    for (size_t i = 0; i < n; i++) {
+      if (entries[i].type == RUN_LENGTH) run_flags[i / 8] |= 1 << (i % 8);
+    }
+    out->append(run_flags);
+  } else {
+    append32(kCookieNoRuns);
+    append32(static_cast<uint32_t>(n));
+  }
+
+  for (const auto& entry : entries) {
+    append16(entry.key);
+    append16(static_cast<uint16_t>(entry.cardinality - 1));
+  }
+
+  auto payload_size = [](const Entry& entry) -> size_t {
+    switch (entry.type) {
+      case ARRAY:
+        return entry.size * sizeof(uint16_t);
+      case RUN_LENGTH:
+        return sizeof(uint16_t) + entry.size * sizeof(Run);
+      default:
+        return kBytesPerContainer;
+    }
+  };
+
+  if (!has_runs || n >= kNoOffsetThreshold) {
+    size_t offset = out->size() - start + n * sizeof(uint32_t);
+    for (const auto& entry : entries) {
+      append32(static_cast<uint32_t>(offset));
+      offset += payload_size(entry);
+    }
+  }
+
+  for (const auto& entry : entries) {
+    if (entry.type == RUN_LENGTH) append16(static_cast<uint16_t>(entry.size));
+    append(entry.payload, entry.type == RUN_LENGTH ? entry.size * sizeof(Run)
+                                                   : payload_size(entry));
+  }
+}
+
+std::string WriteRoaring(const Bitmap& bitmap) {
+  const auto& keys = bitmap.keys();
+  if (!keys.empty() && keys.back() >= kKeysPerBucket) {
+    throw Exception("Key ", keys.back(), " doesn't fit the 32-bit Roaring format");
+  }
+
+  std::string out;
+  WriteBucket(bitmap, 0, keys.size(), &out);
+  return out;
+}
+
+std::string WriteRoaring64(const Bitmap& bitmap) {
+  const auto& keys = bitmap.keys();
+
+  // The range of containers of each bucket, skipping the buckets without
+  // set bits.
+  std::vector<std::pair<size_t, size_t>> buckets;
+  for (size_t begin = 0; begin < keys.size();) {
+    size_t end = begin;
+    uint64_t cardinality = 0;
+    while (end < keys.size() && keys[end] >> 16 == keys[begin] >> 16) {
+      cardinality += bitmap.containers()[end++].cardinality();
+    }
+    if (cardinality != 0) buckets.emplace_back(begin, end);
+    begin = end;
+  }
+
+  std::string out;
+  const uint64_t n_buckets = buckets.size();
+  out.append(reinterpret_cast<const char*>(&n_buckets), sizeof(n_buckets));
+  for (auto [begin, end] : buckets) {
+    const uint32_t high = keys[begin] >> 16;
+    out.append(reinterpret_cast<const char*>(&high), sizeof(high));
+    WriteBucket(bitmap, begin, end, &out);
+  }
+  return out;
+}
+
+FrozenRoaring::FrozenRoaring(const char* data, size_t size) {
+  BufferReader reader{data, size};
+  for (const auto& serialized : Parse(&reader)) {
+    const auto address = reinterpret_cast<uintptr_t>(serialized.payload);
+    const bool aligned = serialized.type == BITMAP ? address % kCacheLineSize == 0
+                                                   : address % sizeof(uint16_t) == 0;
+
+    ContainerView view{serialized.type, serialized.size, serialized.payload,
+                       Statistics{ProxyBitmap().set(),
+                                  static_cast<int32_t>(serialized.cardinality)}};
+    if (!aligned) {
+      copies_.push_back(Materialize(serialized));
+      auto copy = copies_.back().get();
+      switch (serialized.type) {
+        case ARRAY:
+          view.data = static_cast<const ArrayContainer*>(copy)->data();
+          break;
+        case RUN_LENGTH:
+          view.data = static_cast<const RunContainer*>(copy)->data();
+          break;
+        default:
+          view.data = static_cast<const DenseContainer*>(copy)->data();
+          break;
+      }
+    }
+
+    keys_.push_back(serialized.key);
+    views_.push_back(view);
+  }
+}
+
+ContainerView FrozenRoaring::Find(key_index_type key) const {
+  auto i = LowerBound(keys_.data(), keys_.size(), key);
+  if (i == keys_.size() || keys_[i] != key) return {};
+  return views_[i];
+}
+
+}  // namespace jitmap
@@ -0,0 +1,83 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/snapshot.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+
+namespace jitmap {
+
+SharedBitmap::SharedBitmap(Bitmap bitmap) {
+  auto current = std::make_unique<Bitmap>(std::move(bitmap));
+  current->cumulative_cardinalities();
+  current_.store(current.release());
+}
+
+SharedBitmap::~SharedBitmap() { delete current_.load(); }
+
+SharedBitmap::Snapshot SharedBitmap::snapshot() const {
+  // Probe from a position per thread to spread the concurrent readers.
+  static thread_local const size_t start =
+      std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+  while (true) {
+    for (size_t i = 0; i < kMaxReaders; i++) {
+      auto& slot = slots_[(start + i) % kMaxReaders].epoch;
+      uint64_t free = 0;
+      if (slot.load(std::memory_order_relaxed) != 0) continue;
+
+      // The epoch may be incremented before it is pinned, pinning an older
+      // epoch only delays the reclamation. The load of the current version is
+      // ordered after the pin, a writer which saw the slot free published its
+      // version before.
+      if (slot.compare_exchange_strong(free, epoch_.load())) {
+        return Snapshot{&slot, current_.load()};
+      }
+    }
+    std::this_thread::yield();
+  }
+}
+
+void SharedBitmap::Publish(std::unique_ptr<Bitmap> next) {
+  // Build the cache of the bitmap before it is visible, such that the readers
+  // don't race to build it.
+  next->cumulative_cardinalities();
+
+  std::unique_ptr<const Bitmap> previous{current_.exchange(next.release())};
+  // The readers pinning the new epoch can only load the new version.
+  auto retired_epoch = epoch_.fetch_add(1);
+  retired_.emplace_back(retired_epoch, std::move(previous));
+}
+
+size_t SharedBitmap::Reclaim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // A reader pinning epoch `e` may have loaded any version retired at or
+  // after `e`.
+  uint64_t oldest = std::numeric_limits<uint64_t>::max();
+  for (const auto& slot : slots_) {
+    auto epoch = slot.epoch.load();
+    if (epoch != 0) oldest = std::min(oldest, epoch);
+  }
+
+  auto unreachable = [oldest](const auto& retired) { return retired.first < oldest; };
+  retired_.erase(std::remove_if(retired_.begin(), retired_.end(), unreachable),
+                 retired_.end());
+  return retired_.size();
+}
+
+}  // namespace jitmap
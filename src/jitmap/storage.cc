@@ -0,0 +1,270 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/storage.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "jitmap/util/exception.h"
+
+namespace jitmap {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "The storage format is little-endian");
+
+static constexpr uint64_t AlignUp(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+static size_t PayloadSize(ContainerType type, uint32_t size) {
+  switch (type) {
+    case BITMAP:
+      return kBytesPerContainer;
+    case ARRAY:
+      return size_t{size} * sizeof(Container::index_type);
+    case RUN_LENGTH:
+      return size_t{size} * sizeof(Run);
+    default:
+      break;
+  }
+  throw Exception("Invalid stored container type ", static_cast<int>(type));
+}
+
+// The full container stored as a single run.
+static const Run kFullRun{0, kBitsPerContainer - 1};
+
+void WriteBitmap(const Bitmap& bitmap, const std::string& path) {
+  const auto& keys = bitmap.keys();
+  const auto& containers = bitmap.containers();
+
+  std::vector<uint32_t> stored_keys;
+  std::vector<StorageEntry> entries;
+  std::vector<const void*> payloads;
+  for (size_t i = 0; i < keys.size(); i++) {
+    const auto& handle = containers[i];
+    StorageEntry entry{};
+    const void* payload = nullptr;
+    switch (handle.type()) {
+      case BITMAP:
+        payload = static_cast<const DenseContainer*>(handle.get())->data();
+        break;
+      case ARRAY: {
+        auto array = static_cast<const ArrayContainer*>(handle.get());
+        entry.size = array->cardinality();
+        payload = array->data();
+        break;
+      }
+      case RUN_LENGTH: {
+        auto runs = static_cast<const RunContainer*>(handle.get());
+        entry.size = runs->n_runs();
+        payload = runs->data();
+        break;
+      }
+      case FULL:
+        entry.size = 1;
+        payload = &kFullRun;
+        break;
+      case EMPTY:
+        continue;
+    }
+
+    const auto& statistics = handle.get()->statistics();
+    entry.type = handle.type() == FULL ? RUN_LENGTH : handle.type();
+    entry.cardinality = handle.cardinality();
+    entry.proxy = statistics.proxy().to_ullong();
+
+    stored_keys.push_back(keys[i]);
+    entries.push_back(entry);
+    payloads.push_back(payload);
+  }
+
+  StorageHeader header{};
+  std::memcpy(header.magic, kStorageMagic, sizeof(kStorageMagic));
+  header.version = kStorageVersion;
+  header.n_containers = static_cast<uint32_t>(entries.size());
+  header.keys_offset = sizeof(StorageHeader);
+  header.entries_offset =
+      AlignUp(header.keys_offset + stored_keys.size() * sizeof(uint32_t), kCacheLineSize);
+
+  const uint64_t entries_size = entries.size() * sizeof(StorageEntry);
+  uint64_t offset = AlignUp(header.entries_offset + entries_size, kCacheLineSize);
+  for (auto& entry : entries) {
+    entry.offset = offset;
+    offset = AlignUp(offset + PayloadSize(entry.type, entry.size), kCacheLineSize);
+  }
+  header.file_size = offset;
+
+  // Write a temporary file renamed over the destination, such that the
+  // processes mapping the previous file are not affected.
+  const std::string tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!out) throw Exception("Can't open '", tmp_path, "' for writing");
+
+  uint64_t written = 0;
+  auto write = [&](const void* data, size_t size) {
+    out.write(static_cast<const char*>(data), size);
+    written += size;
+  };
+  auto pad = [&](uint64_t until) {
+    static const char kZeros[kCacheLineSize] = {};
+    write(kZeros, until - written);
+  };
+
+  write(&header, sizeof(header));
+  write(stored_keys.data(), stored_keys.size() * sizeof(uint32_t));
+  pad(header.entries_offset);
+  write(entries.data(), entries.size() * sizeof(StorageEntry));
+  for (size_t i = 0; i < entries.size(); i++) {
+    pad(entries[i].offset);
+    write(payloads[i], PayloadSize(entries[i].type, entries[i].size));
+  }
+  pad(header.file_size);
+
+  out.close();
+  if (!out) throw Exception("Failed writing '", tmp_path, "'");
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    throw Exception("Can't rename '", tmp_path, "': ", std::strerror(errno));
+  }
+}
+
+std::unique_ptr<MappedBitmap> MappedBitmap::Open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw Exception("Can't open '", path, "': ", std::strerror(errno));
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw Exception("Can't stat '", path, "': ", std::strerror(errno));
+  }
+
+  const size_t size = st.st_size;
+  if (size < sizeof(StorageHeader)) {
+    ::close(fd);
+    throw Exception("File '", path, "' is too small to be a bitmap");
+  }
+
+  // The mapping holds a reference on the file, the descriptor can be closed.
+  void* data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    throw Exception("Can't map '", path, "': ", std::strerror(errno));
+  }
+
+  std::unique_ptr<MappedBitmap> bitmap{
+      new MappedBitmap(static_cast<const char*>(data), size)};
+
+  const auto& header = bitmap->header();
+  const uint64_t n = header.n_containers;
+  if (std::memcmp(header.magic, kStorageMagic, sizeof(kStorageMagic)) != 0) {
+    throw Exception("File '", path, "' is not a bitmap");
+  }
+  if (header.version != kStorageVersion) {
+    throw Exception("Unsupported bitmap version ", header.version, " in '", path, "'");
+  }
+  if (header.file_size != size || header.keys_offset % kCacheLineSize != 0 ||
+      header.entries_offset % kCacheLineSize != 0 ||
+      header.keys_offset > size ||
+      n > (size - header.keys_offset) / sizeof(uint32_t) ||
+      header.entries_offset > size ||
+      n > (size - header.entries_offset) / sizeof(StorageEntry)) {
+    throw Exception("Bitmap file '", path, "' is truncated or corrupted");
+  }
+
+  return bitmap;
+}
+
+MappedBitmap::~MappedBitmap() { ::munmap(const_cast<char*>(data_), size_); }
+
+const MappedBitmap::key_index_type* MappedBitmap::keys() const noexcept {
+  return reinterpret_cast<const key_index_type*>(data_ + header().keys_offset);
+}
+
+const StorageEntry* MappedBitmap::entries() const noexcept {
+  return reinterpret_cast<const StorageEntry*>(data_ + header().entries_offset);
+}
+
+size_t MappedBitmap::PayloadSizeOf(size_t i) const {
+  // Validated lazily such that opening doesn't touch all the entries.
+  const auto& entry = entries()[i];
+  const size_t payload_size = PayloadSize(entry.type, entry.size);
+  if (entry.offset % kCacheLineSize != 0 || entry.offset > size_ ||
+      payload_size > size_ - entry.offset) {
+    throw Exception("Container ", i, " points outside of the mapped bitmap");
+  }
+  return payload_size;
+}
+
+ContainerView MappedBitmap::view(size_t i) const {
+  JITMAP_PRE(i < n_containers());
+
+  const auto& entry = entries()[i];
+  PayloadSizeOf(i);
+  return {entry.type, entry.size, data_ + entry.offset,
+          Statistics{entry.proxy, static_cast<int32_t>(entry.cardinality)}};
+}
+
+ContainerView MappedBitmap::Find(key_index_type key) const {
+  const size_t n = n_containers();
+  auto i = LowerBound(keys(), n, key);
+  if (i == n || keys()[i] != key) return {};
+  return view(i);
+}
+
+uint64_t MappedBitmap::cardinality() const noexcept {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n_containers(); i++) sum += entries()[i].cardinality;
+  return sum;
+}
+
+void MappedBitmap::WillNeed(const std::vector<key_index_type>& keys) const {
+  static const uint64_t kPageSize = ::sysconf(_SC_PAGESIZE);
+
+  // The pending range of pages, extended while the next payload follows.
+  uint64_t begin = 0, end = 0;
+  auto advise = [&]() {
+    if (begin == end) return;
+    ::madvise(const_cast<char*>(data_) + begin, end - begin, MADV_WILLNEED);
+  };
+
+  const size_t n = n_containers();
+  for (auto key : keys) {
+    auto i = LowerBound(this->keys(), n, key);
+    if (i == n || this->keys()[i] != key) continue;
+
+    const auto& entry = entries()[i];
+    const size_t payload_size = PayloadSizeOf(i);
+    const uint64_t first = entry.offset / kPageSize * kPageSize;
+    const uint64_t last = AlignUp(entry.offset + payload_size, kPageSize);
+    if (first >= begin && first <= end) {
+      end = std::max(end, last);
+      continue;
+    }
+
+    advise();
+    begin = first;
+    end = last;
+  }
+  advise();
+}
+
+}  // namespace jitmap
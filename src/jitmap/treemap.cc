@@ -0,0 +1,203 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jitmap/treemap.h"
+
+#include <algorithm>
+
+#include "jitmap/query/expr.h"
+#include "jitmap/query/query.h"
+#include "jitmap/util/exception.h"
+
+namespace jitmap {
+
+uint64_t Treemap::cardinality() const noexcept {
+  uint64_t sum = 0;
+  for (const auto& bucket : buckets_) sum += bucket.cardinality();
+  return sum;
+}
+
+size_t Treemap::n_containers() const noexcept {
+  size_t sum = 0;
+  for (const auto& bucket : buckets_) sum += bucket.n_containers();
+  return sum;
+}
+
+const ContainerHandle* Treemap::Find(key_type key) const {
+  auto [high, low] = split(key);
+  auto bucket = FindBucket(high);
+  return bucket != nullptr ? bucket->Find(low) : nullptr;
+}
+
+const Bitmap* Treemap::FindBucket(high_type high) const {
+  auto b = LowerBound(highs_.data(), highs_.size(), high);
+  if (b == highs_.size() || highs_[b] != high) return nullptr;
+  return &buckets_[b];
+}
+
+void Treemap::Insert(key_type key, std::shared_ptr<const Container> container) {
+  JITMAP_PRE(key < kEndKey);
+  JITMAP_PRE_NE(container, nullptr);
+  auto [high, low] = split(key);
+
+  // Fast path for the treemaps built in key order.
+  if (highs_.empty() || highs_.back() < high) {
+    highs_.push_back(high);
+    buckets_.emplace_back();
+    buckets_.back().Insert(low, std::move(container));
+    return;
+  }
+
+  auto b = LowerBound(highs_.data(), highs_.size(), high);
+  if (highs_[b] != high) {
+    highs_.insert(highs_.begin() + b, high);
+    buckets_.emplace(buckets_.begin() + b);
+  }
+  buckets_[b].Insert(low, std::move(container));
+}
+
+bool Treemap::Erase(key_type key) {
+  auto [high, low] = split(key);
+  auto b = LowerBound(highs_.data(), highs_.size(), high);
+  if (b == highs_.size() || highs_[b] != high) return false;
+  if (!buckets_[b].Erase(low)) return false;
+
+  if (buckets_[b].n_containers() == 0) {
+    highs_.erase(highs_.begin() + b);
+    buckets_.erase(buckets_.begin() + b);
+  }
+  return true;
+}
+
+// Position on the containers of a treemap, advanced in key order.
+class TreemapCursor {
+ public:
+  TreemapCursor(const Treemap& treemap, Treemap::key_type begin)
+      : highs_(treemap.highs()), buckets_(treemap.buckets()) {
+    auto [high, low] = Treemap::split(begin);
+    bucket_ = LowerBound(highs_.data(), highs_.size(), high);
+    if (bucket_ < highs_.size() && highs_[bucket_] == high) {
+      const auto& keys = buckets_[bucket_].keys();
+      i_ = LowerBound(keys.data(), keys.size(), low);
+    }
+    SkipExhaustedBuckets();
+  }
+
+  bool done() const noexcept { return bucket_ == highs_.size(); }
+
+  Treemap::key_type key() const noexcept {
+    return (Treemap::key_type{highs_[bucket_]} << Treemap::kLogContainersPerBucket) |
+           buckets_[bucket_].keys()[i_];
+  }
+
+  const ContainerHandle* handle() const noexcept {
+    return &buckets_[bucket_].containers()[i_];
+  }
+
+  void Next() noexcept {
+    i_++;
+    SkipExhaustedBuckets();
+  }
+
+ private:
+  void SkipExhaustedBuckets() noexcept {
+    while (bucket_ < highs_.size() && i_ == buckets_[bucket_].n_containers()) {
+      bucket_++;
+      i_ = 0;
+    }
+  }
+
+  const std::vector<Treemap::high_type>& highs_;
+  const std::vector<Bitmap>& buckets_;
+  size_t bucket_ = 0;
+  size_t i_ = 0;
+};
+
+// See `EvalTreemaps`, a shifting query also evaluates the keys adjacent to
+// the keys of the inputs, its result spills over the container boundaries.
+static Treemap EvalShiftingTreemaps(query::Query* query,
+                                    const query::EvaluationContext& ctx,
+                                    const std::vector<const Treemap*>& ins,
+                                    Treemap::key_type begin, Treemap::key_type end) {
+  std::vector<Treemap::key_type> keys;
+  auto add_key = [&](Treemap::key_type key, const ContainerHandle&) {
+    if (key > begin) keys.push_back(key - 1);
+    keys.push_back(key);
+    if (key + 1 < end) keys.push_back(key + 1);
+  };
+  for (auto treemap : ins) {
+    treemap->ForEach(begin > 0 ? begin - 1 : 0, end < Treemap::kEndKey ? end + 1 : end,
+                     add_key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  Treemap result;
+  std::vector<const ContainerHandle*> handles(ins.size());
+  std::vector<const ContainerHandle*> previous(ins.size());
+  std::vector<const ContainerHandle*> next(ins.size());
+  for (auto key : keys) {
+    if (key < begin || key >= end) continue;
+    for (size_t i = 0; i < ins.size(); i++) {
+      handles[i] = ins[i]->Find(key);
+      previous[i] = key > 0 ? ins[i]->Find(key - 1) : nullptr;
+      next[i] = key + 1 < Treemap::kEndKey ? ins[i]->Find(key + 1) : nullptr;
+    }
+
+    auto container = query->EvalShared(ctx, handles, previous, next);
+    if (!container->statistics().empty()) result.Insert(key, std::move(container));
+  }
+
+  return result;
+}
+
+Treemap EvalTreemaps(query::Query* query, const query::EvaluationContext& ctx,
+                     const std::vector<const Treemap*>& ins, Treemap::key_type begin,
+                     Treemap::key_type end) {
+  JITMAP_PRE_NE(query, nullptr);
+  JITMAP_PRE_EQ(query->variables().size(), ins.size());
+  for (auto treemap : ins) JITMAP_PRE_NE(treemap, nullptr);
+
+  if (query->expr().HasShift()) return EvalShiftingTreemaps(query, ctx, ins, begin, end);
+
+  std::vector<TreemapCursor> cursors;
+  cursors.reserve(ins.size());
+  for (auto treemap : ins) cursors.emplace_back(*treemap, begin);
+
+  Treemap result;
+  std::vector<const ContainerHandle*> handles(ins.size());
+  while (true) {
+    // The smallest key of the inputs, the inputs are merged in key order.
+    auto key = end;
+    for (const auto& cursor : cursors) {
+      if (!cursor.done()) key = std::min(key, cursor.key());
+    }
+    if (key >= end) break;
+
+    for (size_t i = 0; i < cursors.size(); i++) {
+      auto& cursor = cursors[i];
+      handles[i] = nullptr;
+      if (cursor.done() || cursor.key() != key) continue;
+      handles[i] = cursor.handle();
+      cursor.Next();
+    }
+
+    auto container = query->EvalShared(ctx, handles);
+    if (!container->statistics().empty()) result.Insert(key, std::move(container));
+  }
+
+  return result;
+}
+
+}  // namespace jitmap
@@ -15,9 +15,12 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
+#include <random>
 #include <type_traits>
+#include <vector>
 
 #include <jitmap/bitset.h>
 
@@ -164,6 +167,277 @@ TEST(BitsetTest, Operations) {
   EXPECT_EQ(full_xor_full, empty);
 }
 
+TEST(BitsetTest, LazyExpressions) {
+  const uint64_t a_bits[2] = {0b1100, 0xF0};
+  const uint64_t b_bits[2] = {0b1010, 0xFF};
+  const uint64_t c_bits[2] = {0b0110, UINT64_MAX};
+  auto a = make_bitset<128>(a_bits);
+  auto b = make_bitset<128>(b_bits);
+  auto c = make_bitset<128>(c_bits);
+
+  uint64_t result_bits[2] = {0, 0};
+  auto result = make_bitset<128>(result_bits);
+
+  // Evaluated word by word on assignment.
+  auto expr = (a & b) | ~c;
+  result = expr;
+  EXPECT_EQ(result_bits[0], (0b1100 & 0b1010) | ~uint64_t{0b0110});
+  EXPECT_EQ(result_bits[1], 0xF0);
+  EXPECT_EQ(expr, result);
+  EXPECT_EQ(expr.count(), result.count());
+  EXPECT_TRUE(expr.any());
+  EXPECT_TRUE((a ^ a).none());
+  EXPECT_TRUE((a | ~a).all());
+
+  // The destination may be an operand.
+  result = result ^ b;
+  EXPECT_EQ(result_bits[1], 0x0F);
+  result &= a | c;
+  EXPECT_EQ(result_bits[1], 0x0F);
+  result |= ~(a ^ b);
+  EXPECT_EQ(result_bits[1], UINT64_MAX);
+
+  auto owned = make_owned_bitset(a & ~b);
+  EXPECT_EQ(owned.word()[0], 0b0100);
+  EXPECT_EQ(owned.word()[1], 0);
+}
+
+template <typename L, typename R, typename = void>
+struct HasAnd : std::false_type {};
+template <typename L, typename R>
+struct HasAnd<L, R, std::void_t<decltype(std::declval<L>() & std::declval<R>())>>
+    : std::true_type {};
+
+TEST(BitsetTest, TemporaryOperands) {
+  using Owned = decltype(make_owned_bitset<128>());
+  using View = Bitset<128, const uint64_t*>;
+  using Lazy = decltype(std::declval<const View&>() & std::declval<const View&>());
+
+  static_assert(HasAnd<const Owned&, const Owned&>::value);
+  static_assert(HasAnd<const View&, Lazy>::value);
+  static_assert(HasAnd<Lazy, const Owned&>::value);
+  // The views are copied in the expression.
+  static_assert(HasAnd<Lazy, View>::value);
+  // The expression would reference the temporary past its lifetime.
+  static_assert(!HasAnd<const Owned&, Owned>::value);
+  static_assert(!HasAnd<Owned, const View&>::value);
+
+  const uint64_t words[2] = {0b1100, 0xFF};
+  auto owned = make_owned_bitset(64);
+  owned.set();
+  auto expr = owned & make_bitset<128>(words).view(2, 66);
+  EXPECT_EQ(expr.count(), 4);
+}
+
+TEST(BitsetTest, WordsReductions) {
+  std::mt19937_64 rng(0);
+  for (size_t n : {0, 1, 3, 4, 15, 16, 17, 63, 64, 65, 255, 256, 1024, 1031}) {
+    std::vector<uint64_t> words(n);
+    for (auto& w : words) w = rng() & rng();
+
+    size_t expected = 0;
+    for (auto w : words) expected += __builtin_popcountll(w);
+    EXPECT_EQ(CountWords(words.data(), n), expected) << n;
+
+    // A single word deciding the predicates, at every position.
+    std::vector<uint64_t> zeros(n, 0), ones(n, UINT64_MAX);
+    EXPECT_EQ(CountWords(ones.data(), n), n * 64);
+    EXPECT_EQ(AnyWords(zeros.data(), n), false);
+    EXPECT_EQ(AllWords(ones.data(), n), true);
+    EXPECT_TRUE(EqualWords(words.data(), words.data(), n));
+    for (size_t i = 0; i < n; i++) {
+      zeros[i] = uint64_t{1} << (i % 64);
+      ones[i] = ~zeros[i];
+      EXPECT_TRUE(AnyWords(zeros.data(), n)) << n << " " << i;
+      EXPECT_FALSE(AllWords(ones.data(), n)) << n << " " << i;
+      EXPECT_FALSE(EqualWords(zeros.data(), std::vector<uint64_t>(n, 0).data(), n));
+      zeros[i] = 0;
+      ones[i] = UINT64_MAX;
+    }
+  }
+}
+
+// The bits in [begin, begin + size) of the words.
+static std::vector<bool> BitsOf(const std::vector<uint64_t>& words, size_t begin,
+                                size_t size) {
+  std::vector<bool> bits(size);
+  for (size_t i = 0; i < size; i++) {
+    bits[i] = (words[(begin + i) / 64] >> ((begin + i) % 64)) & 1;
+  }
+  return bits;
+}
+
+template <typename Ptr>
+static std::vector<bool> BitsOf(const Bitset<kDynamicExtent, Ptr>& bitset) {
+  std::vector<bool> bits(bitset.size());
+  for (size_t i = 0; i < bitset.size(); i++) bits[i] = bitset[i];
+  return bits;
+}
+
+TEST(BitsetTest, Views) {
+  constexpr size_t kWords = 24;
+  std::mt19937_64 rng(0);
+  std::vector<uint64_t> words(kWords);
+  for (auto& w : words) w = rng();
+  words[4] = words[5] = words[6] = UINT64_MAX;
+  words[10] = words[11] = 0;
+
+  // Const, the views are read-only and `~` is lazy.
+  const auto bitset = make_bitset<kWords * 64>(words.data());
+  std::vector<std::pair<size_t, size_t>> ranges{
+      {0, 0},    {3, 3},     {0, 64},    {5, 9},     {60, 70},   {64, 128},
+      {1, 1535}, {0, 1536},  {256, 448}, {257, 447}, {640, 768}, {643, 700},
+      {7, 1000}, {128, 129}, {63, 65},   {320, 900}};
+  for (auto [begin, end] : ranges) {
+    auto view = bitset.view(begin, end);
+    auto expected = BitsOf(words, begin, end - begin);
+    size_t ones = std::count(expected.begin(), expected.end(), true);
+    EXPECT_EQ(view.size(), end - begin);
+    EXPECT_EQ(BitsOf(view), expected);
+    EXPECT_EQ(view.count(), ones) << begin << " " << end;
+    EXPECT_EQ(view.all(), ones == expected.size()) << begin << " " << end;
+    EXPECT_EQ(view.none(), ones == 0) << begin << " " << end;
+    EXPECT_EQ(view.any(), ones != 0);
+    // The lazy expressions ignore the bits past the size.
+    EXPECT_EQ((~view).count(), expected.size() - ones) << begin << " " << end;
+    EXPECT_EQ((view | ~view).all(), true);
+    EXPECT_EQ(view, view);
+    EXPECT_EQ(view, view & view);
+
+    // A view of a view.
+    if (end - begin > 2) {
+      EXPECT_EQ(BitsOf(view.view(1, end - begin - 1)),
+                BitsOf(words, begin + 1, end - begin - 2));
+    }
+  }
+
+  // Equal ranges at different shifts.
+  std::vector<uint64_t> shifted(kWords + 1, 0);
+  auto shifted_bitset = make_bitset<(kWords + 1) * 64>(shifted.data());
+  shifted_bitset.view(13, 13 + 1000) = bitset.view(0, 1000) | bitset.view(0, 1000);
+  EXPECT_EQ(shifted_bitset.view(13, 1013), bitset.view(0, 1000));
+  EXPECT_NE(shifted_bitset.view(13, 1013), bitset.view(1, 1001));
+  EXPECT_NE(shifted_bitset.view(13, 1013), bitset.view(0, 999));
+
+  EXPECT_THROW(bitset.view(10, 9), std::out_of_range);
+  EXPECT_THROW(bitset.view(0, kWords * 64 + 1), std::out_of_range);
+  EXPECT_THROW(bitset.view(0, 10).test(10), std::out_of_range);
+}
+
+TEST(BitsetTest, ViewModifiers) {
+  constexpr size_t kWords = 24;
+  std::mt19937_64 rng(1);
+  std::vector<uint64_t> a_words(kWords), b_words(kWords);
+  for (auto& w : a_words) w = rng();
+  for (auto& w : b_words) w = rng();
+  const auto a = make_bitset<kWords * 64>(a_words.data());
+  const auto b = make_bitset<kWords * 64>(b_words.data());
+
+  for (size_t size : {0, 1, 50, 64, 65, 300, 700}) {
+    for (size_t src : {0, 3, 64, 100}) {
+      for (size_t dst : {0, 1, 63, 64, 129}) {
+        std::vector<uint64_t> out_words(kWords);
+        for (auto& w : out_words) w = rng();
+        auto before = BitsOf(out_words, 0, kWords * 64);
+        auto out = make_bitset<kWords * 64>(out_words.data());
+        auto view = out.view(dst, dst + size);
+
+        auto a_bits = BitsOf(a_words, src, size);
+        auto b_bits = BitsOf(b_words, src + 1, size);
+        auto expected = BitsOf(view);
+        for (size_t i = 0; i < size; i++) {
+          expected[i] = expected[i] ^ (a_bits[i] && !b_bits[i]);
+        }
+
+        view ^= a.view(src, src + size) & ~b.view(src + 1, src + 1 + size);
+        EXPECT_EQ(BitsOf(view), expected) << size << " " << src << " " << dst;
+
+        // The bits around the view are left untouched.
+        auto after = BitsOf(out_words, 0, kWords * 64);
+        EXPECT_TRUE(std::equal(after.begin(), after.begin() + dst, before.begin()));
+        EXPECT_TRUE(std::equal(after.begin() + dst + size, after.end(),
+                               before.begin() + dst + size));
+
+        // Referencing itself.
+        view = view ^ a.view(src, src + size);
+        for (size_t i = 0; i < size; i++) expected[i] = expected[i] ^ a_bits[i];
+        EXPECT_EQ(BitsOf(view), expected);
+
+        view.assign(b.view(src, src + size));
+        EXPECT_EQ(view, b.view(src, src + size));
+        view &= a.view(src, src + size);
+        EXPECT_EQ(view, a.view(src, src + size) & b.view(src, src + size));
+
+        view.set();
+        EXPECT_EQ(view.count(), size);
+        view.flip();
+        EXPECT_TRUE(view.none());
+        after = BitsOf(out_words, 0, kWords * 64);
+        EXPECT_TRUE(std::equal(after.begin(), after.begin() + dst, before.begin()));
+        EXPECT_TRUE(std::equal(after.begin() + dst + size, after.end(),
+                               before.begin() + dst + size));
+      }
+    }
+  }
+
+  EXPECT_THROW(a.view(0, 10) & b.view(0, 11), Exception);
+  std::vector<uint64_t> out_words(kWords);
+  auto out = make_bitset<kWords * 64>(out_words.data());
+  auto view = out.view(0, 10);
+  EXPECT_THROW(view |= a.view(0, 11), Exception);
+}
+
+TEST(BitsetTest, OwnedDynamicBitset) {
+  auto owned = make_owned_bitset(100);
+  EXPECT_EQ(owned.size(), 100);
+  owned.reset();
+  owned.set(99);
+  owned.set(3);
+  EXPECT_EQ(owned.count(), 2);
+  EXPECT_THROW(owned.set(100), std::out_of_range);
+
+  const uint64_t words[3] = {UINT64_MAX, 0xF0, 0xFF};
+  auto bitset = make_bitset<192>(words);
+  auto window = make_owned_bitset(bitset.view(60, 140) & ~bitset.view(61, 141));
+  EXPECT_EQ(window.size(), 80);
+  EXPECT_EQ(window, bitset.view(60, 140) & ~bitset.view(61, 141));
+  // The last bit of each run of ones.
+  EXPECT_EQ(window.count(), 3);
+  EXPECT_TRUE(window[63 - 60] && window[71 - 60] && window[135 - 60]);
+
+  auto empty = make_owned_bitset(0);
+  EXPECT_TRUE(empty.none());
+  EXPECT_TRUE(empty.all());
+  EXPECT_EQ(empty.count(), 0);
+}
+
+TEST(BitsetTest, SingleBitModifiers) {
+  uint64_t bits[2] = {0ULL, 0ULL};
+  auto bitset = make_bitset<128>(bits);
+
+  bitset.set(1);
+  bitset.set(64);
+  bitset.set(127);
+  EXPECT_EQ(bits[0], 0b10);
+  EXPECT_EQ(bits[1], 0x8000000000000001);
+  EXPECT_TRUE(bitset[1]);
+  EXPECT_TRUE(bitset.test(64));
+  EXPECT_FALSE(bitset[0]);
+  EXPECT_EQ(bitset.count(), 3);
+
+  bitset.reset(64);
+  bitset.flip(0);
+  bitset.flip(1);
+  EXPECT_EQ(bits[0], 0b01);
+  EXPECT_EQ(bits[1], 0x8000000000000000);
+
+  bitset.set(2, false);
+  EXPECT_EQ(bits[0], 0b01);
+
+  EXPECT_THROW(bitset.set(128), std::out_of_range);
+  EXPECT_THROW(bitset.test(128), std::out_of_range);
+}
+
 TEST(BitsetTest, ErrorOnNullPtrConstructor) {
   EXPECT_THROW(BitsetUInt64 null_u64_bitset{nullptr}, Exception);
   EXPECT_THROW(BitsetConstUInt64 null_const_u64_bitset{nullptr}, Exception);
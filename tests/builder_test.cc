@@ -0,0 +1,151 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <jitmap/builder.h>
+#include <jitmap/container/run.h>
+
+namespace jitmap {
+
+template <typename T>
+static void ExpectBitmapEquals(const Bitmap& bitmap, std::vector<T> ids) {
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+  EXPECT_EQ(bitmap.cardinality(), ids.size());
+  for (auto id : ids) ASSERT_TRUE(bitmap[id]) << id;
+}
+
+TEST(BuilderTest, BuildContainer) {
+  std::vector<uint16_t> sparse{1, 1, 5, 9, 9, 9, 4000};
+  auto container = BuildContainer(sparse.data(), sparse.size());
+  EXPECT_EQ(container->container_type(), ARRAY);
+  EXPECT_EQ(container->count(), 4);
+
+  std::vector<uint16_t> runs;
+  for (uint32_t i = 100; i < 3000; i++) runs.push_back(i);
+  container = BuildContainer(runs.data(), runs.size());
+  EXPECT_EQ(container->container_type(), RUN_LENGTH);
+  EXPECT_EQ(container->count(), 2900);
+
+  std::vector<uint16_t> dense;
+  for (uint32_t i = 0; i < kBitsPerContainer; i += 2) dense.push_back(i);
+  container = BuildContainer(dense.data(), dense.size());
+  EXPECT_EQ(container->container_type(), BITMAP);
+  EXPECT_EQ(container->count(), kBitsPerContainer / 2);
+  EXPECT_TRUE((*container)[65534]);
+  EXPECT_FALSE((*container)[65535]);
+
+  std::vector<uint16_t> full;
+  for (uint32_t i = 0; i < kBitsPerContainer; i++) full.push_back(i);
+  container = BuildContainer(full.data(), full.size());
+  EXPECT_EQ(container->container_type(), RUN_LENGTH);
+  EXPECT_TRUE(container->all());
+
+  // Many duplicates which fit in an array once removed.
+  std::vector<uint16_t> duplicates(10000, 7);
+  container = BuildContainer(duplicates.data(), duplicates.size());
+  EXPECT_EQ(container->container_type(), ARRAY);
+  EXPECT_EQ(container->count(), 1);
+
+  EXPECT_EQ(BuildContainer(nullptr, 0)->count(), 0);
+}
+
+TEST(BuilderTest, BuildContainerTails) {
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<uint32_t> gaps(0, 3);
+
+  // Duplicates, adjacent and distant ids straddling the vectors and the words,
+  // with sizes which aren't a multiple of the vectors.
+  for (size_t n : {1, 2, 15, 17, 33, 1000, 30001}) {
+    std::vector<uint16_t> ids;
+    uint32_t id = gaps(rng);
+    for (size_t i = 0; i < n && id < kBitsPerContainer; i++, id += gaps(rng)) {
+      ids.push_back(id);
+    }
+
+    size_t unique = 1, n_runs = 1;
+    for (size_t i = 1; i < ids.size(); i++) {
+      unique += ids[i] != ids[i - 1];
+      n_runs += ids[i] > ids[i - 1] + 1;
+    }
+
+    auto container = BuildContainer(ids.data(), ids.size());
+    EXPECT_EQ(container->container_type(), SmallestContainerType(unique, n_runs)) << n;
+    EXPECT_EQ(container->count(), unique) << n;
+    for (auto i : ids) ASSERT_TRUE((*container)[i]) << n;
+  }
+}
+
+TEST(BuilderTest, BuildBitmap32) {
+  std::mt19937 rng(0);
+  std::vector<uint32_t> ids;
+  // A dense container, a sparse one, a run and the last key.
+  std::uniform_int_distribution<uint32_t> dense_ids(0, kBitsPerContainer - 1);
+  for (size_t i = 0; i < 20000; i++) ids.push_back(dense_ids(rng));
+  for (uint32_t i = 0; i < 100; i++) ids.push_back(5 * kBitsPerContainer + 17 * i);
+  for (uint32_t i = 0; i < 5000; i++) ids.push_back(9 * kBitsPerContainer + 300 + i);
+  ids.push_back(UINT32_MAX);
+  std::sort(ids.begin(), ids.end());
+
+  auto bitmap = BuildBitmap(ids.data(), ids.size());
+  EXPECT_EQ(bitmap.keys(), (std::vector<uint32_t>{0, 5, 9, 65535}));
+  EXPECT_EQ(bitmap.containers()[0].type(), BITMAP);
+  EXPECT_EQ(bitmap.containers()[1].type(), ARRAY);
+  EXPECT_EQ(bitmap.containers()[2].type(), RUN_LENGTH);
+  EXPECT_EQ(bitmap.containers()[3].type(), ARRAY);
+  ExpectBitmapEquals(bitmap, ids);
+  EXPECT_FALSE(bitmap[5 * kBitsPerContainer + 1]);
+
+  std::reverse(ids.begin(), ids.end());
+  EXPECT_THROW(BuildBitmap(ids.data(), ids.size()), Exception);
+}
+
+TEST(BuilderTest, BuildBitmap64) {
+  std::vector<uint64_t> ids{0, 1, 1ULL << 32, (1ULL << 48) - 1};
+  auto bitmap = BuildBitmap(ids.data(), ids.size());
+  EXPECT_EQ(bitmap.n_containers(), 3);
+  ExpectBitmapEquals(bitmap, ids);
+
+  ids.push_back(1ULL << 48);
+  EXPECT_THROW(BuildBitmap(ids.data(), ids.size()), Exception);
+}
+
+TEST(BuilderTest, BuildBitmapUnsorted) {
+  std::mt19937_64 rng(0);
+
+  // Large enough for the radix sort.
+  std::vector<uint32_t> ids32(200000);
+  std::uniform_int_distribution<uint32_t> dist32(0, 1U << 24);
+  for (auto& id : ids32) id = dist32(rng);
+  auto expected32 = ids32;
+  ExpectBitmapEquals(BuildBitmapUnsorted(ids32.data(), ids32.size()), expected32);
+
+  std::vector<uint64_t> ids64(200000);
+  std::uniform_int_distribution<uint64_t> dist64(0, (1ULL << 48) - 1);
+  for (auto& id : ids64) id = dist64(rng);
+  auto expected64 = ids64;
+  ExpectBitmapEquals(BuildBitmapUnsorted(ids64.data(), ids64.size()), expected64);
+
+  std::vector<uint64_t> small{5, 3, 3, 1ULL << 40};
+  ExpectBitmapEquals(BuildBitmapUnsorted(small.data(), small.size()),
+                     std::vector<uint64_t>{5, 3, 1ULL << 40});
+}
+
+}  // namespace jitmap
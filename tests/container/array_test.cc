@@ -0,0 +1,156 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <jitmap/container/array.h>
+
+namespace jitmap {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+using Values = std::vector<Container::index_type>;
+
+// Generate `n` sorted unique random indices.
+static Values RandomValues(size_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  Values all(kBitsPerContainer);
+  std::iota(all.begin(), all.end(), 0);
+  std::shuffle(all.begin(), all.end(), rng);
+  all.resize(n);
+  std::sort(all.begin(), all.end());
+  return all;
+}
+
+static Values ReferenceIntersection(const Values& a, const Values& b) {
+  Values out;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+  return out;
+}
+
+static Values ReferenceUnion(const Values& a, const Values& b) {
+  Values out;
+  std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+  return out;
+}
+
+TEST(ArrayContainerTest, Basic) {
+  ArrayContainer array({1, 3, 65535});
+  EXPECT_EQ(array.container_type(), ARRAY);
+  EXPECT_EQ(array.cardinality(), 3);
+  EXPECT_TRUE(array[1]);
+  EXPECT_FALSE(array[2]);
+  EXPECT_TRUE(array[65535]);
+
+  EXPECT_TRUE(array.add(2));
+  EXPECT_TRUE(array.add(2));
+  EXPECT_THAT(array.values(), ElementsAre(1, 2, 3, 65535));
+
+  EXPECT_THROW(ArrayContainer({2, 1}), Exception);
+  EXPECT_THROW(ArrayContainer({1, 1}), Exception);
+  EXPECT_THROW(ArrayContainer(Values(ArrayContainer::kMaxCardinality + 1)), Exception);
+}
+
+TEST(ArrayContainerTest, AddFull) {
+  Values values(ArrayContainer::kMaxCardinality);
+  for (size_t i = 0; i < values.size(); i++) values[i] = 2 * i;
+
+  ArrayContainer array(values);
+  EXPECT_TRUE(array.add(0));
+  EXPECT_FALSE(array.add(1));
+  EXPECT_EQ(array.cardinality(), ArrayContainer::kMaxCardinality);
+}
+
+TEST(ArrayContainerTest, DenseConversion) {
+  auto values = RandomValues(1000, 0);
+  ArrayContainer array(values);
+
+  auto dense = array.ToDense();
+  EXPECT_EQ(dense.cardinality(), values.size());
+  for (auto v : values) EXPECT_TRUE(dense[v]);
+
+  EXPECT_EQ(ArrayContainer::FromDense(dense).values(), values);
+
+  dense.bitmap().set();
+  EXPECT_THROW(ArrayContainer::FromDense(dense), Exception);
+}
+
+TEST(ArrayContainerTest, IntersectArrays) {
+  // Comparable sizes (vectorized merge), skewed sizes (galloping) and sizes
+  // not multiple of the vector width.
+  std::vector<std::pair<size_t, size_t>> sizes{
+      {0, 10}, {1, 1}, {7, 9}, {100, 100}, {4096, 4096}, {3, 4000}, {4000, 17}};
+
+  uint32_t seed = 0;
+  for (auto [n_a, n_b] : sizes) {
+    auto a = RandomValues(n_a, seed++);
+    auto b = RandomValues(n_b, seed++);
+    auto expected = ReferenceIntersection(a, b);
+
+    EXPECT_EQ(Intersect(ArrayContainer(a), ArrayContainer(b)).values(), expected);
+    EXPECT_EQ(Intersect(ArrayContainer(b), ArrayContainer(a)).values(), expected);
+  }
+
+  // Identical inputs.
+  auto a = RandomValues(2048, seed++);
+  EXPECT_EQ(Intersect(ArrayContainer(a), ArrayContainer(a)).values(), a);
+}
+
+TEST(ArrayContainerTest, IntersectArrayDense) {
+  auto a = RandomValues(3000, 0);
+  auto b = RandomValues(4000, 1);
+
+  auto dense = ArrayContainer(b).ToDense();
+  EXPECT_EQ(Intersect(ArrayContainer(a), dense).values(), ReferenceIntersection(a, b));
+  EXPECT_EQ(Intersect(dense, ArrayContainer(b)).values(), b);
+  EXPECT_THAT(Intersect(ArrayContainer(), dense).values(), IsEmpty());
+}
+
+TEST(ArrayContainerTest, UnionArrays) {
+  auto a = RandomValues(1000, 0);
+  auto b = RandomValues(2000, 1);
+
+  auto result = Union(ArrayContainer(a), ArrayContainer(b));
+  auto array = dynamic_cast<ArrayContainer*>(result.get());
+  ASSERT_NE(array, nullptr);
+  EXPECT_EQ(array->values(), ReferenceUnion(a, b));
+
+  // Overlapping inputs whose union still fits in an array.
+  auto c = RandomValues(4000, 2);
+  result = Union(ArrayContainer(c), ArrayContainer(Values(c.begin(), c.begin() + 100)));
+  array = dynamic_cast<ArrayContainer*>(result.get());
+  ASSERT_NE(array, nullptr);
+  EXPECT_EQ(array->values(), c);
+
+  // Converts to dense past the threshold.
+  auto d = RandomValues(4000, 3);
+  result = Union(ArrayContainer(c), ArrayContainer(d));
+  auto dense = dynamic_cast<DenseContainer*>(result.get());
+  ASSERT_NE(dense, nullptr);
+  auto expected = ReferenceUnion(c, d);
+  EXPECT_EQ(dense->cardinality(), expected.size());
+  for (auto v : expected) EXPECT_TRUE((*dense)[v]);
+
+  EXPECT_TRUE(Union(ArrayContainer(), ArrayContainer())->none());
+}
+
+}  // namespace jitmap
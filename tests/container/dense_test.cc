@@ -0,0 +1,106 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include <jitmap/container/container.h>
+
+namespace jitmap {
+
+TEST(DenseContainerTest, Statistics) {
+  DenseContainer dense;
+  EXPECT_EQ(dense.count(), 0);
+  EXPECT_TRUE(dense.none());
+  EXPECT_EQ(dense.statistics().proxy(), ProxyBitmap());
+
+  // First and last bits of blocks.
+  dense.set(0);
+  dense.set(kBitsPerProxyBit - 1);
+  dense.set(3 * kBitsPerProxyBit);
+  dense.set(kBitsPerContainer - 1);
+  EXPECT_EQ(dense.count(), 4);
+  EXPECT_TRUE(dense.any());
+  EXPECT_FALSE(dense.all());
+  EXPECT_EQ(dense.statistics().proxy(), ProxyBitmap((1ULL << 63) | (1ULL << 3) | 1ULL));
+
+  dense.bitmap().set();
+  EXPECT_EQ(dense.count(), kBitsPerContainer);
+  EXPECT_TRUE(dense.all());
+  EXPECT_TRUE(dense.statistics().proxy().all());
+}
+
+TEST(DenseContainerTest, StatisticsRandom) {
+  std::mt19937_64 rng(0);
+  std::uniform_int_distribution<uint64_t> words;
+  std::bernoulli_distribution keep_block(0.25);
+
+  for (size_t trial = 0; trial < 8; trial++) {
+    DenseContainer dense;
+    auto data = dense.bitmap().word();
+    ProxyBitmap expected_proxy;
+    size_t expected_count = 0;
+    for (size_t b = 0; b < kBitsInProxy; b++) {
+      if (!keep_block(rng)) continue;
+      for (size_t i = 0; i < kBitsPerProxyBit / DenseBitset::kBitsPerWord; i++) {
+        auto& word = data[b * kBitsPerProxyBit / DenseBitset::kBitsPerWord + i];
+        word = words(rng);
+        expected_count += __builtin_popcountll(word);
+        if (word != 0) expected_proxy.set(b);
+      }
+    }
+
+    EXPECT_EQ(dense.statistics().count(), expected_count);
+    EXPECT_EQ(dense.statistics().proxy(), expected_proxy);
+  }
+}
+
+TEST(DenseContainerTest, DirtyLines) {
+  DenseContainer dense;
+  EXPECT_TRUE(dense.dirty().none());
+
+  dense.set(0);
+  dense.set(1);
+  dense.set(kBitsPerCacheLine * 5);
+  EXPECT_EQ(dense.dirty().count(), 2);
+  EXPECT_TRUE(dense.dirty().test(0));
+  EXPECT_TRUE(dense.dirty().test(5));
+
+  // Setting a set bit doesn't modify the container.
+  dense.ClearDirty();
+  dense.set(1);
+  EXPECT_TRUE(dense.dirty().none());
+
+  // The mutable bitmap may be modified anywhere.
+  dense.bitmap().reset();
+  EXPECT_EQ(dense.dirty().count(), kCacheLinesPerContainer);
+
+  DenseContainer moved(std::move(dense));
+  EXPECT_EQ(moved.dirty().count(), kCacheLinesPerContainer);
+}
+
+TEST(ContainerTest, EmptyAndFullStatistics) {
+  EmptyContainer empty;
+  EXPECT_EQ(empty.count(), 0);
+  EXPECT_TRUE(empty.none());
+  EXPECT_FALSE(empty.all());
+
+  FullContainer full;
+  EXPECT_EQ(full.count(), kBitsPerContainer);
+  EXPECT_TRUE(full.all());
+  EXPECT_TRUE(full.any());
+}
+
+}  // namespace jitmap
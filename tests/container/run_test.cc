@@ -0,0 +1,184 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include <jitmap/container/run.h>
+
+namespace jitmap {
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+std::ostream& operator<<(std::ostream& os, const Run& run) {
+  return os << "[" << run.start << ", " << run.end() << "]";
+}
+
+// Generate random disjoint non-adjacent runs.
+static std::vector<Run> RandomRuns(size_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint32_t> gap(1, 64), length(0, 128);
+
+  std::vector<Run> runs;
+  uint32_t next = gap(rng) - 1;
+  while (runs.size() < n) {
+    auto run_length = length(rng);
+    if (next + run_length >= kBitsPerContainer) break;
+    runs.push_back({static_cast<uint16_t>(next), static_cast<uint16_t>(run_length)});
+    next += run_length + 1 + gap(rng);
+  }
+  return runs;
+}
+
+// Reference implementation through the dense representation.
+static DenseContainer ToDense(const std::vector<Run>& runs) {
+  DenseContainer dense;
+  for (const auto& run : runs) {
+    for (uint32_t i = run.start; i <= run.end(); i++) dense.set(i);
+  }
+  return dense;
+}
+
+TEST(RunContainerTest, Basic) {
+  RunContainer runs({{0, 0}, {10, 5}, {65534, 1}});
+  EXPECT_EQ(runs.container_type(), RUN_LENGTH);
+  EXPECT_EQ(runs.n_runs(), 3);
+  EXPECT_EQ(runs.cardinality(), 1 + 6 + 2);
+  EXPECT_TRUE(runs[0]);
+  EXPECT_FALSE(runs[1]);
+  EXPECT_FALSE(runs[9]);
+  EXPECT_TRUE(runs[10]);
+  EXPECT_TRUE(runs[15]);
+  EXPECT_FALSE(runs[16]);
+  EXPECT_TRUE(runs[65535]);
+
+  // Full container.
+  EXPECT_EQ(RunContainer({{0, 65535}}).cardinality(), kBitsPerContainer);
+
+  // Overlapping and adjacent runs.
+  EXPECT_THROW(RunContainer({{0, 10}, {5, 1}}), Exception);
+  EXPECT_THROW(RunContainer({{0, 10}, {11, 1}}), Exception);
+  EXPECT_THROW(RunContainer({{65535, 1}}), Exception);
+}
+
+TEST(RunContainerTest, Conversions) {
+  auto runs = RandomRuns(200, 0);
+  RunContainer container(runs);
+
+  auto dense = container.ToDense();
+  EXPECT_EQ(dense.cardinality(), container.cardinality());
+  EXPECT_EQ(CountRuns(dense.data()), runs.size());
+  EXPECT_EQ(RunContainer::FromDense(dense).runs(), runs);
+
+  // A run spanning a range boundary is counted in the range it starts in.
+  const size_t n_words = kBitsPerContainer / 64;
+  EXPECT_EQ(CountRuns(dense.data(), 0, 7) + CountRuns(dense.data(), 7, n_words),
+            runs.size());
+  RunContainer spanning({{60, 10}});
+  EXPECT_EQ(CountRuns(spanning.ToDense().data(), 0, 1), 1);
+  EXPECT_EQ(CountRuns(spanning.ToDense().data(), 1, 2), 0);
+  EXPECT_THROW(CountRuns(dense.data(), 2, 1), Exception);
+
+  RunContainer small({{3, 2}, {100, 0}, {65530, 5}});
+  auto array = small.ToArray();
+  EXPECT_THAT(array.values(), ElementsAre(3, 4, 5, 100, 65530, 65531, 65532, 65533,
+                                          65534, 65535));
+  EXPECT_EQ(RunContainer::FromArray(array).runs(), small.runs());
+  EXPECT_EQ(RunContainer::FromDense(small.ToDense()).runs(), small.runs());
+
+  RunContainer full({{0, 65535}});
+  EXPECT_EQ(full.ToDense().cardinality(), kBitsPerContainer);
+  EXPECT_EQ(RunContainer::FromDense(full.ToDense()).runs(), full.runs());
+  EXPECT_THROW(full.ToArray(), Exception);
+
+  EXPECT_THAT(RunContainer::FromDense(DenseContainer()).runs(), IsEmpty());
+}
+
+TEST(RunContainerTest, IntersectRuns) {
+  auto a = RandomRuns(300, 0);
+  auto b = RandomRuns(300, 1);
+
+  auto result = Intersect(RunContainer(a), RunContainer(b));
+  auto expected = Intersect(RunContainer(a), ToDense(b));
+  EXPECT_EQ(result.ToDense().bitmap(), expected.bitmap());
+  EXPECT_EQ(result.runs(), RunContainer::FromDense(expected).runs());
+
+  EXPECT_THAT(Intersect(RunContainer({{0, 10}}), RunContainer({{11, 10}})).runs(),
+              IsEmpty());
+  auto runs = Intersect(RunContainer({{0, 10}, {20, 10}}), RunContainer({{5, 20}}));
+  EXPECT_THAT(runs.runs(), ElementsAre(jitmap::Run{5, 5}, jitmap::Run{20, 5}));
+}
+
+TEST(RunContainerTest, IntersectRunDense) {
+  auto a = RandomRuns(300, 0);
+  auto b = RandomRuns(300, 1);
+
+  auto result = Intersect(RunContainer(a), ToDense(b));
+  for (uint32_t i = 0; i < kBitsPerContainer; i++) {
+    EXPECT_EQ(result[i], RunContainer(a)[i] && RunContainer(b)[i]) << i;
+  }
+}
+
+TEST(RunContainerTest, IntersectRunArray) {
+  RunContainer runs({{3, 2}, {100, 10}});
+  ArrayContainer array({0, 3, 5, 6, 99, 105, 111, 200});
+  EXPECT_THAT(Intersect(runs, array).values(), ElementsAre(3, 5, 105));
+  EXPECT_THAT(Intersect(array, runs).values(), ElementsAre(3, 5, 105));
+}
+
+TEST(RunContainerTest, UnionRuns) {
+  auto a = RandomRuns(300, 0);
+  auto b = RandomRuns(300, 1);
+
+  auto result = Union(RunContainer(a), RunContainer(b));
+  auto expected = ToDense(a);
+  expected.bitmap() |= ToDense(b).bitmap();
+  EXPECT_EQ(result.runs(), RunContainer::FromDense(expected).runs());
+
+  // Adjacent runs are merged.
+  EXPECT_THAT(Union(RunContainer({{0, 10}}), RunContainer({{11, 10}})).runs(),
+              ElementsAre(jitmap::Run{0, 21}));
+  EXPECT_THAT(Union(RunContainer({{0, 10}, {30, 1}}), RunContainer({{5, 2}})).runs(),
+              ElementsAre(jitmap::Run{0, 10}, jitmap::Run{30, 1}));
+}
+
+TEST(RunContainerTest, Compact) {
+  EXPECT_EQ(SmallestContainerType(0, 0), ARRAY);
+  EXPECT_EQ(SmallestContainerType(kBitsPerContainer, 1), RUN_LENGTH);
+  EXPECT_EQ(SmallestContainerType(100, 100), ARRAY);
+  EXPECT_EQ(SmallestContainerType(30000, 15000), BITMAP);
+
+  auto dense = RunContainer({{0, 65535}}).ToDense();
+  auto compact = Compact(dense);
+  EXPECT_NE(dynamic_cast<RunContainer*>(compact.get()), nullptr);
+
+  compact = Compact(RunContainer({{0, 0}, {2, 0}, {4, 0}}));
+  EXPECT_NE(dynamic_cast<ArrayContainer*>(compact.get()), nullptr);
+
+  compact = Compact(ArrayContainer({1, 2, 3, 4, 5, 6, 7, 8}));
+  EXPECT_NE(dynamic_cast<RunContainer*>(compact.get()), nullptr);
+
+  std::vector<jitmap::Run> alternating;
+  for (uint32_t i = 0; i < kBitsPerContainer; i += 2) {
+    alternating.push_back({static_cast<uint16_t>(i), 0});
+  }
+  compact = Compact(RunContainer(alternating));
+  EXPECT_NE(dynamic_cast<DenseContainer*>(compact.get()), nullptr);
+}
+
+}  // namespace jitmap
@@ -0,0 +1,75 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <jitmap/dirty.h>
+#include <jitmap/util/aligned.h>
+
+namespace jitmap {
+
+TEST(DirtyLinesTest, Basic) {
+  DirtyLines dirty;
+  EXPECT_TRUE(dirty.none());
+  EXPECT_EQ(dirty.count(), 0);
+
+  dirty.MarkBit(0);
+  dirty.MarkBit(kBitsPerCacheLine - 1);
+  EXPECT_EQ(dirty.count(), 1);
+  EXPECT_TRUE(dirty.test(0));
+
+  dirty.MarkBit(kBitsPerContainer - 1);
+  EXPECT_EQ(dirty.count(), 2);
+  EXPECT_TRUE(dirty.test(kCacheLinesPerContainer - 1));
+  EXPECT_FALSE(dirty.test(1));
+
+  DirtyLines other;
+  other.MarkLine(1);
+  dirty |= other;
+  EXPECT_EQ(dirty.count(), 3);
+
+  dirty.clear();
+  EXPECT_TRUE(dirty.none());
+
+  dirty.MarkAll();
+  EXPECT_EQ(dirty.count(), kCacheLinesPerContainer);
+}
+
+TEST(TrackedBitsetTest, MarksModifiedLines) {
+  aligned_array<BitsetWordType, kBitsPerContainer / 64> storage;
+  TrackedBitset<> bitset{storage.data()};
+
+  bitset.set(3);
+  EXPECT_TRUE(bitset[3]);
+  EXPECT_TRUE(bitset.dirty().test(0));
+  EXPECT_EQ(bitset.dirty().count(), 1);
+
+  bitset.ClearDirty();
+  // Setting a bit already set is not a modification.
+  bitset.set(3);
+  bitset.reset(kBitsPerCacheLine);
+  EXPECT_TRUE(bitset.dirty().none());
+
+  bitset.flip(kBitsPerCacheLine * 5 + 7);
+  bitset.set_word(kBitsPerContainer / 64 - 1, 0xFF);
+  EXPECT_TRUE(bitset.dirty().test(5));
+  EXPECT_TRUE(bitset.dirty().test(kCacheLinesPerContainer - 1));
+  EXPECT_EQ(bitset.dirty().count(), 2);
+  EXPECT_EQ(bitset.bitset().count(), 1 + 1 + 8);
+
+  EXPECT_THROW(bitset.set(kBitsPerContainer), std::out_of_range);
+}
+
+}  // namespace jitmap
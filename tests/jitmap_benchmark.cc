@@ -16,9 +16,11 @@
 
 #include <bitset>
 #include <functional>
+#include <random>
 #include <string_view>
 #include <vector>
 
+#include <jitmap/builder.h>
 #include <jitmap/jitmap.h>
 #include <jitmap/query/compiler.h>
 #include <jitmap/query/query.h>
@@ -119,4 +121,25 @@ BENCHMARK_TEMPLATE(BasicBenchmark, JitFunctor<WithoutPopCount>)
     ->RangeMultiplier(2)
     ->Range(2, 8);
 
+// Build a container from sorted indices, one in `state.range(0)` on average
+// with duplicates, dense enough for a bitmap container.
+static void BuildContainerBenchmark(benchmark::State& state) {
+  auto gap = static_cast<uint32_t>(state.range(0));
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<uint32_t> gaps(0, 2 * gap);
+
+  std::vector<Container::index_type> indices;
+  for (uint32_t i = 0; i < kBitsPerContainer; i += gaps(rng)) indices.push_back(i);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(BuildContainer(indices.data(), indices.size()));
+  }
+
+  state.SetItemsProcessed(indices.size() * state.iterations());
+  state.SetBytesProcessed(indices.size() * sizeof(Container::index_type) *
+                          state.iterations());
+}
+
+BENCHMARK(BuildContainerBenchmark)->Arg(1)->Arg(2)->Arg(4);
+
 }  // namespace jitmap
@@ -15,13 +15,136 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <vector>
+
 #include <jitmap/jitmap.h>
 
 using testing::ContainerEq;
+using testing::ElementsAre;
 
 namespace jitmap {
 
 static_assert(sizeof(ProxyBitmap) == sizeof(uint64_t), "ProxyBitmap must fit in 64bits");
 
 TEST(JitmapTest, Basic) { DenseContainer dense; }
+
+TEST(BitmapTest, Key) {
+  EXPECT_EQ(Bitmap::key(0), std::make_pair(0U, uint16_t{0}));
+  EXPECT_EQ(Bitmap::key(65535), std::make_pair(0U, uint16_t{65535}));
+  EXPECT_EQ(Bitmap::key(65536 * 3 + 300), std::make_pair(3U, uint16_t{300}));
+}
+
+TEST(BitmapTest, InsertFindErase) {
+  Bitmap bitmap;
+  EXPECT_EQ(bitmap.Find(0), nullptr);
+  EXPECT_FALSE(bitmap[0]);
+
+  bitmap.Insert(7, std::make_unique<ArrayContainer>(std::vector<uint16_t>{1, 300}));
+  bitmap.Insert(2, std::make_unique<FullContainer>());
+  bitmap.Insert(5, std::make_unique<RunContainer>(std::vector<jitmap::Run>{{10, 9}}));
+  EXPECT_THAT(bitmap.keys(), ElementsAre(2, 5, 7));
+  EXPECT_EQ(bitmap.n_containers(), 3);
+  EXPECT_EQ(bitmap.cardinality(), 2 + kBitsPerContainer + 10);
+
+  auto handle = bitmap.Find(7);
+  ASSERT_NE(handle, nullptr);
+  EXPECT_EQ(handle->type(), ARRAY);
+  EXPECT_EQ(handle->cardinality(), 2);
+  EXPECT_EQ(bitmap.Find(6), nullptr);
+
+  EXPECT_TRUE(bitmap[7 * kBitsPerContainer + 300]);
+  EXPECT_FALSE(bitmap[7 * kBitsPerContainer + 301]);
+  EXPECT_TRUE(bitmap[2 * kBitsPerContainer + 12345]);
+  EXPECT_TRUE(bitmap[5 * kBitsPerContainer + 19]);
+  EXPECT_FALSE(bitmap[5 * kBitsPerContainer + 20]);
+
+  // Replace an existing container.
+  bitmap.Insert(2, std::make_unique<EmptyContainer>());
+  EXPECT_EQ(bitmap.n_containers(), 3);
+  EXPECT_FALSE(bitmap[2 * kBitsPerContainer + 12345]);
+
+  EXPECT_TRUE(bitmap.Erase(5));
+  EXPECT_FALSE(bitmap.Erase(5));
+  EXPECT_THAT(bitmap.keys(), ElementsAre(2, 7));
+
+  EXPECT_THROW(bitmap.Insert(1, nullptr), Exception);
+}
+
+TEST(BitmapTest, CopyOnWrite) {
+  Bitmap bitmap;
+  bitmap.Insert(1, std::make_unique<DenseContainer>());
+  bitmap.Insert(2, std::make_unique<ArrayContainer>(std::vector<uint16_t>{4, 5}));
+  const Container* dense = bitmap.Find(1)->get();
+
+  // Not shared, modified in place.
+  bitmap.Modify(1, [](Container* c) { static_cast<DenseContainer*>(c)->set(3); });
+  EXPECT_EQ(bitmap.Find(1)->get(), dense);
+  EXPECT_EQ(bitmap.Find(1)->cardinality(), 1);
+
+  // The copies share the containers.
+  Bitmap copy = bitmap;
+  EXPECT_EQ(copy.Find(1)->get(), dense);
+  EXPECT_EQ(copy.Find(2)->get(), bitmap.Find(2)->get());
+  EXPECT_FALSE(copy.Find(1)->unique());
+
+  // The first modification copies the shared container.
+  copy.Modify(1, [](Container* c) { static_cast<DenseContainer*>(c)->set(7); });
+  EXPECT_NE(copy.Find(1)->get(), dense);
+  EXPECT_TRUE(copy[kBitsPerContainer + 3] && copy[kBitsPerContainer + 7]);
+  EXPECT_FALSE(bitmap[kBitsPerContainer + 7]);
+  EXPECT_EQ(copy.cardinality(), 4);
+  EXPECT_EQ(bitmap.cardinality(), 3);
+
+  // Now owned by each bitmap.
+  EXPECT_TRUE(bitmap.Find(1)->unique());
+  EXPECT_TRUE(copy.Find(1)->unique());
+  EXPECT_EQ(copy.Find(2)->get(), bitmap.Find(2)->get());
+
+  EXPECT_THROW(copy.Modify(3, [](Container*) {}), Exception);
+}
+
+TEST(BitmapTest, LowerBound) {
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<uint32_t> dist;
+
+  for (size_t n : {0, 1, 3, 4, 15, 16, 17, 100, 1000}) {
+    std::vector<uint32_t> keys(n);
+    for (auto& k : keys) k = dist(rng);
+    // Keys on both sides of the sign bit.
+    if (n > 2) {
+      keys[0] = 0;
+      keys[1] = 0x80000000;
+      keys[2] = 0xFFFFFFFF;
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<uint32_t> probes{0, 1, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+    for (auto k : keys) probes.insert(probes.end(), {k - 1, k, k + 1});
+    for (auto probe : probes) {
+      auto expected = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+      EXPECT_EQ(LowerBound(keys.data(), keys.size(), probe), expected) << probe;
+    }
+  }
+}
+
+TEST(BitmapTest, MergeJoin) {
+  Bitmap lhs, rhs;
+  for (auto k : {1, 3, 4, 9}) lhs.Insert(k, std::make_unique<FullContainer>());
+  for (auto k : {0, 3, 9, 10}) rhs.Insert(k, std::make_unique<EmptyContainer>());
+
+  std::vector<std::tuple<uint32_t, bool, bool>> joined;
+  MergeJoin(lhs, rhs,
+            [&](uint32_t key, const ContainerHandle* l, const ContainerHandle* r) {
+              joined.emplace_back(key, l != nullptr, r != nullptr);
+            });
+
+  using T = std::tuple<uint32_t, bool, bool>;
+  EXPECT_THAT(joined,
+              ElementsAre(T{0, false, true}, T{1, true, false}, T{3, true, true},
+                          T{4, true, false}, T{9, true, true}, T{10, false, true}));
+}
 }  // namespace jitmap
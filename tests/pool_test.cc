@@ -0,0 +1,158 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <jitmap/bitset.h>
+#include <jitmap/pool.h>
+#include <jitmap/util/exception.h>
+
+namespace jitmap {
+
+// Must run first, the pool can only be configured before reserving memory.
+TEST(ContainerPoolTest, Configure) {
+  auto& pool = ContainerPool::Instance();
+  ContainerPool::Options options;
+  options.huge_pages = true;
+  pool.Configure(options);
+
+  auto block = pool.Allocate();
+  // Huge pages might not be available, the pool falls back to regular pages.
+  EXPECT_LE(pool.stats().huge_slabs, pool.stats().slabs);
+  pool.Free(block);
+
+  EXPECT_THROW(pool.Configure(options), Exception);
+}
+
+TEST(ContainerPoolTest, AllocateFree) {
+  auto& pool = ContainerPool::Instance();
+  auto before = pool.stats();
+
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < 1000; i++) {
+    auto block = pool.Allocate();
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % kCacheLineSize, 0);
+    // Blocks must not overlap.
+    std::memset(block, static_cast<int>(i), kBytesPerContainer);
+    blocks.push_back(block);
+  }
+  for (size_t i = 0; i < blocks.size(); i++) {
+    EXPECT_EQ(static_cast<uint8_t*>(blocks[i])[kBytesPerContainer - 1],
+              static_cast<uint8_t>(i));
+  }
+
+  auto during = pool.stats();
+  EXPECT_EQ(during.allocations - before.allocations, 1000);
+  EXPECT_GE(during.blocks_reserved(), during.blocks_in_use());
+  EXPECT_EQ(during.blocks_in_use(), before.blocks_in_use() + 1000);
+
+  for (auto block : blocks) pool.Free(block);
+  auto after = pool.stats();
+  EXPECT_EQ(after.deallocations - before.deallocations, 1000);
+  EXPECT_EQ(after.blocks_in_use(), before.blocks_in_use());
+  EXPECT_GT(after.fragmentation(), during.fragmentation());
+
+  // The last freed block is handed out first.
+  auto block = pool.Allocate();
+  EXPECT_EQ(block, blocks.back());
+  pool.Free(block);
+}
+
+TEST(ContainerPoolTest, Threads) {
+  auto& pool = ContainerPool::Instance();
+  auto before = pool.stats();
+
+  constexpr size_t kThreads = 4;
+  constexpr size_t kIterations = 10000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; t++) {
+    threads.emplace_back([&pool] {
+      std::vector<void*> blocks;
+      for (size_t i = 0; i < kIterations; i++) {
+        blocks.push_back(pool.Allocate());
+        // Free in batches such that blocks flow through the shared list.
+        if (blocks.size() == 100) {
+          for (auto block : blocks) pool.Free(block);
+          blocks.clear();
+        }
+      }
+      for (auto block : blocks) pool.Free(block);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  // The counters of the exited threads are retained.
+  auto after = pool.stats();
+  EXPECT_EQ(after.allocations - before.allocations, kThreads * kIterations);
+  EXPECT_EQ(after.blocks_in_use(), before.blocks_in_use());
+}
+
+TEST(ContainerPoolTest, FreeAfterThreadCache) {
+  struct Holder {
+    ~Holder() { FreeContainer(block); }
+    void* block = nullptr;
+  };
+
+  auto& pool = ContainerPool::Instance();
+  auto before = pool.stats();
+  std::thread([] {
+    // Constructed before the thread cache, thus destroyed after it.
+    thread_local Holder holder;
+    holder.block = AllocateContainer();
+  }).join();
+
+  auto after = pool.stats();
+  EXPECT_EQ(after.allocations - before.allocations, 1);
+  EXPECT_EQ(after.deallocations - before.deallocations, 1);
+}
+
+TEST(ContainerPoolTest, FreeFromOtherThread) {
+  auto& pool = ContainerPool::Instance();
+  auto before = pool.stats();
+
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < 100; i++) blocks.push_back(pool.Allocate());
+  // The thread never allocates, its blocks go through the shared list.
+  std::thread([&pool, &blocks] {
+    for (auto block : blocks) pool.Free(block);
+  }).join();
+
+  auto after = pool.stats();
+  EXPECT_EQ(after.deallocations - before.deallocations, blocks.size());
+  EXPECT_EQ(after.blocks_in_use(), before.blocks_in_use());
+}
+
+TEST(ContainerPoolTest, OwnedBitset) {
+  auto& pool = ContainerPool::Instance();
+  auto before = pool.stats();
+  {
+    auto bitset = make_owned_bitset<kBitsPerContainer>();
+    bitset.set();
+    EXPECT_EQ(bitset.count(), kBitsPerContainer);
+    EXPECT_EQ(pool.stats().blocks_in_use(), before.blocks_in_use() + 1);
+  }
+  EXPECT_EQ(pool.stats().blocks_in_use(), before.blocks_in_use());
+
+  // Other sizes are not pooled.
+  auto small = make_owned_bitset<512>();
+  EXPECT_EQ(pool.stats().blocks_in_use(), before.blocks_in_use());
+}
+
+}  // namespace jitmap
@@ -0,0 +1,179 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../query_test.h"
+
+#include <cstring>
+
+#include <jitmap/query/cache.h>
+#include <jitmap/query/compiler.h>
+#include <jitmap/query/query.h>
+#include <jitmap/util/aligned.h>
+
+namespace jitmap {
+namespace query {
+
+class CacheTest : public QueryTest {
+ protected:
+  CachedBuffer Filled(ResultCache& cache, char value) {
+    auto buffer = cache.Allocate();
+    memset(buffer.get(), value, kBytesPerContainer);
+    return buffer;
+  }
+};
+
+TEST_F(CacheTest, CanonicalForm) {
+  EXPECT_EQ(CanonicalForm(*Parse("a")), "a");
+  EXPECT_EQ(CanonicalForm(*Parse("$1")), "$1");
+  EXPECT_EQ(CanonicalForm(*Parse("!a")), "!a");
+  EXPECT_EQ(CanonicalForm(*Parse("a & b")), CanonicalForm(*Parse("b & a")));
+  EXPECT_EQ(CanonicalForm(*Parse("(a | !b) ^ c")), CanonicalForm(*Parse("c ^ (!b | a)")));
+
+  EXPECT_NE(CanonicalForm(*Parse("a & b")), CanonicalForm(*Parse("a | b")));
+  EXPECT_NE(CanonicalForm(*Parse("a & b")), CanonicalForm(*Parse("a & c")));
+  EXPECT_NE(CanonicalForm(*Parse("!(a & b)")), CanonicalForm(*Parse("!a & b")));
+
+  EXPECT_EQ(CanonicalForm(*Parse("a << 2")), "(a << 2)");
+  EXPECT_EQ(CanonicalForm(*Parse("(b & a) >> 1")), CanonicalForm(*Parse("(a & b) >> 1")));
+  EXPECT_NE(CanonicalForm(*Parse("a << 1")), CanonicalForm(*Parse("a >> 1")));
+  EXPECT_NE(CanonicalForm(*Parse("a << 1")), CanonicalForm(*Parse("a << 2")));
+}
+
+TEST_F(CacheTest, LookupInsert) {
+  ResultCache cache{4 * kBytesPerContainer};
+
+  ResultCacheKey key{"(a & b)", {1, 2}};
+  EXPECT_EQ(cache.Lookup(key), nullptr);
+
+  cache.Insert(key, Filled(cache, 0x0F));
+  auto hit = cache.Lookup(key);
+  ASSERT_NE(hit, nullptr);
+  EXPECT_EQ(hit.get()[0], 0x0F);
+
+  // Same expression, different versions.
+  EXPECT_EQ(cache.Lookup({"(a & b)", {1, 3}}), nullptr);
+
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.memory_usage(), kBytesPerContainer);
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_EQ(cache.misses(), 2);
+}
+
+TEST_F(CacheTest, LruEviction) {
+  ResultCache cache{2 * kBytesPerContainer};
+
+  ResultCacheKey a{"a", {0}}, b{"b", {0}}, c{"c", {0}};
+  cache.Insert(a, Filled(cache, 0x0A));
+  cache.Insert(b, Filled(cache, 0x0B));
+
+  // Touch `a` such that `b` is the least recently used.
+  auto a_buffer = cache.Lookup(a);
+  ASSERT_NE(a_buffer, nullptr);
+
+  cache.Insert(c, Filled(cache, 0x0C));
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.evictions(), 1);
+  EXPECT_NE(cache.Lookup(a), nullptr);
+  EXPECT_EQ(cache.Lookup(b), nullptr);
+  EXPECT_NE(cache.Lookup(c), nullptr);
+
+  // An evicted buffer stays valid while referenced.
+  cache.Clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(a_buffer.get()[kBytesPerContainer - 1], 0x0A);
+}
+
+TEST_F(CacheTest, QueryEvalWithCache) {
+  auto cache = std::make_shared<ResultCache>(16 * kBytesPerContainer);
+  ExecutionContext ctx{JitEngine::Make(), cache};
+
+  auto q1 = Query::Make("cached_q1", "(a & !b) | c", &ctx);
+  auto q2 = Query::Make("cached_q2", "d ^ (!b & a)", &ctx);
+
+  aligned_array<char, kBytesPerContainer> a(0b00001111);
+  aligned_array<char, kBytesPerContainer> b(0b00000011);
+  aligned_array<char, kBytesPerContainer> c(0b00010000);
+  aligned_array<char, kBytesPerContainer> d(0b11111111);
+  aligned_array<char, kBytesPerContainer> result(0x00);
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+
+  auto popcount = q1->Eval(eval_ctx, {a.data(), b.data(), c.data()}, {1, 1, 1},
+                           result.data());
+  EXPECT_THAT(result, testing::Each(0b00011100));
+  EXPECT_EQ(popcount, kBitsPerContainer * 3 / 8);
+  EXPECT_EQ(cache->misses(), 1);
+
+  // `(!b & a)` is shared with q1.
+  q2->Eval(eval_ctx, {d.data(), b.data(), a.data()}, {1, 1, 1}, result.data());
+  EXPECT_THAT(result, testing::Each(static_cast<char>(0b11110011)));
+  EXPECT_EQ(cache->hits(), 1);
+
+  // A new version of `b` invalidates the cached result.
+  b.fill(0b00000001);
+  q1->Eval(eval_ctx, {a.data(), b.data(), c.data()}, {1, 2, 1}, result.data());
+  EXPECT_THAT(result, testing::Each(0b00011110));
+  EXPECT_EQ(cache->misses(), 2);
+
+  // The versions are keyed by variable, `(a & !b)` at versions a=3, b=4 is not
+  // `(!b & a)` at versions b=3, a=4.
+  q1->Eval(eval_ctx, {a.data(), b.data(), c.data()}, {3, 4, 1}, result.data());
+  EXPECT_EQ(cache->misses(), 3);
+  q2->Eval(eval_ctx, {d.data(), b.data(), a.data()}, {1, 3, 4}, result.data());
+  EXPECT_EQ(cache->misses(), 4);
+  q2->Eval(eval_ctx, {d.data(), b.data(), a.data()}, {1, 4, 3}, result.data());
+  EXPECT_EQ(cache->hits(), 2);
+
+  EXPECT_THROW(q1->Eval(eval_ctx, {a.data(), b.data(), c.data()}, {1}, result.data()),
+               Exception);
+}
+
+TEST_F(CacheTest, QueryEvalNestedSubExpressions) {
+  auto cache = std::make_shared<ResultCache>(16 * kBytesPerContainer);
+  ExecutionContext ctx{JitEngine::Make(), cache};
+
+  auto q1 = Query::Make("nested_q1", "((a & !b) & c) & d", &ctx);
+  auto q2 = Query::Make("nested_q2", "(a & !b) | c", &ctx);
+  // The sub-expression kernels don't collide with the user queries.
+  EXPECT_NO_THROW(Query::Make("nested_q1_cached_0", "a & (b | c)", &ctx));
+
+  aligned_array<char, kBytesPerContainer> a(0b00001111);
+  aligned_array<char, kBytesPerContainer> b(0b00000011);
+  aligned_array<char, kBytesPerContainer> c(0b00000110);
+  aligned_array<char, kBytesPerContainer> d(0b00000100);
+  aligned_array<char, kBytesPerContainer> result(0x00);
+
+  EvaluationContext eval_ctx;
+  std::vector<const char*> inputs{a.data(), b.data(), c.data(), d.data()};
+  q1->Eval(eval_ctx, inputs, {1, 1, 1, 1}, result.data());
+  EXPECT_THAT(result, testing::Each(0b00000100));
+  // `a & !b` and `(a & !b) & c`.
+  EXPECT_EQ(cache->misses(), 2);
+  EXPECT_EQ(cache->size(), 2);
+
+  // The nested `a & !b` of the chain is shared with q2.
+  q2->Eval(eval_ctx, {a.data(), b.data(), c.data()}, {1, 1, 1}, result.data());
+  EXPECT_THAT(result, testing::Each(0b00001110));
+  EXPECT_EQ(cache->hits(), 1);
+
+  // The nested sub-expression isn't looked up on a hit of the enclosing one.
+  q1->Eval(eval_ctx, inputs, {1, 1, 1, 2}, result.data());
+  EXPECT_THAT(result, testing::Each(0b00000100));
+  EXPECT_EQ(cache->hits(), 2);
+  EXPECT_EQ(cache->misses(), 2);
+}
+
+}  // namespace query
+}  // namespace jitmap
@@ -14,7 +14,11 @@
 
 #include "../query_test.h"
 
+#include <algorithm>
 #include <atomic>
+#include <regex>
+#include <sstream>
+#include <unordered_map>
 
 #include <jitmap/query/compiler.h>
 #include <jitmap/query/parser.h>
@@ -94,10 +98,59 @@ TEST_F(JitTest, CompileAndExecuteTest) {
 
   AssertQueryResult("a & b & c & d & e", {a, b, c, d, e}, a & b & c & d & e);
   AssertQueryResult("a | b | c | d | e", {a, b, c, d, e}, a | b | c | d | e);
+  AssertQueryResult("a ^ b ^ c ^ d ^ e ^ a", {a, b, c, d, e}, b ^ c ^ d ^ e);
+  AssertQueryResult("(a | b | c) & d & e & (a ^ b ^ c ^ d) & !a", {a, b, c, d, e},
+                    (a | b | c) & d & e & (a ^ b ^ c ^ d) & ~a);
 
   // Complex re-use of inputs
   AssertQueryResult("(a | b) & (((!a & c) | (d & b)) ^ (!e & b))", {a, b, c, d, e},
                     (a | b) & (((~a & c) | (d & b)) ^ (~e & b)));
+
+  // Minimized by the optimizer.
+  AssertQueryResult("(a & b) | (a & c)", {a, b, c}, a & (b | c));
+  AssertQueryResult("!(!a | b) ^ (c & (c | a))", {a, b, c}, (a & ~b) ^ c);
+  AssertQueryResult("(a & !b) | (!a & b) | (a & b)", {a, b}, a | b);
+
+  // Common sub-expressions, shared in the DAG.
+  AssertQueryResult("(a & b) | (c ^ (a & b)) | !(a & b)", {a, b, c},
+                    (a & b) | (c ^ (a & b)) | ~(a & b));
+}
+
+// Return the length of the longest chain of dependent `op` instructions in the
+// function `fn_name` of the IR.
+static size_t ChainHeight(const std::string& ir, const std::string& fn_name,
+                          const std::string& op) {
+  std::regex instruction("\\s*(%\\S+) = " + op + " <[^>]*> (%[^,]+), (%\\S+)");
+  std::unordered_map<std::string, size_t> heights;
+  auto height_of = [&](const std::string& value) -> size_t {
+    auto it = heights.find(value);
+    return it != heights.end() ? it->second : 0;
+  };
+
+  size_t max_height = 0;
+  bool in_fn = false;
+  std::istringstream lines(ir);
+  for (std::string line; std::getline(lines, line);) {
+    if (line.rfind("define ", 0) == 0) {
+      in_fn = line.find("@" + fn_name + "(") != std::string::npos;
+    }
+
+    std::smatch match;
+    if (!in_fn || !std::regex_match(line, match, instruction)) continue;
+    auto height = 1 + std::max(height_of(match[2]), height_of(match[3]));
+    heights[match[1]] = height;
+    max_height = std::max(max_height, height);
+  }
+  return max_height;
+}
+
+TEST_F(JitTest, TreeHeightReductionIR) {
+  auto query = Query::Make("tree_height", "a & b & c & d & e & f & g & h", &ctx);
+
+  // The parsed chain is serial, the compiled one is balanced.
+  EXPECT_EQ(query->compiled_expr(), *Parse("((a & b) & (c & d)) & ((e & f) & (g & h))"));
+  auto ir = ctx.jit()->CompileIR(query->name(), query->compiled_expr());
+  EXPECT_EQ(ChainHeight(ir, query->name(), "and"), 3);
 }
 
 }  // namespace query
@@ -38,12 +38,46 @@ TEST_F(ExprTest, Equals) {
   ExprNe(Not(&e), Not(&f));
 
   ExprEq(And(Var("0"), Or(Var("a"), &f)), And(Var("0"), Or(Var("a"), &f)));
+
+  ExprEq(Shl(Var("a"), 1), Shl(Var("a"), 1));
+  ExprNe(Shl(Var("a"), 1), Shl(Var("a"), 2));
+  ExprNe(Shl(Var("a"), 1), Shr(Var("a"), 1));
+  ExprNe(Shl(Var("a"), 1), Shl(Var("b"), 1));
 }
 
 TEST_F(ExprTest, EqualsNotCommutative) {
   ExprNe(And(Full(), Empty()), And(Empty(), Full()));
 }
 
+TEST_F(ExprTest, HashConsing) {
+  // The structurally equal nodes are a single node.
+  EXPECT_EQ(Var("a"), Var("a"));
+  EXPECT_EQ(And(Var("a"), Var("b")), And(Var("a"), Var("b")));
+  EXPECT_EQ(Shl(Var("a"), 1), Shl(Var("a"), 1));
+  EXPECT_NE(Shl(Var("a"), 1), Shr(Var("a"), 1));
+  EXPECT_NE(And(Var("a"), Var("b")), Or(Var("a"), Var("b")));
+  EXPECT_NE(And(Var("a"), Var("b")), And(Var("b"), Var("a")));
+
+  ExprBuilder builder;
+  auto expr = query::Parse("(a & b) | (c & (a & b))", &builder);
+  auto size = builder.size();
+  // a, b, c, a & b, c & (a & b) and the root.
+  EXPECT_EQ(size, 6);
+  auto common = query::Parse("a & b", &builder);
+  EXPECT_EQ(builder.Or(common, query::Parse("c & (a & b)", &builder)), expr);
+  EXPECT_EQ(builder.size(), size);
+
+  // Copying into the same builder doesn't build nodes.
+  EXPECT_EQ(expr->Copy(&builder), expr);
+  EXPECT_EQ(builder.size(), size);
+
+  // Copying into another builder keeps the DAG.
+  ExprBuilder other;
+  auto copy = expr->Copy(&other);
+  ExprEq(copy, expr);
+  EXPECT_EQ(other.size(), size);
+}
+
 using testing::ElementsAre;
 
 template <typename... T>
@@ -62,6 +96,7 @@ TEST_F(ExprTest, Variables) {
   ReferencesAre("a", "a");
   ReferencesAre("a ^ b", "a", "b");
   ReferencesAre("a ^ (b | $0)", "a", "b");
+  ReferencesAre("(a << 1) & b & (a >> 2)", "a", "b");
 }
 
 }  // namespace query
@@ -54,6 +54,10 @@ TEST_F(OptimizationTest, ConstantFolding) {
   ExpectOpt(cf, Xor(e, Empty()), e);
   ExpectOpt(cf, Xor(Full(), e), Not(e));
   ExpectOpt(cf, Xor(e, f), Xor(e, f));
+
+  ExpectOpt(cf, Shl(Full(), 3), Full());
+  ExpectOpt(cf, Shr(Empty(), 3), Empty());
+  ExpectOpt(cf, Shl(e, 3), Shl(e, 3));
 }
 
 TEST_F(OptimizationTest, SameOperandFolding) {
@@ -81,6 +85,92 @@ TEST_F(OptimizationTest, NotChainFolding) {
   ExpectOpt(nc, Not(Not(Not(Not(Not(Not(e)))))), e);
 }
 
+TEST_F(OptimizationTest, ComplementFolding) {
+  ComplementFolding cf(&expr_builder_);
+
+  ExpectOpt(cf, And(e, Not(e)), Empty());
+  ExpectOpt(cf, And(Not(f), f), Empty());
+  ExpectOpt(cf, Or(f, Not(f)), Full());
+  ExpectOpt(cf, Xor(Not(e), e), Full());
+  ExpectOpt(cf, And(e, Not(f)), And(e, Not(f)));
+  ExpectOpt(cf, Not(Not(e)), Not(Not(e)));
+}
+
+TEST_F(OptimizationTest, AbsorptionFolding) {
+  AbsorptionFolding af(&expr_builder_);
+
+  ExpectOpt(af, And(e, Or(e, f)), e);
+  ExpectOpt(af, And(e, Or(f, e)), e);
+  ExpectOpt(af, And(Or(f, e), e), e);
+  ExpectOpt(af, Or(f, And(e, f)), f);
+  ExpectOpt(af, Or(And(e, f), e), e);
+
+  ExpectOpt(af, And(e, And(e, f)), And(e, And(e, f)));
+  ExpectOpt(af, Or(e, Or(e, f)), Or(e, Or(e, f)));
+  ExpectOpt(af, And(e, Or(Var("x"), f)), And(e, Or(Var("x"), f)));
+}
+
+TEST_F(OptimizationTest, Factoring) {
+  Factoring fa(&expr_builder_);
+  auto a = Var("a");
+  auto b = Var("b");
+  auto c = Var("c");
+
+  ExpectOpt(fa, Or(And(a, b), And(a, c)), And(a, Or(b, c)));
+  ExpectOpt(fa, Or(And(a, b), And(c, a)), And(a, Or(b, c)));
+  ExpectOpt(fa, Or(And(b, a), And(a, c)), And(Or(b, c), a));
+  ExpectOpt(fa, Or(And(b, a), And(c, a)), And(Or(b, c), a));
+  ExpectOpt(fa, And(Or(a, b), Or(a, c)), Or(a, And(b, c)));
+  ExpectOpt(fa, Xor(And(a, b), And(a, c)), And(a, Xor(b, c)));
+
+  // Or doesn't distribute over Xor.
+  ExpectOpt(fa, Xor(Or(a, b), Or(a, c)), Xor(Or(a, b), Or(a, c)));
+  ExpectOpt(fa, Or(Or(a, b), Or(a, c)), Or(Or(a, b), Or(a, c)));
+  ExpectOpt(fa, Or(And(a, b), Or(a, c)), Or(And(a, b), Or(a, c)));
+  ExpectOpt(fa, Or(And(a, b), And(c, e)), Or(And(a, b), And(c, e)));
+}
+
+TEST_F(OptimizationTest, DeMorganFolding) {
+  DeMorganFolding dm(&expr_builder_);
+
+  ExpectOpt(dm, Not(And(Not(e), f)), Or(e, Not(f)));
+  ExpectOpt(dm, Not(And(e, Not(f))), Or(Not(e), f));
+  ExpectOpt(dm, Not(Or(Not(e), Not(f))), And(e, f));
+  ExpectOpt(dm, Not(Xor(Not(e), f)), Xor(e, f));
+  ExpectOpt(dm, Not(Xor(e, Not(f))), Xor(e, f));
+  ExpectOpt(dm, Xor(Not(e), Not(f)), Xor(e, f));
+  // The shifts are pushed down to the variables, the negation commutes.
+  ExpectOpt(dm, Not(Shl(Not(e), 1)), Shl(e, 1));
+  ExpectOpt(dm, Not(Shr(Not(And(e, f)), 3)), Shr(And(e, f), 3));
+
+  // Pushing the negation would add an operation.
+  ExpectOpt(dm, Not(And(e, f)), Not(And(e, f)));
+  ExpectOpt(dm, Xor(Not(e), f), Xor(Not(e), f));
+  ExpectOpt(dm, Not(Shl(e, 1)), Not(Shl(e, 1)));
+}
+
+TEST_F(OptimizationTest, TreeHeightReduction) {
+  TreeHeightReduction th(&expr_builder_);
+  auto a = Var("a"), b = Var("b"), c = Var("c"), d = Var("d");
+
+  ExpectOpt(th, e, e);
+  ExpectOpt(th, f, f);
+  ExpectOpt(th, Parse("a & b & c"), And(And(a, b), c));
+  ExpectOpt(th, Parse("a & b & c & d"), And(And(a, b), And(c, d)));
+  ExpectOpt(th, Parse("a | b | c | d | e"), Or(Or(Or(a, b), Or(c, d)), e));
+  ExpectOpt(th, Parse("!(a ^ b ^ c ^ d) << 1"), Shl(Not(Xor(Xor(a, b), Xor(c, d))), 1));
+
+  // The chains of different operators are reduced independently.
+  ExpectOpt(th, Parse("a & b | c & d"), Parse("a & b | c & d"));
+  // The height of the operands weigh on the shape of the chain.
+  ExpectOpt(th, Parse("a & b & c & (d | e | f | g)"),
+            And(And(And(a, b), c), Or(Or(d, e), Or(Var("f"), Var("g")))));
+
+  // The variables are referenced in the same order.
+  auto wide = Parse("x & (c | b | e | a) & d & !(a ^ y ^ z ^ b ^ c) & w & v");
+  EXPECT_EQ(th(wide)->Variables(), wide->Variables());
+}
+
 TEST_F(OptimizationTest, Optimizer) {
   Optimizer opt(&expr_builder_);
 
@@ -93,8 +183,46 @@ TEST_F(OptimizationTest, Optimizer) {
   // NotChainFolding
   ExpectOpt(opt, Not(Not(e)), e);
 
+  // TreeHeightReduction
+  ExpectOpt(opt, Parse("a & b & c & d"), Parse("(a & b) & (c & d)"));
+
+  // ComplementFolding
+  ExpectOpt(opt, Or(f, Not(f)), Full());
+  // AbsorptionFolding
+  ExpectOpt(opt, And(e, Or(e, f)), e);
+  // Factoring
+  ExpectOpt(opt, Parse("(a & b) | (a & c)"), Parse("a & (b | c)"));
+  // DeMorganFolding
+  ExpectOpt(opt, Parse("!(!a | !b)"), Parse("a & b"));
+  ExpectOpt(opt, Parse("!((!a) << 1)"), Parse("a << 1"));
+
   // A mixed bag
   ExpectOpt(opt, And(e, Or(e, Not(Not(Not(Full()))))), e);
+  ExpectOpt(opt, Parse("a & $1 & b & c & (d & $1)"), Parse("(a & b) & (c & d)"));
+
+  // The passes expose each other until a fixpoint: the factoring yields a
+  // complement, then a constant.
+  ExpectOpt(opt, Parse("(a & b) | (a & !b)"), Parse("a"));
+  ExpectOpt(opt, Parse("(a | !b) & (a | b) & !(!a & c)"), Parse("a"));
+  ExpectOpt(opt, Parse("!(!(a & b) & !(a & c))"), Parse("a & (b | c)"));
+}
+
+TEST_F(OptimizationTest, OperationCount) {
+  EXPECT_EQ(Optimizer::OperationCount(*e), 0);
+  EXPECT_EQ(Optimizer::OperationCount(*Full()), 0);
+  EXPECT_EQ(Optimizer::OperationCount(*f), 3);
+  // A shared node is counted once.
+  EXPECT_EQ(Optimizer::OperationCount(*Parse("(a & b) | ((a & b) << 1)")), 3);
+  EXPECT_EQ(Optimizer::OperationCount(*Xor(f, f)), 4);
+
+  Optimizer opt(&expr_builder_);
+  for (auto query : {"(a & b) | (a & c)", "!(!a & b) ^ (a & (a | c))",
+                     "((a ^ b) << 1) & !!(a ^ b)", "a & b & !(c | d) & e"}) {
+    auto expr = Parse(query);
+    EXPECT_LE(Optimizer::OperationCount(*opt.Optimize(*expr)),
+              Optimizer::OperationCount(*expr))
+        << query;
+  }
 }
 
 }  // namespace query
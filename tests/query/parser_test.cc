@@ -37,6 +37,8 @@ class LexerTest : public QueryTest {
   auto And() { return Token::AndOp(); }
   auto Or() { return Token::OrOp(); }
   auto Xor() { return Token::XorOp(); }
+  auto Shl() { return Token::ShiftLeftOp(); }
+  auto Shr() { return Token::ShiftRightOp(); }
 
   template <typename... T>
   void ExpectTokenize(std::string_view query, T... tokens) {
@@ -94,9 +96,17 @@ TEST_F(LexerTest, Basic) {
 
   ExpectTokenize("((a | b) ^ !b) ", Left(), Left(), Var("a"), Or(), Var("b"), Right(),
                  Xor(), Not(), Var("b"), Right());
+
+  ExpectTokenize("a << 1", Var("a"), Shl(), Var("1"));
+  ExpectTokenize("(a>>12)&b", Left(), Var("a"), Shr(), Var("12"), Right(), And(),
+                 Var("b"));
 }
 
-TEST_F(LexerTest, Errors) {}
+TEST_F(LexerTest, Errors) {
+  ExpectThrow("a < 1");
+  ExpectThrow("a > 1");
+  ExpectThrow("a <> 1");
+}
 
 TEST_F(ParserTest, Basic) {
   ExpectParse("$0", Empty());
@@ -134,6 +144,13 @@ TEST_F(ParserTest, OperatorPrecedence) {
 
   // Enforce with parenthesis
   ExpectParse("a ^ b & (c | d)", Xor(Var("a"), And(Var("b"), Or(Var("c"), Var("d")))));
+
+  // Not precede over the shifts, which precede over And, and chain left to
+  // right.
+  ExpectParse("!a << 1 & b", And(Shl(Not(Var("a")), 1), Var("b")));
+  ExpectParse("a << 1 >> 2", Shr(Shl(Var("a"), 1), 2));
+  ExpectParse("a | b >> 3", Or(Var("a"), Shr(Var("b"), 3)));
+  ExpectParse("(a | b) >> 3", Shr(Or(Var("a"), Var("b")), 3));
 }
 
 TEST_F(ParserTest, Errors) {
@@ -158,6 +175,14 @@ TEST_F(ParserTest, Errors) {
   ExpectThrow("a)");
   ExpectThrow("()(a)");
   ExpectThrow("(a)()");
+
+  // Invalid shift amounts
+  ExpectThrow("a << b");
+  ExpectThrow("a << ");
+  ExpectThrow("a << (1)");
+  ExpectThrow("a << 1a");
+  ExpectThrow("a << 4294967296");
+  ExpectThrow("<< 1");
 }
 
 }  // namespace query
@@ -14,8 +14,15 @@
 
 #include "../query_test.h"
 
+#include <algorithm>
+#include <unordered_map>
+
+#include <jitmap/container/run.h>
+#include <jitmap/dirty.h>
+#include <jitmap/jitmap.h>
 #include <jitmap/query/compiler.h>
 #include <jitmap/query/query.h>
+#include <jitmap/tiny.h>
 #include <jitmap/util/aligned.h>
 
 namespace jitmap {
@@ -49,6 +56,11 @@ TEST_F(QueryExecTest, Make) {
   auto q2 = Query::Make("q2", "a ^ a", &ctx);
   EXPECT_EQ(q2->name(), "q2");
   EXPECT_EQ(q2->expr(), Xor(Var("a"), Var("a")));
+  // The folded expression doesn't keep the variable.
+  EXPECT_EQ(q2->compiled_expr(), Xor(Var("a"), Var("a")));
+
+  auto q3 = Query::Make("q3", "!!a & b", &ctx);
+  EXPECT_EQ(q3->compiled_expr(), And(Var("a"), Var("b")));
 }
 
 TEST_F(QueryExecTest, variables) {
@@ -141,5 +153,542 @@ TEST_F(QueryExecTest, EvalWithPopCount) {
   EXPECT_EQ(q->Eval(eval_ctx, inputs, result.data()), kBitsPerContainer / 8);
 }
 
+TEST_F(QueryExecTest, EvalIncremental) {
+  aligned_array<BitsetWordType, kBitsPerContainer / 64> a_storage(0ULL);
+  aligned_array<char, kBytesPerContainer> b(0xFF);
+  aligned_array<char, kBytesPerContainer> result(0x00);
+  TrackedBitset<> a{a_storage.data()};
+
+  auto q = Query::Make("incremental_a_and_b", "a & b", &ctx);
+  std::vector<const char*> inputs{a.data(), b.data()};
+  // The incremental kernel is compiled on first use.
+  EXPECT_THROW(ctx.jit()->LookupUserIncrementalQuery("incremental_a_and_b"),
+               CompilerException);
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  auto popcount = q->Eval(eval_ctx, inputs, result.data());
+  EXPECT_EQ(popcount, 0);
+
+  a.set(0);
+  a.set(kBitsPerCacheLine * 3 + 1);
+  a.set(kBitsPerContainer - 1);
+  popcount = q->EvalIncremental(eval_ctx, inputs, a.dirty(), result.data(), popcount);
+  EXPECT_EQ(popcount, 3);
+  EXPECT_EQ(result[0], 0x01);
+  EXPECT_EQ(result[kCacheLineSize * 3], 0x02);
+  EXPECT_EQ(result[kBytesPerContainer - 1], static_cast<char>(0x80));
+
+  a.ClearDirty();
+  a.reset(0);
+  popcount = q->EvalIncremental(eval_ctx, inputs, a.dirty(), result.data(), popcount);
+  EXPECT_EQ(popcount, 2);
+  EXPECT_EQ(result[0], 0x00);
+
+  // Lines not flagged as dirty are not recomputed.
+  DirtyLines nothing;
+  b.fill(0x00);
+  popcount = q->EvalIncremental(eval_ctx, inputs, nothing, result.data(), popcount);
+  EXPECT_EQ(popcount, 2);
+  EXPECT_EQ(result[kCacheLineSize * 3], 0x02);
+
+  EXPECT_EQ(q->EvalIncremental(eval_ctx, inputs, nothing, result.data()),
+            kUnknownPopCount);
+
+  // The dense containers track their modified cachelines.
+  DenseContainer c;
+  b.fill(0xFF);
+  inputs[0] = reinterpret_cast<const char*>(c.data());
+  popcount = q->Eval(eval_ctx, inputs, result.data());
+  c.set(kBitsPerCacheLine * 7);
+  popcount = q->EvalIncremental(eval_ctx, inputs, c.dirty(), result.data(), popcount);
+  EXPECT_EQ(popcount, 1);
+  EXPECT_EQ(result[kCacheLineSize * 7], 0x01);
+}
+
+TEST_F(QueryExecTest, EvalBatch) {
+  constexpr size_t kBatchSize = 3;
+  std::vector<aligned_array<char, kBytesPerContainer>> a(kBatchSize), b(kBatchSize),
+      results(kBatchSize);
+
+  std::vector<const char*> inputs;
+  std::vector<char*> outputs;
+  for (size_t i = 0; i < kBatchSize; i++) {
+    a[i].fill(0xFF);
+    b[i].fill(0x00);
+    b[i][i] = 0x01;
+    inputs.push_back(a[i].data());
+    inputs.push_back(b[i].data());
+    outputs.push_back(results[i].data());
+  }
+
+  auto q = Query::Make("batch_a_and_b", "a & b", &ctx);
+  // The batch kernel is compiled on first use.
+  EXPECT_THROW(ctx.jit()->LookupUserBatchQuery("batch_a_and_b"), CompilerException);
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  EXPECT_EQ(q->EvalBatch(eval_ctx, inputs, outputs),
+            std::vector<int32_t>(kBatchSize, 1));
+  EXPECT_NE(ctx.jit()->LookupUserBatchQuery("batch_a_and_b"), nullptr);
+  for (size_t i = 0; i < kBatchSize; i++) {
+    EXPECT_EQ(results[i][i], 0x01);
+  }
+
+  EXPECT_THROW(q->EvalBatch(eval_ctx, {a[0].data()}, outputs), Exception);
+
+  // The absorption drops the shift, the inputs of each output are still
+  // padded with the adjacent containers.
+  auto absorbed = Query::Make("batch_absorbed", "a | (a & (a << 1))", &ctx);
+  inputs.clear();
+  for (size_t i = 0; i < kBatchSize; i++) {
+    a[i].fill(0x00);
+    a[i][i] = 0x03;
+    inputs.push_back(a[i].data());
+  }
+  EXPECT_EQ(absorbed->EvalBatch(eval_ctx, inputs, outputs),
+            std::vector<int32_t>(kBatchSize, 2));
+  for (size_t i = 0; i < kBatchSize; i++) {
+    EXPECT_TRUE(std::equal(a[i].begin(), a[i].end(), results[i].begin())) << i;
+  }
+}
+
+TEST_F(QueryExecTest, EvalAsync) {
+  constexpr size_t kRequests = 256;
+  aligned_array<char, kBytesPerContainer> a(0xFF);
+  aligned_array<char, kBytesPerContainer> b(0x0F);
+  std::vector<aligned_array<char, kBytesPerContainer>> results(kRequests);
+
+  auto q = Query::Make("async_a_and_b", "a & b", &ctx);
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+
+  std::vector<std::future<int32_t>> futures;
+  for (auto& result : results) {
+    futures.push_back(q->EvalAsync(eval_ctx, {a.data(), b.data()}, result.data()));
+  }
+
+  for (size_t i = 0; i < kRequests; i++) {
+    EXPECT_EQ(futures[i].get(), kBitsPerContainer / 2);
+    EXPECT_THAT(results[i], testing::Each(0x0F));
+  }
+
+  std::promise<int32_t> done;
+  EvaluationContext missing_ctx;
+  missing_ctx.set_missing_policy(EvaluationContext::REPLACE_WITH_EMPTY);
+  q->EvalAsync(missing_ctx, {a.data(), nullptr}, results[0].data(),
+               [&done](int32_t popcount, std::exception_ptr error) {
+                 EXPECT_EQ(error, nullptr);
+                 done.set_value(popcount);
+               });
+  EXPECT_EQ(done.get_future().get(), kUnknownPopCount);
+  EXPECT_THAT(results[0], testing::Each(0x00));
+
+  // A throwing callback doesn't prevent the other requests from completing.
+  q->EvalAsync(eval_ctx, {a.data(), b.data()}, results[0].data(),
+               [](int32_t, std::exception_ptr) { throw std::runtime_error("callback"); });
+  EXPECT_EQ(q->EvalAsync(eval_ctx, {a.data(), b.data()}, results[1].data()).get(),
+            kBitsPerContainer / 2);
+}
+
+TEST_F(QueryExecTest, EvalContainers) {
+  DenseContainer dense;
+  for (uint32_t i = 0; i < kBitsPerContainer; i += 3) dense.set(i);
+  // Elements on both sides of the cacheline boundaries.
+  ArrayContainer array({0, 1, 31, 32, 511, 512, 513, 4000, 65535});
+  // Runs contained in a lane, spanning lanes and spanning cachelines.
+  RunContainer runs({{2, 3}, {30, 40}, {500, 1100}, {2048, 511}, {65000, 535}});
+  EmptyContainer empty;
+  FullContainer full;
+
+  // The reference evaluation goes through the dense representations.
+  auto dense_array = array.ToDense();
+  auto dense_runs = runs.ToDense();
+  DenseContainer dense_empty, dense_full;
+  dense_full.bitmap().set();
+  std::unordered_map<const Container*, const DenseContainer*> as_dense{
+      {&dense, &dense},        {&array, &dense_array}, {&runs, &dense_runs},
+      {&empty, &dense_empty}, {&full, &dense_full}};
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+
+  aligned_array<char, kBytesPerContainer> result(0x00);
+  aligned_array<char, kBytesPerContainer> expected(0x00);
+
+  auto q = Query::Make("containers", "(a & !b) | (c ^ b)", &ctx);
+  std::vector<std::vector<const Container*>> combinations{
+      {&dense, &array, &runs},  {&array, &runs, &dense}, {&runs, &runs, &array},
+      {&array, &array, &array}, {&dense, &dense, &dense}, {&full, &array, &empty}};
+  for (const auto& containers : combinations) {
+    std::vector<const char*> inputs;
+    for (auto c : containers) {
+      inputs.push_back(reinterpret_cast<const char*>(as_dense[c]->data()));
+    }
+
+    auto popcount = q->Eval(eval_ctx, inputs, expected.data());
+    EXPECT_EQ(q->EvalContainers(eval_ctx, containers, result.data()), popcount);
+    EXPECT_EQ(result, expected);
+  }
+
+  EXPECT_THROW(q->EvalContainers(eval_ctx, {&dense, &array}, result.data()), Exception);
+  EXPECT_THROW(q->EvalContainers(eval_ctx, {&dense, nullptr, &runs}, result.data()),
+               Exception);
+}
+
+TEST_F(QueryExecTest, EvalCompact) {
+  DenseContainer a, b;
+  a.bitmap().set();
+  auto as_input = [](const DenseContainer& c) {
+    return reinterpret_cast<const char*>(c.data());
+  };
+  std::vector<const char*> inputs{as_input(a), as_input(b)};
+
+  auto q = Query::Make("compact_a_and_b", "a & b", &ctx);
+  // The kernel counting the runs is compiled on first use.
+  EXPECT_THROW(ctx.jit()->LookupUserRunsQuery("compact_a_and_b"), CompilerException);
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  eval_ctx.set_output_policy(EvaluationContext::COMPACT);
+  EXPECT_EQ(q->Eval(eval_ctx, inputs)->container_type(), EMPTY);
+  auto runs_fn = ctx.jit()->LookupUserRunsQuery("compact_a_and_b");
+
+  for (uint32_t i = 0; i < 100; i++) b.set(i * 601);
+  auto result = q->Eval(eval_ctx, inputs);
+  ASSERT_EQ(result->container_type(), ARRAY);
+  EXPECT_EQ(static_cast<const ArrayContainer&>(*result).cardinality(), 100);
+
+  // Runs spanning lanes, cachelines and ending on the last bit.
+  b.bitmap().reset();
+  for (uint32_t i = 30; i < 40; i++) b.set(i);
+  for (uint32_t i = 500; i < 1100; i++) b.set(i);
+  for (uint32_t i = 60000; i < kBitsPerContainer; i++) b.set(i);
+  result = q->Eval(eval_ctx, inputs);
+  ASSERT_EQ(result->container_type(), RUN_LENGTH);
+  std::vector<jitmap::Run> expected_runs{{30, 9}, {500, 599}, {60000, 5535}};
+  EXPECT_EQ(static_cast<const RunContainer&>(*result).runs(), expected_runs);
+
+  for (uint32_t i = 0; i < kBitsPerContainer; i += 3) b.set(i);
+  result = q->Eval(eval_ctx, inputs);
+  ASSERT_EQ(result->container_type(), BITMAP);
+  EXPECT_EQ(static_cast<const DenseContainer&>(*result).bitmap(), b.bitmap());
+
+  // The kernel counts the runs in the same pass.
+  aligned_array<char, kBytesPerContainer> output(0x00);
+  int32_t n_runs = 0;
+  EXPECT_EQ(runs_fn(inputs.data(), output.data(), &n_runs), b.cardinality());
+  EXPECT_EQ(n_runs, CountRuns(b.data()));
+
+  b.bitmap().set();
+  EXPECT_EQ(q->Eval(eval_ctx, inputs)->container_type(), FULL);
+  EXPECT_EQ(q->EvalContainers(eval_ctx, {&a, &b})->container_type(), FULL);
+
+  // Sparse inputs, the runs are counted after the specialized kernel.
+  ArrayContainer array({1, 2, 3, 4, 5, 6, 7, 8, 1000});
+  result = q->EvalContainers(eval_ctx, {&a, &array});
+  ASSERT_EQ(result->container_type(), RUN_LENGTH);
+  expected_runs = {{1, 7}, {1000, 0}};
+  EXPECT_EQ(static_cast<const RunContainer&>(*result).runs(), expected_runs);
+
+  // The result is dense without popcount or with the DENSE policy.
+  eval_ctx.set_popcount(false);
+  EXPECT_EQ(q->Eval(eval_ctx, inputs)->container_type(), BITMAP);
+  eval_ctx.set_popcount(true);
+  eval_ctx.set_output_policy(EvaluationContext::DENSE);
+  EXPECT_EQ(q->EvalContainers(eval_ctx, {&a, &array})->container_type(), BITMAP);
+}
+
+TEST_F(QueryExecTest, EvalShared) {
+  DenseContainer a;
+  a.set(42);
+  ContainerHandle dense{std::make_unique<DenseContainer>(std::move(a))};
+  ContainerHandle array{std::make_unique<ArrayContainer>(std::vector<uint16_t>{42, 43})};
+  ContainerHandle empty{std::make_unique<EmptyContainer>()};
+  ContainerHandle full{std::make_unique<FullContainer>()};
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  eval_ctx.set_missing_policy(EvaluationContext::REPLACE_WITH_EMPTY);
+
+  // The missing and constant inputs reduce the expression to `a`.
+  auto q = Query::Make("shared_and_not", "a & !b", &ctx);
+  EXPECT_EQ(q->EvalShared(eval_ctx, {&dense, nullptr}), dense.shared());
+  EXPECT_EQ(q->EvalShared(eval_ctx, {&dense, &empty}), dense.shared());
+  EXPECT_EQ(q->EvalShared(eval_ctx, {&array, &empty}), array.shared());
+
+  auto result = q->EvalShared(eval_ctx, {&dense, &array});
+  EXPECT_NE(result, dense.shared());
+  EXPECT_EQ(result->container_type(), BITMAP);
+  EXPECT_EQ(result->statistics().count(), 0);
+
+  // A constant result is evaluated, following the output policy.
+  result = q->EvalShared(eval_ctx, {&dense, &full});
+  EXPECT_EQ(result->container_type(), BITMAP);
+  eval_ctx.set_output_policy(EvaluationContext::COMPACT);
+  EXPECT_EQ(q->EvalShared(eval_ctx, {&dense, &full})->container_type(), EMPTY);
+
+  auto same = Query::Make("shared_same", "(a | $0) & (a ^ $0) & ($1 & b | b)", &ctx);
+  EXPECT_EQ(same->EvalShared(eval_ctx, {&array, &full}), array.shared());
+
+  auto a_and_b = Query::Make("shared_and", "a & b", &ctx);
+  eval_ctx.set_missing_policy(EvaluationContext::REPLACE_WITH_FULL);
+  EXPECT_EQ(a_and_b->EvalShared(eval_ctx, {&dense, nullptr}), dense.shared());
+
+  eval_ctx.set_missing_policy(EvaluationContext::ERROR);
+  EXPECT_THROW(q->EvalShared(eval_ctx, {&dense, nullptr}), Exception);
+  EXPECT_THROW(q->EvalShared(eval_ctx, {&dense}), Exception);
+  // The missing input is folded away but still required.
+  auto folded = Query::Make("shared_folded", "a | (b & $0)", &ctx);
+  EXPECT_THROW(folded->EvalShared(eval_ctx, {&dense, nullptr}), Exception);
+  eval_ctx.set_missing_policy(EvaluationContext::REPLACE_WITH_FULL);
+  EXPECT_EQ(folded->EvalShared(eval_ctx, {&dense, nullptr}), dense.shared());
+}
+
+TEST_F(QueryExecTest, EvalTiny) {
+  auto q = Query::Make("tiny", "(a & b) ^ !c", &ctx);
+
+  for (size_t n_bits : {64, 128, 256, 512}) {
+    const size_t n_words = n_bits / kBitsInTiny;
+    // The words of a, b and c, one after the other.
+    std::vector<uint64_t> inputs(3 * n_words);
+    for (size_t i = 0; i < inputs.size(); i++) {
+      inputs[i] = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+
+    std::vector<uint64_t> output(n_words, 0);
+    int32_t expected_popcount = 0;
+    auto popcount = q->EvalTiny(n_bits, inputs.data(), output.data());
+    for (size_t w = 0; w < n_words; w++) {
+      auto a = inputs[w], b = inputs[n_words + w], c = inputs[2 * n_words + w];
+      EXPECT_EQ(output[w], (a & b) ^ ~c) << n_bits;
+      expected_popcount += __builtin_popcountll(output[w]);
+    }
+    EXPECT_EQ(popcount, expected_popcount);
+  }
+
+  uint64_t words[3] = {0, 0, 0};
+  EXPECT_THROW(q->EvalTiny(32, words, words), Exception);
+  EXPECT_THROW(q->EvalTiny(1024, words, words), Exception);
+  EXPECT_THROW(q->EvalTiny(64, nullptr, words), Exception);
+}
+
+TEST_F(QueryExecTest, EvalContainersPruning) {
+  // Two dense containers whose set bits are in a few blocks.
+  DenseContainer a, b;
+  for (uint32_t i = 0; i < kBitsPerProxyBit; i += 7) {
+    a.set(i);
+    a.set(10 * kBitsPerProxyBit + i);
+    b.set(i + 1);
+    b.set(20 * kBitsPerProxyBit + i);
+  }
+  EmptyContainer empty;
+  FullContainer full;
+  auto bytes = [](const DenseContainer& c) {
+    return reinterpret_cast<const char*>(c.data());
+  };
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  aligned_array<char, kBytesPerContainer> result(0x00);
+  aligned_array<char, kBytesPerContainer> expected(0x00);
+
+  // Only the blocks set in both inputs are evaluated.
+  auto a_and_b = Query::Make("pruned_and", "a & b", &ctx);
+  result.fill(0x5A);
+  auto popcount = a_and_b->Eval(eval_ctx, {bytes(a), bytes(b)}, expected.data());
+  EXPECT_EQ(a_and_b->EvalContainers(eval_ctx, {&a, &b}, result.data()), popcount);
+  EXPECT_EQ(result, expected);
+
+  auto a_or_b = Query::Make("pruned_or", "a | b", &ctx);
+  result.fill(0x5A);
+  popcount = a_or_b->Eval(eval_ctx, {bytes(a), bytes(b)}, expected.data());
+  EXPECT_EQ(a_or_b->EvalContainers(eval_ctx, {&a, &b}, result.data()), popcount);
+  EXPECT_EQ(result, expected);
+
+  // Results proven empty or full.
+  auto q = Query::Make("pruned", "(a & b) | !c", &ctx);
+  EXPECT_EQ(q->EvalContainers(eval_ctx, {&a, &empty, &full}, result.data()), 0);
+  EXPECT_THAT(result, testing::Each(0x00));
+  EXPECT_EQ(q->EvalContainers(eval_ctx, {&a, &b, &empty}, result.data()),
+            kBitsPerContainer);
+  EXPECT_THAT(result, testing::Each(0xFF));
+
+  auto x = Query::Make("pruned_xor", "a ^ b", &ctx);
+  EXPECT_EQ(x->EvalContainers(eval_ctx, {&full, &full}, result.data()), 0);
+  EXPECT_THAT(result, testing::Each(0x00));
+  EXPECT_EQ(x->EvalContainers(eval_ctx, {&empty, &full}, result.data()),
+            kBitsPerContainer);
+  EXPECT_THAT(result, testing::Each(0xFF));
+
+  eval_ctx.set_popcount(false);
+  EXPECT_EQ(x->EvalContainers(eval_ctx, {&full, &full}, result.data()),
+            kUnknownPopCount);
+
+  // The runs of a pruned result are counted in the evaluated blocks.
+  DenseContainer c, d;
+  for (uint32_t i = kBitsPerProxyBit - 10; i < kBitsPerProxyBit + 10; i++) c.set(i);
+  for (uint32_t i = 0; i < 100; i++) d.set(5 * kBitsPerProxyBit + i);
+  eval_ctx.set_popcount(true);
+  eval_ctx.set_output_policy(EvaluationContext::COMPACT);
+  auto runs = a_or_b->EvalContainers(eval_ctx, {&c, &d});
+  ASSERT_EQ(runs->container_type(), RUN_LENGTH);
+  std::vector<jitmap::Run> expected_runs{{kBitsPerProxyBit - 10, 19},
+                                         {5 * kBitsPerProxyBit, 99}};
+  EXPECT_EQ(static_cast<const RunContainer&>(*runs).runs(), expected_runs);
+}
+
+// Set the bits of a pseudo-random sequence, about one in `1 << log_density`.
+static void FillRandom(DenseContainer* container, uint64_t seed, int log_density = 2) {
+  uint64_t state = seed;
+  for (uint32_t i = 0; i < kBitsPerContainer; i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    if ((state >> (64 - log_density)) == 0) container->set(i);
+  }
+}
+
+TEST_F(QueryExecTest, EvalShift) {
+  constexpr int64_t kBits = kBitsPerContainer;
+  // The containers of `a` around the evaluated one, and the evaluated
+  // container of `b`.
+  std::vector<std::unique_ptr<DenseContainer>> containers;
+  for (uint64_t seed = 1; seed <= 4; seed++) {
+    containers.push_back(std::make_unique<DenseContainer>());
+    FillRandom(containers.back().get(), seed, seed == 4 ? 1 : 2);
+  }
+  // Bits on both sides of the lane, vector and container boundaries.
+  for (uint16_t i : {0, 1, 31, 32, 511, 512, 65534, 65535}) {
+    for (size_t c = 0; c < 3; c++) containers[c]->set(i);
+  }
+  std::vector<const DenseContainer*> dense;
+  for (const auto& c : containers) dense.push_back(c.get());
+  const DenseContainer& a = *dense[1];
+  const DenseContainer& b = *dense[3];
+  // The bit of `a` at a position relative to the evaluated container.
+  auto a_at = [&](int64_t p) {
+    if (p < 0) return (*dense[0])[static_cast<uint16_t>(p + kBits)];
+    if (p >= kBits) return (*dense[2])[static_cast<uint16_t>(p - kBits)];
+    return (*dense[1])[static_cast<uint16_t>(p)];
+  };
+
+  ContainerHandle a_previous_handle{std::move(containers[0])};
+  ContainerHandle a_handle{std::move(containers[1])};
+  ContainerHandle a_next_handle{std::move(containers[2])};
+  ContainerHandle b_handle{std::move(containers[3])};
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  aligned_array<char, kBytesPerContainer> result(0x00);
+  auto bytes = [](const DenseContainer& c) {
+    return reinterpret_cast<const char*>(c.data());
+  };
+
+  for (int64_t amount : {1, 31, 32, 33, 512, 1000, 65535}) {
+    for (bool left : {true, false}) {
+      const std::string op = left ? " << " : " >> ";
+      auto q = Query::Make("shift_" + std::string(left ? "left_" : "right_") +
+                               std::to_string(amount),
+                           "(a" + op + std::to_string(amount) + ") & !b", &ctx);
+      const int64_t source = left ? -amount : amount;
+
+      // With the adjacent containers.
+      auto shared =
+          q->EvalShared(eval_ctx, {&a_handle, &b_handle}, {&a_previous_handle, nullptr},
+                        {&a_next_handle, nullptr});
+      // A single container, the adjacent containers are empty.
+      auto popcount = q->Eval(eval_ctx, {bytes(a), bytes(b)}, result.data());
+
+      int32_t expected_shared = 0, expected_single = 0;
+      for (int64_t i = 0; i < kBits; i++) {
+        auto index = static_cast<uint16_t>(i);
+        const bool in_container = i + source >= 0 && i + source < kBits;
+        const bool expected = a_at(i + source) && !b[index];
+        ASSERT_EQ((*shared)[index], expected) << amount << op << i;
+        ASSERT_EQ((result[i / 8] >> (i % 8)) & 1, expected && in_container)
+            << amount << op << i;
+        expected_shared += expected;
+        expected_single += expected && in_container;
+      }
+      EXPECT_EQ(shared->statistics().count(), expected_shared);
+      EXPECT_EQ(popcount, expected_single);
+    }
+  }
+
+  // The sparse inputs are decoded.
+  std::vector<uint16_t> values{0, 65535};
+  std::vector<jitmap::Run> b_runs{{0, 5}};
+  ContainerHandle array{std::make_unique<ArrayContainer>(values)};
+  ContainerHandle runs{std::make_unique<RunContainer>(b_runs)};
+  auto phrase = Query::Make("shift_phrase", "(a << 1) & b", &ctx);
+  auto shared = phrase->EvalShared(eval_ctx, {&array, &runs}, {&array, nullptr}, {});
+  EXPECT_EQ(shared->statistics().count(), 2);
+  EXPECT_TRUE((*shared)[0] && (*shared)[1]);
+
+  // At most a container away.
+  EXPECT_THROW(Query::Make("shift_far", "a << 65536", &ctx), CompilerException);
+  EXPECT_THROW(Query::Make("shift_far_sum", "a >> 40000 >> 40000", &ctx),
+               CompilerException);
+  EXPECT_THROW(phrase->EvalShared(eval_ctx, {&array, &runs}, {&array}, {}), Exception);
+}
+
+TEST_F(QueryExecTest, EvalShiftIncremental) {
+  aligned_array<BitsetWordType, kBitsPerContainer / 64> a_storage(0ULL);
+  aligned_array<char, kBytesPerContainer> result(0x00);
+  TrackedBitset<> a{a_storage.data()};
+
+  auto q = Query::Make("incremental_shift", "a << 1", &ctx);
+  std::vector<const char*> inputs{a.data()};
+
+  EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  auto popcount = q->Eval(eval_ctx, inputs, result.data());
+  EXPECT_EQ(popcount, 0);
+
+  // The bit moves to the next cacheline, which is not dirty.
+  a.set(kBitsPerCacheLine - 1);
+  popcount = q->EvalIncremental(eval_ctx, inputs, a.dirty(), result.data(), popcount);
+  EXPECT_EQ(popcount, 1);
+  EXPECT_EQ(result[kCacheLineSize], 0x01);
+}
+
+TEST_F(QueryExecTest, EvalTinyShift) {
+  auto q = Query::Make("tiny_shift", "(a << 3) ^ (b >> 70)", &ctx);
+  // The shared node `a ^ b` is evaluated at two offsets.
+  auto shared = Query::Make("tiny_shift_shared", "((a ^ b) << 1) & ((a ^ b) >> 1)", &ctx);
+
+  for (size_t n_bits : {64, 128, 256, 512}) {
+    const size_t n_words = n_bits / kBitsInTiny;
+    std::vector<uint64_t> inputs(2 * n_words);
+    for (size_t i = 0; i < inputs.size(); i++) {
+      inputs[i] = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+    auto bit = [&](size_t input, int64_t p) {
+      if (p < 0 || p >= static_cast<int64_t>(n_bits)) return false;
+      return ((inputs[input * n_words + p / 64] >> (p % 64)) & 1) == 1;
+    };
+
+    std::vector<uint64_t> output(n_words, 0);
+    auto popcount = q->EvalTiny(n_bits, inputs.data(), output.data());
+    int32_t expected_popcount = 0;
+    for (int64_t p = 0; p < static_cast<int64_t>(n_bits); p++) {
+      const bool expected = bit(0, p - 3) != bit(1, p + 70);
+      EXPECT_EQ((output[p / 64] >> (p % 64)) & 1, expected) << n_bits << " " << p;
+      expected_popcount += expected;
+    }
+    EXPECT_EQ(popcount, expected_popcount);
+
+    popcount = shared->EvalTiny(n_bits, inputs.data(), output.data());
+    expected_popcount = 0;
+    auto either = [&](int64_t p) { return bit(0, p) != bit(1, p); };
+    for (int64_t p = 0; p < static_cast<int64_t>(n_bits); p++) {
+      const bool expected = either(p - 1) && either(p + 1);
+      EXPECT_EQ((output[p / 64] >> (p % 64)) & 1, expected) << n_bits << " " << p;
+      expected_popcount += expected;
+    }
+    EXPECT_EQ(popcount, expected_popcount);
+  }
+}
+
 }  // namespace query
 }  // namespace jitmap
@@ -53,6 +53,13 @@ class QueryTest : public testing::Test {
   Expr* Or(Expr* lhs, Expr* rhs) { return expr_builder_.Or(lhs, rhs); }
   Expr* Xor(Expr* lhs, Expr* rhs) { return expr_builder_.Xor(lhs, rhs); }
 
+  Expr* Shl(Expr* operand, uint32_t amount) {
+    return expr_builder_.ShiftLeft(operand, amount);
+  }
+  Expr* Shr(Expr* operand, uint32_t amount) {
+    return expr_builder_.ShiftRight(operand, amount);
+  }
+
   Expr* Parse(std::string_view query) {
     return jitmap::query::Parse(query, &expr_builder_);
   }
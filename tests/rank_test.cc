@@ -0,0 +1,134 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <jitmap/builder.h>
+#include <jitmap/rank.h>
+
+namespace jitmap {
+
+// Compare rank and select of `c` with the positions of its set bits, found
+// by probing every index.
+template <typename C>
+static void ExpectRankSelect(const C& c, size_t size) {
+  size_t rank = 0;
+  for (size_t i = 0; i < size; i++) {
+    ASSERT_EQ(c.rank(i), rank) << i;
+    if (c[i]) {
+      ASSERT_EQ(c.select(rank), i) << rank;
+      rank++;
+    }
+  }
+  EXPECT_THROW(c.select(rank), Exception);
+}
+
+TEST(RankTest, SelectInWord) {
+  EXPECT_EQ(SelectInWord(1, 0), 0);
+  EXPECT_EQ(SelectInWord(0x8000000000000000ULL, 0), 63);
+  EXPECT_EQ(SelectInWord(0xF0F0, 0), 4);
+  EXPECT_EQ(SelectInWord(0xF0F0, 4), 12);
+  EXPECT_EQ(SelectInWord(~0ULL, 37), 37);
+}
+
+TEST(RankTest, RankDirectory) {
+  // 10 words, the last block of the directory is partial.
+  constexpr size_t kSize = 640;
+  uint64_t words[kSize / 64] = {1, 0, ~0ULL, 0x8000000000000001ULL, 0, 0, 0, 0, 0xF0, 3};
+  auto bitset = make_bitset<kSize, const uint64_t*>(words);
+  RankDirectory<kSize> ranks(bitset);
+  EXPECT_EQ(ranks.count(), bitset.count());
+  EXPECT_EQ(ranks.rank(bitset, kSize), bitset.count());
+  EXPECT_THROW(ranks.rank(bitset, kSize + 1), std::out_of_range);
+
+  struct {
+    const Bitset<kSize>& bitset;
+    const RankDirectory<kSize>& ranks;
+    size_t rank(size_t i) const { return ranks.rank(bitset, i); }
+    size_t select(size_t k) const { return ranks.select(bitset, k); }
+    bool operator[](size_t i) const { return bitset[i]; }
+  } indexed{bitset, ranks};
+  ExpectRankSelect(indexed, kSize);
+
+  EXPECT_EQ(RankDirectory<kSize>().count(), 0);
+}
+
+TEST(RankTest, Containers) {
+  std::mt19937 rng(0);
+  DenseContainer dense;
+  for (size_t i = 0; i < 20000; i++) dense.set(rng() % kBitsPerContainer);
+  ExpectRankSelect(dense, kBitsPerContainer);
+  EXPECT_EQ(dense.rank(kBitsPerContainer - 1) + dense[kBitsPerContainer - 1],
+            dense.cardinality());
+
+  // The directory is rebuilt after a modification.
+  dense.bitmap().reset();
+  dense.set(42);
+  EXPECT_EQ(dense.rank(43), 1);
+  EXPECT_EQ(dense.select(0), 42);
+
+  ExpectRankSelect(ArrayContainer({1, 3, 100, 65535}), kBitsPerContainer);
+  ExpectRankSelect(RunContainer({{0, 2}, {10, 5}, {65530, 5}}), kBitsPerContainer);
+  ExpectRankSelect(EmptyContainer(), kBitsPerContainer);
+  ExpectRankSelect(FullContainer(), kBitsPerContainer);
+}
+
+TEST(RankTest, Bitmap) {
+  std::vector<uint64_t> ids{3, 65535, 65536 * 2, 65536 * 2 + 7};
+  for (uint64_t i = 0; i < 5000; i++) ids.push_back(65536 * 5 + 3 * i);
+  for (uint64_t i = 0; i < 70000; i++) ids.push_back(65536 * 9 + i);
+  auto bitmap = BuildBitmap(ids.data(), ids.size());
+
+  for (size_t k = 0; k < ids.size(); k++) {
+    ASSERT_EQ(bitmap.rank(ids[k]), k) << ids[k];
+    ASSERT_EQ(bitmap.select(k), ids[k]) << k;
+  }
+  EXPECT_EQ(bitmap.rank(65536 * 2 + 1), 3);
+  EXPECT_EQ(bitmap.rank(uint64_t{1} << 40), ids.size());
+  EXPECT_THROW(bitmap.select(ids.size()), Exception);
+
+  // The cumulative cardinalities follow the mutations.
+  bitmap.Erase(2);
+  EXPECT_EQ(bitmap.select(2), 65536 * 5);
+  bitmap.Insert(0, std::make_unique<FullContainer>());
+  EXPECT_EQ(bitmap.rank(65536 * 5), kBitsPerContainer);
+  EXPECT_EQ(bitmap.select(kBitsPerContainer), 65536 * 5);
+}
+
+TEST(RankTest, BitmapConcurrentReaders) {
+  std::vector<uint64_t> ids;
+  for (uint64_t i = 0; i < 64; i++) ids.push_back(65536 * i + i);
+  auto bitmap = BuildBitmap(ids.data(), ids.size());
+
+  // The readers race to build the cumulative cardinalities.
+  std::vector<std::thread> readers;
+  std::vector<char> ok(4, true);
+  for (size_t t = 0; t < ok.size(); t++) {
+    readers.emplace_back([&, t] {
+      const Bitmap copy = bitmap;
+      for (size_t k = 0; k < ids.size(); k++) {
+        ok[t] = ok[t] && bitmap.rank(ids[k]) == k && bitmap.select(k) == ids[k] &&
+                copy.rank(ids[k]) == k;
+      }
+    });
+  }
+  for (auto& reader : readers) reader.join();
+  for (size_t t = 0; t < ok.size(); t++) EXPECT_TRUE(ok[t]) << t;
+}
+
+}  // namespace jitmap
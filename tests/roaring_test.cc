@@ -0,0 +1,157 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <jitmap/builder.h>
+#include <jitmap/query/compiler.h>
+#include <jitmap/query/query.h>
+#include <jitmap/roaring.h>
+
+namespace jitmap {
+
+static std::string Bytes(std::vector<uint8_t> bytes) {
+  return std::string(bytes.begin(), bytes.end());
+}
+
+static void ExpectBitmapEquals(const Bitmap& actual, const Bitmap& expected) {
+  ASSERT_EQ(actual.cardinality(), expected.cardinality());
+  for (uint64_t k = 0; k < expected.cardinality(); k++) {
+    ASSERT_EQ(actual.select(k), expected.select(k)) << k;
+  }
+}
+
+TEST(RoaringTest, WithoutRuns) {
+  // {1, 2, 3, 1000}: cookie, number of containers, (key, cardinality - 1),
+  // offset of the container and its values.
+  auto serialized = Bytes({0x3A, 0x30, 0, 0, 1, 0, 0, 0, 0, 0, 3, 0, 16, 0, 0, 0,
+                           1, 0, 2, 0, 3, 0, 0xE8, 0x03});
+
+  std::vector<uint32_t> ids{1, 2, 3, 1000};
+  auto bitmap = BuildBitmap(ids.data(), ids.size());
+  EXPECT_EQ(WriteRoaring(bitmap), serialized);
+  ExpectBitmapEquals(ReadRoaring(serialized.data(), serialized.size()), bitmap);
+}
+
+TEST(RoaringTest, WithRuns) {
+  // [0, 99]: cookie with the number of containers minus one, the run flags,
+  // (key, cardinality - 1) and the number of runs followed by the runs. There
+  // are no offsets below 4 containers.
+  auto serialized =
+      Bytes({0x3B, 0x30, 0, 0, 1, 0, 0, 99, 0, 1, 0, 0, 0, 99, 0});
+
+  Bitmap bitmap;
+  bitmap.Insert(0, std::make_unique<RunContainer>(std::vector<jitmap::Run>{{0, 99}}));
+  EXPECT_EQ(WriteRoaring(bitmap), serialized);
+  ExpectBitmapEquals(ReadRoaring(serialized.data(), serialized.size()), bitmap);
+}
+
+TEST(RoaringTest, RoundTrip) {
+  std::vector<uint64_t> ids;
+  for (uint64_t i = 0; i < 100; i++) ids.push_back(7 * i);
+  for (uint64_t i = 0; i < 30000; i++) ids.push_back(65536 * 2 + 2 * i);
+  for (uint64_t i = 0; i < 1000; i++) ids.push_back(65536 * 5 + i);
+  for (uint64_t i = 0; i < 10; i++) ids.push_back((uint64_t{3} << 32) + 11 * i);
+  auto bitmap = BuildBitmap(ids.data(), ids.size());
+  bitmap.Insert(7, std::make_unique<FullContainer>());
+  bitmap.Insert(8, std::make_unique<EmptyContainer>());
+
+  auto serialized = WriteRoaring64(bitmap);
+  auto read = ReadRoaring64(serialized.data(), serialized.size());
+  ExpectBitmapEquals(read, bitmap);
+  EXPECT_EQ(read.Find(8), nullptr);
+  EXPECT_EQ(read.Find(7)->type(), RUN_LENGTH);
+
+  // The keys past 2^16 don't fit the 32-bit format.
+  EXPECT_THROW(WriteRoaring(bitmap), Exception);
+  bitmap.Erase(3 << 16);
+  auto serialized32 = WriteRoaring(bitmap);
+  ExpectBitmapEquals(ReadRoaring(serialized32.data(), serialized32.size()), bitmap);
+
+  // Dense containers of at most 4096 elements are read back as arrays.
+  Bitmap small;
+  auto dense = std::make_unique<DenseContainer>();
+  dense->set(5);
+  small.Insert(0, std::move(dense));
+  auto serialized_small = WriteRoaring(small);
+  EXPECT_EQ(ReadRoaring(serialized_small.data(), serialized_small.size()).Find(0)->type(),
+            ARRAY);
+}
+
+TEST(RoaringTest, Malformed) {
+  std::vector<uint32_t> ids{1, 2, 3, 1000};
+  auto serialized = WriteRoaring(BuildBitmap(ids.data(), ids.size()));
+
+  for (size_t size = 0; size < serialized.size(); size++) {
+    EXPECT_THROW(ReadRoaring(serialized.data(), size), Exception) << size;
+  }
+
+  auto bad_cookie = serialized;
+  bad_cookie[0] = 0;
+  EXPECT_THROW(ReadRoaring(bad_cookie.data(), bad_cookie.size()), Exception);
+
+  // Values not sorted.
+  auto unsorted = serialized;
+  unsorted[16] = 10;
+  EXPECT_THROW(ReadRoaring(unsorted.data(), unsorted.size()), Exception);
+}
+
+TEST(RoaringTest, FrozenEvalViews) {
+  std::vector<uint32_t> a_ids, b_ids;
+  for (uint32_t i = 0; i < 100; i++) a_ids.push_back(7 * i);
+  for (uint32_t i = 0; i < 30000; i++) a_ids.push_back(65536 * 2 + 2 * i);
+  for (uint32_t i = 0; i < 5000; i++) b_ids.push_back(3 * i);
+  for (uint32_t i = 0; i < 20000; i++) b_ids.push_back(65536 * 2 + 3 * i);
+  auto a = BuildBitmap(a_ids.data(), a_ids.size());
+  auto b = BuildBitmap(b_ids.data(), b_ids.size());
+
+  // Copy the serialized bitmaps in cacheline aligned buffers.
+  auto serialized_a = WriteRoaring(a);
+  auto serialized_b = WriteRoaring(b);
+  std::vector<uint64_t> buffer_a(serialized_a.size() / 8 + 1);
+  std::vector<uint64_t> buffer_b(serialized_b.size() / 8 + 1);
+  std::memcpy(buffer_a.data(), serialized_a.data(), serialized_a.size());
+  std::memcpy(buffer_b.data(), serialized_b.data(), serialized_b.size());
+  FrozenRoaring frozen_a{reinterpret_cast<const char*>(buffer_a.data()),
+                         serialized_a.size()};
+  FrozenRoaring frozen_b{reinterpret_cast<const char*>(buffer_b.data()),
+                         serialized_b.size()};
+  ASSERT_EQ(frozen_a.n_containers(), 2);
+  // The arrays are referenced in place.
+  EXPECT_LE(frozen_a.n_copies(), 1);
+  EXPECT_EQ(frozen_a.Find(1).data, nullptr);
+
+  query::ExecutionContext context{query::JitEngine::Make()};
+  auto query = query::Query::Make("roaring_xor", "a ^ b", &context);
+  query::EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  eval_ctx.set_missing_policy(query::EvaluationContext::REPLACE_WITH_EMPTY);
+
+  auto expected = make_owned_bitset<kBitsPerContainer>();
+  auto result = make_owned_bitset<kBitsPerContainer>();
+  for (uint32_t key : {0, 2}) {
+    auto expected_popcount = query->EvalContainers(
+        eval_ctx, {a.Find(key)->get(), b.Find(key)->get()}, expected.data());
+    auto popcount = query->EvalViews(eval_ctx, {frozen_a.Find(key), frozen_b.Find(key)},
+                                     result.data());
+    EXPECT_EQ(popcount, expected_popcount) << key;
+    EXPECT_EQ(result, expected) << key;
+  }
+}
+
+}  // namespace jitmap
@@ -0,0 +1,104 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <jitmap/snapshot.h>
+
+namespace jitmap {
+
+static void SetBit(Bitmap* bitmap, Bitmap::key_index_type key, uint16_t index) {
+  if (bitmap->Find(key) == nullptr) {
+    bitmap->Insert(key, std::make_unique<DenseContainer>());
+  }
+  bitmap->Modify(key, [&](Container* c) { static_cast<DenseContainer*>(c)->set(index); });
+}
+
+TEST(SharedBitmapTest, Snapshot) {
+  SharedBitmap shared;
+  EXPECT_EQ(shared.snapshot()->n_containers(), 0);
+
+  shared.Update([](Bitmap* bitmap) {
+    SetBit(bitmap, 0, 1);
+    bitmap->Insert(1, std::make_unique<FullContainer>());
+  });
+  auto first = shared.snapshot();
+  EXPECT_EQ(first->cardinality(), 1 + kBitsPerContainer);
+
+  // The pinned version is not affected by the updates, and shares the
+  // containers which were not modified.
+  shared.Update([](Bitmap* bitmap) { SetBit(bitmap, 0, 2); });
+  shared.Update([](Bitmap* bitmap) { bitmap->Erase(1); });
+  EXPECT_EQ(first->cardinality(), 1 + kBitsPerContainer);
+  EXPECT_EQ(first->rank(kBitsPerContainer), 1);
+  {
+    auto second = shared.snapshot();
+    EXPECT_EQ(second->cardinality(), 2);
+    EXPECT_TRUE((*second)[2]);
+    EXPECT_FALSE((*first)[2]);
+    EXPECT_NE(second->Find(0)->get(), first->Find(0)->get());
+    EXPECT_EQ(shared.epoch(), 4);
+  }
+
+  // The versions retired after the first snapshot are freed with it.
+  EXPECT_EQ(shared.Reclaim(), 2);
+  { auto moved = std::move(first); }
+  EXPECT_EQ(shared.Reclaim(), 0);
+}
+
+TEST(SharedBitmapTest, ConcurrentReaders) {
+  constexpr size_t kReaders = 4;
+  constexpr uint16_t kUpdates = 2000;
+
+  // Each update sets a bit in both containers, a consistent snapshot has the
+  // same cardinality in both.
+  SharedBitmap shared;
+  std::atomic<bool> done{false};
+  std::atomic<size_t> inconsistent{0};
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r < kReaders; r++) {
+    readers.emplace_back([&]() {
+      while (!done.load()) {
+        auto snapshot = shared.snapshot();
+        auto lhs = snapshot->Find(0);
+        auto rhs = snapshot->Find(1);
+        if (lhs == nullptr || rhs == nullptr) continue;
+        if (lhs->get()->count() != rhs->get()->count() ||
+            snapshot->cardinality() != 2 * lhs->cardinality()) {
+          inconsistent++;
+        }
+      }
+    });
+  }
+
+  for (uint16_t i = 0; i < kUpdates; i++) {
+    shared.Update([i](Bitmap* bitmap) {
+      SetBit(bitmap, 0, i);
+      SetBit(bitmap, 1, i * 3);
+    });
+  }
+  done = true;
+  for (auto& reader : readers) reader.join();
+
+  EXPECT_EQ(inconsistent.load(), 0);
+  EXPECT_EQ(shared.snapshot()->cardinality(), 2 * kUpdates);
+  EXPECT_EQ(shared.Reclaim(), 0);
+}
+
+}  // namespace jitmap
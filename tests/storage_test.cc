@@ -0,0 +1,161 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <jitmap/builder.h>
+#include <jitmap/query/compiler.h>
+#include <jitmap/query/query.h>
+#include <jitmap/storage.h>
+
+namespace jitmap {
+
+class StorageTest : public testing::Test {
+ protected:
+  void TearDown() override { std::remove(path_.c_str()); }
+
+  // A bitmap with a container of each representation.
+  static Bitmap MakeBitmap(uint64_t offset) {
+    std::vector<uint64_t> ids;
+    for (uint64_t i = 0; i < 100; i++) ids.push_back(offset + 7 * i);
+    for (uint64_t i = 0; i < 30000; i++) ids.push_back(offset + 65536 * 2 + 2 * i);
+    for (uint64_t i = 0; i < 1000; i++) ids.push_back(offset + 65536 * 5 + i);
+    auto bitmap = BuildBitmap(ids.data(), ids.size());
+    bitmap.Insert(9, std::make_unique<FullContainer>());
+    bitmap.Insert(11, std::make_unique<EmptyContainer>());
+    return bitmap;
+  }
+
+  std::string path_ = testing::TempDir() + "jitmap_storage_test.bin";
+};
+
+TEST_F(StorageTest, RoundTrip) {
+  auto bitmap = MakeBitmap(0);
+  WriteBitmap(bitmap, path_);
+
+  auto mapped = MappedBitmap::Open(path_);
+  // The empty container is not stored.
+  ASSERT_EQ(mapped->n_containers(), 4);
+  EXPECT_EQ(mapped->cardinality(), bitmap.cardinality());
+  EXPECT_EQ(mapped->keys()[3], 9);
+
+  EXPECT_EQ(mapped->Find(0).type, ARRAY);
+  EXPECT_EQ(mapped->Find(0).size, 100);
+  EXPECT_EQ(mapped->Find(2).type, BITMAP);
+  EXPECT_EQ(mapped->Find(5).type, RUN_LENGTH);
+  EXPECT_EQ(mapped->Find(9).type, RUN_LENGTH);
+  EXPECT_TRUE(mapped->Find(9).statistics.full());
+  EXPECT_EQ(mapped->Find(11).data, nullptr);
+  EXPECT_EQ(mapped->Find(1000).data, nullptr);
+
+  for (size_t i = 0; i < mapped->n_containers(); i++) {
+    auto view = mapped->view(i);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(view.data) % kCacheLineSize, 0);
+    EXPECT_EQ(view.statistics.proxy(),
+              bitmap.Find(mapped->keys()[i])->get()->statistics().proxy());
+  }
+
+  mapped->WillNeed({9, 5, 0, 2, 42});
+}
+
+TEST_F(StorageTest, EvalViews) {
+  auto a = MakeBitmap(0);
+  auto b = MakeBitmap(3);
+  WriteBitmap(a, path_);
+  auto mapped_a = MappedBitmap::Open(path_);
+  // The mapping outlives the file.
+  WriteBitmap(b, path_);
+  auto mapped_b = MappedBitmap::Open(path_);
+
+  query::ExecutionContext context{query::JitEngine::Make()};
+  auto query = query::Query::Make("storage_and", "a & !b", &context);
+  query::EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  eval_ctx.set_missing_policy(query::EvaluationContext::REPLACE_WITH_EMPTY);
+
+  auto get = [](const Bitmap& bitmap, uint32_t key) -> const Container* {
+    auto handle = bitmap.Find(key);
+    return handle ? handle->get() : nullptr;
+  };
+
+  // The kernels require outputs aligned to a cacheline.
+  auto expected = make_owned_bitset<kBitsPerContainer>();
+  auto result = make_owned_bitset<kBitsPerContainer>();
+  for (uint32_t key : {0, 2, 5, 9, 11}) {
+    auto expected_popcount =
+        query->EvalContainers(eval_ctx, {get(a, key), get(b, key)}, expected.data());
+    auto popcount = query->EvalViews(eval_ctx, {mapped_a->Find(key), mapped_b->Find(key)},
+                                     result.data());
+    EXPECT_EQ(popcount, expected_popcount) << key;
+    EXPECT_EQ(result, expected) << key;
+  }
+}
+
+TEST_F(StorageTest, InvalidFiles) {
+  EXPECT_THROW(MappedBitmap::Open(path_ + ".missing"), Exception);
+
+  {
+    std::ofstream out(path_, std::ios::binary);
+    out << std::string(sizeof(StorageHeader), 'x');
+  }
+  EXPECT_THROW(MappedBitmap::Open(path_), Exception);
+
+  WriteBitmap(MakeBitmap(0), path_);
+  {
+    // Truncate the payloads.
+    std::ifstream in(path_, std::ios::binary);
+    std::string content(std::istreambuf_iterator<char>(in), {});
+    std::ofstream(path_, std::ios::binary | std::ios::trunc)
+        .write(content.data(), content.size() / 2);
+  }
+  EXPECT_THROW(MappedBitmap::Open(path_), Exception);
+
+  // Overwrite the offset at `position` in the file such that the end of the
+  // pointed data wraps around.
+  const uint64_t wrapping_offset = UINT64_MAX - kCacheLineSize + 1;
+  auto corrupt = [&](auto position) {
+    std::fstream file(path_, std::ios::binary | std::ios::in | std::ios::out);
+    StorageHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    file.seekp(position(header));
+    file.write(reinterpret_cast<const char*>(&wrapping_offset), sizeof(wrapping_offset));
+  };
+
+  WriteBitmap(MakeBitmap(0), path_);
+  corrupt([](const StorageHeader&) { return offsetof(StorageHeader, keys_offset); });
+  EXPECT_THROW(MappedBitmap::Open(path_), Exception);
+
+  WriteBitmap(MakeBitmap(0), path_);
+  corrupt([](const StorageHeader&) { return offsetof(StorageHeader, entries_offset); });
+  EXPECT_THROW(MappedBitmap::Open(path_), Exception);
+
+  // The offset of the first payload.
+  WriteBitmap(MakeBitmap(0), path_);
+  corrupt([](const StorageHeader& header) {
+    return header.entries_offset + offsetof(StorageEntry, offset);
+  });
+  auto corrupted = MappedBitmap::Open(path_);
+  EXPECT_THROW(corrupted->view(0), Exception);
+  EXPECT_THROW(corrupted->WillNeed({corrupted->keys()[0]}), Exception);
+}
+
+}  // namespace jitmap
@@ -0,0 +1,186 @@
+// Copyright 2020 RStudio, Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <jitmap/query/compiler.h>
+#include <jitmap/query/query.h>
+#include <jitmap/treemap.h>
+
+namespace jitmap {
+
+using testing::ElementsAre;
+
+// The container key of a 64-bit id.
+static Treemap::key_type KeyOf(uint64_t id) { return Treemap::key(id).first; }
+
+// Insert the ids, sharing a container key, as an array container.
+static void InsertArray(Treemap* treemap, uint64_t base, std::vector<uint16_t> offsets) {
+  treemap->Insert(KeyOf(base), std::make_unique<ArrayContainer>(std::move(offsets)));
+}
+
+TEST(TreemapTest, Basic) {
+  const uint64_t shard = uint64_t{7} << 32;
+  const uint64_t last = UINT64_MAX - 0xFFFF;
+
+  Treemap treemap;
+  EXPECT_EQ(treemap.cardinality(), 0);
+  EXPECT_FALSE(treemap[0]);
+
+  // Inserted out of order, across the high parts.
+  InsertArray(&treemap, last, {0, 0xFFFF});
+  InsertArray(&treemap, shard + 0x10000, {1, 2});
+  InsertArray(&treemap, 0, {3});
+  InsertArray(&treemap, shard, {0x1234});
+  treemap.Insert(KeyOf(shard + 0x20000), std::make_unique<FullContainer>());
+
+  EXPECT_EQ(treemap.n_buckets(), 3);
+  EXPECT_EQ(treemap.n_containers(), 5);
+  EXPECT_EQ(treemap.cardinality(), 6 + kBitsPerContainer);
+  EXPECT_THAT(treemap.highs(), ElementsAre(0, 7, UINT32_MAX));
+
+  EXPECT_TRUE(treemap[3]);
+  EXPECT_FALSE(treemap[4]);
+  EXPECT_TRUE(treemap[shard + 0x1234]);
+  EXPECT_FALSE(treemap[0x1234]);
+  EXPECT_TRUE(treemap[shard + 0x10002]);
+  EXPECT_TRUE(treemap[shard + 0x2ABCD]);
+  EXPECT_TRUE(treemap[UINT64_MAX]);
+  EXPECT_FALSE(treemap[UINT64_MAX - 1]);
+
+  ASSERT_NE(treemap.FindBucket(7), nullptr);
+  EXPECT_EQ(treemap.FindBucket(7)->n_containers(), 3);
+  EXPECT_EQ(treemap.FindBucket(8), nullptr);
+  EXPECT_EQ(treemap.Find(KeyOf(shard + 0x30000)), nullptr);
+
+  // Replacing a container.
+  InsertArray(&treemap, 0, {3, 4});
+  EXPECT_TRUE(treemap[4]);
+  EXPECT_EQ(treemap.n_containers(), 5);
+
+  EXPECT_TRUE(treemap.Erase(KeyOf(last)));
+  EXPECT_FALSE(treemap.Erase(KeyOf(last)));
+  EXPECT_EQ(treemap.n_buckets(), 2);
+  EXPECT_FALSE(treemap[UINT64_MAX]);
+
+  EXPECT_THROW(treemap.Insert(Treemap::kEndKey, std::make_unique<EmptyContainer>()),
+               Exception);
+  EXPECT_THROW(treemap.Insert(0, nullptr), Exception);
+}
+
+TEST(TreemapTest, ForEach) {
+  Treemap treemap;
+  std::vector<uint64_t> keys{0,       1,         0xFFFF,
+                             0x10000, 0x10001,   0x5000000,
+                             Treemap::kEndKey - 1};
+  for (auto key : keys) treemap.Insert(key, std::make_unique<FullContainer>());
+
+  auto visit = [&](Treemap::key_type begin, Treemap::key_type end) {
+    std::vector<uint64_t> visited;
+    treemap.ForEach(begin, end, [&](auto key, const ContainerHandle& handle) {
+      EXPECT_EQ(handle.type(), FULL);
+      visited.push_back(key);
+    });
+    return visited;
+  };
+
+  EXPECT_EQ(visit(0, Treemap::kEndKey), keys);
+  EXPECT_THAT(visit(1, 0x10001), ElementsAre(1, 0xFFFF, 0x10000));
+  EXPECT_THAT(visit(0x2, 0x5000000), ElementsAre(0xFFFF, 0x10000, 0x10001));
+  EXPECT_THAT(visit(0x20000, Treemap::kEndKey),
+              ElementsAre(0x5000000, Treemap::kEndKey - 1));
+  EXPECT_THAT(visit(5, 5), ElementsAre());
+}
+
+TEST(TreemapTest, EvalTreemaps) {
+  const uint64_t shard = uint64_t{3} << 32;
+
+  Treemap a, b;
+  InsertArray(&a, 0, {1, 2, 3});
+  InsertArray(&b, 0, {2, 3, 4});
+  InsertArray(&a, shard, {10});
+  InsertArray(&b, shard + 0x10000, {20});
+  a.Insert(KeyOf(shard + 0x20000), std::make_unique<FullContainer>());
+  InsertArray(&b, shard + 0x20000, {5});
+
+  query::ExecutionContext context{query::JitEngine::Make()};
+  query::EvaluationContext eval_ctx;
+  eval_ctx.set_popcount(true);
+  eval_ctx.set_output_policy(query::EvaluationContext::COMPACT);
+  eval_ctx.set_missing_policy(query::EvaluationContext::REPLACE_WITH_EMPTY);
+
+  auto intersection = query::Query::Make("treemap_and", "a & b", &context);
+  auto result = EvalTreemaps(intersection.get(), eval_ctx, {&a, &b});
+  // The empty intersections are not stored.
+  EXPECT_EQ(result.n_containers(), 2);
+  EXPECT_EQ(result.cardinality(), 3);
+  EXPECT_TRUE(result[2] && result[3] && result[shard + 0x20005]);
+
+  auto difference = query::Query::Make("treemap_and_not", "a & !b", &context);
+  result = EvalTreemaps(difference.get(), eval_ctx, {&a, &b});
+  EXPECT_EQ(result.cardinality(), 2 + kBitsPerContainer - 1);
+  EXPECT_EQ(result.Find(KeyOf(shard))->type(), ARRAY);
+  // Not in `b`, the container of `a` is shared.
+  EXPECT_EQ(result.Find(KeyOf(shard))->get(), a.Find(KeyOf(shard))->get());
+  EXPECT_EQ(result.Find(KeyOf(shard + 0x20000))->type(), RUN_LENGTH);
+
+  // Restricted to the keys of the shard.
+  auto shard_key = KeyOf(shard);
+  auto shard_end = KeyOf(shard + (uint64_t{1} << 32));
+  auto with_or = query::Query::Make("treemap_or", "a | b", &context);
+  result = EvalTreemaps(with_or.get(), eval_ctx, {&a, &b}, shard_key, shard_end);
+  EXPECT_THAT(result.highs(), ElementsAre(3));
+  EXPECT_EQ(result.cardinality(), 2 + kBitsPerContainer);
+  EXPECT_EQ(result.Find(KeyOf(shard + 0x20000))->type(), FULL);
+
+  result = EvalTreemaps(with_or.get(), eval_ctx, {&a, &b}, shard_key + 1, shard_key + 2);
+  EXPECT_EQ(result.cardinality(), 1);
+
+  EXPECT_THROW(EvalTreemaps(with_or.get(), eval_ctx, {&a}), Exception);
+  EXPECT_THROW(EvalTreemaps(with_or.get(), eval_ctx, {&a, nullptr}), Exception);
+}
+
+TEST(TreemapTest, EvalTreemapsShift) {
+  Treemap a, b;
+  // The phrase `a b`, across a container boundary and within a container.
+  InsertArray(&a, 0xFFFF, {0xFFFF});
+  InsertArray(&b, 0x10000, {0, 7});
+  InsertArray(&a, 0x10000, {6});
+  // `b` without a preceding `a`, the evaluated keys are around the keys of
+  // the inputs.
+  InsertArray(&b, 0x50000, {0});
+
+  query::ExecutionContext context{query::JitEngine::Make()};
+  query::EvaluationContext eval_ctx;
+  eval_ctx.set_missing_policy(query::EvaluationContext::REPLACE_WITH_EMPTY);
+
+  auto phrase = query::Query::Make("treemap_phrase", "a & (b >> 1)", &context);
+  auto result = EvalTreemaps(phrase.get(), eval_ctx, {&a, &b});
+  EXPECT_EQ(result.cardinality(), 2);
+  EXPECT_TRUE(result[0xFFFF] && result[0x10006]);
+
+  auto followed = query::Query::Make("treemap_followed", "b << 1", &context);
+  result = EvalTreemaps(followed.get(), eval_ctx, {&b});
+  EXPECT_EQ(result.n_containers(), 2);
+  EXPECT_TRUE(result[0x10001] && result[0x10008] && result[0x50001]);
+
+  // The bits shifted in from outside the range are kept.
+  result = EvalTreemaps(phrase.get(), eval_ctx, {&a, &b}, 0, 1);
+  EXPECT_EQ(result.cardinality(), 1);
+}
+
+}  // namespace jitmap
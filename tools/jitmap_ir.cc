@@ -34,7 +34,7 @@ int main(int argc, char** argv) {
   try {
     query::ExecutionContext context{query::JitEngine::Make()};
     auto query = query::Query::Make("query", query_str, &context);
-    std::cout << context.jit()->CompileIR(query->name(), query->expr()) << "\n";
+    std::cout << context.jit()->CompileIR(query->name(), query->compiled_expr()) << "\n";
   } catch (jitmap::Exception& e) {
     std::cerr << "Problem '" << query_str << "' :\n";
     std::cerr << "\t" << e.message() << "\n";